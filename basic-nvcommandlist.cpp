@@ -43,6 +43,10 @@
 
 #include "common.h"
 #include "nvtoken.hpp"
+#include "shadowstate.hpp"
+
+#include <algorithm>
+#include <thread>
 
 using namespace nvtoken;
 
@@ -66,11 +70,16 @@ class Sample : public nvgl::AppWindowProfilerGL
     DRAW_TOKEN_EMULATED,
     DRAW_TOKEN_BUFFER,
     DRAW_TOKEN_LIST,
+    DRAW_TOKEN_EMULATED_MULTIDRAW,
+    DRAW_TOKEN_EMULATED_COMPILED,
+    DRAW_TOKEN_EMULATED_PIPELINED,
   };
 
   struct
   {
     nvgl::ProgramID draw_scene, draw_scene_geo;
+    // object data is fetched via gl_BaseInstanceARB, used by the multi-draw emulation
+    nvgl::ProgramID draw_scene_multi, draw_scene_geo_multi;
   } programs;
 
   struct
@@ -109,6 +118,13 @@ class Sample : public nvgl::AppWindowProfilerGL
         scene_ubo, objects_ubo;
   } buffersADDR;
 
+  struct
+  {
+    GLuint64 box_vbo, box_ibo, sphere_vbo, sphere_ibo,
+
+        scene_ubo, objects_ubo;
+  } buffersSize;
+
   struct Vertex
   {
 
@@ -141,6 +157,9 @@ class Sample : public nvgl::AppWindowProfilerGL
   {
     uint programChangeID;
     uint fboChangeID;
+    uint tokenChangeID;
+    uint segmentChangeID;
+    uint patchChangeID;
 
     bool operator==(const StateChangeID& other) const { return memcmp(this, &other, sizeof(StateChangeID)) == 0; }
 
@@ -149,6 +168,9 @@ class Sample : public nvgl::AppWindowProfilerGL
     StateChangeID()
         : programChangeID(0)
         , fboChangeID(0)
+        , tokenChangeID(0)
+        , segmentChangeID(0)
+        , patchChangeID(0)
     {
     }
   };
@@ -157,6 +179,12 @@ class Sample : public nvgl::AppWindowProfilerGL
     // we introduce variables that track when we changed global state
     StateChangeID state;
     StateChangeID captured;
+#if ALLOW_EMULATION_LAYER
+    // the lists are only updated when they are drawn, so the other modes
+    // keep patching tokens in place without recording or compiling them
+    StateChangeID capturedList;
+    StateChangeID capturedEmu;
+#endif
 
     // two state objects
     GLuint stateobj_draw;
@@ -167,23 +195,77 @@ class Sample : public nvgl::AppWindowProfilerGL
     StateSystem          statesystem;
     StateSystem::StateID stateid_draw;
     StateSystem::StateID stateid_draw_geo;
+    StateSystem::StateID stateid_draw_multi;
+    StateSystem::StateID stateid_draw_geo_multi;
+    NVTokenMultiDraw     multiDraw;
 #endif
 
     // there is multiple ways to draw the scene
     // either via buffer, cmdlist object, or emulation
-    GLuint                   tokenBuffer;
-    GLuint                   tokenCmdList;
+    GLuint                   tokenBuffer  = 0;
+    GLuint                   tokenCmdList = 0;
+#if ALLOW_EMULATION_LAYER
+    nvtoken::NVTokenStream   tokenData;
+#else
     std::string              tokenData;
+#endif
     nvtoken::NVTokenSequence tokenSequence;
     nvtoken::NVTokenSequence tokenSequenceList;
     nvtoken::NVTokenSequence tokenSequenceEmu;
+    nvtoken::NVTokenSequence tokenSequenceEmuMulti;
+#if ALLOW_EMULATION_LAYER
+    // tokenSequenceEmu decoded once, the emulated counterpart of tokenCmdList,
+    // segments flagged dirty are compiled again by updateCommandListState
+    nvtoken::NVTokenSegmentedList tokenCompiledEmu;
+    std::vector<GLboolean>        segmentDirty;
+    // decodes tokenSequenceEmu on worker threads while this thread submits,
+    // the workers also compile the dirty segments of tokenCompiledEmu
+    nvtoken::NVTokenPipeline     pipeline;
+
+    // cost of the last update of either list, in milliseconds
+    double listRecordTime      = 0;
+    double listCompileTime     = 0;
+    double emuCompileTime      = 0;
+    int    emuSegmentsCompiled = 0;
+    // transition cost of tokenSequenceEmu before and after scheduling
+    int    scheduleCostBefore  = 0;
+    int    scheduleCostAfter   = 0;
+
+    // tokens changed in place since the last upload to tokenBuffer, which
+    // leaves room for objects moved to the end of the stream up to tokenCapacity
+    nvtoken::NVTokenDirtyRanges tokenDirty;
+    size_t                      tokenCapacity  = 0;
+    int                         tokenUploads   = 0;  // of the last frame
+    double                      tokenPatchTime = 0;  // ms, changes and uploads of the last frame
+#endif
+
+#if ALLOW_EMULATION_LAYER
+    // cpu cost of the emulation, accumulated over EMU_STATS_FRAMES
+    static const int               EMU_STATS_FRAMES = 32;
+    nvtoken::NVTokenEmulationStats emuStats         = {0};
+    double                         emuTime          = 0;
+    int                            emuFrames        = 0;
+    // averages of the last completed interval
+    double emuNsPerToken      = 0;
+    double emuNsPerSequence   = 0;
+    double emuCallsPerDraw    = 0;
+    double emuFilteredPerDraw = 0;
+#endif
   } cmdlist;
 
   struct Tweak
   {
     DrawMode mode = DRAW_STANDARD;
     vec3     lightDir;
-    float    animate = 1.0f;
+    float    animate          = 1.0f;
+    int      buildThreads     = 1;
+    int      pipelineWorkers  = 2;
+    int      listSegments     = 1;
+    int      objectChanges    = 0;
+    bool     optimizeBindings = false;
+    bool     sortObjects      = false;
+    bool     scheduleSequences = false;
+    bool     validateBuild    = false;
   };
 
   nvgl::ProgramManager m_progManager;
@@ -192,13 +274,34 @@ class Sample : public nvgl::AppWindowProfilerGL
   double           m_uiTime;
 
   Tweak m_tweak;
+  Tweak m_lastTweak;
+
+  // optional file the token stream is loaded from, written if missing
+  std::string m_tokenCache;
 
   std::vector<ObjectInfo> m_sceneObjects;
+  std::vector<uint32_t>   m_objectOrder;  // emission order of m_sceneObjects into the token stream
+
+  // where each object's tokens are in cmdlist.tokenData, indexed like
+  // m_sceneObjects, empty for binding-optimized streams as objects share
+  // bindings there
+  struct ObjectTokens
+  {
+    GLintptr offset;
+    GLsizei  size;
+    GLuint   sequence;  // within cmdlist.tokenSequence
+  };
+  std::vector<ObjectTokens> m_objectTokens;
   SceneData               m_sceneUbo;
 
   bool m_bindlessVboUbo;
   bool m_hwsupport;
 
+  // filters redundant binds and enables of drawStandard and the emulation,
+  // reset every frame, m_shadowStats holds the last frame's counts
+  ShadowState        m_shadow;
+  ShadowState::Stats m_shadowStats = {0};
+
   nvh::CameraControl m_control;
 
   bool begin();
@@ -212,7 +315,20 @@ class Sample : public nvgl::AppWindowProfilerGL
 
 #if ALLOW_EMULATION_LAYER
   bool initCommandList();
-  void updateCommandListState();
+  void initObjectOrder();
+  void initTokenStream();
+  void initTokenSequences();
+  void initObjectTokens();
+  void buildTokenStream(size_t begin, size_t end, NVTokenStream& stream, NVTokenSequence& seq) const;
+  void enqueueObjectTokens(size_t i, NVTokenStream& stream) const;
+  bool setObject(size_t i, const ObjectInfo& info);
+  void moveObjectTokens(size_t i);
+  void markTokensDirty(GLintptr offset);
+  void changeObjects(int count);
+  std::string        tokenCacheFile() const;
+  NVTokenObjectTable tokenCacheObjects(std::vector<NVTokenBufferRef>& bufferRefs, GLuint stateRefs[2], GLuint fboRefs[1]) const;
+  void segmentSequences(const NVTokenSequence& seq, GLintptr streamBegin, GLuint segment, GLuint numSegments, NVTokenSequence& out) const;
+  void updateCommandListState(DrawMode mode);  // updates the lists only for their modes
 #else
   bool initCommandListMinimal();
   void updateCommandListStateMinimal();
@@ -221,7 +337,7 @@ class Sample : public nvgl::AppWindowProfilerGL
   void drawTokenBuffer();
   void drawTokenList();
 #if ALLOW_EMULATION_LAYER
-  void drawTokenEmulation();
+  void drawTokenEmulation(DrawMode mode);
 #endif
 
 
@@ -238,6 +354,15 @@ public:
   {
     m_parameterList.add("drawmode", (uint32_t*)&m_tweak.mode);
     m_parameterList.add("animate", &m_tweak.animate);
+    m_parameterList.add("buildthreads", &m_tweak.buildThreads);
+    m_parameterList.add("pipelineworkers", &m_tweak.pipelineWorkers);
+    m_parameterList.add("listsegments", &m_tweak.listSegments);
+    m_parameterList.add("objectchanges", &m_tweak.objectChanges);
+    m_parameterList.add("optimizebindings", &m_tweak.optimizeBindings);
+    m_parameterList.add("sortobjects", &m_tweak.sortObjects);
+    m_parameterList.add("schedulesequences", &m_tweak.scheduleSequences);
+    m_parameterList.add("validatebuild", &m_tweak.validateBuild);
+    m_parameterList.add("tokencache", &m_tokenCache);
   }
 };
 
@@ -258,6 +383,21 @@ bool Sample::initProgram()
                                                         ProgramManager::Definition(GL_GEOMETRY_SHADER, "scene.geo.glsl"),
                                                         ProgramManager::Definition(GL_FRAGMENT_SHADER, "scene.frag.glsl"));
 
+#if ALLOW_EMULATION_LAYER
+  if(has_GL_ARB_shader_draw_parameters)
+  {
+    const char* multiDefine = "#define USE_MULTIDRAW 1\n";
+    programs.draw_scene_multi =
+        m_progManager.createProgram(ProgramManager::Definition(GL_VERTEX_SHADER, multiDefine, "scene.vert.glsl"),
+                                    ProgramManager::Definition(GL_FRAGMENT_SHADER, multiDefine, "scene.frag.glsl"));
+
+    programs.draw_scene_geo_multi =
+        m_progManager.createProgram(ProgramManager::Definition(GL_VERTEX_SHADER, multiDefine, "scene.vert.glsl"),
+                                    ProgramManager::Definition(GL_GEOMETRY_SHADER, multiDefine, "scene.geo.glsl"),
+                                    ProgramManager::Definition(GL_FRAGMENT_SHADER, multiDefine, "scene.frag.glsl"));
+  }
+#endif
+
   cmdlist.state.programChangeID++;
 
   validated = m_progManager.areProgramsValid();
@@ -353,6 +493,8 @@ bool Sample::initScene()
     glNamedBufferStorage(buffers.box_ibo, box.getTriangleIndicesSize(), &box.m_indicesTriangles[0], 0);
     newBuffer(buffers.box_vbo);
     glNamedBufferStorage(buffers.box_vbo, box.getVerticesSize(), &box.m_vertices[0], 0);
+    buffersSize.box_ibo = box.getTriangleIndicesSize();
+    buffersSize.box_vbo = box.getVerticesSize();
 
     if(m_bindlessVboUbo)
     {
@@ -368,6 +510,8 @@ bool Sample::initScene()
     glNamedBufferStorage(buffers.sphere_ibo, sphere.getTriangleIndicesSize(), &sphere.m_indicesTriangles[0], 0);
     newBuffer(buffers.sphere_vbo);
     glNamedBufferStorage(buffers.sphere_vbo, sphere.getVerticesSize(), &sphere.m_vertices[0], 0);
+    buffersSize.sphere_ibo = sphere.getTriangleIndicesSize();
+    buffersSize.sphere_vbo = sphere.getVerticesSize();
 
     if(m_bindlessVboUbo)
     {
@@ -382,6 +526,7 @@ bool Sample::initScene()
     newBuffer(buffers.objects_ubo);
     glBindBuffer(GL_UNIFORM_BUFFER, buffers.objects_ubo);
     glBufferData(GL_UNIFORM_BUFFER, uboAligned(sizeof(ObjectData)) * numObjects, NULL, GL_STATIC_DRAW);
+    buffersSize.objects_ubo = uboAligned(sizeof(ObjectData)) * numObjects;
     if(m_bindlessVboUbo)
     {
       glGetNamedBufferParameterui64vNV(buffers.objects_ubo, GL_BUFFER_GPU_ADDRESS_NV, &buffersADDR.objects_ubo);
@@ -444,6 +589,7 @@ bool Sample::initScene()
     newBuffer(buffers.scene_ubo);
     glBindBuffer(GL_UNIFORM_BUFFER, buffers.scene_ubo);
     glBufferData(GL_UNIFORM_BUFFER, sizeof(SceneData), NULL, GL_DYNAMIC_DRAW);
+    buffersSize.scene_ubo = sizeof(SceneData);
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
     if(m_bindlessVboUbo)
     {
@@ -668,19 +814,27 @@ void Sample::updateCommandListStateMinimal()
 bool Sample::initCommandList()
 {
   m_hwsupport = has_GL_NV_command_list ? true : false;
-  nvtokenInitInternals(m_hwsupport, m_bindlessVboUbo);
+  if(!nvtokenInitInternals(m_hwsupport, m_bindlessVboUbo))
+  {
+    LOGE("token headers are not unique, can't decode token streams\n");
+    return false;
+  }
+  nvtokenSetShadowState(&m_shadow);
   cmdlist.statesystem.init();
+  cmdlist.statesystem.setShadowState(&m_shadow);
+  cmdlist.pipeline.init(GLuint(std::max(m_tweak.pipelineWorkers, 0)));
 
   {
     cmdlist.statesystem.generate(1, &cmdlist.stateid_draw);
     cmdlist.statesystem.generate(1, &cmdlist.stateid_draw_geo);
+    cmdlist.statesystem.generate(1, &cmdlist.stateid_draw_multi);
+    cmdlist.statesystem.generate(1, &cmdlist.stateid_draw_geo_multi);
   }
   if(m_hwsupport)
   {
     glCreateStatesNV(1, &cmdlist.stateobj_draw);
     glCreateStatesNV(1, &cmdlist.stateobj_draw_geo);
 
-    glCreateBuffers(1, &cmdlist.tokenBuffer);
     glCreateCommandListsNV(1, &cmdlist.tokenCmdList);
   }
   else
@@ -691,100 +845,383 @@ bool Sample::initCommandList()
 
 
   // create actual token stream from our scene
+  initTokenStream();
+
+  updateCommandListState(m_tweak.mode);
+
+  return true;
+}
+
+std::string Sample::tokenCacheFile() const
+{
+  // the options that change the stream's content are part of the name,
+  // so are the binding mode and object count the file is only valid for
+  std::string filename = m_tokenCache;
+  filename += m_bindlessVboUbo ? ".bindless" : ".bind";
+  filename += "." + std::to_string(m_sceneObjects.size());
+  if(m_tweak.sortObjects)
   {
-    NVTokenSequence& seq    = cmdlist.tokenSequence;
-    std::string&     stream = cmdlist.tokenData;
+    filename += ".sorted";
+  }
+  if(m_tweak.optimizeBindings)
+  {
+    filename += ".optimized";
+  }
+  return filename;
+}
 
-    size_t offset = 0;
+NVTokenObjectTable Sample::tokenCacheObjects(std::vector<NVTokenBufferRef>& bufferRefs, GLuint stateRefs[2], GLuint fboRefs[1]) const
+{
+  const GLuint names[] = {buffers.box_vbo,    buffers.box_ibo,   buffers.sphere_vbo,
+                          buffers.sphere_ibo, buffers.scene_ubo, buffers.objects_ubo};
+  const GLuint64 addresses[] = {buffersADDR.box_vbo,    buffersADDR.box_ibo,   buffersADDR.sphere_vbo,
+                                buffersADDR.sphere_ibo, buffersADDR.scene_ubo, buffersADDR.objects_ubo};
+  const GLuint64 sizes[] = {buffersSize.box_vbo,    buffersSize.box_ibo,   buffersSize.sphere_vbo,
+                            buffersSize.sphere_ibo, buffersSize.scene_ubo, buffersSize.objects_ubo};
+
+  bufferRefs.resize(sizeof(names) / sizeof(names[0]));
+  for(size_t i = 0; i < bufferRefs.size(); i++)
+  {
+    bufferRefs[i].buffer  = names[i];
+    bufferRefs[i].address = m_bindlessVboUbo ? addresses[i] : 0;
+    bufferRefs[i].size    = sizes[i];
+  }
+
+  stateRefs[0] = cmdlist.stateobj_draw;
+  stateRefs[1] = cmdlist.stateobj_draw_geo;
+  fboRefs[0]   = fbos.scene;
+
+  NVTokenObjectTable table;
+  table.buffers    = bufferRefs.data();
+  table.numBuffers = GLuint(bufferRefs.size());
+  table.states     = stateRefs;
+  table.numStates  = 2;
+  table.fbos       = fboRefs;
+  table.numFbos    = 1;
+  return table;
+}
 
+void Sample::buildTokenStream(size_t begin, size_t end, NVTokenStream& stream, NVTokenSequence& seq) const
+{
+  // worst case per object: vbo, ibo, three ubos and the draw
+  stream.reserve(stream.size() + sizeof(NVTokenUbo) * 3
+                 + (end - begin) * (sizeof(NVTokenVbo) + sizeof(NVTokenIbo) + sizeof(NVTokenUbo) * 3 + sizeof(NVTokenDrawElems)));
+
+  size_t offset = stream.size();
+
+  if(begin == 0)
+  {
     // at first we bind the scene ubo to all used stages
+    const NVTokenShaderStage stages[] = {NVTOKEN_STAGE_VERTEX, NVTOKEN_STAGE_GEOMETRY, NVTOKEN_STAGE_FRAGMENT};
+    for(NVTokenShaderStage stage : stages)
     {
-      NVTokenUbo ubo;
-      ubo.setBuffer(buffers.scene_ubo, buffersADDR.scene_ubo, 0, sizeof(SceneData));
-      ubo.setBinding(UBO_SCENE, NVTOKEN_STAGE_VERTEX);
-      nvtokenEnqueue(stream, ubo);
-      ubo.setBinding(UBO_SCENE, NVTOKEN_STAGE_GEOMETRY);
-      nvtokenEnqueue(stream, ubo);
-      ubo.setBinding(UBO_SCENE, NVTOKEN_STAGE_FRAGMENT);
-      nvtokenEnqueue(stream, ubo);
+      NVTokenUbo* ubo = stream.alloc<NVTokenUbo>();
+      ubo->setBuffer(buffers.scene_ubo, buffersADDR.scene_ubo, 0, sizeof(SceneData));
+      ubo->setBinding(UBO_SCENE, stage);
     }
+  }
 
-    // then we iterate over all objects in our scene
-    GLuint lastStateobj = 0;
+  // then we iterate over all objects in our scene
+  GLuint lastStateobj = 0;
+  for(size_t o = begin; o < end; o++)
+  {
+    size_t            i   = m_objectOrder[o];
+    const ObjectInfo& obj = m_sceneObjects[i];
+
+    GLuint usedStateobj = obj.program == programs.draw_scene ? cmdlist.stateobj_draw : cmdlist.stateobj_draw_geo;
+
+    if(lastStateobj != 0 && (usedStateobj != lastStateobj || !USE_PROGRAM_FILTER))
+    {
+      // Whenever our program changes a new stateobject is required,
+      // hence the current sequence gets appended
+      seq.offsets.push_back(offset);
+      seq.sizes.push_back(GLsizei(stream.size() - offset));
+      seq.states.push_back(lastStateobj);
+
+      // By passing the fbo here, it means we can render objects
+      // even as the fbos get resized (and their textures changed).
+      // If we would pass 0 it would mean the stateobject's fbo was used
+      // which means on fbo resizes we would have to recreate all stateobjects.
+      seq.fbos.push_back(fbos.scene);
+
+
+      // new sequence start
+      offset = stream.size();
+    }
+
+    enqueueObjectTokens(i, stream);
+
+    lastStateobj = usedStateobj;
+  }
+
+  if(lastStateobj != 0)
+  {
+    seq.offsets.push_back(offset);
+    seq.sizes.push_back(GLsizei(stream.size() - offset));
+    seq.fbos.push_back(fbos.scene);
+    seq.states.push_back(lastStateobj);
+  }
+}
+
+void Sample::enqueueObjectTokens(size_t i, NVTokenStream& stream) const
+{
+  const ObjectInfo& obj = m_sceneObjects[i];
+
+  // tokens are constructed in place, the stream was reserved by the caller
+  NVTokenVbo* vbo = stream.alloc<NVTokenVbo>();
+  vbo->setBinding(0);
+  vbo->setBuffer(obj.vbo, obj.vboADDR, 0);
+
+  NVTokenIbo* ibo = stream.alloc<NVTokenIbo>();
+  ibo->setType(GL_UNSIGNED_INT);
+  ibo->setBuffer(obj.ibo, obj.iboADDR);
+
+  const NVTokenShaderStage stages[] = {NVTOKEN_STAGE_VERTEX, NVTOKEN_STAGE_FRAGMENT, NVTOKEN_STAGE_GEOMETRY};
+  // the geometry stage is only used by the geometry shader program
+  size_t numStages = obj.program == programs.draw_scene_geo ? 3 : 2;
+  for(size_t s = 0; s < numStages; s++)
+  {
+    NVTokenUbo* ubo = stream.alloc<NVTokenUbo>();
+    ubo->setBuffer(buffers.objects_ubo, buffersADDR.objects_ubo, GLuint(uboAligned(sizeof(ObjectData)) * i), sizeof(ObjectData));
+    ubo->setBinding(UBO_OBJECT, stages[s]);
+  }
+
+  NVTokenDrawElems* draw = stream.alloc<NVTokenDrawElems>();
+  draw->setParams(obj.numIndices);
+  // be aware the stateobject's primitive mode must be compatible!
+  draw->setMode(GL_TRIANGLES);
+}
+
+// LSD radix sort, passes for bytes that are equal across all keys are skipped
+static void radixSort64(std::vector<uint64_t>& keys)
+{
+  std::vector<uint64_t> temp(keys.size());
+
+  for(int shift = 0; shift < 64; shift += 8)
+  {
+    size_t histogram[256] = {0};
+    for(size_t i = 0; i < keys.size(); i++)
+    {
+      histogram[(keys[i] >> shift) & 0xFF]++;
+    }
+    if(histogram[(keys[0] >> shift) & 0xFF] == keys.size())
+      continue;
+
+    size_t sum = 0;
+    for(int d = 0; d < 256; d++)
+    {
+      size_t count = histogram[d];
+      histogram[d] = sum;
+      sum += count;
+    }
+    for(size_t i = 0; i < keys.size(); i++)
+    {
+      temp[histogram[(keys[i] >> shift) & 0xFF]++] = keys[i];
+    }
+    keys.swap(temp);
+  }
+}
+
+void Sample::initObjectOrder()
+{
+  m_objectOrder.resize(m_sceneObjects.size());
+
+  if(!m_tweak.sortObjects || m_sceneObjects.empty())
+  {
     for(size_t i = 0; i < m_sceneObjects.size(); i++)
     {
-      const ObjectInfo& obj = m_sceneObjects[i];
+      m_objectOrder[i] = uint32_t(i);
+    }
+    return;
+  }
 
-      GLuint usedStateobj = obj.program == programs.draw_scene ? cmdlist.stateobj_draw : cmdlist.stateobj_draw_geo;
+  // key: state | vbo | ibo | object index (which is also the ubo slot)
+  // buffer names are truncated to 12 bits, that may only affect grouping, not correctness
+  std::vector<uint64_t> keys(m_sceneObjects.size());
+  for(size_t i = 0; i < m_sceneObjects.size(); i++)
+  {
+    const ObjectInfo& obj   = m_sceneObjects[i];
+    uint64_t          state = obj.program == programs.draw_scene ? 0 : 1;
+    keys[i] = (state << 56) | (uint64_t(obj.vbo & 0xFFF) << 44) | (uint64_t(obj.ibo & 0xFFF) << 32) | uint64_t(i);
+  }
 
-      if(lastStateobj != 0 && (usedStateobj != lastStateobj || !USE_PROGRAM_FILTER))
-      {
-        // Whenever our program changes a new stateobject is required,
-        // hence the current sequence gets appended
-        seq.offsets.push_back(offset);
-        seq.sizes.push_back(GLsizei(stream.size() - offset));
-        seq.states.push_back(lastStateobj);
+  radixSort64(keys);
 
-        // By passing the fbo here, it means we can render objects
-        // even as the fbos get resized (and their textures changed).
-        // If we would pass 0 it would mean the stateobject's fbo was used
-        // which means on fbo resizes we would have to recreate all stateobjects.
-        seq.fbos.push_back(fbos.scene);
+  for(size_t i = 0; i < keys.size(); i++)
+  {
+    m_objectOrder[i] = uint32_t(keys[i] & 0xFFFFFFFF);
+  }
+}
 
+void Sample::initTokenStream()
+{
+  double begin = NVPSystem::getTime();
 
-        // new sequence start
-        offset = stream.size();
-      }
+  initObjectOrder();
 
-      NVTokenVbo vbo;
-      vbo.setBinding(0);
-      vbo.setBuffer(obj.vbo, obj.vboADDR, 0);
-      nvtokenEnqueue(stream, vbo);
+  cmdlist.tokenData.clear();
+  cmdlist.tokenSequence = NVTokenSequence();
 
-      NVTokenIbo ibo;
-      ibo.setType(GL_UNSIGNED_INT);
-      ibo.setBuffer(obj.ibo, obj.iboADDR);
-      nvtokenEnqueue(stream, ibo);
+  std::vector<NVTokenBufferRef> cacheBuffers;
+  GLuint                        cacheStates[2];
+  GLuint                        cacheFbos[1];
+  NVTokenObjectTable            cacheObjects = tokenCacheObjects(cacheBuffers, cacheStates, cacheFbos);
 
-      NVTokenUbo ubo;
-      ubo.setBuffer(buffers.objects_ubo, buffersADDR.objects_ubo, GLuint(uboAligned(sizeof(ObjectData)) * i), sizeof(ObjectData));
-      ubo.setBinding(UBO_OBJECT, NVTOKEN_STAGE_VERTEX);
-      nvtokenEnqueue(stream, ubo);
-      ubo.setBinding(UBO_OBJECT, NVTOKEN_STAGE_FRAGMENT);
-      nvtokenEnqueue(stream, ubo);
+  bool loaded = false;
+  if(!m_tokenCache.empty())
+  {
+    NVTokenFile file;
+    loaded = file.load(tokenCacheFile().c_str(), cacheObjects, cmdlist.tokenSequence);
+    if(loaded)
+    {
+      // The sample keeps its own copy rather than using the mapping: objects
+      // that change program are appended to the stream, which needs room
+      // to grow the fixed size mapping does not have.
+      cmdlist.tokenData.append(file.data(), file.size());
+      LOGI("token stream: loaded %s, %.3f ms\n", tokenCacheFile().c_str(), (NVPSystem::getTime() - begin) * 1000.0);
+    }
+  }
 
-      if(usedStateobj == cmdlist.stateobj_draw_geo)
+  size_t numThreads = std::min(size_t(std::max(m_tweak.buildThreads, 1)), m_sceneObjects.size());
+  if(loaded)
+  {
+    // nothing to build
+  }
+  else if(numThreads <= 1)
+  {
+    buildTokenStream(0, m_sceneObjects.size(), cmdlist.tokenData, cmdlist.tokenSequence);
+  }
+  else
+  {
+    // every thread writes a contiguous range of objects into its own stream,
+    // the sub-streams are concatenated in order afterwards
+    std::vector<NVTokenStream>   streams(numThreads);
+    std::vector<NVTokenSequence> sequences(numThreads);
+    std::vector<std::thread>     threads;
+    threads.reserve(numThreads);
+
+    size_t perThread = (m_sceneObjects.size() + numThreads - 1) / numThreads;
+    for(size_t t = 0; t < numThreads; t++)
+    {
+      size_t first = std::min(t * perThread, m_sceneObjects.size());
+      size_t last  = std::min(first + perThread, m_sceneObjects.size());
+      threads.push_back(std::thread([this, first, last, t, &streams, &sequences]() {
+        buildTokenStream(first, last, streams[t], sequences[t]);
+      }));
+    }
+
+    size_t totalSize = 0;
+    for(size_t t = 0; t < numThreads; t++)
+    {
+      threads[t].join();
+      totalSize += streams[t].size();
+    }
+
+    cmdlist.tokenData.reserve(totalSize);
+    for(size_t t = 0; t < numThreads; t++)
+    {
+      // sequences are only cut at state changes, so a sequence spanning two
+      // threads' ranges has to be stitched back together
+      nvtokenAppendSequences(cmdlist.tokenData, cmdlist.tokenSequence, streams[t], sequences[t], USE_PROGRAM_FILTER != 0);
+    }
+
+    if(m_tweak.validateBuild)
+    {
+      // explicit opt-in, the serial build doubles the cost of every rebuild
+      NVTokenStream   serialStream;
+      NVTokenSequence serialSeq;
+      buildTokenStream(0, m_sceneObjects.size(), serialStream, serialSeq);
+      bool sameStream = serialStream.size() == cmdlist.tokenData.size()
+                        && memcmp(serialStream.data(), cmdlist.tokenData.data(), serialStream.size()) == 0;
+      bool sameSeq = serialSeq.offsets == cmdlist.tokenSequence.offsets && serialSeq.sizes == cmdlist.tokenSequence.sizes
+                     && serialSeq.states == cmdlist.tokenSequence.states && serialSeq.fbos == cmdlist.tokenSequence.fbos;
+      if(!sameStream || !sameSeq)
       {
-        // also add for geometry stage
-        ubo.setBinding(UBO_OBJECT, NVTOKEN_STAGE_GEOMETRY);
-        nvtokenEnqueue(stream, ubo);
+        LOGE("token stream: parallel build differs from serial build\n");
       }
+      assert(sameStream && sameSeq);
+    }
+  }
 
-      NVTokenDrawElems draw;
-      draw.setParams(obj.numIndices);
-      // be aware the stateobject's primitive mode must be compatible!
-      draw.setMode(GL_TRIANGLES);
-      nvtokenEnqueue(stream, draw);
+  if(m_tweak.optimizeBindings && !loaded)
+  {
+    NVTokenOptimizeStats stats;
+    nvtokenOptimizeBindings(cmdlist.tokenData, cmdlist.tokenSequence, &stats);
+    LOGI("token stream: removed %d redundant bindings, %d bytes\n", int(stats.tokensRemoved), int(stats.bytesRemoved));
+  }
 
-      lastStateobj = usedStateobj;
+#ifndef NDEBUG
+  {
+    const NVTokenSequence& seq = cmdlist.tokenSequence;
+    size_t                 errorOffset;
+    NVTokenValidateResult  result = nvtokenValidate(cmdlist.tokenData.data(), cmdlist.tokenData.size(), seq.offsets.data(),
+                                                   seq.sizes.data(), GLuint(seq.offsets.size()), &errorOffset);
+    if(result != NVTOKEN_VALID)
+    {
+      LOGE("token stream: invalid (%d) at offset %d\n", int(result), int(errorOffset));
     }
+    assert(result == NVTOKEN_VALID);
+  }
+#endif
 
-    seq.offsets.push_back(offset);
-    seq.sizes.push_back(GLsizei(stream.size() - offset));
-    seq.fbos.push_back(fbos.scene);
-    seq.states.push_back(lastStateobj);
+  if(!m_tokenCache.empty() && !loaded)
+  {
+    if(!nvtokenSaveFile(tokenCacheFile().c_str(), cmdlist.tokenData.data(), cmdlist.tokenData.size(),
+                        cmdlist.tokenSequence, cacheObjects))
+    {
+      LOGE("token stream: could not write %s\n", tokenCacheFile().c_str());
+    }
+  }
+
+  LOGI("token stream: %d objects, %d threads, %d sequences, %d bytes, %.3f ms\n", int(m_sceneObjects.size()),
+       int(numThreads), int(cmdlist.tokenSequence.offsets.size()), int(cmdlist.tokenData.size()),
+       (NVPSystem::getTime() - begin) * 1000.0);
+
+  {
+    // every sequence is one applyGL call in emulation, only some are actual state switches
+    const NVTokenSequence& seq      = cmdlist.tokenSequence;
+    int                    switches = 0;
+    for(size_t i = 1; i < seq.states.size(); i++)
+    {
+      switches += seq.states[i] != seq.states[i - 1] ? 1 : 0;
+    }
+    LOGI("token stream: %s, %d applyGL transitions, %d state switches\n", m_tweak.sortObjects ? "sorted" : "unsorted",
+         int(seq.states.size()), switches);
   }
 
+  initObjectTokens();
+
+  // leave room for objects that are moved to the end of the stream,
+  // once it is used up the stream is built again
+  cmdlist.tokenCapacity = cmdlist.tokenData.size() + cmdlist.tokenData.size() / 4;
+  cmdlist.tokenDirty.clear();
+
   if(m_hwsupport)
   {
-    // upload the tokens once, so we can reuse them efficiently
-    glNamedBufferStorage(cmdlist.tokenBuffer, cmdlist.tokenData.size(), &cmdlist.tokenData[0], 0);
+    // upload the tokens once, so we can reuse them efficiently, buffer
+    // storage cannot grow so a rebuild needs a new buffer, changes in place
+    // are uploaded with glNamedBufferSubData
+    if(cmdlist.tokenBuffer)
+    {
+      glDeleteBuffers(1, &cmdlist.tokenBuffer);
+    }
+    glCreateBuffers(1, &cmdlist.tokenBuffer);
+    glNamedBufferStorage(cmdlist.tokenBuffer, cmdlist.tokenCapacity, NULL, GL_DYNAMIC_STORAGE_BIT);
+    glNamedBufferSubData(cmdlist.tokenBuffer, 0, cmdlist.tokenData.size(), cmdlist.tokenData.data());
+  }
+
+  initTokenSequences();
+}
 
+void Sample::initTokenSequences()
+{
+  if(m_hwsupport)
+  {
     // for list generation convert offsets to pointers
     cmdlist.tokenSequenceList = cmdlist.tokenSequence;
     for(size_t i = 0; i < cmdlist.tokenSequenceList.offsets.size(); i++)
     {
-      cmdlist.tokenSequenceList.offsets[i] += (GLintptr)&cmdlist.tokenData[0];
+      cmdlist.tokenSequenceList.offsets[i] += (GLintptr)cmdlist.tokenData.data();
     }
   }
 
@@ -796,36 +1233,284 @@ bool Sample::initCommandList()
       GLuint oldstate = cmdlist.tokenSequenceEmu.states[i];
       cmdlist.tokenSequenceEmu.states[i] = (oldstate == cmdlist.stateobj_draw) ? cmdlist.stateid_draw : cmdlist.stateid_draw_geo;
     }
+
+    cmdlist.tokenSequenceEmuMulti = cmdlist.tokenSequence;
+    for(size_t i = 0; i < cmdlist.tokenSequenceEmuMulti.states.size(); i++)
+    {
+      GLuint oldstate = cmdlist.tokenSequenceEmuMulti.states[i];
+      cmdlist.tokenSequenceEmuMulti.states[i] =
+          (oldstate == cmdlist.stateobj_draw) ? cmdlist.stateid_draw_multi : cmdlist.stateid_draw_geo_multi;
+    }
   }
 
-  updateCommandListState();
+  cmdlist.state.tokenChangeID++;
+}
 
-  return true;
+void Sample::initObjectTokens()
+{
+  m_objectTokens.clear();
+  if(m_tweak.optimizeBindings)
+  {
+    return;
+  }
+
+  // buildTokenStream writes the objects in m_objectOrder after the scene ubo
+  // tokens, a sequence ends where the next object's state object differs
+  const NVTokenSequence& seq = cmdlist.tokenSequence;
+  m_objectTokens.resize(m_sceneObjects.size());
+
+  GLuint        s      = 0;
+  GLintptr      offset = seq.offsets[0] + GLintptr(sizeof(NVTokenUbo) * 3);
+  NVTokenStream tokens;
+  for(size_t o = 0; o < m_objectOrder.size(); o++)
+  {
+    size_t i = m_objectOrder[o];
+    if(offset == seq.offsets[s] + seq.sizes[s])
+    {
+      s++;
+      offset = seq.offsets[s];
+    }
+
+    tokens.clear();
+    enqueueObjectTokens(i, tokens);
+    assert(memcmp(cmdlist.tokenData.data() + offset, tokens.data(), tokens.size()) == 0);
+
+    m_objectTokens[i].offset   = offset;
+    m_objectTokens[i].size     = GLsizei(tokens.size());
+    m_objectTokens[i].sequence = s;
+    offset += GLintptr(tokens.size());
+  }
+}
+
+bool Sample::setObject(size_t i, const ObjectInfo& info)
+{
+  // returns true if the sequences changed, or if the stream has to be
+  // built again as it was binding-optimized
+  bool programChanged = info.program != m_sceneObjects[i].program;
+  m_sceneObjects[i]   = info;
+
+  if(m_objectTokens.empty())
+  {
+    return true;
+  }
+  if(programChanged)
+  {
+    moveObjectTokens(i);
+    return true;
+  }
+
+  // the object's tokens keep their types, so they are overwritten in place
+  const ObjectTokens& entry = m_objectTokens[i];
+  NVTokenStream       tokens;
+  enqueueObjectTokens(i, tokens);
+  assert(tokens.size() == size_t(entry.size));
+  if(nvtokenPatch(cmdlist.tokenData, size_t(entry.offset), tokens.data(), tokens.size(), cmdlist.tokenDirty))
+  {
+    markTokensDirty(entry.offset);
+  }
+  return false;
+}
+
+void Sample::moveObjectTokens(size_t i)
+{
+  // Another program needs another state object and may need more tokens.
+  // The object's new tokens are appended to the stream, and its sequence is
+  // split into the parts before and after the old tokens, with a sequence
+  // for the object in between. The old tokens are no longer referenced.
+  NVTokenSequence& seq   = cmdlist.tokenSequence;
+  ObjectTokens&    entry = m_objectTokens[i];
+  GLuint           s     = entry.sequence;
+
+  GLintptr begin     = seq.offsets[s];
+  GLintptr end       = begin + seq.sizes[s];
+  GLintptr objectEnd = entry.offset + entry.size;
+  GLuint   stateobj  = seq.states[s];
+  GLuint   fbo       = seq.fbos[s];
+
+  GLintptr offset = GLintptr(cmdlist.tokenData.size());
+  enqueueObjectTokens(i, cmdlist.tokenData);
+  GLsizei size = GLsizei(cmdlist.tokenData.size() - size_t(offset));
+  cmdlist.tokenDirty.add(size_t(offset), size_t(size));
+
+  GLuint objectState = m_sceneObjects[i].program == programs.draw_scene ? cmdlist.stateobj_draw : cmdlist.stateobj_draw_geo;
+
+  NVTokenSequence split;
+  if(entry.offset > begin)
+  {
+    // the scene ubos in front of the first object draw nothing, so they
+    // can use the object's state rather than cause a transition
+    bool sceneOnly = s == 0 && entry.offset - begin == GLintptr(sizeof(NVTokenUbo) * 3);
+    split.offsets.push_back(begin);
+    split.sizes.push_back(GLsizei(entry.offset - begin));
+    split.states.push_back(sceneOnly ? objectState : stateobj);
+    split.fbos.push_back(fbo);
+  }
+  GLuint objectSeq = s + GLuint(split.offsets.size());
+  split.offsets.push_back(offset);
+  split.sizes.push_back(size);
+  split.states.push_back(objectState);
+  split.fbos.push_back(fbo);
+  if(objectEnd < end)
+  {
+    split.offsets.push_back(objectEnd);
+    split.sizes.push_back(GLsizei(end - objectEnd));
+    split.states.push_back(stateobj);
+    split.fbos.push_back(fbo);
+  }
+
+  seq.offsets.erase(seq.offsets.begin() + s);
+  seq.sizes.erase(seq.sizes.begin() + s);
+  seq.states.erase(seq.states.begin() + s);
+  seq.fbos.erase(seq.fbos.begin() + s);
+  seq.offsets.insert(seq.offsets.begin() + s, split.offsets.begin(), split.offsets.end());
+  seq.sizes.insert(seq.sizes.begin() + s, split.sizes.begin(), split.sizes.end());
+  seq.states.insert(seq.states.begin() + s, split.states.begin(), split.states.end());
+  seq.fbos.insert(seq.fbos.begin() + s, split.fbos.begin(), split.fbos.end());
+
+  GLuint added = GLuint(split.offsets.size()) - 1;
+  for(size_t o = 0; o < m_objectTokens.size(); o++)
+  {
+    ObjectTokens& other = m_objectTokens[o];
+    if(other.sequence > s)
+    {
+      other.sequence += added;
+    }
+    else if(other.sequence == s && other.offset > entry.offset)
+    {
+      other.sequence = objectSeq + 1;
+    }
+  }
+
+  entry.offset   = offset;
+  entry.size     = size;
+  entry.sequence = objectSeq;
+}
+
+void Sample::markTokensDirty(GLintptr offset)
+{
+  // the native list holds a copy of the tokens and is compiled again,
+  // of the emulated one only the segments that draw them
+  cmdlist.state.patchChangeID++;
+
+  const NVTokenSequence& seq         = cmdlist.tokenSequenceEmu;
+  size_t                 count       = seq.offsets.size();
+  size_t                 numSegments = cmdlist.segmentDirty.size();
+  for(size_t j = 0; j < count && numSegments; j++)
+  {
+    if(offset >= seq.offsets[j] && offset < seq.offsets[j] + seq.sizes[j])
+    {
+      // inverse of the partition in segmentSequences
+      size_t segment                = ((j + 1) * numSegments + count - 1) / count - 1;
+      cmdlist.segmentDirty[segment] = GL_TRUE;
+    }
+  }
+}
+
+void Sample::changeObjects(int count)
+{
+  if(!m_tokenCache.empty())
+  {
+    LOGI("token stream: objects change, token cache disabled\n");
+    m_tokenCache.clear();
+  }
+
+  // swap the meshes of random pairs of objects, every other pair swaps
+  // the programs as well, which moves the objects to other sequences
+  bool sequencesChanged = false;
+  for(int c = 0; c < count; c++)
+  {
+    size_t     a     = size_t(rand()) % m_sceneObjects.size();
+    size_t     b     = size_t(rand()) % m_sceneObjects.size();
+    ObjectInfo infoA = m_sceneObjects[a];
+    ObjectInfo infoB = m_sceneObjects[b];
+    std::swap(infoA.vbo, infoB.vbo);
+    std::swap(infoA.ibo, infoB.ibo);
+    std::swap(infoA.vboADDR, infoB.vboADDR);
+    std::swap(infoA.iboADDR, infoB.iboADDR);
+    std::swap(infoA.numIndices, infoB.numIndices);
+    if(c & 1)
+    {
+      std::swap(infoA.program, infoB.program);
+    }
+
+    sequencesChanged |= setObject(a, infoA);
+    sequencesChanged |= setObject(b, infoB);
+  }
+
+  if(m_objectTokens.empty() || cmdlist.tokenData.size() > cmdlist.tokenCapacity)
+  {
+    // objects share bindings in optimized streams, and moved objects leave
+    // their old tokens behind, building the stream again resolves both
+    initTokenStream();
+  }
+  else if(sequencesChanged)
+  {
+    initTokenSequences();
+  }
+}
+
+void Sample::segmentSequences(const NVTokenSequence& seq, GLintptr streamBegin, GLuint segment, GLuint numSegments, NVTokenSequence& out) const
+{
+  size_t count = seq.offsets.size();
+  size_t begin = count * segment / numSegments;
+  size_t end   = count * (segment + 1) / numSegments;
+
+  out.offsets.clear();
+  out.sizes.clear();
+  out.states.clear();
+  out.fbos.clear();
+
+  if(segment > 0)
+  {
+    // A segment does not inherit the bindings of the ones before, so all but
+    // the first start with the scene ubo tokens that buildTokenStream puts at
+    // the front of the stream.
+    out.offsets.push_back(streamBegin);
+    out.sizes.push_back(GLsizei(sizeof(NVTokenUbo) * 3));
+    out.states.push_back(seq.states[begin]);
+    out.fbos.push_back(seq.fbos[begin]);
+  }
+
+  out.offsets.insert(out.offsets.end(), seq.offsets.begin() + begin, seq.offsets.begin() + end);
+  out.sizes.insert(out.sizes.end(), seq.sizes.begin() + begin, seq.sizes.begin() + end);
+  out.states.insert(out.states.end(), seq.states.begin() + begin, seq.states.begin() + end);
+  out.fbos.insert(out.fbos.end(), seq.fbos.begin() + begin, seq.fbos.begin() + end);
 }
 
-void Sample::updateCommandListState()
+void Sample::updateCommandListState(DrawMode mode)
 {
+  GLuint numSegments = GLuint(std::min(size_t(std::max(m_tweak.listSegments, 1)), cmdlist.tokenSequence.offsets.size()));
 
   if(cmdlist.state.programChangeID != cmdlist.captured.programChangeID)
   {
+    // The state is recorded while it is set up, which avoids querying
+    // it back with the costly state.getGL(). The recorder starts from the
+    // OpenGL defaults, of which dither and multisample are enabled.
+    // Without native support nothing needs to be set in GL at all.
+    StateSystem::State state;
+    StateSystem::setBit(state.enable.stateBits, StateSystem::DITHER);
+    StateSystem::setBit(state.enable.stateBits, StateSystem::MULTISAMPLE);
+
+    StateSystem::Recorder rec(state, m_hwsupport);
+
     // generic state shared by both programs
-    glBindFramebuffer(GL_FRAMEBUFFER, fbos.scene);
+    rec.bindFramebuffer(GL_FRAMEBUFFER, fbos.scene);
 
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
+    rec.enable(GL_DEPTH_TEST);
+    rec.enable(GL_CULL_FACE);
 
-    glEnableVertexAttribArray(VERTEX_POS);
-    glEnableVertexAttribArray(VERTEX_NORMAL);
-    glEnableVertexAttribArray(VERTEX_UV);
+    rec.enableVertexAttribArray(VERTEX_POS);
+    rec.enableVertexAttribArray(VERTEX_NORMAL);
+    rec.enableVertexAttribArray(VERTEX_UV);
 
-    glVertexAttribFormat(VERTEX_POS, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, position));
-    glVertexAttribFormat(VERTEX_NORMAL, 3, GL_SHORT, GL_TRUE, offsetof(Vertex, normal));
-    glVertexAttribFormat(VERTEX_UV, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, uv));
-    glVertexAttribBinding(VERTEX_POS, 0);
-    glVertexAttribBinding(VERTEX_NORMAL, 0);
-    glVertexAttribBinding(VERTEX_UV, 0);
+    rec.vertexAttribFormat(VERTEX_POS, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, position));
+    rec.vertexAttribFormat(VERTEX_NORMAL, 3, GL_SHORT, GL_TRUE, offsetof(Vertex, normal));
+    rec.vertexAttribFormat(VERTEX_UV, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, uv));
+    rec.vertexAttribBinding(VERTEX_POS, 0);
+    rec.vertexAttribBinding(VERTEX_NORMAL, 0);
+    rec.vertexAttribBinding(VERTEX_UV, 0);
     // prime the stride parameter, used by bindless VBO and statesystem
-    glBindVertexBuffer(0, 0, 0, sizeof(Vertex));
+    rec.bindVertexBuffer(0, 0, 0, sizeof(Vertex));
 
     // temp workaround
     if(m_hwsupport)
@@ -837,23 +1522,17 @@ void Sample::updateCommandListState()
     }
 
     // let's create the first stateobject
-    glUseProgram(m_progManager.get(programs.draw_scene));
+    rec.useProgram(m_progManager.get(programs.draw_scene));
 
     if(m_hwsupport)
     {
       glStateCaptureNV(cmdlist.stateobj_draw, GL_TRIANGLES);
     }
 
-
-    StateSystem::State state;
-    state.getGL();  // this is a costly operation
     cmdlist.statesystem.set(cmdlist.stateid_draw, state, GL_TRIANGLES);
 
 
-    // The statesystem also provides an alternative approach
-    // to getGL, by manipulating the state data directly.
-    // When no getGL is called the state data matches the default
-    // state of OpenGL.
+    // The state data can also be manipulated directly.
 
     state.program.program = m_progManager.get(programs.draw_scene_geo);
     cmdlist.statesystem.set(cmdlist.stateid_draw_geo, state, GL_TRIANGLES);
@@ -873,26 +1552,114 @@ void Sample::updateCommandListState()
     cmdlist.statesystem.prepareTransition(cmdlist.stateid_draw, cmdlist.stateid_draw_geo);
     cmdlist.statesystem.prepareTransition(cmdlist.stateid_draw_geo, cmdlist.stateid_draw);
 
-    glDisableVertexAttribArray(VERTEX_POS);
-    glDisableVertexAttribArray(VERTEX_NORMAL);
-    glDisableVertexAttribArray(VERTEX_UV);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
+    if(has_GL_ARB_shader_draw_parameters)
+    {
+      // the multi-draw emulation uses the same state with different programs
+      state.program.program = m_progManager.get(programs.draw_scene_multi);
+      cmdlist.statesystem.set(cmdlist.stateid_draw_multi, state, GL_TRIANGLES);
+      state.program.program = m_progManager.get(programs.draw_scene_geo_multi);
+      cmdlist.statesystem.set(cmdlist.stateid_draw_geo_multi, state, GL_TRIANGLES);
+
+      cmdlist.statesystem.prepareTransition(cmdlist.stateid_draw_multi, cmdlist.stateid_draw_geo_multi);
+      cmdlist.statesystem.prepareTransition(cmdlist.stateid_draw_geo_multi, cmdlist.stateid_draw_multi);
+    }
+
+    if(m_hwsupport)
+    {
+      glDisableVertexAttribArray(VERTEX_POS);
+      glDisableVertexAttribArray(VERTEX_NORMAL);
+      glDisableVertexAttribArray(VERTEX_UV);
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      glDisable(GL_DEPTH_TEST);
+      glDisable(GL_CULL_FACE);
+    }
   }
 
-  if(m_hwsupport
-     && (cmdlist.state.programChangeID != cmdlist.captured.programChangeID
-         || cmdlist.state.fboChangeID != cmdlist.captured.fboChangeID))
+  if(m_hwsupport && mode == DRAW_TOKEN_LIST && cmdlist.state != cmdlist.capturedList)
   {
     // Because the commandlist object takes all state information
     // from the objects during compile, we have to update commandlist
-    // every time a state object or fbo changes.
-    NVTokenSequence& seq = cmdlist.tokenSequenceList;
-    glCommandListSegmentsNV(cmdlist.tokenCmdList, 1);
-    glListDrawCommandsStatesClientNV(cmdlist.tokenCmdList, 0, (const void**)&seq.offsets[0], &seq.sizes[0],
-                                     &seq.states[0], &seq.fbos[0], int(seq.states.size()));
+    // every time a state object or fbo changes, and as it holds a copy of
+    // the tokens, whenever they were patched. A compiled list cannot be
+    // modified, so all segments are recorded again, and as the client calls
+    // need the context they stay on this thread.
+    NVTokenSequence segmentSeq;
+    double          begin = NVPSystem::getTime();
+    glCommandListSegmentsNV(cmdlist.tokenCmdList, numSegments);
+    for(GLuint s = 0; s < numSegments; s++)
+    {
+      segmentSequences(cmdlist.tokenSequenceList, (GLintptr)cmdlist.tokenData.data(), s, numSegments, segmentSeq);
+      glListDrawCommandsStatesClientNV(cmdlist.tokenCmdList, s, (const void**)&segmentSeq.offsets[0], &segmentSeq.sizes[0],
+                                       &segmentSeq.states[0], &segmentSeq.fbos[0], int(segmentSeq.states.size()));
+    }
+    double recorded = NVPSystem::getTime();
     glCompileCommandListNV(cmdlist.tokenCmdList);
+    cmdlist.listRecordTime  = (recorded - begin) * 1000.0;
+    cmdlist.listCompileTime = (NVPSystem::getTime() - recorded) * 1000.0;
+    cmdlist.capturedList    = cmdlist.state;
+  }
+
+  if(m_tweak.scheduleSequences
+     && (cmdlist.state.programChangeID != cmdlist.captured.programChangeID
+         || cmdlist.state.tokenChangeID != cmdlist.captured.tokenChangeID))
+  {
+    // The transition costs depend on the states' content, so this is done
+    // once they are set. The first sequence binds the scene ubo for all
+    // others and must stay in front.
+    std::vector<GLboolean> orderDependent(cmdlist.tokenSequenceEmu.states.size(), GL_FALSE);
+    if(!orderDependent.empty())
+    {
+      orderDependent[0] = GL_TRUE;
+    }
+
+    NVTokenScheduleStats stats;
+    nvtokenScheduleSequences(cmdlist.tokenSequenceEmu, cmdlist.statesystem, orderDependent.data(), &stats);
+    cmdlist.scheduleCostBefore = int(stats.costBefore);
+    cmdlist.scheduleCostAfter  = int(stats.costAfter);
+    nvtokenScheduleSequences(cmdlist.tokenSequenceEmuMulti, cmdlist.statesystem, orderDependent.data(), NULL);
+  }
+
+  if(mode == DRAW_TOKEN_EMULATED_COMPILED && cmdlist.state != cmdlist.capturedEmu)
+  {
+    // Like the native list, the compiled emulation bakes in the states and
+    // fbos as they are now, and the order of the scheduling above. Its
+    // segments are independent, so if only tokens were patched in place,
+    // just the segments drawing them are compiled again, spread over the
+    // pipeline's workers.
+    const StateChangeID& captured = cmdlist.capturedEmu;
+    if(cmdlist.state.programChangeID != captured.programChangeID || cmdlist.state.fboChangeID != captured.fboChangeID
+       || cmdlist.state.tokenChangeID != captured.tokenChangeID || cmdlist.state.segmentChangeID != captured.segmentChangeID)
+    {
+      nvtokenListSegmentsSW(cmdlist.tokenCompiledEmu, numSegments);
+      cmdlist.segmentDirty.assign(numSegments, GL_TRUE);
+    }
+
+    std::vector<GLuint> dirty;
+    for(GLuint s = 0; s < numSegments; s++)
+    {
+      if(cmdlist.segmentDirty[s])
+      {
+        dirty.push_back(s);
+      }
+    }
+
+    if(!dirty.empty())
+    {
+      double begin = NVPSystem::getTime();
+      cmdlist.pipeline.runTasks(GLuint(dirty.size()), [this, numSegments, &dirty](GLuint d) {
+        NVTokenSequence segmentSeq;
+        GLuint          s = dirty[d];
+        segmentSequences(cmdlist.tokenSequenceEmu, 0, s, numSegments, segmentSeq);
+        nvtokenResetSegmentSW(cmdlist.tokenCompiledEmu, s);
+        nvtokenListDrawCommandsStatesSW(cmdlist.tokenCompiledEmu, s, cmdlist.tokenData.data(), cmdlist.tokenData.size(),
+                                        &segmentSeq.offsets[0], &segmentSeq.sizes[0], &segmentSeq.states[0],
+                                        &segmentSeq.fbos[0], GLuint(segmentSeq.offsets.size()), cmdlist.statesystem);
+      });
+      cmdlist.emuCompileTime      = (NVPSystem::getTime() - begin) * 1000.0;
+      cmdlist.emuSegmentsCompiled = int(dirty.size());
+    }
+    cmdlist.segmentDirty.assign(numSegments, GL_FALSE);
+    cmdlist.capturedEmu = cmdlist.state;
   }
 
   cmdlist.captured = cmdlist.state;
@@ -933,6 +1700,12 @@ bool Sample::begin()
     m_ui.enumAdd(0, DRAW_STANDARD, "standard");
 #if ALLOW_EMULATION_LAYER
     m_ui.enumAdd(0, DRAW_TOKEN_EMULATED, "nvcmdlist emulated");
+    m_ui.enumAdd(0, DRAW_TOKEN_EMULATED_COMPILED, "nvcmdlist emulated compiled");
+    m_ui.enumAdd(0, DRAW_TOKEN_EMULATED_PIPELINED, "nvcmdlist emulated pipelined");
+    if(has_GL_ARB_shader_draw_parameters)
+    {
+      m_ui.enumAdd(0, DRAW_TOKEN_EMULATED_MULTIDRAW, "nvcmdlist emulated multidraw");
+    }
 #endif
     if(m_hwsupport)
     {
@@ -942,6 +1715,7 @@ bool Sample::begin()
   }
 
   m_tweak.lightDir = normalize(vec3(-1, 1, 1));
+  m_lastTweak      = m_tweak;
 
   m_control.m_sceneOrbit     = vec3(0.0f);
   m_control.m_sceneDimension = float(grid) * 0.2f;
@@ -972,6 +1746,50 @@ void Sample::processUI(double time)
   {
     m_ui.enumCombobox(0, "draw mode", &m_tweak.mode);
     ImGui::SliderFloat("shrink factor", &m_sceneUbo.shrinkFactor, 0, 1.0f);
+    if(m_tweak.mode != DRAW_TOKEN_BUFFER && m_tweak.mode != DRAW_TOKEN_LIST)
+    {
+      ImGui::Text("shadow state: %d calls issued, %d filtered", int(m_shadowStats.issued), int(m_shadowStats.filtered));
+    }
+#if ALLOW_EMULATION_LAYER
+    ImGui::Checkbox("sort objects", &m_tweak.sortObjects);
+    ImGui::Checkbox("optimize bindings", &m_tweak.optimizeBindings);
+    ImGui::Checkbox("schedule emulated sequences", &m_tweak.scheduleSequences);
+    if(m_tweak.scheduleSequences)
+    {
+      ImGui::Text("transition cost: %d -> %d", cmdlist.scheduleCostBefore, cmdlist.scheduleCostAfter);
+    }
+    ImGui::SliderInt("object changes / frame", &m_tweak.objectChanges, 0, 64);
+    if(m_tweak.objectChanges > 0)
+    {
+      ImGui::Text("token patches: %.3f ms, %d uploads", cmdlist.tokenPatchTime, cmdlist.tokenUploads);
+    }
+    if(m_tweak.mode == DRAW_TOKEN_EMULATED_PIPELINED || m_tweak.mode == DRAW_TOKEN_EMULATED_COMPILED)
+    {
+      ImGui::SliderInt("pipeline workers", &m_tweak.pipelineWorkers, 0, 8);
+    }
+    if(m_tweak.mode == DRAW_TOKEN_LIST)
+    {
+      ImGui::SliderInt("list segments", &m_tweak.listSegments, 1, 16);
+      ImGui::Text("command list: record %.3f ms, compile %.3f ms", cmdlist.listRecordTime, cmdlist.listCompileTime);
+    }
+    if(m_tweak.mode == DRAW_TOKEN_EMULATED_COMPILED)
+    {
+      ImGui::SliderInt("list segments", &m_tweak.listSegments, 1, 16);
+      ImGui::Text("emulated list: %d segments compiled, %.3f ms", cmdlist.emuSegmentsCompiled, cmdlist.emuCompileTime);
+    }
+    if(m_tweak.mode == DRAW_TOKEN_EMULATED || m_tweak.mode == DRAW_TOKEN_EMULATED_MULTIDRAW
+       || m_tweak.mode == DRAW_TOKEN_EMULATED_COMPILED || m_tweak.mode == DRAW_TOKEN_EMULATED_PIPELINED)
+    {
+      ImGui::Text("emulation: %.1f ns/token", cmdlist.emuNsPerToken);
+      ImGui::Text("           %.1f ns/sequence", cmdlist.emuNsPerSequence);
+      ImGui::Text("           %.2f GL calls/draw", cmdlist.emuCallsPerDraw);
+      ImGui::Text("           %.2f filtered calls/draw", cmdlist.emuFilteredPerDraw);
+
+      const StateSystem::TransitionCacheStats& cache = cmdlist.statesystem.getTransitionCacheStats();
+      ImGui::Text("transitions: %d hits, %d misses, %d evictions", int(cache.hits), int(cache.misses), int(cache.evictions));
+      ImGui::Text("             %d cached, %d of %d KB", int(cache.entries), int(cache.bytes / 1024), int(cache.budget / 1024));
+    }
+#endif
   }
   ImGui::End();
 }
@@ -1000,6 +1818,38 @@ void Sample::think(double time)
     return;
   }
 
+#if ALLOW_EMULATION_LAYER
+  if(m_tweak.sortObjects != m_lastTweak.sortObjects || m_tweak.optimizeBindings != m_lastTweak.optimizeBindings
+     || m_tweak.scheduleSequences != m_lastTweak.scheduleSequences)
+  {
+    initTokenStream();
+  }
+  if(m_tweak.pipelineWorkers != m_lastTweak.pipelineWorkers)
+  {
+    cmdlist.pipeline.init(GLuint(std::max(m_tweak.pipelineWorkers, 0)));
+  }
+  if(m_tweak.listSegments != m_lastTweak.listSegments)
+  {
+    cmdlist.state.segmentChangeID++;
+  }
+  {
+    double begin = NVPSystem::getTime();
+    if(m_tweak.objectChanges > 0)
+    {
+      changeObjects(m_tweak.objectChanges);
+    }
+    cmdlist.tokenUploads = 0;
+    if(!cmdlist.tokenDirty.empty())
+    {
+      // only the buffer mode reads the token buffer, it is kept current regardless
+      cmdlist.tokenUploads = m_hwsupport ? int(cmdlist.tokenDirty.upload(cmdlist.tokenBuffer, cmdlist.tokenData.data())) : 0;
+      cmdlist.tokenDirty.clear();
+    }
+    cmdlist.tokenPatchTime = (NVPSystem::getTime() - begin) * 1000.0;
+  }
+#endif
+  m_lastTweak = m_tweak;
+
   {
     NV_PROFILE_GL_SECTION("Setup");
     m_sceneUbo.viewport = uvec2(width, height);
@@ -1029,6 +1879,10 @@ void Sample::think(double time)
   {
     NV_PROFILE_GL_SECTION("Draw");
 
+    // setup and the previous frame's gui changed the context directly
+    m_shadow.invalidate();
+    m_shadow.resetStats();
+
     switch(m_tweak.mode)
     {
       case DRAW_STANDARD:
@@ -1036,7 +1890,10 @@ void Sample::think(double time)
         break;
 #if ALLOW_EMULATION_LAYER
       case DRAW_TOKEN_EMULATED:
-        drawTokenEmulation();
+      case DRAW_TOKEN_EMULATED_MULTIDRAW:
+      case DRAW_TOKEN_EMULATED_COMPILED:
+      case DRAW_TOKEN_EMULATED_PIPELINED:
+        drawTokenEmulation(m_tweak.mode);
         break;
 #endif
       case DRAW_TOKEN_BUFFER:
@@ -1046,6 +1903,8 @@ void Sample::think(double time)
         drawTokenList();
         break;
     }
+
+    m_shadowStats = m_shadow.getStats();
   }
 
   {
@@ -1071,8 +1930,8 @@ void Sample::resize(int width, int height)
 
 void Sample::drawStandard()
 {
-  glEnable(GL_DEPTH_TEST);
-  glEnable(GL_CULL_FACE);
+  m_shadow.enable(GL_DEPTH_TEST);
+  m_shadow.enable(GL_CULL_FACE);
 
   glVertexAttribFormat(VERTEX_POS, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, position));
   glVertexAttribFormat(VERTEX_NORMAL, 3, GL_SHORT, GL_TRUE, offsetof(Vertex, normal));
@@ -1081,40 +1940,42 @@ void Sample::drawStandard()
   glVertexAttribBinding(VERTEX_NORMAL, 0);
   glVertexAttribBinding(VERTEX_UV, 0);
 
-  glEnableVertexAttribArray(VERTEX_POS);
-  glEnableVertexAttribArray(VERTEX_NORMAL);
-  glEnableVertexAttribArray(VERTEX_UV);
+  m_shadow.enableVertexAttribArray(VERTEX_POS);
+  m_shadow.enableVertexAttribArray(VERTEX_NORMAL);
+  m_shadow.enableVertexAttribArray(VERTEX_UV);
 
-  glBindBufferBase(GL_UNIFORM_BUFFER, UBO_SCENE, buffers.scene_ubo);
+  m_shadow.bindBufferBase(GL_UNIFORM_BUFFER, UBO_SCENE, buffers.scene_ubo);
 
-  GLuint lastProg = 0;
   for(int i = 0; i < m_sceneObjects.size(); i++)
   {
     const ObjectInfo& obj      = m_sceneObjects[i];
     GLuint            usedProg = m_progManager.get(obj.program);
 
-    if(usedProg != lastProg || !USE_PROGRAM_FILTER)
+    if(USE_PROGRAM_FILTER)
+    {
+      // the shadow state skips redundant binds
+      m_shadow.useProgram(usedProg);
+    }
+    else
     {
-      // simple redundancy tracker
       glUseProgram(usedProg);
-      lastProg = usedProg;
     }
 
-    glBindBufferRange(GL_UNIFORM_BUFFER, UBO_OBJECT, buffers.objects_ubo, uboAligned(sizeof(ObjectData)) * i, sizeof(ObjectData));
+    m_shadow.bindBufferRange(GL_UNIFORM_BUFFER, UBO_OBJECT, buffers.objects_ubo, uboAligned(sizeof(ObjectData)) * i, sizeof(ObjectData));
 
-    glBindVertexBuffer(0, obj.vbo, 0, sizeof(Vertex));
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.ibo);
+    m_shadow.bindVertexBuffer(0, obj.vbo, 0, sizeof(Vertex));
+    m_shadow.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.ibo);
     glDrawElements(GL_TRIANGLES, obj.numIndices, GL_UNSIGNED_INT, NV_BUFFER_OFFSET(0));
   }
 
-  glDisableVertexAttribArray(VERTEX_POS);
-  glDisableVertexAttribArray(VERTEX_NORMAL);
-  glDisableVertexAttribArray(VERTEX_UV);
+  m_shadow.disableVertexAttribArray(VERTEX_POS);
+  m_shadow.disableVertexAttribArray(VERTEX_NORMAL);
+  m_shadow.disableVertexAttribArray(VERTEX_UV);
 
-  glBindBufferBase(GL_UNIFORM_BUFFER, UBO_SCENE, 0);
-  glBindBufferBase(GL_UNIFORM_BUFFER, UBO_OBJECT, 0);
-  glBindVertexBuffer(0, 0, 0, 0);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  m_shadow.bindBufferBase(GL_UNIFORM_BUFFER, UBO_SCENE, 0);
+  m_shadow.bindBufferBase(GL_UNIFORM_BUFFER, UBO_OBJECT, 0);
+  m_shadow.bindVertexBuffer(0, 0, 0, 0);
+  m_shadow.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 void Sample::drawTokenBuffer()
@@ -1122,7 +1983,7 @@ void Sample::drawTokenBuffer()
   if(cmdlist.state != cmdlist.captured)
   {
 #if ALLOW_EMULATION_LAYER
-    updateCommandListState();
+    updateCommandListState(DRAW_TOKEN_BUFFER);
 #else
     updateCommandListStateMinimal();
 #endif
@@ -1135,19 +1996,22 @@ void Sample::drawTokenBuffer()
 
 void Sample::drawTokenList()
 {
-  if(cmdlist.state != cmdlist.captured)
-  {
 #if ALLOW_EMULATION_LAYER
-    updateCommandListState();
+  if(cmdlist.state != cmdlist.capturedList)
+  {
+    updateCommandListState(DRAW_TOKEN_LIST);
+  }
 #else
+  if(cmdlist.state != cmdlist.captured)
+  {
     updateCommandListStateMinimal();
-#endif
   }
+#endif
 
   glCallCommandListNV(cmdlist.tokenCmdList);
 }
 #if ALLOW_EMULATION_LAYER
-void Sample::drawTokenEmulation()
+void Sample::drawTokenEmulation(DrawMode mode)
 {
   if(m_bindlessVboUbo)
   {
@@ -1161,15 +2025,70 @@ void Sample::drawTokenEmulation()
 #endif
   }
 
-  if(cmdlist.state != cmdlist.captured)
+  const StateChangeID& captured = mode == DRAW_TOKEN_EMULATED_COMPILED ? cmdlist.capturedEmu : cmdlist.captured;
+  if(cmdlist.state != captured)
+  {
+    updateCommandListState(mode);
+    m_shadow.invalidate();
+  }
+
+  nvtoken::NVTokenEmulationStats stats;
+  double                         begin = NVPSystem::getTime();
+
+  if(mode == DRAW_TOKEN_EMULATED_MULTIDRAW)
+  {
+    // the object ubo ranges are read as one array, indexed by baseInstance
+    NVTokenMultiDraw& multi = cmdlist.multiDraw;
+    multi.uboIndex          = UBO_OBJECT;
+    multi.uboStride         = GLuint(uboAligned(sizeof(ObjectData)));
+    multi.uboBuffer         = buffers.objects_ubo;
+    multi.uboAddress        = m_bindlessVboUbo ? buffersADDR.objects_ubo : 0;
+    m_shadow.bindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_OBJECTS, buffers.objects_ubo);
+
+    const NVTokenSequence& seq = cmdlist.tokenSequenceEmuMulti;
+    nvtokenDrawCommandsStatesMultiSW(cmdlist.tokenData.data(), cmdlist.tokenData.size(), &seq.offsets[0], &seq.sizes[0],
+                                     &seq.states[0], &seq.fbos[0], GLuint(seq.offsets.size()), cmdlist.statesystem, multi, &stats);
+
+    m_shadow.bindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_OBJECTS, 0);
+  }
+  else if(mode == DRAW_TOKEN_EMULATED_COMPILED)
+  {
+    nvtokenDrawSegmentedSW(cmdlist.tokenCompiledEmu, &stats);
+  }
+  else if(mode == DRAW_TOKEN_EMULATED_PIPELINED)
+  {
+    const NVTokenSequence& seq = cmdlist.tokenSequenceEmu;
+    nvtokenDrawCommandsStatesPipelinedSW(cmdlist.pipeline, cmdlist.tokenData.data(), cmdlist.tokenData.size(), &seq.offsets[0],
+                                         &seq.sizes[0], &seq.states[0], &seq.fbos[0], GLuint(seq.offsets.size()),
+                                         cmdlist.statesystem, &stats);
+  }
+  else
   {
-    updateCommandListState();
+    nvtokenDrawCommandsStatesSW(cmdlist.tokenData.data(), cmdlist.tokenData.size(), &cmdlist.tokenSequenceEmu.offsets[0],
+                                &cmdlist.tokenSequenceEmu.sizes[0], &cmdlist.tokenSequenceEmu.states[0],
+                                &cmdlist.tokenSequenceEmu.fbos[0], GLuint(cmdlist.tokenSequenceEmu.offsets.size()),
+                                cmdlist.statesystem, &stats);
   }
 
-  nvtokenDrawCommandsStatesSW(&cmdlist.tokenData[0], cmdlist.tokenData.size(), &cmdlist.tokenSequenceEmu.offsets[0],
-                              &cmdlist.tokenSequenceEmu.sizes[0], &cmdlist.tokenSequenceEmu.states[0],
-                              &cmdlist.tokenSequenceEmu.fbos[0], GLuint(cmdlist.tokenSequenceEmu.offsets.size()),
-                              cmdlist.statesystem);
+  // this is the cpu time to submit, the driver may defer the actual work
+  cmdlist.emuTime += NVPSystem::getTime() - begin;
+  cmdlist.emuStats.sequences += stats.sequences;
+  cmdlist.emuStats.tokens += stats.tokens;
+  cmdlist.emuStats.draws += stats.draws;
+  cmdlist.emuStats.glCalls += stats.glCalls;
+  cmdlist.emuStats.filteredCalls += stats.filteredCalls;
+  if(++cmdlist.emuFrames == CmdList::EMU_STATS_FRAMES)
+  {
+    double ns                = cmdlist.emuTime * 1000000000.0;
+    cmdlist.emuNsPerToken      = cmdlist.emuStats.tokens ? ns / double(cmdlist.emuStats.tokens) : 0;
+    cmdlist.emuNsPerSequence   = cmdlist.emuStats.sequences ? ns / double(cmdlist.emuStats.sequences) : 0;
+    cmdlist.emuCallsPerDraw    = cmdlist.emuStats.draws ? double(cmdlist.emuStats.glCalls) / double(cmdlist.emuStats.draws) : 0;
+    cmdlist.emuFilteredPerDraw = cmdlist.emuStats.draws ? double(cmdlist.emuStats.filteredCalls) / double(cmdlist.emuStats.draws) : 0;
+
+    cmdlist.emuStats  = nvtoken::NVTokenEmulationStats();
+    cmdlist.emuTime   = 0;
+    cmdlist.emuFrames = 0;
+  }
 
   if(m_bindlessVboUbo)
   {
@@ -0,0 +1,424 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Cost of the emulation per token type and for a scene like the sample's,
+// and of the StateSystem operations the emulation relies on. The GL calls
+// go to the stub, so the numbers are the CPU overhead of the emulation.
+
+#include "benchutil.hpp"
+
+#include <functional>
+
+//////////////////////////////////////////////////////////////////////////
+
+struct TokenCase
+{
+  const char*                                       name;
+  std::function<void(NVTokenStream&, GLuint index)> enqueue;
+};
+
+static void benchTokenTypes(bool bindless, double minTime)
+{
+  nvtokenInitInternals(false, bindless);
+
+  StateSystem stateSystem;
+  stateSystem.init();
+  StateSystem::StateID state;
+  stateSystem.generate(1, &state);
+  {
+    StateSystem::State content;
+    benchSceneState(content, 0);
+    stateSystem.set(state, content, GL_TRIANGLES);
+  }
+
+  // every token binds or sets something else than the one before
+  const TokenCase cases[] = {
+      {"vbo",
+       [](NVTokenStream& s, GLuint i) {
+         s.alloc<NVTokenVbo>()->setBuffer(1 + i % 64, 0x200000000ull + i * 0x10000, 0);
+       }},
+      {"ibo",
+       [](NVTokenStream& s, GLuint i) {
+         NVTokenIbo* ibo = s.alloc<NVTokenIbo>();
+         ibo->setType(GL_UNSIGNED_INT);
+         ibo->setBuffer(1 + i % 64, 0x200000000ull + i * 0x10000);
+       }},
+      {"ubo",
+       [](NVTokenStream& s, GLuint i) {
+         NVTokenUbo* ubo = s.alloc<NVTokenUbo>();
+         ubo->setBuffer(BenchScene::OBJECTS_UBO, BenchScene::OBJECTS_ADDRESS, 256 * (i % 1024), 256);
+         ubo->setBinding(1, NVTOKEN_STAGE_VERTEX);
+       }},
+      {"draw elements", [](NVTokenStream& s, GLuint i) { s.alloc<NVTokenDrawElems>()->setParams(36, i % 16); }},
+      {"draw arrays", [](NVTokenStream& s, GLuint i) { s.alloc<NVTokenDrawArrays>()->setParams(36, i % 16); }},
+      {"draw elements strip", [](NVTokenStream& s, GLuint i) { s.alloc<NVTokenDrawElemsStrip>()->setParams(36, i % 16); }},
+      {"draw elements instanced",
+       [](NVTokenStream& s, GLuint i) {
+         NVTokenDrawElemsInstanced* draw = s.alloc<NVTokenDrawElemsInstanced>();
+         draw->setMode(GL_TRIANGLES);
+         draw->setParams(36, i % 16);
+         draw->setInstances(2);
+       }},
+      {"draw arrays instanced",
+       [](NVTokenStream& s, GLuint i) {
+         NVTokenDrawArraysInstanced* draw = s.alloc<NVTokenDrawArraysInstanced>();
+         draw->setMode(GL_TRIANGLES);
+         draw->setParams(36, i % 16);
+         draw->setInstances(2);
+       }},
+      {"blend color",
+       [](NVTokenStream& s, GLuint i) {
+         BlendColorCommandNV& cmd = s.alloc<NVTokenBlendColor>()->cmd;
+         cmd.red = cmd.green = cmd.blue = cmd.alpha = float(i % 8) / 8.0f;
+       }},
+      {"stencil ref",
+       [](NVTokenStream& s, GLuint i) {
+         StencilRefCommandNV& cmd = s.alloc<NVTokenStencilRef>()->cmd;
+         cmd.frontStencilRef = cmd.backStencilRef = i % 256;
+       }},
+      {"line width", [](NVTokenStream& s, GLuint i) { s.alloc<NVTokenLineWidth>()->cmd.lineWidth = float(1 + i % 4); }},
+      {"polygon offset",
+       [](NVTokenStream& s, GLuint i) {
+         PolygonOffsetCommandNV& cmd = s.alloc<NVTokenPolygonOffset>()->cmd;
+         cmd.scale = cmd.bias = float(i % 4);
+       }},
+      {"viewport",
+       [](NVTokenStream& s, GLuint i) {
+         ViewportCommandNV& cmd = s.alloc<NVTokenViewport>()->cmd;
+         cmd.x = cmd.y = i % 16;
+         cmd.width = cmd.height = 256;
+       }},
+      {"scissor",
+       [](NVTokenStream& s, GLuint i) {
+         ScissorCommandNV& cmd = s.alloc<NVTokenScissor>()->cmd;
+         cmd.x = cmd.y = i % 16;
+         cmd.width = cmd.height = 256;
+       }},
+      {"front face", [](NVTokenStream& s, GLuint i) { s.alloc<NVTokenFrontFace>()->setFrontFace(i & 1 ? GL_CW : GL_CCW); }},
+      {"nop", [](NVTokenStream& s, GLuint) { s.alloc<NVTokenNop>(); }},
+  };
+
+  const GLuint numTokens = 4096;
+
+  printf("emulation per token type (%s), %u tokens in one sequence\n", bindless ? "bindless" : "bind", numTokens);
+  for(const TokenCase& tc : cases)
+  {
+    NVTokenStream stream;
+    for(GLuint i = 0; i < numTokens; i++)
+    {
+      tc.enqueue(stream, i);
+    }
+
+    GLintptr offset = 0;
+    GLsizei  size   = GLsizei(stream.size());
+    GLuint   fbo    = BenchScene::FBO;
+
+    NVTokenEmulationStats stats;
+    double                time = benchRun(
+        [&]() {
+          nvtokenDrawCommandsStatesSW(stream.data(), stream.size(), &offset, &size, &state, &fbo, 1, stateSystem, &stats);
+        },
+        minTime);
+
+    printf("  %-24s %8.2f ns/token %6.2f GL calls/token\n", tc.name, time * 1e9 / double(stats.tokens),
+           double(stats.glCalls) / double(stats.tokens));
+  }
+}
+
+static void benchScene(bool bindless, bool coherent, double minTime)
+{
+  nvtokenInitInternals(false, bindless);
+
+  StateSystem stateSystem;
+  stateSystem.init();
+  StateSystem::StateID states[2];
+  StateSystem::StateID statesMulti[2];
+  stateSystem.generate(2, states);
+  stateSystem.generate(2, statesMulti);
+  for(GLuint i = 0; i < 2; i++)
+  {
+    StateSystem::State content;
+    benchSceneState(content, i);
+    stateSystem.set(states[i], content, GL_TRIANGLES);
+    stateSystem.set(statesMulti[i], content, GL_TRIANGLES);
+  }
+
+  BenchScene scene;
+  scene.init(8192, 8, coherent);
+
+  NVTokenStream   stream;
+  NVTokenSequence seq;
+  scene.build(stream, seq, states);
+
+  NVTokenSequence seqMulti = seq;
+  for(size_t i = 0; i < seqMulti.states.size(); i++)
+  {
+    seqMulti.states[i] = seqMulti.states[i] == states[0] ? statesMulti[0] : statesMulti[1];
+  }
+
+  NVTokenMultiDraw multi;
+  multi.uboIndex   = BenchScene::UBO_OBJECT;
+  multi.uboStride  = BenchScene::UBO_STRIDE;
+  multi.uboBuffer  = BenchScene::OBJECTS_UBO;
+  multi.uboAddress = BenchScene::OBJECTS_ADDRESS;
+
+  printf("emulation of %d objects (%s, %s programs), %d sequences\n", int(scene.objects.size()),
+         bindless ? "bindless" : "bind", coherent ? "coherent" : "random", int(seq.offsets.size()));
+
+  NVTokenEmulationStats stats;
+  double                time = benchRun(
+      [&]() {
+        nvtokenDrawCommandsStatesSW(stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(), seq.states.data(),
+                                    seq.fbos.data(), GLuint(seq.offsets.size()), stateSystem, &stats);
+      },
+      minTime);
+  printf("  %-24s %8.2f ns/draw %8.2f ns/token %6.2f GL calls/draw\n", "standard", time * 1e9 / double(stats.draws),
+         time * 1e9 / double(stats.tokens), double(stats.glCalls) / double(stats.draws));
+
+  time = benchRun(
+      [&]() {
+        nvtokenDrawCommandsStatesMultiSW(stream.data(), stream.size(), seqMulti.offsets.data(), seqMulti.sizes.data(),
+                                         seqMulti.states.data(), seqMulti.fbos.data(), GLuint(seqMulti.offsets.size()),
+                                         stateSystem, multi, &stats);
+      },
+      minTime);
+  printf("  %-24s %8.2f ns/draw %8.2f ns/token %6.2f GL calls/draw\n", "multidraw", time * 1e9 / double(stats.draws),
+         time * 1e9 / double(stats.tokens), double(stats.glCalls) / double(stats.draws));
+
+  // compiled once, like the sample's emulated compiled mode, then replayed
+  NVTokenSegmentedList list;
+  double               compileTime = benchRun(
+      [&]() {
+        nvtokenListSegmentsSW(list, 1);
+        nvtokenListDrawCommandsStatesSW(list, 0, stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(),
+                                        seq.states.data(), seq.fbos.data(), GLuint(seq.offsets.size()), stateSystem);
+      },
+      minTime);
+  time = benchRun([&]() { nvtokenDrawSegmentedSW(list, &stats); }, minTime);
+  printf("  %-24s %8.2f ns/draw %8.2f ns/token %6.2f GL calls/draw\n", "compiled", time * 1e9 / double(stats.draws),
+         time * 1e9 / double(stats.tokens), double(stats.glCalls) / double(stats.draws));
+  printf("  %-24s %8.2f ns/draw %8.2f ns/token\n", "compiled (compile)", compileTime * 1e9 / double(stats.draws),
+         compileTime * 1e9 / double(stats.tokens));
+
+  // the time the calling thread spends, decoding is left to the workers,
+  // of which it spends replay issuing GL calls and wait waiting for packets
+  NVTokenPipeline pipeline;
+  for(GLuint numWorkers = 0; numWorkers <= 4; numWorkers = numWorkers ? numWorkers * 2 : 1)
+  {
+    pipeline.init(numWorkers);
+    time = benchRun(
+        [&]() {
+          nvtokenDrawCommandsStatesPipelinedSW(pipeline, stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(),
+                                               seq.states.data(), seq.fbos.data(), GLuint(seq.offsets.size()), stateSystem,
+                                               &stats);
+        },
+        minTime);
+    char name[32];
+    snprintf(name, sizeof(name), "pipelined, %u worker%s", numWorkers, numWorkers == 1 ? "" : "s");
+    const NVTokenPipelineTimes& times = pipeline.getTimes();
+    printf("  %-24s %8.2f ns/draw %8.2f ns/token %6.2f GL calls/draw, replay %6.2f wait %6.2f ns/draw\n", name,
+           time * 1e9 / double(stats.draws), time * 1e9 / double(stats.tokens), double(stats.glCalls) / double(stats.draws),
+           times.replay * 1e9 / double(stats.draws), times.wait * 1e9 / double(stats.draws));
+  }
+  pipeline.deinit();
+}
+
+// The compiled list split into segments of consecutive sequences, as the
+// sample records it: compiling all segments serially and on the pipeline's
+// workers, compiling one segment again after a change within it, and the
+// replay. More segments add transitions from scratch at their starts.
+void benchSegments(bool quick)
+{
+  double minTime    = quick ? 0.002 : 0.2;
+  GLuint numWorkers = 3;
+
+  nvtokenInitInternals(false, false);
+
+  StateSystem stateSystem;
+  stateSystem.init();
+  StateSystem::StateID states[2];
+  stateSystem.generate(2, states);
+  for(GLuint i = 0; i < 2; i++)
+  {
+    StateSystem::State content;
+    benchSceneState(content, i);
+    stateSystem.set(states[i], content, GL_TRIANGLES);
+  }
+
+  BenchScene      scene;
+  NVTokenStream   stream;
+  NVTokenSequence seq;
+  scene.init(quick ? 1024 : 8192, 8, false);
+  scene.build(stream, seq, states);
+  GLuint count = GLuint(seq.offsets.size());
+
+  NVTokenPipeline pipeline;
+  pipeline.init(numWorkers);
+
+  printf("segmented compiled list, %d objects, %u sequences, %u workers\n", int(scene.objects.size()), count, numWorkers);
+  printf("  %-10s %14s %14s %14s %14s\n", "segments", "compile us", "parallel us", "recompile us", "replay us");
+
+  for(GLuint numSegments = 1; numSegments <= 16; numSegments *= 2)
+  {
+    NVTokenSegmentedList list;
+    auto record = [&](GLuint s) {
+      GLuint begin = count * s / numSegments;
+      GLuint end   = count * (s + 1) / numSegments;
+      nvtokenResetSegmentSW(list, s);
+      nvtokenListDrawCommandsStatesSW(list, s, stream.data(), stream.size(), seq.offsets.data() + begin,
+                                      seq.sizes.data() + begin, seq.states.data() + begin, seq.fbos.data() + begin,
+                                      end - begin, stateSystem);
+    };
+
+    double compileTime = benchRun(
+        [&]() {
+          nvtokenListSegmentsSW(list, numSegments);
+          for(GLuint s = 0; s < numSegments; s++)
+          {
+            record(s);
+          }
+        },
+        minTime);
+    double parallelTime = benchRun(
+        [&]() {
+          nvtokenListSegmentsSW(list, numSegments);
+          pipeline.runTasks(numSegments, record);
+        },
+        minTime);
+    double recompileTime = benchRun([&]() { record(numSegments / 2); }, minTime);
+
+    NVTokenEmulationStats stats;
+    double                replayTime = benchRun([&]() { nvtokenDrawSegmentedSW(list, &stats); }, minTime);
+
+    printf("  %-10u %14.1f %14.1f %14.1f %14.1f\n", numSegments, compileTime * 1e6, parallelTime * 1e6,
+           recompileTime * 1e6, replayTime * 1e6);
+  }
+
+  pipeline.deinit();
+}
+
+void benchEmulation(bool quick)
+{
+  double minTime = quick ? 0.002 : 0.2;
+  for(int bindless = 0; bindless < 2; bindless++)
+  {
+    benchTokenTypes(bindless != 0, minTime);
+  }
+  for(int bindless = 0; bindless < 2; bindless++)
+  {
+    benchScene(bindless != 0, true, minTime);
+    benchScene(bindless != 0, false, minTime);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void benchStateSystem(bool quick)
+{
+  double minTime   = quick ? 0.002 : 0.2;
+  GLuint numStates = 64;
+
+  StateSystem stateSystem;
+  stateSystem.init();
+
+  std::vector<StateSystem::StateID> ids(numStates);
+  stateSystem.generate(numStates, ids.data());
+
+  std::vector<StateSystem::State> contents(numStates);
+  for(GLuint i = 0; i < numStates; i++)
+  {
+    benchVariedState(contents[i], i);
+  }
+
+  printf("state system, %u states\n", numStates);
+
+  double time = benchRun(
+      [&]() {
+        for(GLuint i = 0; i < numStates; i++)
+        {
+          stateSystem.set(ids[i], contents[i], GL_TRIANGLES);
+        }
+      },
+      minTime);
+  printf("  %-32s %8.1f ns\n", "set", time * 1e9 / numStates);
+
+  time = benchRun(
+      [&]() {
+        for(GLuint i = 0; i < numStates; i++)
+        {
+          stateSystem.applyGL(ids[i], true);
+        }
+      },
+      minTime);
+  printf("  %-32s %8.1f ns\n", "applyGL (everything)", time * 1e9 / numStates);
+
+  // the transitions of a fixed cycle, all of them are cached after the warm up
+  stateSystem.resetTransitionCacheStats();
+  time = benchRun(
+      [&]() {
+        for(GLuint i = 0; i < numStates; i++)
+        {
+          stateSystem.applyGL(ids[(i * 7 + 1) % numStates], ids[(i * 7) % numStates], true);
+        }
+      },
+      minTime);
+  {
+    const StateSystem::TransitionCacheStats& cache = stateSystem.getTransitionCacheStats();
+    printf("  %-32s %8.1f ns  %.1f%% hits\n", "applyGL (transition)", time * 1e9 / numStates,
+           100.0 * double(cache.hits) / double(cache.hits + cache.misses));
+  }
+
+  StateSystem::OpList ops;
+  size_t              words = 0;
+  time = benchRun(
+      [&]() {
+        words = 0;
+        for(GLuint i = 0; i < numStates; i++)
+        {
+          ops.clear();
+          stateSystem.compileTransitionUncached(ops, ids[(i * 7 + 1) % numStates], ids[(i * 7) % numStates]);
+          words += ops.words.size();
+        }
+      },
+      minTime);
+  printf("  %-32s %8.1f ns  %.1f words\n", "compileTransitionUncached", time * 1e9 / numStates,
+         double(words) / numStates);
+
+  volatile GLuint cost = 0;
+  time                 = benchRun(
+      [&]() {
+        for(GLuint i = 0; i < numStates; i++)
+        {
+          cost = cost + stateSystem.getTransitionCost(ids[(i * 7 + 1) % numStates], ids[(i * 7) % numStates]);
+        }
+      },
+      minTime);
+  printf("  %-32s %8.1f ns\n", "getTransitionCost", time * 1e9 / numStates);
+
+  time = benchRun(
+      [&]() {
+        for(GLuint i = 0; i < numStates; i++)
+        {
+          StateSystem::StateID id = stateSystem.intern(contents[i], GL_TRIANGLES);
+          stateSystem.destroy(1, &id);
+        }
+      },
+      minTime);
+  printf("  %-32s %8.1f ns\n", "intern + destroy", time * 1e9 / numStates);
+}
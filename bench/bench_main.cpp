@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// nvtoken_bench [-quick] [name...]
+// runs all benchmarks or the named ones, -quick only checks they run
+
+#include <stdio.h>
+#include <string.h>
+
+void benchEmulation(bool quick);
+void benchSegments(bool quick);
+void benchStateSystem(bool quick);
+void benchMakeDiff(bool quick);
+void benchTransitionCache(bool quick);
+void benchApplyTransitions(bool quick);
+void benchStateThreads(bool quick);
+void benchCompactStore(bool quick);
+void benchDecode(bool quick);
+void benchEnqueue(bool quick);
+void benchBuild(bool quick);
+void benchLoad(bool quick);
+
+struct Benchmark
+{
+  const char* name;
+  void (*run)(bool quick);
+};
+
+static const Benchmark s_benchmarks[] = {
+    {"emulation", benchEmulation},
+    {"segments", benchSegments},
+    {"statesystem", benchStateSystem},
+    {"makediff", benchMakeDiff},
+    {"transitioncache", benchTransitionCache},
+    {"applytransitions", benchApplyTransitions},
+    {"statethreads", benchStateThreads},
+    {"compactstore", benchCompactStore},
+    {"decode", benchDecode},
+    {"enqueue", benchEnqueue},
+    {"build", benchBuild},
+    {"load", benchLoad},
+};
+
+int main(int argc, const char** argv)
+{
+  bool quick    = false;
+  int  selected = 0;
+  for(int a = 1; a < argc; a++)
+  {
+    if(strcmp(argv[a], "-quick") == 0)
+      quick = true;
+    else
+      selected++;
+  }
+
+  for(const Benchmark& bench : s_benchmarks)
+  {
+    bool run = selected == 0;
+    for(int a = 1; a < argc; a++)
+    {
+      run = run || strcmp(argv[a], bench.name) == 0;
+    }
+    if(run)
+    {
+      bench.run(quick);
+      printf("\n");
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// StateSystem internals: the makeDiff variants, the transition cache,
+// cached transitions over many states,
+// state creation from several threads and the CompactStore
+
+#include "benchutil.hpp"
+#include "statesystemtest.hpp"
+
+#include <thread>
+
+void benchMakeDiff(bool quick)
+{
+  double minTime = quick ? 0.002 : 0.2;
+
+  StateSystem stateSystem;
+  stateSystem.init();
+
+  struct Case
+  {
+    const char*        name;
+    StateSystem::State from;
+    StateSystem::State to;
+  };
+  std::vector<Case> cases(6);
+
+  cases[0].name = "identical";
+  benchSceneState(cases[0].from, 0);
+  cases[0].to = cases[0].from;
+
+  cases[1].name = "blend factor";
+  cases[1].from = cases[0].from;
+  cases[1].to   = cases[1].from;
+  cases[1].to.blend.blends[0].rgb.srcw = GL_SRC_ALPHA;
+
+  cases[2].name = "vertex format";
+  cases[2].from = cases[0].from;
+  cases[2].to   = cases[2].from;
+  cases[2].to.vertexformat.formats[1].relativeoffset = 16;
+
+  cases[3].name = "program + fbo";
+  cases[3].from = cases[0].from;
+  cases[3].to   = cases[3].from;
+  cases[3].to.program.program = 11;
+  cases[3].to.fbo.fboDraw     = 2;
+
+  cases[4].name = "4 sub-states";
+  cases[4].from = cases[3].to;
+  cases[4].to   = cases[2].to;
+  cases[4].to.blend.blends[0].rgb.srcw = GL_SRC_ALPHA;
+  cases[4].to.depth.func               = GL_LEQUAL;
+
+  cases[5].name = "unrelated states";
+  benchVariedState(cases[5].from, 6);
+  benchVariedState(cases[5].to, 13);
+
+  printf("makeDiff\n");
+  printf("  %-24s %12s %12s\n", "", "sub-states", "per word");
+  for(const Case& c : cases)
+  {
+    StateSystem::StateID ids[2];
+    stateSystem.generate(2, ids);
+    stateSystem.set(ids[0], c.from, GL_TRIANGLES);
+    stateSystem.set(ids[1], c.to, GL_TRIANGLES);
+
+    const GLuint repeats = 64;
+    double       times[2];
+    for(int path = 0; path < 2; path++)
+    {
+      StateSystemTest::Diff diff;
+      times[path] = benchRun(
+          [&]() {
+            for(GLuint r = 0; r < repeats; r++)
+            {
+              StateSystemTest::makeDiff(stateSystem, StateSystemTest::DiffPath(path), diff, ids[1], ids[0]);
+            }
+          },
+          minTime);
+    }
+    printf("  %-24s %9.1f ns %9.1f ns\n", c.name, times[0] * 1e9 / repeats, times[1] * 1e9 / repeats);
+  }
+}
+
+// hit rate and memory of the transition cache for a frame of draws, whose
+// states follow a skewed distribution, under different budgets
+void benchTransitionCache(bool quick)
+{
+  double minTime   = quick ? 0.002 : 0.2;
+  GLuint numStates = 256;
+  GLuint numDraws  = 4096;
+
+  StateSystem stateSystem;
+  stateSystem.init();
+
+  std::vector<StateSystem::StateID> ids(numStates);
+  stateSystem.generate(numStates, ids.data());
+  for(GLuint i = 0; i < numStates; i++)
+  {
+    StateSystem::State state;
+    benchVariedState(state, i);
+    stateSystem.set(ids[i], state, GL_TRIANGLES);
+  }
+
+  // squaring a uniform value favors the low state indices
+  std::vector<StateSystem::StateID> frame(numDraws);
+  GLuint                            seed = 3;
+  for(GLuint i = 0; i < numDraws; i++)
+  {
+    seed         = seed * 1664525u + 1013904223u;
+    double value = double(seed >> 8) / double(1 << 24);
+    frame[i]     = ids[GLuint(value * value * numStates)];
+  }
+
+  printf("transition cache, %u states, %u draws per frame\n", numStates, numDraws);
+  printf("  %-10s %10s %8s %10s %10s %12s\n", "budget", "ns/draw", "hits", "entries", "KB", "bytes/entry");
+
+  const size_t budgets[] = {16 * 1024, 64 * 1024, 256 * 1024, StateSystem::DEFAULT_TRANSITION_BUDGET, 4 * 1024 * 1024};
+  for(size_t budget : budgets)
+  {
+    stateSystem.setTransitionCacheBudget(budget);
+    // warm up, then only measure the steady state
+    for(GLuint i = 1; i < numDraws; i++)
+    {
+      stateSystem.applyGL(frame[i], frame[i - 1], true);
+    }
+    stateSystem.resetTransitionCacheStats();
+
+    double time = benchRun(
+        [&]() {
+          for(GLuint i = 1; i < numDraws; i++)
+          {
+            stateSystem.applyGL(frame[i], frame[i - 1], true);
+          }
+        },
+        minTime);
+
+    const StateSystem::TransitionCacheStats& cache = stateSystem.getTransitionCacheStats();
+    printf("  %7d KB %10.1f %7.1f%% %10d %10.1f %12.1f\n", int(budget / 1024), time * 1e9 / (numDraws - 1),
+           100.0 * double(cache.hits) / double(cache.hits + cache.misses), int(cache.entries), double(cache.bytes) / 1024.0,
+           cache.entries ? double(cache.bytes) / double(cache.entries) : 0.0);
+  }
+}
+
+// cached applyGL(id, prev) over random pairs of many states, every lookup
+// resolves both ids and walks the cache's links, so this is bound by how
+// many cache lines the hot per-state and per-entry data spans
+void benchApplyTransitions(bool quick)
+{
+  double       minTime       = quick ? 0.002 : 0.2;
+  const GLuint stateCounts[] = {16384, 65536};
+  GLuint       numPairs      = quick ? 1024 : 16384;
+
+  printf("cached applyGL(id, prev), %u random pairs\n", numPairs);
+  printf("  %-10s %10s %8s %10s\n", "states", "ns/apply", "hits", "KB cache");
+
+  for(GLuint numStates : stateCounts)
+  {
+    StateSystem stateSystem;
+    stateSystem.init();
+    stateSystem.setTransitionCacheBudget(size_t(256) * 1024 * 1024);
+
+    std::vector<StateSystem::StateID> ids(numStates);
+    stateSystem.generate(numStates, ids.data());
+    for(GLuint i = 0; i < numStates; i++)
+    {
+      StateSystem::State state;
+      benchMaterialState(state, i);
+      stateSystem.set(ids[i], state, GL_TRIANGLES);
+    }
+
+    // each pair is its own transition, spread over all states
+    std::vector<StateSystem::StateID> pairs(numPairs * 2);
+    GLuint                            seed = 9;
+    for(StateSystem::StateID& id : pairs)
+    {
+      seed = seed * 1664525u + 1013904223u;
+      id   = ids[(seed >> 4) % numStates];
+    }
+
+    auto applyAll = [&]() {
+      for(GLuint i = 0; i < numPairs; i++)
+      {
+        stateSystem.applyGL(pairs[i * 2 + 1], pairs[i * 2], true);
+      }
+    };
+    applyAll();
+    stateSystem.resetTransitionCacheStats();
+
+    double time = benchRun(applyAll, minTime);
+
+    const StateSystem::TransitionCacheStats& cache = stateSystem.getTransitionCacheStats();
+    printf("  %-10u %10.1f %7.1f%% %10.1f\n", numStates, time * 1e9 / numPairs,
+           100.0 * double(cache.hits) / double(cache.hits + cache.misses), double(cache.bytes) / 1024.0);
+    stateSystem.deinit();
+  }
+}
+
+// loader threads that each generate, set, get and destroy their own states,
+// the throughput should grow with the threads up to the available cores
+void benchStateThreads(bool quick)
+{
+  GLuint numStates = quick ? 256 : 65536;  // per thread
+  GLuint batch     = 64;
+
+  std::vector<StateSystem::State> contents(batch);
+  for(GLuint i = 0; i < batch; i++)
+  {
+    benchVariedState(contents[i], i);
+  }
+
+  printf("state creation, %u states per thread, %u hardware threads\n", numStates, std::thread::hardware_concurrency());
+  printf("  %-10s %12s %12s %10s\n", "threads", "ns/state", "Mstates/s", "speedup");
+
+  double single = 0;
+  for(GLuint numThreads = 1; numThreads <= 8; numThreads *= 2)
+  {
+    StateSystem stateSystem;
+    stateSystem.init();
+
+    std::vector<std::thread> threads;
+    std::atomic<GLuint>      sink(0);  // keeps the gets
+    double                   begin = benchTime();
+    for(GLuint t = 0; t < numThreads; t++)
+    {
+      threads.push_back(std::thread([&]() {
+        StateSystem::StateID ids[64];
+        GLuint               check = 0;
+        for(GLuint i = 0; i < numStates; i += batch)
+        {
+          stateSystem.generate(batch, ids);
+          for(GLuint b = 0; b < batch; b++)
+          {
+            stateSystem.set(ids[b], contents[b], GL_TRIANGLES);
+          }
+          for(GLuint b = 0; b < batch; b++)
+          {
+            check += stateSystem.get(ids[b]).program.program;
+          }
+          // keep every other batch, so the chunks keep growing
+          if(i & batch)
+          {
+            stateSystem.destroy(batch, ids);
+          }
+        }
+        sink += check;
+      }));
+    }
+    for(std::thread& thread : threads)
+    {
+      thread.join();
+    }
+    double time = benchTime() - begin;
+
+    double states = double(numStates) * numThreads;
+    if(numThreads == 1)
+    {
+      single = time;
+    }
+    printf("  %-10u %12.1f %12.2f %9.2fx\n", numThreads, time * 1e9 / states, states / time * 1e-6,
+           single * numThreads / time);
+  }
+}
+
+// memory per state and diff throughput of a CompactStore against the same
+// states held as StateSystem ids
+void benchCompactStore(bool quick)
+{
+  double minTime   = quick ? 0.002 : 0.2;
+  GLuint numStates = quick ? 1024 : 16384;
+  GLuint numDiffs  = 4096;
+
+  StateSystem stateSystem;
+  stateSystem.init();
+
+  StateSystem::CompactStore         store;
+  std::vector<StateSystem::StateID> ids(numStates);
+  stateSystem.generate(numStates, ids.data());
+  for(GLuint i = 0; i < numStates; i++)
+  {
+    StateSystem::State state;
+    benchMaterialState(state, i);
+    stateSystem.set(ids[i], state, GL_TRIANGLES);
+    store.add(state, GL_TRIANGLES);
+  }
+
+  std::vector<GLuint> pairs(numDiffs * 2);
+  GLuint              seed = 5;
+  for(GLuint& index : pairs)
+  {
+    seed  = seed * 1664525u + 1013904223u;
+    index = (seed >> 8) % numStates;
+  }
+
+  printf("compact store, %u states\n", numStates);
+  printf("  %-12s %16s %16s\n", "", "StateSystem", "CompactStore");
+  // an id holds two versions of the State and its hashes
+  printf("  %-12s %16.1f %16.1f\n", "bytes/state", double(sizeof(StateSystem::State) * 2),
+         double(store.getBytes()) / double(numStates));
+
+  std::atomic<GLuint> sink(0);  // keeps the costs
+  double              times[2];
+  times[0] = benchRun(
+      [&]() {
+        GLuint cost = 0;
+        for(GLuint i = 0; i < numDiffs; i++)
+        {
+          cost += stateSystem.getTransitionCost(ids[pairs[i * 2]], ids[pairs[i * 2 + 1]]);
+        }
+        sink += cost;
+      },
+      minTime);
+  times[1] = benchRun(
+      [&]() {
+        GLuint cost = 0;
+        for(GLuint i = 0; i < numDiffs; i++)
+        {
+          cost += store.getTransitionCost(pairs[i * 2], pairs[i * 2 + 1]);
+        }
+        sink += cost;
+      },
+      minTime);
+  printf("  %-12s %16.2f %16.2f\n", "Mcosts/s", numDiffs / times[0] * 1e-6, numDiffs / times[1] * 1e-6);
+
+  StateSystem::OpList ops;
+  times[0] = benchRun(
+      [&]() {
+        for(GLuint i = 0; i < numDiffs; i++)
+        {
+          ops.clear();
+          stateSystem.compileTransitionUncached(ops, ids[pairs[i * 2]], ids[pairs[i * 2 + 1]]);
+        }
+      },
+      minTime);
+  times[1] = benchRun(
+      [&]() {
+        for(GLuint i = 0; i < numDiffs; i++)
+        {
+          ops.clear();
+          stateSystem.compileTransition(ops, store, pairs[i * 2], pairs[i * 2 + 1]);
+        }
+      },
+      minTime);
+  printf("  %-12s %16.2f %16.2f\n", "Mcompiles/s", numDiffs / times[0] * 1e-6, numDiffs / times[1] * 1e-6);
+}
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Cost of building, decoding and storing token streams, without replaying
+// them.
+
+#include "benchutil.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+
+// tokens of a random type each, the scan's branches can't predict them
+static void buildMixedStream(NVTokenStream& stream, NVTokenSequence& seq, GLuint numTokens)
+{
+  stream.clear();
+  seq = NVTokenSequence();
+
+  unsigned seed = 1;
+  for(GLuint i = 0; i < numTokens; i++)
+  {
+    seed = seed * 1664525 + 1013904223;
+    switch((seed >> 16) % 8)
+    {
+      case 0:
+        stream.alloc<NVTokenVbo>()->setBuffer(1, 0x200000000ull, 0);
+        break;
+      case 1:
+        stream.alloc<NVTokenIbo>()->setBuffer(2, 0x200000000ull);
+        break;
+      case 2:
+        stream.alloc<NVTokenUbo>()->setBuffer(BenchScene::OBJECTS_UBO, BenchScene::OBJECTS_ADDRESS, 0, 256);
+        break;
+      case 3:
+        stream.alloc<NVTokenDrawElems>()->setParams(36);
+        break;
+      case 4:
+        stream.alloc<NVTokenStencilRef>();
+        break;
+      case 5:
+        stream.alloc<NVTokenBlendColor>();
+        break;
+      case 6:
+        stream.alloc<NVTokenPolygonOffset>();
+        break;
+      case 7:
+        stream.alloc<NVTokenNop>();
+        break;
+    }
+  }
+  seq.offsets.push_back(0);
+  seq.sizes.push_back(GLsizei(stream.size()));
+  seq.states.push_back(1);
+  seq.fbos.push_back(BenchScene::FBO);
+}
+
+// the header lookup table against the linear scan over the headers it
+// replaced, for software and hardware encoded headers
+void benchDecode(bool quick)
+{
+  double minTime = quick ? 0.002 : 0.2;
+
+  const GLuint states[2] = {1, 2};
+  BenchScene   scene;
+  scene.init(8192, 8, false);
+
+  for(int mixed = 0; mixed < 2; mixed++)
+  {
+    if(mixed)
+      printf("header decode of %d tokens of random types\n", int(scene.objects.size() * 5));
+    else
+      printf("header decode of %d objects\n", int(scene.objects.size()));
+
+    for(int hwsupport = 0; hwsupport < 2; hwsupport++)
+    {
+      for(int linear = 1; linear >= 0; linear--)
+      {
+        nvtokenInitInternals(hwsupport != 0, hwsupport != 0, linear != 0);
+
+        NVTokenStream   stream;
+        NVTokenSequence seq;
+        if(mixed)
+          buildMixedStream(stream, seq, GLuint(scene.objects.size() * 5));
+        else
+          scene.build(stream, seq, states);
+
+        int    stats[NVTOKEN_TYPES] = {0};
+        double time = benchRun([&]() { nvtokenGetStats(stream.data(), stream.size(), stats); }, minTime);
+
+        size_t numTokens           = 0;
+        int    once[NVTOKEN_TYPES] = {0};
+        nvtokenGetStats(stream.data(), stream.size(), once);
+        for(int i = 0; i < NVTOKEN_TYPES; i++)
+        {
+          numTokens += once[i];
+        }
+
+        double validate = benchRun(
+            [&]() {
+              nvtokenValidate(stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(),
+                              GLuint(seq.offsets.size()), NULL);
+            },
+            minTime);
+
+        char name[32];
+        snprintf(name, sizeof(name), "%s, %s", hwsupport ? "hw headers" : "sw headers", linear ? "linear" : "table");
+        printf("  %-24s %8.1f Mtokens/s getStats %8.1f Mtokens/s validate\n", name, double(numTokens) / time * 1e-6,
+               double(numTokens) / validate * 1e-6);
+      }
+    }
+  }
+
+  nvtokenInitInternals(false, false);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// the tokens of one object, copied in through nvtokenEnqueue
+template <class QUEUE>
+static void enqueueObject(QUEUE& queue, GLuint i)
+{
+  NVTokenVbo vbo;
+  vbo.setBinding(0);
+  vbo.setBuffer(1 + i % 64, 0x200000000ull + (i % 64) * 0x10000, 0);
+  nvtokenEnqueue(queue, vbo);
+
+  NVTokenIbo ibo;
+  ibo.setType(GL_UNSIGNED_INT);
+  ibo.setBuffer(65 + i % 64, 0x300000000ull + (i % 64) * 0x10000);
+  nvtokenEnqueue(queue, ibo);
+
+  NVTokenUbo ubo;
+  ubo.setBuffer(BenchScene::OBJECTS_UBO, BenchScene::OBJECTS_ADDRESS, 256 * i, 256);
+  ubo.setBinding(BenchScene::UBO_OBJECT, NVTOKEN_STAGE_VERTEX);
+  nvtokenEnqueue(queue, ubo);
+  ubo.setBinding(BenchScene::UBO_OBJECT, NVTOKEN_STAGE_FRAGMENT);
+  nvtokenEnqueue(queue, ubo);
+
+  NVTokenDrawElems draw;
+  draw.setParams(36);
+  draw.setMode(GL_TRIANGLES);
+  nvtokenEnqueue(queue, draw);
+}
+
+// the same tokens constructed in place
+static void allocObject(NVTokenStream& stream, GLuint i)
+{
+  NVTokenVbo* vbo = stream.alloc<NVTokenVbo>();
+  vbo->setBinding(0);
+  vbo->setBuffer(1 + i % 64, 0x200000000ull + (i % 64) * 0x10000, 0);
+
+  NVTokenIbo* ibo = stream.alloc<NVTokenIbo>();
+  ibo->setType(GL_UNSIGNED_INT);
+  ibo->setBuffer(65 + i % 64, 0x300000000ull + (i % 64) * 0x10000);
+
+  NVTokenUbo* ubo = stream.alloc<NVTokenUbo>();
+  ubo->setBuffer(BenchScene::OBJECTS_UBO, BenchScene::OBJECTS_ADDRESS, 256 * i, 256);
+  ubo->setBinding(BenchScene::UBO_OBJECT, NVTOKEN_STAGE_VERTEX);
+  ubo = stream.alloc<NVTokenUbo>();
+  ubo->setBuffer(BenchScene::OBJECTS_UBO, BenchScene::OBJECTS_ADDRESS, 256 * i, 256);
+  ubo->setBinding(BenchScene::UBO_OBJECT, NVTOKEN_STAGE_FRAGMENT);
+
+  NVTokenDrawElems* draw = stream.alloc<NVTokenDrawElems>();
+  draw->setParams(36);
+  draw->setMode(GL_TRIANGLES);
+}
+
+// Every capacity change of the queue is one allocation (and copy). Counted
+// through the capacity, NVTokenStream doesn't allocate through operator new.
+// A fresh queue grows from empty, otherwise it is cleared and reused.
+template <class QUEUE, class FN>
+static void benchEnqueuePath(const char* name, GLuint numObjects, bool fresh, double minTime, FN enqueue)
+{
+  const GLuint tokensPerObject = 5;
+
+  QUEUE  reused;
+  size_t allocations = 0;
+  size_t bytes       = 0;
+  double time        = benchRun(
+      [&]() {
+        QUEUE  created;
+        QUEUE& queue = fresh ? created : reused;
+        queue.clear();
+
+        size_t capacity = queue.capacity();
+        allocations     = 0;
+        for(GLuint i = 0; i < numObjects; i++)
+        {
+          enqueue(queue, i);
+          if(queue.capacity() != capacity)
+          {
+            capacity = queue.capacity();
+            allocations++;
+          }
+        }
+        bytes = queue.size();
+      },
+      minTime);
+
+  double tokens = double(numObjects) * tokensPerObject;
+  printf("  %-32s %8.1f Mtokens/s %6.1f allocations/1M tokens %6.1f MB\n", name, tokens / time * 1e-6,
+         double(allocations) * 1e6 / tokens, double(bytes) / (1024.0 * 1024.0));
+}
+
+void benchEnqueue(bool quick)
+{
+  double minTime    = quick ? 0.002 : 0.2;
+  GLuint numObjects = quick ? 20000 : 200000;
+
+  nvtokenInitInternals(false, false);
+
+  for(int fresh = 1; fresh >= 0; fresh--)
+  {
+    printf("token enqueue of %u tokens, %s\n", numObjects * 5, fresh ? "a new queue per run" : "the queue reused");
+    benchEnqueuePath<std::string>("std::string, nvtokenEnqueue", numObjects, fresh != 0, minTime,
+                                  [](std::string& queue, GLuint i) { enqueueObject(queue, i); });
+    benchEnqueuePath<NVTokenStream>("NVTokenStream, nvtokenEnqueue", numObjects, fresh != 0, minTime,
+                                    [](NVTokenStream& queue, GLuint i) { enqueueObject(queue, i); });
+    benchEnqueuePath<NVTokenStream>("NVTokenStream, alloc", numObjects, fresh != 0, minTime,
+                                    [](NVTokenStream& queue, GLuint i) { allocObject(queue, i); });
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// the sample's token build split over 1..8 threads, including the append
+// of the per-thread streams, one thread builds in place
+void benchBuild(bool quick)
+{
+  double minTime    = quick ? 0.002 : 0.2;
+  size_t numObjects = quick ? 16384 : 262144;
+
+  nvtokenInitInternals(false, false);
+
+  const GLuint states[2] = {1, 2};
+  BenchScene   scene;
+  scene.init(numObjects, 8, false);
+
+  printf("token build of %d objects (random programs)\n", int(numObjects));
+
+  NVTokenStream   stream;
+  NVTokenSequence seq;
+  double          serial = 0;
+  for(size_t numThreads = 1; numThreads <= 8; numThreads *= 2)
+  {
+    double time = benchRun([&]() { scene.buildParallel(stream, seq, states, numThreads); }, minTime);
+    serial      = numThreads == 1 ? time : serial;
+
+    char name[32];
+    snprintf(name, sizeof(name), "%d thread%s", int(numThreads), numThreads == 1 ? "" : "s");
+    printf("  %-24s %8.2f ms %8.1f Mobjects/s %6.2fx\n", name, time * 1e3, double(numObjects) / time * 1e-6, serial / time);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Startup with a token file: NVTokenFile::load maps it and relocates the
+// tokens to the current buffers, against building the stream again. The
+// sample copies the loaded stream, as objects are appended to it later.
+// The file stays in the file cache between runs, the mapping's pages are
+// copied on write by the relocation.
+void benchLoad(bool quick)
+{
+  double       minTime       = quick ? 0.002 : 0.2;
+  size_t       numObjects    = quick ? 16384 : 1024 * 1024;
+  const GLuint numGeometries = 8;
+  const char*  filename      = "nvtoken_bench.nvtk";
+
+  GLuint states[2] = {1, 2};
+  GLuint fbos[1]   = {BenchScene::FBO};
+
+  BenchScene scene;
+  scene.init(numObjects, numGeometries, false);
+
+  std::vector<NVTokenBufferRef> refs;
+  scene.bufferRefs(numGeometries, refs);
+
+  NVTokenObjectTable table;
+  table.buffers    = refs.data();
+  table.numBuffers = GLuint(refs.size());
+  table.states     = states;
+  table.numStates  = 2;
+  table.fbos       = fbos;
+  table.numFbos    = 1;
+
+  for(int bindless = 0; bindless < 2; bindless++)
+  {
+    nvtokenInitInternals(false, bindless != 0);
+
+    NVTokenStream   stream;
+    NVTokenSequence seq;
+    scene.build(stream, seq, states);
+    if(!nvtokenSaveFile(filename, stream.data(), stream.size(), seq, table))
+    {
+      printf("could not write %s\n", filename);
+      return;
+    }
+
+    printf("startup of %d objects (%s), %.1f MB of tokens, %d sequences\n", int(numObjects),
+           bindless ? "bindless" : "bind", double(stream.size()) / (1024.0 * 1024.0), int(seq.offsets.size()));
+
+    double time = benchRun([&]() { scene.build(stream, seq, states); }, minTime);
+    printf("  %-24s %8.2f ms\n", "build", time * 1e3);
+
+    // what a startup does, the pages of a new stream are touched first
+    time = benchRun(
+        [&]() {
+          NVTokenStream created;
+          scene.build(created, seq, states);
+        },
+        minTime);
+    printf("  %-24s %8.2f ms\n", "build, new stream", time * 1e3);
+
+    bool loaded = true;
+    time        = benchRun(
+        [&]() {
+          NVTokenFile file;
+          loaded = file.load(filename, table, seq) && loaded;
+        },
+        minTime);
+    printf("  %-24s %8.2f ms%s\n", "load", time * 1e3, loaded ? "" : " (failed)");
+
+    time = benchRun(
+        [&]() {
+          NVTokenFile file;
+          loaded = file.load(filename, table, seq) && loaded;
+          stream.clear();
+          stream.append(file.data(), file.size());
+        },
+        minTime);
+    printf("  %-24s %8.2f ms%s\n", "load + copy", time * 1e3, loaded ? "" : " (failed)");
+  }
+
+  remove(filename);
+}
@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "glstub.hpp"
+#include "../nvtoken.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+
+using namespace nvtoken;
+
+//////////////////////////////////////////////////////////////////////////
+// timing
+
+inline double benchTime()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// runs fn until minTime passed, returns the seconds per run
+template <class FN>
+double benchRun(FN fn, double minTime)
+{
+  fn();  // warm up
+
+  size_t runs  = 0;
+  double begin = benchTime();
+  double time  = 0;
+  do
+  {
+    fn();
+    runs++;
+    time = benchTime() - begin;
+  } while(time < minTime);
+
+  return time / double(runs);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// a scene like the sample's, objects with their own vbo, ibo and ubo range
+// drawn with one of two states
+
+struct BenchScene
+{
+  static constexpr GLuint UBO_SCENE  = 0;
+  static constexpr GLuint UBO_OBJECT = 1;
+  static constexpr GLuint UBO_STRIDE = 256;
+  static constexpr GLuint FBO        = 1;
+
+  static constexpr GLuint   OBJECTS_UBO     = 100;
+  static constexpr GLuint64 OBJECTS_ADDRESS = 0x100000000ull;
+
+  struct Object
+  {
+    GLuint   vbo;
+    GLuint   ibo;
+    GLuint   numIndices;
+    GLuint   program;  // 0 or 1, also selects the state
+    GLuint64 vboADDR;
+    GLuint64 iboADDR;
+  };
+
+  std::vector<Object> objects;
+
+  // random programs give a sequence per object, coherent ones few sequences
+  void init(size_t numObjects, GLuint numGeometries, bool coherentPrograms, unsigned seed = 1)
+  {
+    objects.resize(numObjects);
+    for(size_t i = 0; i < numObjects; i++)
+    {
+      seed = seed * 1664525 + 1013904223;
+
+      Object& obj    = objects[i];
+      GLuint  geo    = (seed >> 8) % numGeometries;
+      obj.vbo        = 1 + geo * 2;
+      obj.ibo        = 2 + geo * 2;
+      obj.vboADDR    = 0x200000000ull + GLuint64(obj.vbo) * 0x10000;
+      obj.iboADDR    = 0x200000000ull + GLuint64(obj.ibo) * 0x10000;
+      obj.numIndices = 36 * (geo + 1);
+      obj.program    = coherentPrograms ? GLuint(i * 2 >= numObjects) : (seed >> 20) & 1;
+    }
+  }
+
+  void enqueueObject(size_t i, NVTokenStream& stream) const
+  {
+    const Object& obj = objects[i];
+
+    NVTokenVbo* vbo = stream.alloc<NVTokenVbo>();
+    vbo->setBinding(0);
+    vbo->setBuffer(obj.vbo, obj.vboADDR, 0);
+
+    NVTokenIbo* ibo = stream.alloc<NVTokenIbo>();
+    ibo->setType(GL_UNSIGNED_INT);
+    ibo->setBuffer(obj.ibo, obj.iboADDR);
+
+    const NVTokenShaderStage stages[] = {NVTOKEN_STAGE_VERTEX, NVTOKEN_STAGE_FRAGMENT, NVTOKEN_STAGE_GEOMETRY};
+    for(GLuint s = 0; s < (obj.program ? 3u : 2u); s++)
+    {
+      NVTokenUbo* ubo = stream.alloc<NVTokenUbo>();
+      ubo->setBuffer(OBJECTS_UBO, OBJECTS_ADDRESS, GLuint(UBO_STRIDE * i), UBO_STRIDE);
+      ubo->setBinding(UBO_OBJECT, stages[s]);
+    }
+
+    NVTokenDrawElems* draw = stream.alloc<NVTokenDrawElems>();
+    draw->setParams(obj.numIndices);
+    draw->setMode(GL_TRIANGLES);
+  }
+
+  // the buffers the tokens refer to, for a file's object table
+  void bufferRefs(GLuint numGeometries, std::vector<NVTokenBufferRef>& refs) const
+  {
+    refs.clear();
+    for(GLuint name = 1; name <= numGeometries * 2; name++)
+    {
+      NVTokenBufferRef ref;
+      ref.buffer  = name;
+      ref.address = 0x200000000ull + GLuint64(name) * 0x10000;
+      ref.size    = 0x10000;
+      refs.push_back(ref);
+    }
+    NVTokenBufferRef objectsUbo;
+    objectsUbo.buffer  = OBJECTS_UBO;
+    objectsUbo.address = OBJECTS_ADDRESS;
+    objectsUbo.size    = UBO_STRIDE * objects.size();
+    refs.push_back(objectsUbo);
+
+    NVTokenBufferRef sceneUbo;
+    sceneUbo.buffer  = OBJECTS_UBO + 1;
+    sceneUbo.address = OBJECTS_ADDRESS - 0x10000;
+    sceneUbo.size    = UBO_STRIDE;
+    refs.push_back(sceneUbo);
+  }
+
+  // Appends the objects [begin, end) like the sample's buildTokenStream,
+  // the range at 0 binds the scene ubo first. Sequences are cut at program
+  // changes, states[] maps the program to the sequence's state id.
+  void buildRange(size_t begin, size_t end, NVTokenStream& stream, NVTokenSequence& seq, const GLuint states[2]) const
+  {
+    size_t offset = stream.size();
+
+    if(begin == 0)
+    {
+      const NVTokenShaderStage stages[] = {NVTOKEN_STAGE_VERTEX, NVTOKEN_STAGE_GEOMETRY, NVTOKEN_STAGE_FRAGMENT};
+      for(NVTokenShaderStage stage : stages)
+      {
+        NVTokenUbo* ubo = stream.alloc<NVTokenUbo>();
+        ubo->setBuffer(OBJECTS_UBO + 1, OBJECTS_ADDRESS - 0x10000, 0, UBO_STRIDE);
+        ubo->setBinding(UBO_SCENE, stage);
+      }
+    }
+
+    GLuint program = ~0u;
+    for(size_t i = begin; i < end; i++)
+    {
+      if(program != ~0u && objects[i].program != program)
+      {
+        seq.offsets.push_back(offset);
+        seq.sizes.push_back(GLsizei(stream.size() - offset));
+        seq.states.push_back(states[program]);
+        seq.fbos.push_back(FBO);
+        offset = stream.size();
+      }
+      enqueueObject(i, stream);
+      program = objects[i].program;
+    }
+    if(program != ~0u)
+    {
+      seq.offsets.push_back(offset);
+      seq.sizes.push_back(GLsizei(stream.size() - offset));
+      seq.states.push_back(states[program]);
+      seq.fbos.push_back(FBO);
+    }
+  }
+
+  void build(NVTokenStream& stream, NVTokenSequence& seq, const GLuint states[2]) const
+  {
+    stream.clear();
+    seq = NVTokenSequence();
+    buildRange(0, objects.size(), stream, seq, states);
+  }
+
+  // the sample's parallel build: contiguous ranges of objects per thread,
+  // their streams appended in order with the split sequences merged
+  void buildParallel(NVTokenStream& stream, NVTokenSequence& seq, const GLuint states[2], size_t numThreads) const
+  {
+    numThreads = std::min(numThreads, objects.size());
+    if(numThreads <= 1)
+    {
+      build(stream, seq, states);
+      return;
+    }
+
+    std::vector<NVTokenStream>   streams(numThreads);
+    std::vector<NVTokenSequence> sequences(numThreads);
+    std::vector<std::thread>     threads;
+    threads.reserve(numThreads);
+
+    size_t perThread = (objects.size() + numThreads - 1) / numThreads;
+    for(size_t t = 0; t < numThreads; t++)
+    {
+      size_t first = std::min(t * perThread, objects.size());
+      size_t last  = std::min(first + perThread, objects.size());
+      threads.push_back(std::thread([&, first, last, t]() { buildRange(first, last, streams[t], sequences[t], states); }));
+    }
+
+    size_t totalSize = 0;
+    for(size_t t = 0; t < numThreads; t++)
+    {
+      threads[t].join();
+      totalSize += streams[t].size();
+    }
+
+    stream.clear();
+    seq = NVTokenSequence();
+    stream.reserve(totalSize);
+    for(size_t t = 0; t < numThreads; t++)
+    {
+      nvtokenAppendSequences(stream, seq, streams[t], sequences[t], true);
+    }
+  }
+};
+
+// the sample's draw state for either program, with vertex stride for the
+// non-bindless vbo binding
+inline void benchSceneState(StateSystem::State& state, GLuint program)
+{
+  state = StateSystem::State();
+
+  StateSystem::Recorder rec(state, false);
+  rec.bindFramebuffer(GL_FRAMEBUFFER, BenchScene::FBO);
+  rec.enable(GL_DEPTH_TEST);
+  rec.enable(GL_CULL_FACE);
+  rec.enableVertexAttribArray(0);
+  rec.enableVertexAttribArray(1);
+  rec.enableVertexAttribArray(2);
+  rec.vertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
+  rec.vertexAttribFormat(1, 3, GL_SHORT, GL_TRUE, 12);
+  rec.vertexAttribFormat(2, 2, GL_FLOAT, GL_FALSE, 20);
+  rec.vertexAttribBinding(0, 0);
+  rec.vertexAttribBinding(1, 0);
+  rec.vertexAttribBinding(2, 0);
+  rec.useProgram(10 + program);
+  state.vertexformat.bindings[0].stride = 28;
+}
+
+// deterministic states that differ in a few sub-states each, index 0 is
+// the default state
+inline void benchVariedState(StateSystem::State& state, GLuint index)
+{
+  state = StateSystem::State();
+  if(!index)
+    return;
+
+  StateSystem::Recorder rec(state, false);
+  rec.bindFramebuffer(GL_FRAMEBUFFER, 1 + index % 3);
+  rec.useProgram(10 + index % 7);
+  if(index & 1)
+    rec.enable(GL_DEPTH_TEST);
+  if(index & 2)
+    rec.enable(GL_BLEND);
+  if(index & 4)
+    rec.enable(GL_CULL_FACE);
+  if(index % 5 == 0)
+    rec.depthFunc(GL_LEQUAL);
+  if(index % 6 == 0)
+    rec.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  if(index % 9 == 0)
+    rec.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_FALSE);
+  for(GLuint a = 0; a < 1 + index % 4; a++)
+  {
+    rec.enableVertexAttribArray(a);
+    rec.vertexAttribFormat(a, 1 + (index + a) % 4, GL_FLOAT, GL_FALSE, a * 16);
+  }
+  state.vertexformat.bindings[0].stride = 16 * (1 + index % 4);
+}
+
+// material-like states, each distinct through its stencil reference, some
+// with per-viewport depth ranges or per-buffer color masks
+inline void benchMaterialState(StateSystem::State& state, GLuint index)
+{
+  benchVariedState(state, index % 64);
+
+  StateSystem::Recorder rec(state, false);
+  rec.stencilFunc(GL_EQUAL, GLint(index), 0xFF);
+  if(index % 8 == 3)
+    rec.depthRangeIndexed(1 + index % 7, 0.0, 0.5);
+  if(index % 16 == 5)
+    rec.colorMaski(index % 4, GL_FALSE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// tests
+
+extern int g_testFailures;
+
+#define TEST_CHECK(cond)                                                                                               \
+  do                                                                                                                   \
+  {                                                                                                                    \
+    if(!(cond))                                                                                                        \
+    {                                                                                                                  \
+      printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #cond);                                                \
+      g_testFailures++;                                                                                                \
+    }                                                                                                                  \
+  } while(0)
@@ -0,0 +1,835 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "glstub.hpp"
+
+#include <map>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+namespace glstub {
+
+Counters counters;
+
+// indices the non-indexed calls set, as many as the StateSystem uses
+static const GLuint STUB_DRAW_BUFFERS = 8;
+static const GLuint STUB_VIEWPORTS    = 16;
+
+struct Value
+{
+  double v[4];
+};
+typedef std::pair<GLenum, GLuint> Key;
+
+static bool                                                   s_tracing  = false;
+static bool                                                   s_tracking = false;
+static std::vector<std::string>                               s_trace;
+static std::map<Key, Value>                                   s_context;
+static std::vector<uint64_t>                                  s_drawContexts;
+static std::unordered_map<GLuint, std::vector<unsigned char>> s_buffers;
+
+void reset()
+{
+  memset(&counters, 0, sizeof(counters));
+  s_trace.clear();
+  s_context.clear();
+  s_drawContexts.clear();
+  s_buffers.clear();
+}
+
+void setTracking(bool enabled)
+{
+  s_tracking = enabled;
+}
+
+const std::vector<uint64_t>& getDrawContexts()
+{
+  return s_drawContexts;
+}
+
+void setTracing(bool enabled)
+{
+  s_tracing = enabled;
+}
+
+const std::vector<std::string>& getTrace()
+{
+  return s_trace;
+}
+
+const std::vector<unsigned char>& getBufferData(GLuint buffer)
+{
+  return s_buffers[buffer];
+}
+
+#if defined(__GNUC__)
+static void trace(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+#endif
+
+static void trace(const char* fmt, ...)
+{
+  counters.calls++;
+  if(!s_tracing)
+    return;
+
+  char    line[256];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  s_trace.push_back(line);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// tracked context
+
+static void set(GLenum pname, GLuint index, double x, double y = 0, double z = 0, double w = 0)
+{
+  if(!s_tracking)
+    return;
+
+  Value& value = s_context[Key(pname, index)];
+  value.v[0]   = x;
+  value.v[1]   = y;
+  value.v[2]   = z;
+  value.v[3]   = w;
+}
+
+static void setAll(GLenum pname, GLuint count, double x, double y = 0, double z = 0, double w = 0)
+{
+  for(GLuint i = 0; i < count; i++)
+  {
+    set(pname, i, x, y, z, w);
+  }
+}
+
+static Value get(GLenum pname, GLuint index)
+{
+  auto it = s_context.find(Key(pname, index));
+  return it != s_context.end() ? it->second : Value{{0, 0, 0, 0}};
+}
+
+// the draw and read buffers belong to the bound framebuffer, index is the
+// framebuffer and unset buffers have their defaults
+static GLuint boundFramebuffer(GLenum pname)
+{
+  return GLuint(get(pname == GL_READ_BUFFER ? GL_READ_FRAMEBUFFER_BINDING : GL_DRAW_FRAMEBUFFER_BINDING, 0).v[0]);
+}
+
+static bool isFramebufferBuffer(GLenum pname)
+{
+  return pname == GL_READ_BUFFER || (pname >= GL_DRAW_BUFFER0 && pname < GL_DRAW_BUFFER0 + STUB_DRAW_BUFFERS);
+}
+
+static void setFramebufferBuffer(GLenum pname, GLenum buffer)
+{
+  set(pname, boundFramebuffer(pname), buffer);
+}
+
+static Value getValue(GLenum pname, GLuint index)
+{
+  if(!s_tracking || !isFramebufferBuffer(pname))
+    return get(pname, index);
+
+  GLuint fbo = boundFramebuffer(pname);
+  auto   it  = s_context.find(Key(pname, fbo));
+  if(it != s_context.end())
+    return it->second;
+
+  GLenum buffer = GL_NONE;
+  if(pname == GL_READ_BUFFER || pname == GL_DRAW_BUFFER0)
+    buffer = fbo ? GL_COLOR_ATTACHMENT0 : GL_BACK;
+  return Value{{double(buffer), 0, 0, 0}};
+}
+
+static void recordDraw()
+{
+  if(!s_tracking)
+    return;
+
+  // FNV-1a over the keys and values
+  uint64_t hash = 14695981039346656037ull;
+  for(const auto& it : s_context)
+  {
+    unsigned char bytes[sizeof(Key) + sizeof(Value)];
+    memcpy(bytes, &it.first, sizeof(Key));
+    memcpy(bytes + sizeof(Key), &it.second, sizeof(Value));
+    for(unsigned char byte : bytes)
+    {
+      hash = (hash ^ byte) * 1099511628211ull;
+    }
+  }
+  s_drawContexts.push_back(hash);
+}
+
+}  // namespace glstub
+
+using glstub::counters;
+using glstub::set;
+using glstub::setAll;
+using glstub::STUB_DRAW_BUFFERS;
+using glstub::STUB_VIEWPORTS;
+using glstub::trace;
+
+// the arguments are traced with the fewest digits that keep them distinct
+
+#define STUB_BIND() counters.binds++
+#define STUB_DRAW()                                                                                                    \
+  counters.draws++;                                                                                                    \
+  glstub::recordDraw()
+#define STUB_QUERY() counters.queries++
+
+// values the calls set for several indices or faces
+
+static GLuint stubIndices(GLenum cap)
+{
+  switch(cap)
+  {
+    case GL_BLEND:
+      return STUB_DRAW_BUFFERS;
+    case GL_SCISSOR_TEST:
+      return STUB_VIEWPORTS;
+    default:
+      return 1;
+  }
+}
+
+static void stubBlendFunc(GLuint first, GLuint count, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+{
+  for(GLuint i = first; i < first + count; i++)
+  {
+    set(GL_BLEND_SRC_RGB, i, srcRGB);
+    set(GL_BLEND_DST_RGB, i, dstRGB);
+    set(GL_BLEND_SRC_ALPHA, i, srcAlpha);
+    set(GL_BLEND_DST_ALPHA, i, dstAlpha);
+  }
+}
+
+static void stubBlendEquation(GLuint first, GLuint count, GLenum modeRGB, GLenum modeAlpha)
+{
+  for(GLuint i = first; i < first + count; i++)
+  {
+    set(GL_BLEND_EQUATION_RGB, i, modeRGB);
+    set(GL_BLEND_EQUATION_ALPHA, i, modeAlpha);
+  }
+}
+
+static void stubStencilFunc(GLenum face, GLenum func, GLint ref, GLuint mask)
+{
+  if(face != GL_BACK)
+  {
+    set(GL_STENCIL_FUNC, 0, func);
+    set(GL_STENCIL_REF, 0, ref);
+    set(GL_STENCIL_VALUE_MASK, 0, mask);
+  }
+  if(face != GL_FRONT)
+  {
+    set(GL_STENCIL_BACK_FUNC, 0, func);
+    set(GL_STENCIL_BACK_REF, 0, ref);
+    set(GL_STENCIL_BACK_VALUE_MASK, 0, mask);
+  }
+}
+
+static void stubStencilOp(GLenum face, GLenum fail, GLenum zfail, GLenum zpass)
+{
+  if(face != GL_BACK)
+  {
+    set(GL_STENCIL_FAIL, 0, fail);
+    set(GL_STENCIL_PASS_DEPTH_FAIL, 0, zfail);
+    set(GL_STENCIL_PASS_DEPTH_PASS, 0, zpass);
+  }
+  if(face != GL_FRONT)
+  {
+    set(GL_STENCIL_BACK_FAIL, 0, fail);
+    set(GL_STENCIL_BACK_PASS_DEPTH_FAIL, 0, zfail);
+    set(GL_STENCIL_BACK_PASS_DEPTH_PASS, 0, zpass);
+  }
+}
+
+static void stubStencilMask(GLenum face, GLuint mask)
+{
+  if(face != GL_BACK)
+    set(GL_STENCIL_WRITEMASK, 0, mask);
+  if(face != GL_FRONT)
+    set(GL_STENCIL_BACK_WRITEMASK, 0, mask);
+}
+
+static void stubVertexFormat(GLuint index, GLint size, GLenum type, GLboolean normalized, GLboolean integer, GLuint relativeoffset)
+{
+  set(GL_VERTEX_ATTRIB_ARRAY_SIZE, index, size);
+  set(GL_VERTEX_ATTRIB_ARRAY_TYPE, index, type);
+  set(GL_VERTEX_ATTRIB_ARRAY_NORMALIZED, index, normalized);
+  set(GL_VERTEX_ATTRIB_ARRAY_INTEGER, index, integer);
+  set(GL_VERTEX_ATTRIB_RELATIVE_OFFSET, index, relativeoffset);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// queries, vector queries write as many values as GL would
+
+static int stubQueryCount(GLenum pname)
+{
+  switch(pname)
+  {
+    case GL_COLOR_WRITEMASK:
+    case GL_CURRENT_VERTEX_ATTRIB:
+    case GL_VIEWPORT:
+    case GL_SCISSOR_BOX:
+    case GL_BLEND_COLOR:
+      return 4;
+    case GL_DEPTH_RANGE:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+// the tracked values converted like GL would, unsigned values are stored
+// as such and wrap into GLint
+template <class T>
+static void stubQuery(GLenum pname, GLuint index, T* params)
+{
+  STUB_QUERY();
+  glstub::Value value = glstub::getValue(pname, index);
+  for(int i = 0; i < stubQueryCount(pname); i++)
+  {
+    params[i] = T(int64_t(value.v[i]));
+  }
+}
+
+template <>
+void stubQuery(GLenum pname, GLuint index, GLboolean* params)
+{
+  STUB_QUERY();
+  glstub::Value value = glstub::getValue(pname, index);
+  for(int i = 0; i < stubQueryCount(pname); i++)
+  {
+    params[i] = value.v[i] != 0 ? GL_TRUE : GL_FALSE;
+  }
+}
+
+template <>
+void stubQuery(GLenum pname, GLuint index, GLfloat* params)
+{
+  STUB_QUERY();
+  glstub::Value value = glstub::getValue(pname, index);
+  for(int i = 0; i < stubQueryCount(pname); i++)
+  {
+    params[i] = GLfloat(value.v[i]);
+  }
+}
+
+template <>
+void stubQuery(GLenum pname, GLuint index, GLdouble* params)
+{
+  STUB_QUERY();
+  glstub::Value value = glstub::getValue(pname, index);
+  for(int i = 0; i < stubQueryCount(pname); i++)
+  {
+    params[i] = value.v[i];
+  }
+}
+
+extern "C" {
+
+//////////////////////////////////////////////////////////////////////////
+// bindings
+
+void APIENTRY glBindBuffer(GLenum target, GLuint buffer)
+{
+  STUB_BIND();
+  trace("glBindBuffer %x %u", target, buffer);
+  set(target, 0, buffer);
+}
+void APIENTRY glBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+  STUB_BIND();
+  trace("glBindBufferRange %x %u %u %lld %lld", target, index, buffer, (long long)offset, (long long)size);
+  set(target, index, buffer, double(offset), double(size));
+}
+void APIENTRY glBindFramebuffer(GLenum target, GLuint framebuffer)
+{
+  STUB_BIND();
+  trace("glBindFramebuffer %x %u", target, framebuffer);
+  if(target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER)
+    set(GL_DRAW_FRAMEBUFFER_BINDING, 0, framebuffer);
+  if(target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER)
+    set(GL_READ_FRAMEBUFFER_BINDING, 0, framebuffer);
+}
+void APIENTRY glBindVertexBuffer(GLuint bindingindex, GLuint buffer, GLintptr offset, GLsizei stride)
+{
+  STUB_BIND();
+  trace("glBindVertexBuffer %u %u %lld %d", bindingindex, buffer, (long long)offset, stride);
+  set(GL_VERTEX_BINDING_BUFFER, bindingindex, buffer);
+  set(GL_VERTEX_BINDING_OFFSET, bindingindex, double(offset));
+  set(GL_VERTEX_BINDING_STRIDE, bindingindex, stride);
+}
+void APIENTRY glBufferAddressRangeNV(GLenum pname, GLuint index, GLuint64EXT address, GLsizeiptr length)
+{
+  STUB_BIND();
+  trace("glBufferAddressRangeNV %x %u %llx %lld", pname, index, (unsigned long long)address, (long long)length);
+  set(pname, index, double(address >> 32), double(address & 0xFFFFFFFF), double(length));
+}
+void APIENTRY glUseProgram(GLuint program)
+{
+  STUB_BIND();
+  trace("glUseProgram %u", program);
+  set(GL_CURRENT_PROGRAM, 0, program);
+}
+void APIENTRY glNamedBufferSubData(GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data)
+{
+  counters.uploads++;
+  std::vector<unsigned char>& content = glstub::s_buffers[buffer];
+  if(content.size() < size_t(offset + size))
+  {
+    content.resize(size_t(offset + size));
+  }
+  memcpy(content.data() + offset, data, size_t(size));
+  trace("glNamedBufferSubData %u %lld %lld", buffer, (long long)offset, (long long)size);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// draws
+
+void APIENTRY glDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+  STUB_DRAW();
+  trace("glDrawArrays %x %d %d", mode, first, count);
+}
+void APIENTRY glDrawArraysIndirect(GLenum mode, const void* indirect)
+{
+  STUB_DRAW();
+  const GLuint* cmd = (const GLuint*)indirect;
+  trace("glDrawArraysIndirect %x %u %u %u %u", mode, cmd[0], cmd[1], cmd[2], cmd[3]);
+}
+void APIENTRY glDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const void* indices, GLint basevertex)
+{
+  STUB_DRAW();
+  trace("glDrawElementsBaseVertex %x %d %x %zu %d", mode, count, type, (size_t)indices, basevertex);
+}
+void APIENTRY glDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect)
+{
+  STUB_DRAW();
+  const GLuint* cmd = (const GLuint*)indirect;
+  trace("glDrawElementsIndirect %x %x %u %u %u %u %u", mode, type, cmd[0], cmd[1], cmd[2], cmd[3], cmd[4]);
+}
+void APIENTRY glMultiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride)
+{
+  STUB_DRAW();
+  const unsigned char* cmds = (const unsigned char*)indirect;
+  GLsizei              step = stride ? stride : GLsizei(sizeof(GLuint) * 5);
+  std::string          line;
+  char                 cmd[96];
+  for(GLsizei i = 0; i < drawcount && glstub::s_tracing; i++)
+  {
+    const GLuint* w = (const GLuint*)(cmds + step * i);
+    snprintf(cmd, sizeof(cmd), " [%u %u %u %u %u]", w[0], w[1], w[2], w[3], w[4]);
+    line += cmd;
+  }
+  trace("glMultiDrawElementsIndirect %x %x %d%s", mode, type, drawcount, line.c_str());
+}
+
+//////////////////////////////////////////////////////////////////////////
+// state
+
+void APIENTRY glEnable(GLenum cap)
+{
+  trace("glEnable %x", cap);
+  setAll(cap, stubIndices(cap), GL_TRUE);
+}
+void APIENTRY glDisable(GLenum cap)
+{
+  trace("glDisable %x", cap);
+  setAll(cap, stubIndices(cap), GL_FALSE);
+}
+void APIENTRY glEnablei(GLenum target, GLuint index)
+{
+  trace("glEnablei %x %u", target, index);
+  set(target, index, GL_TRUE);
+}
+void APIENTRY glDisablei(GLenum target, GLuint index)
+{
+  trace("glDisablei %x %u", target, index);
+  set(target, index, GL_FALSE);
+}
+void APIENTRY glBlendColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+  trace("glBlendColor %g %g %g %g", red, green, blue, alpha);
+  set(GL_BLEND_COLOR, 0, red, green, blue, alpha);
+}
+void APIENTRY glBlendEquation(GLenum mode)
+{
+  trace("glBlendEquation %x", mode);
+  stubBlendEquation(0, STUB_DRAW_BUFFERS, mode, mode);
+}
+void APIENTRY glBlendEquationSeparate(GLenum modeRGB, GLenum modeAlpha)
+{
+  trace("glBlendEquationSeparate %x %x", modeRGB, modeAlpha);
+  stubBlendEquation(0, STUB_DRAW_BUFFERS, modeRGB, modeAlpha);
+}
+void APIENTRY glBlendEquationSeparatei(GLuint buf, GLenum modeRGB, GLenum modeAlpha)
+{
+  trace("glBlendEquationSeparatei %u %x %x", buf, modeRGB, modeAlpha);
+  stubBlendEquation(buf, 1, modeRGB, modeAlpha);
+}
+void APIENTRY glBlendEquationi(GLuint buf, GLenum mode)
+{
+  trace("glBlendEquationi %u %x", buf, mode);
+  stubBlendEquation(buf, 1, mode, mode);
+}
+void APIENTRY glBlendFunc(GLenum sfactor, GLenum dfactor)
+{
+  trace("glBlendFunc %x %x", sfactor, dfactor);
+  stubBlendFunc(0, STUB_DRAW_BUFFERS, sfactor, dfactor, sfactor, dfactor);
+}
+void APIENTRY glBlendFuncSeparate(GLenum sfactorRGB, GLenum dfactorRGB, GLenum sfactorAlpha, GLenum dfactorAlpha)
+{
+  trace("glBlendFuncSeparate %x %x %x %x", sfactorRGB, dfactorRGB, sfactorAlpha, dfactorAlpha);
+  stubBlendFunc(0, STUB_DRAW_BUFFERS, sfactorRGB, dfactorRGB, sfactorAlpha, dfactorAlpha);
+}
+void APIENTRY glBlendFuncSeparatei(GLuint buf, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+{
+  trace("glBlendFuncSeparatei %u %x %x %x %x", buf, srcRGB, dstRGB, srcAlpha, dstAlpha);
+  stubBlendFunc(buf, 1, srcRGB, dstRGB, srcAlpha, dstAlpha);
+}
+void APIENTRY glBlendFunci(GLuint buf, GLenum src, GLenum dst)
+{
+  trace("glBlendFunci %u %x %x", buf, src, dst);
+  stubBlendFunc(buf, 1, src, dst, src, dst);
+}
+void APIENTRY glColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+{
+  trace("glColorMask %d %d %d %d", red, green, blue, alpha);
+  setAll(GL_COLOR_WRITEMASK, STUB_DRAW_BUFFERS, red, green, blue, alpha);
+}
+void APIENTRY glColorMaski(GLuint index, GLboolean r, GLboolean g, GLboolean b, GLboolean a)
+{
+  trace("glColorMaski %u %d %d %d %d", index, r, g, b, a);
+  set(GL_COLOR_WRITEMASK, index, r, g, b, a);
+}
+void APIENTRY glCullFace(GLenum mode)
+{
+  trace("glCullFace %x", mode);
+  set(GL_CULL_FACE_MODE, 0, mode);
+}
+void APIENTRY glDepthFunc(GLenum func)
+{
+  trace("glDepthFunc %x", func);
+  set(GL_DEPTH_FUNC, 0, func);
+}
+void APIENTRY glDepthMask(GLboolean flag)
+{
+  trace("glDepthMask %d", flag);
+  set(GL_DEPTH_WRITEMASK, 0, flag);
+}
+void APIENTRY glDepthRange(GLclampd near_val, GLclampd far_val)
+{
+  trace("glDepthRange %g %g", near_val, far_val);
+  setAll(GL_DEPTH_RANGE, STUB_VIEWPORTS, near_val, far_val);
+}
+void APIENTRY glDepthRangeArrayv(GLuint first, GLsizei count, const GLdouble* v)
+{
+  trace("glDepthRangeArrayv %u %d %g %g", first, count, v[0], v[1]);
+  for(GLsizei i = 0; i < count; i++)
+  {
+    set(GL_DEPTH_RANGE, first + i, v[i * 2], v[i * 2 + 1]);
+  }
+}
+void APIENTRY glDepthRangeIndexed(GLuint index, GLdouble n, GLdouble f)
+{
+  trace("glDepthRangeIndexed %u %g %g", index, n, f);
+  set(GL_DEPTH_RANGE, index, n, f);
+}
+void APIENTRY glDrawBuffer(GLenum mode)
+{
+  trace("glDrawBuffer %x", mode);
+  for(GLuint i = 0; i < STUB_DRAW_BUFFERS; i++)
+  {
+    glstub::setFramebufferBuffer(GL_DRAW_BUFFER0 + i, i == 0 ? mode : GL_NONE);
+  }
+}
+void APIENTRY glDrawBuffers(GLsizei n, const GLenum* bufs)
+{
+  trace("glDrawBuffers %d %x", n, n ? bufs[0] : 0);
+  for(GLuint i = 0; i < STUB_DRAW_BUFFERS; i++)
+  {
+    glstub::setFramebufferBuffer(GL_DRAW_BUFFER0 + i, GLsizei(i) < n ? bufs[i] : GL_NONE);
+  }
+}
+void APIENTRY glFrontFace(GLenum mode)
+{
+  trace("glFrontFace %x", mode);
+  set(GL_FRONT_FACE, 0, mode);
+}
+void APIENTRY glLineWidth(GLfloat width)
+{
+  trace("glLineWidth %g", width);
+  set(GL_LINE_WIDTH, 0, width);
+}
+void APIENTRY glLogicOp(GLenum opcode)
+{
+  trace("glLogicOp %x", opcode);
+  set(GL_LOGIC_OP_MODE, 0, opcode);
+}
+void APIENTRY glPatchParameteri(GLenum pname, GLint value)
+{
+  trace("glPatchParameteri %x %d", pname, value);
+  set(pname, 0, value);
+}
+void APIENTRY glPointParameterf(GLenum pname, GLfloat param)
+{
+  trace("glPointParameterf %x %g", pname, param);
+  set(pname, 0, param);
+}
+void APIENTRY glPointParameteri(GLenum pname, GLint param)
+{
+  trace("glPointParameteri %x %d", pname, param);
+  set(pname, 0, param);
+}
+void APIENTRY glPointSize(GLfloat size)
+{
+  trace("glPointSize %g", size);
+  set(GL_POINT_SIZE, 0, size);
+}
+void APIENTRY glPolygonMode(GLenum face, GLenum mode)
+{
+  trace("glPolygonMode %x %x", face, mode);
+  set(GL_POLYGON_MODE, 0, mode, mode);
+}
+void APIENTRY glPolygonOffset(GLfloat factor, GLfloat units)
+{
+  trace("glPolygonOffset %g %g", factor, units);
+  set(GL_POLYGON_OFFSET_FACTOR, 0, factor);
+  set(GL_POLYGON_OFFSET_UNITS, 0, units);
+}
+void APIENTRY glPrimitiveRestartIndex(GLuint index)
+{
+  trace("glPrimitiveRestartIndex %u", index);
+  set(GL_PRIMITIVE_RESTART_INDEX, 0, index);
+}
+void APIENTRY glProvokingVertex(GLenum mode)
+{
+  trace("glProvokingVertex %x", mode);
+  set(GL_PROVOKING_VERTEX, 0, mode);
+}
+void APIENTRY glReadBuffer(GLenum mode)
+{
+  trace("glReadBuffer %x", mode);
+  glstub::setFramebufferBuffer(GL_READ_BUFFER, mode);
+}
+void APIENTRY glSampleCoverage(GLfloat value, GLboolean invert)
+{
+  trace("glSampleCoverage %g %d", value, invert);
+  set(GL_SAMPLE_COVERAGE_VALUE, 0, value);
+  set(GL_SAMPLE_COVERAGE_INVERT, 0, invert);
+}
+void APIENTRY glSampleMaski(GLuint maskNumber, GLbitfield mask)
+{
+  trace("glSampleMaski %u %x", maskNumber, mask);
+  set(GL_SAMPLE_MASK_VALUE, maskNumber, mask);
+}
+void APIENTRY glScissor(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+  trace("glScissor %d %d %d %d", x, y, width, height);
+  setAll(GL_SCISSOR_BOX, STUB_VIEWPORTS, x, y, width, height);
+}
+void APIENTRY glStencilFunc(GLenum func, GLint ref, GLuint mask)
+{
+  trace("glStencilFunc %x %d %x", func, ref, mask);
+  stubStencilFunc(GL_FRONT_AND_BACK, func, ref, mask);
+}
+void APIENTRY glStencilFuncSeparate(GLenum face, GLenum func, GLint ref, GLuint mask)
+{
+  trace("glStencilFuncSeparate %x %x %d %x", face, func, ref, mask);
+  stubStencilFunc(face, func, ref, mask);
+}
+void APIENTRY glStencilMask(GLuint mask)
+{
+  trace("glStencilMask %x", mask);
+  stubStencilMask(GL_FRONT_AND_BACK, mask);
+}
+void APIENTRY glStencilMaskSeparate(GLenum face, GLuint mask)
+{
+  trace("glStencilMaskSeparate %x %x", face, mask);
+  stubStencilMask(face, mask);
+}
+void APIENTRY glStencilOp(GLenum fail, GLenum zfail, GLenum zpass)
+{
+  trace("glStencilOp %x %x %x", fail, zfail, zpass);
+  stubStencilOp(GL_FRONT_AND_BACK, fail, zfail, zpass);
+}
+void APIENTRY glStencilOpSeparate(GLenum face, GLenum sfail, GLenum dpfail, GLenum dppass)
+{
+  trace("glStencilOpSeparate %x %x %x %x", face, sfail, dpfail, dppass);
+  stubStencilOp(face, sfail, dpfail, dppass);
+}
+void APIENTRY glViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+  trace("glViewport %d %d %d %d", x, y, width, height);
+  setAll(GL_VIEWPORT, STUB_VIEWPORTS, x, y, width, height);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// vertex attributes
+
+void APIENTRY glEnableVertexAttribArray(GLuint index)
+{
+  trace("glEnableVertexAttribArray %u", index);
+  set(GL_VERTEX_ATTRIB_ARRAY_ENABLED, index, GL_TRUE);
+}
+void APIENTRY glDisableVertexAttribArray(GLuint index)
+{
+  trace("glDisableVertexAttribArray %u", index);
+  set(GL_VERTEX_ATTRIB_ARRAY_ENABLED, index, GL_FALSE);
+}
+void APIENTRY glVertexAttrib4f(GLuint index, GLfloat x, GLfloat y, GLfloat z, GLfloat w)
+{
+  trace("glVertexAttrib4f %u %g %g %g %g", index, x, y, z, w);
+  set(GL_CURRENT_VERTEX_ATTRIB, index, x, y, z, w);
+}
+void APIENTRY glVertexAttrib4fv(GLuint index, const GLfloat* v)
+{
+  trace("glVertexAttrib4fv %u %g %g %g %g", index, v[0], v[1], v[2], v[3]);
+  set(GL_CURRENT_VERTEX_ATTRIB, index, v[0], v[1], v[2], v[3]);
+}
+void APIENTRY glVertexAttribI4i(GLuint index, GLint x, GLint y, GLint z, GLint w)
+{
+  trace("glVertexAttribI4i %u %d %d %d %d", index, x, y, z, w);
+  set(GL_CURRENT_VERTEX_ATTRIB, index, x, y, z, w);
+}
+void APIENTRY glVertexAttribI4iv(GLuint index, const GLint* v)
+{
+  trace("glVertexAttribI4iv %u %d %d %d %d", index, v[0], v[1], v[2], v[3]);
+  set(GL_CURRENT_VERTEX_ATTRIB, index, v[0], v[1], v[2], v[3]);
+}
+void APIENTRY glVertexAttribI4ui(GLuint index, GLuint x, GLuint y, GLuint z, GLuint w)
+{
+  trace("glVertexAttribI4ui %u %u %u %u %u", index, x, y, z, w);
+  set(GL_CURRENT_VERTEX_ATTRIB, index, x, y, z, w);
+}
+void APIENTRY glVertexAttribI4uiv(GLuint index, const GLuint* v)
+{
+  trace("glVertexAttribI4uiv %u %u %u %u %u", index, v[0], v[1], v[2], v[3]);
+  set(GL_CURRENT_VERTEX_ATTRIB, index, v[0], v[1], v[2], v[3]);
+}
+void APIENTRY glVertexAttribBinding(GLuint attribindex, GLuint bindingindex)
+{
+  trace("glVertexAttribBinding %u %u", attribindex, bindingindex);
+  set(GL_VERTEX_ATTRIB_BINDING, attribindex, bindingindex);
+}
+void APIENTRY glVertexAttribFormat(GLuint attribindex, GLint size, GLenum type, GLboolean normalized, GLuint relativeoffset)
+{
+  trace("glVertexAttribFormat %u %d %x %d %u", attribindex, size, type, normalized, relativeoffset);
+  stubVertexFormat(attribindex, size, type, normalized, GL_FALSE, relativeoffset);
+}
+void APIENTRY glVertexAttribIFormat(GLuint attribindex, GLint size, GLenum type, GLuint relativeoffset)
+{
+  trace("glVertexAttribIFormat %u %d %x %u", attribindex, size, type, relativeoffset);
+  stubVertexFormat(attribindex, size, type, GL_FALSE, GL_TRUE, relativeoffset);
+}
+void APIENTRY glVertexBindingDivisor(GLuint bindingindex, GLuint divisor)
+{
+  trace("glVertexBindingDivisor %u %u", bindingindex, divisor);
+  set(GL_VERTEX_BINDING_DIVISOR, bindingindex, divisor);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// queries
+
+void APIENTRY glGetBooleanv(GLenum pname, GLboolean* params)
+{
+  stubQuery(pname, 0, params);
+}
+void APIENTRY glGetBooleani_v(GLenum target, GLuint index, GLboolean* data)
+{
+  stubQuery(target, index, data);
+}
+void APIENTRY glGetFloatv(GLenum pname, GLfloat* params)
+{
+  stubQuery(pname, 0, params);
+}
+void APIENTRY glGetDoublei_v(GLenum target, GLuint index, GLdouble* data)
+{
+  stubQuery(target, index, data);
+}
+void APIENTRY glGetIntegerv(GLenum pname, GLint* params)
+{
+  stubQuery(pname, 0, params);
+}
+void APIENTRY glGetIntegeri_v(GLenum target, GLuint index, GLint* data)
+{
+  stubQuery(target, index, data);
+}
+void APIENTRY glGetVertexAttribiv(GLuint index, GLenum pname, GLint* params)
+{
+  stubQuery(pname, index, params);
+}
+void APIENTRY glGetVertexAttribIiv(GLuint index, GLenum pname, GLint* params)
+{
+  stubQuery(pname, index, params);
+}
+void APIENTRY glGetVertexAttribIuiv(GLuint index, GLenum pname, GLuint* params)
+{
+  stubQuery(pname, index, params);
+}
+void APIENTRY glGetVertexAttribfv(GLuint index, GLenum pname, GLfloat* params)
+{
+  stubQuery(pname, index, params);
+}
+GLboolean APIENTRY glIsEnabled(GLenum cap)
+{
+  GLboolean enabled;
+  stubQuery(cap, 0, &enabled);
+  return enabled;
+}
+GLboolean APIENTRY glIsEnabledi(GLenum target, GLuint index)
+{
+  GLboolean enabled;
+  stubQuery(target, index, &enabled);
+  return enabled;
+}
+
+// distinct headers and stages, like a driver would hand out
+GLuint APIENTRY glGetCommandHeaderNV(GLenum tokenID, GLuint size)
+{
+  STUB_QUERY();
+  return 0xC0DE0000 | (tokenID << 8) | size;
+}
+GLushort APIENTRY glGetStageIndexNV(GLenum shadertype)
+{
+  STUB_QUERY();
+  switch(shadertype)
+  {
+    case GL_VERTEX_SHADER:
+      return 0;
+    case GL_TESS_CONTROL_SHADER:
+      return 1;
+    case GL_TESS_EVALUATION_SHADER:
+      return 2;
+    case GL_GEOMETRY_SHADER:
+      return 3;
+    case GL_FRAGMENT_SHADER:
+      return 4;
+    default:
+      return 0xFFFF;
+  }
+}
+
+}  // extern "C"
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <nvgl/extensions_gl.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Stub GL function table. Defines the GL entry points nvtoken.cpp,
+// statesystem.cpp and shadowstate.cpp call, so the emulation can be
+// measured and tested without a context. Calls only count, and
+// optionally append a line per call to a trace so call streams can be
+// compared. Queries return zeros unless the context is tracked. Must be
+// used from one thread.
+
+namespace glstub {
+
+struct Counters
+{
+  size_t calls;    // everything but queries
+  size_t draws;    // draw calls, a multi-draw counts once
+  size_t binds;    // buffer, vertex buffer, address, fbo and program binds
+  size_t queries;  // glGet* and glIsEnabled*
+  size_t uploads;  // glNamedBufferSubData
+};
+
+extern Counters counters;
+
+void reset();  // counters, trace, context and buffer contents
+
+// when enabled every non-query call is appended to the trace
+void                            setTracing(bool enabled);
+const std::vector<std::string>& getTrace();
+
+// When enabled the calls update a context of values per (pname, index)
+// that the queries return, everything starts out zero except the draw and
+// read buffers of the framebuffers. Every draw then records a hash of the
+// context it sees, so call streams can be compared by their effect.
+void                         setTracking(bool enabled);
+const std::vector<uint64_t>& getDrawContexts();
+
+// contents written by glNamedBufferSubData
+const std::vector<unsigned char>& getBufferData(GLuint buffer);
+
+}  // namespace glstub
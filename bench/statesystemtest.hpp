@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "../statesystem.hpp"
+
+#include <string.h>
+
+// access to StateSystem internals for the tests and benchmarks
+
+struct StateSystemTest
+{
+  enum DiffPath
+  {
+    DIFF_SUBSTATES,  // per sub-state compare with the hashes, used by the transitions
+    DIFF_CONTENTS,   // the changed sub-states found per word, as CompactStore does per block
+  };
+
+  // large enough for a StateSystem::StateDiff
+  struct Diff
+  {
+    GLuint words[32];
+
+    bool operator==(const Diff& other) const { return memcmp(words, other.words, sizeof(words)) == 0; }
+  };
+
+  // ids handed out so far, to reach MAX_STATES without creating them all
+  static void setNumStates(StateSystem& system, GLuint numStates) { system.m_numStates = numStates; }
+
+  static void makeDiff(const StateSystem& system, DiffPath path, Diff& result, StateSystem::StateID to, StateSystem::StateID from)
+  {
+    static_assert(sizeof(StateSystem::StateDiff) <= sizeof(Diff::words), "Diff too small");
+
+    const StateSystem::StateVersion& toVersion   = system.getVersion(to, system.getInternal(to).changeID);
+    const StateSystem::StateVersion& fromVersion = system.getVersion(from, system.getInternal(from).changeID);
+
+    memset(result.words, 0, sizeof(result.words));
+    StateSystem::StateDiff& diff = *(StateSystem::StateDiff*)result.words;
+    switch(path)
+    {
+      case DIFF_SUBSTATES:
+        system.makeDiff(diff, fromVersion, toVersion);
+        break;
+      case DIFF_CONTENTS:
+        system.makeDiff(diff, fromVersion.state, toVersion.state,
+                        StateSystem::getChangedContents(fromVersion.state, toVersion.state), 0);
+        break;
+    }
+  }
+
+  // the transition with every changed sub-state compiled in full, the way
+  // transitions were emitted before the diffs tracked single fields
+  static void compileSubstates(const StateSystem& system, StateSystem::OpList& ops, StateSystem::StateID to, StateSystem::StateID from)
+  {
+    const StateSystem::StateVersion& toVersion   = system.getVersion(to, system.getInternal(to).changeID);
+    const StateSystem::StateVersion& fromVersion = system.getVersion(from, system.getInternal(from).changeID);
+
+    StateSystem::StateDiff diff;
+    system.makeDiff(diff, fromVersion, toVersion);
+    diff.changedClip          = ~0u;
+    diff.changedBlendEnable   = ~0u;
+    diff.changedBlendFunc     = ~0u;
+    diff.changedBlendEquation = ~0u;
+    diff.changedColorMask     = ~0u;
+    diff.changedDepthRange    = ~0u;
+    diff.changedScissorEnable = ~0u;
+    diff.changedFields        = ~0u;
+    system.compileDiff(ops, diff, toVersion.state);
+  }
+};
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// stand-in for nvpro_core's extension loader. The system headers declare
+// the GL functions as prototypes, glstub.cpp defines the ones the emulation
+// sources call. Only the NV_command_list structs are missing from glext.h.
+
+#pragma once
+
+#define GL_GLEXT_PROTOTYPES 1
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <stddef.h>
+
+typedef struct
+{
+  GLuint header;
+  GLuint count;
+  GLuint firstIndex;
+  GLuint baseVertex;
+} DrawElementsCommandNV;
+
+typedef struct
+{
+  GLuint header;
+  GLuint count;
+  GLuint first;
+} DrawArraysCommandNV;
+
+typedef struct
+{
+  GLuint header;
+  GLenum mode;
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLuint baseVertex;
+  GLuint baseInstance;
+} DrawElementsInstancedCommandNV;
+
+typedef struct
+{
+  GLuint header;
+  GLenum mode;
+  GLuint count;
+  GLuint instanceCount;
+  GLuint first;
+  GLuint baseInstance;
+} DrawArraysInstancedCommandNV;
+
+typedef struct
+{
+  GLuint header;
+  GLuint addressLo;
+  GLuint addressHi;
+  GLuint typeSizeInByte;
+} ElementAddressCommandNV;
+
+typedef struct
+{
+  GLuint header;
+  GLuint index;
+  GLuint addressLo;
+  GLuint addressHi;
+} AttributeAddressCommandNV;
+
+typedef struct
+{
+  GLuint   header;
+  GLushort index;
+  GLushort stage;
+  GLuint   addressLo;
+  GLuint   addressHi;
+} UniformAddressCommandNV;
+
+typedef struct
+{
+  GLuint header;
+  float  red;
+  float  green;
+  float  blue;
+  float  alpha;
+} BlendColorCommandNV;
+
+typedef struct
+{
+  GLuint header;
+  GLuint frontStencilRef;
+  GLuint backStencilRef;
+} StencilRefCommandNV;
+
+typedef struct
+{
+  GLuint header;
+  float  lineWidth;
+} LineWidthCommandNV;
+
+typedef struct
+{
+  GLuint header;
+  float  scale;
+  float  bias;
+} PolygonOffsetCommandNV;
+
+typedef struct
+{
+  GLuint header;
+  float  alphaRef;
+} AlphaRefCommandNV;
+
+typedef struct
+{
+  GLuint header;
+  GLuint x;
+  GLuint y;
+  GLuint width;
+  GLuint height;
+} ViewportCommandNV;
+
+typedef struct
+{
+  GLuint header;
+  GLuint x;
+  GLuint y;
+  GLuint width;
+  GLuint height;
+} ScissorCommandNV;
+
+typedef struct
+{
+  GLuint header;
+  GLuint frontFace;
+} FrontFaceCommandNV;
+
+typedef struct
+{
+  GLuint header;
+} TerminateSequenceCommandNV;
+
+typedef struct
+{
+  GLuint header;
+} NOPCommandNV;
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// stand-in for nvpro_core's platform.h, just what the emulation sources use
+
+#pragma once
+
+#if defined(_MSC_VER)
+#define NV_RESTRICT __restrict
+#define NV_INLINE __forceinline
+#else
+#define NV_RESTRICT __restrict__
+#define NV_INLINE inline
+#endif
+
+#define NV_BUFFER_OFFSET(i) ((char*)NULL + (i))
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// nvtokenSaveFile / NVTokenFile round trip, and damaged files or
+// mismatching buffer tables must be rejected
+
+#include "benchutil.hpp"
+
+static const char* s_filename = "nvtoken_test.nvtk";
+
+static std::vector<unsigned char> readFile(const char* filename)
+{
+  std::vector<unsigned char> content;
+  FILE*                      file = fopen(filename, "rb");
+  if(file)
+  {
+    unsigned char chunk[4096];
+    size_t        read;
+    while((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+      content.insert(content.end(), chunk, chunk + read);
+    }
+    fclose(file);
+  }
+  return content;
+}
+
+static void writeFile(const char* filename, const std::vector<unsigned char>& content)
+{
+  FILE* file = fopen(filename, "wb");
+  if(file)
+  {
+    fwrite(content.data(), 1, content.size(), file);
+    fclose(file);
+  }
+}
+
+static bool loadMatches(const NVTokenObjectTable& table, const NVTokenStream& stream, const NVTokenSequence& seq)
+{
+  NVTokenFile     file;
+  NVTokenSequence loaded;
+  if(!file.load(s_filename, table, loaded))
+    return false;
+
+  return file.size() == stream.size() && memcmp(file.data(), stream.data(), stream.size()) == 0
+         && loaded.offsets == seq.offsets && loaded.sizes == seq.sizes && loaded.states == seq.states && loaded.fbos == seq.fbos;
+}
+
+void testFile()
+{
+  const GLuint numGeometries = 4;
+
+  for(int bindless = 0; bindless < 2; bindless++)
+  {
+    nvtokenInitInternals(false, bindless != 0);
+
+    BenchScene scene;
+    scene.init(64, numGeometries, false);
+
+    GLuint          states[2] = {7, 8};
+    GLuint          fbos[1]   = {BenchScene::FBO};
+    NVTokenStream   stream;
+    NVTokenSequence seq;
+    scene.build(stream, seq, states);
+
+    std::vector<NVTokenBufferRef> refs;
+    scene.bufferRefs(numGeometries, refs);
+
+    NVTokenObjectTable table;
+    table.buffers    = refs.data();
+    table.numBuffers = GLuint(refs.size());
+    table.states     = states;
+    table.numStates  = 2;
+    table.fbos       = fbos;
+    table.numFbos    = 1;
+
+    TEST_CHECK(nvtokenSaveFile(s_filename, stream.data(), stream.size(), seq, table));
+    TEST_CHECK(loadMatches(table, stream, seq));
+
+    // objects now at other names and addresses
+    {
+      std::vector<NVTokenBufferRef> moved = refs;
+      for(NVTokenBufferRef& ref : moved)
+      {
+        ref.buffer += 1000;
+        ref.address += 0x1000000000ull;
+      }
+      NVTokenObjectTable movedTable = table;
+      movedTable.buffers            = moved.data();
+
+      NVTokenFile     file;
+      NVTokenSequence loaded;
+      TEST_CHECK(file.load(s_filename, movedTable, loaded));
+      TEST_CHECK(file.size() == stream.size() && memcmp(file.data(), stream.data(), stream.size()) != 0);
+      TEST_CHECK(nvtokenValidate(file.data(), file.size(), loaded.offsets.data(), loaded.sizes.data(),
+                                 GLuint(loaded.offsets.size()))
+                 == NVTOKEN_VALID);
+    }
+
+    // buffers smaller than the ranges the tokens use
+    {
+      std::vector<NVTokenBufferRef> small = refs;
+      small[numGeometries * 2].size       = BenchScene::UBO_STRIDE * scene.objects.size() / 2;
+      NVTokenObjectTable smallTable       = table;
+      smallTable.buffers                  = small.data();
+      TEST_CHECK(!loadMatches(smallTable, stream, seq));
+    }
+
+    std::vector<unsigned char> original = readFile(s_filename);
+    TEST_CHECK(original.size() > 24);
+
+    // the relocations are the end of the file, the last one is
+    // fieldOffset, bufferOffset, buffer and padding
+    const size_t relocBytes = sizeof(GLuint64) * 2 + sizeof(GLuint) * 2;
+    const size_t lastReloc  = original.size() - relocBytes;
+
+    // a field offset close to the end of the address space
+    {
+      std::vector<unsigned char> damaged     = original;
+      GLuint64                   fieldOffset = ~GLuint64(0) - 2;
+      memcpy(&damaged[lastReloc], &fieldOffset, sizeof(fieldOffset));
+      writeFile(s_filename, damaged);
+      TEST_CHECK(!loadMatches(table, stream, seq));
+    }
+    // a buffer offset past the buffer
+    if(bindless)
+    {
+      std::vector<unsigned char> damaged      = original;
+      GLuint64                   bufferOffset = 0x100000;
+      memcpy(&damaged[lastReloc + sizeof(GLuint64)], &bufferOffset, sizeof(bufferOffset));
+      writeFile(s_filename, damaged);
+      TEST_CHECK(!loadMatches(table, stream, seq));
+    }
+    // a buffer outside of the table
+    {
+      std::vector<unsigned char> damaged = original;
+      GLuint                     buffer  = table.numBuffers;
+      memcpy(&damaged[lastReloc + sizeof(GLuint64) * 2], &buffer, sizeof(buffer));
+      writeFile(s_filename, damaged);
+      TEST_CHECK(!loadMatches(table, stream, seq));
+    }
+    // every truncation
+    for(size_t size = 0; size < original.size(); size += 7)
+    {
+      std::vector<unsigned char> damaged(original.begin(), original.begin() + size);
+      writeFile(s_filename, damaged);
+      TEST_CHECK(!loadMatches(table, stream, seq));
+    }
+
+    remove(s_filename);
+  }
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// nvtoken_test [name...]
+// runs all tests or the named ones, fails if any check did
+
+#include <stdio.h>
+#include <string.h>
+
+int g_testFailures = 0;
+
+void testFile();
+void testMultiDraw();
+void testPipeline();
+void testRecorder();
+void testShadow();
+void testStateSystem();
+void testTokens();
+
+struct Test
+{
+  const char* name;
+  void (*run)();
+};
+
+static const Test s_tests[] = {
+    {"file", testFile},
+    {"multidraw", testMultiDraw},
+    {"pipeline", testPipeline},
+    {"recorder", testRecorder},
+    {"shadow", testShadow},
+    {"statesystem", testStateSystem},
+    {"tokens", testTokens},
+};
+
+int main(int argc, const char** argv)
+{
+  for(const Test& test : s_tests)
+  {
+    bool run = argc == 1;
+    for(int a = 1; a < argc; a++)
+    {
+      run = run || strcmp(argv[a], test.name) == 0;
+    }
+    if(run)
+    {
+      int failures = g_testFailures;
+      test.run();
+      printf("%-24s %s\n", test.name, failures == g_testFailures ? "passed" : "FAILED");
+    }
+  }
+  return g_testFailures ? 1 : 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// the multi-draw emulation swallows the object ubo tokens, every draw type
+// must still see the object that the standard emulation binds for it
+
+#include "benchutil.hpp"
+
+#include <string.h>
+
+struct TracedDraw
+{
+  GLuint count;
+  GLuint object;
+};
+
+// object of a draw is the bound object ubo range plus the draw's
+// baseInstance, the multi-draw programs only use the latter
+static std::vector<TracedDraw> traceDraws(const std::vector<std::string>& trace, bool multi)
+{
+  std::vector<TracedDraw> draws;
+  GLuint                  bound = 0;
+  for(const std::string& line : trace)
+  {
+    const char*        str = line.c_str();
+    unsigned           target, index, buffer, mode, type, w[5];
+    long long          offset, size;
+    unsigned long long address;
+    int                count, first;
+    size_t             indices;
+    if(sscanf(str, "glBindBufferRange %x %u %u %lld %lld", &target, &index, &buffer, &offset, &size) == 5)
+    {
+      if(target == GL_UNIFORM_BUFFER && index == BenchScene::UBO_OBJECT)
+        bound = GLuint(offset / BenchScene::UBO_STRIDE);
+    }
+    else if(sscanf(str, "glBufferAddressRangeNV %x %u %llx %lld", &target, &index, &address, &size) == 4)
+    {
+      if(target == GL_UNIFORM_BUFFER_ADDRESS_NV && index == BenchScene::UBO_OBJECT)
+        bound = GLuint((address - BenchScene::OBJECTS_ADDRESS) / BenchScene::UBO_STRIDE);
+    }
+    else if(sscanf(str, "glDrawElementsBaseVertex %x %d %x %zu %d", &mode, &count, &type, &indices, &first) == 5)
+    {
+      draws.push_back({GLuint(count), multi ? 0 : bound});
+    }
+    else if(sscanf(str, "glDrawArrays %x %d %d", &mode, &first, &count) == 3)
+    {
+      draws.push_back({GLuint(count), multi ? 0 : bound});
+    }
+    else if(sscanf(str, "glDrawElementsIndirect %x %x %u %u %u %u %u", &mode, &type, &w[0], &w[1], &w[2], &w[3], &w[4]) == 7)
+    {
+      draws.push_back({w[0], (multi ? 0 : bound) + w[4]});
+    }
+    else if(sscanf(str, "glDrawArraysIndirect %x %u %u %u %u", &mode, &w[0], &w[1], &w[2], &w[3]) == 5)
+    {
+      draws.push_back({w[0], (multi ? 0 : bound) + w[3]});
+    }
+    else if(sscanf(str, "glMultiDrawElementsIndirect %x %x %d", &mode, &type, &count) == 3)
+    {
+      const char* cmd = strchr(str, '[');
+      for(int i = 0; i < count && cmd; i++)
+      {
+        sscanf(cmd, "[%u %u %u %u %u]", &w[0], &w[1], &w[2], &w[3], &w[4]);
+        draws.push_back({w[0], (multi ? 0 : bound) + w[4]});
+        cmd = strchr(cmd + 1, '[');
+      }
+    }
+  }
+  return draws;
+}
+
+static void testMixedDraws(bool bindless)
+{
+  nvtokenInitInternals(false, bindless);
+
+  StateSystem stateSystem;
+  stateSystem.init();
+  StateSystem::StateID state;
+  stateSystem.generate(1, &state);
+  StateSystem::State content;
+  benchSceneState(content, 0);
+  stateSystem.set(state, content, GL_TRIANGLES);
+
+  NVTokenStream stream;
+  NVTokenVbo*   vbo = stream.alloc<NVTokenVbo>();
+  vbo->setBinding(0);
+  vbo->setBuffer(1, 0x200010000ull, 0);
+  NVTokenIbo* ibo = stream.alloc<NVTokenIbo>();
+  ibo->setType(GL_UNSIGNED_INT);
+  ibo->setBuffer(2, 0x200020000ull);
+
+  // runs of DrawElements interleaved with every other draw type, the
+  // counts identify the draws in the trace
+  const GLuint numDraws = 36;
+  for(GLuint i = 0; i < numDraws; i++)
+  {
+    GLuint object = 1 + (i * 7) % 23;
+    for(NVTokenShaderStage stage : {NVTOKEN_STAGE_VERTEX, NVTOKEN_STAGE_FRAGMENT})
+    {
+      NVTokenUbo* ubo = stream.alloc<NVTokenUbo>();
+      ubo->setBuffer(BenchScene::OBJECTS_UBO, BenchScene::OBJECTS_ADDRESS, BenchScene::UBO_STRIDE * object, BenchScene::UBO_STRIDE);
+      ubo->setBinding(BenchScene::UBO_OBJECT, stage);
+    }
+
+    GLuint count = 3 * (i + 1);
+    switch(i % 9)
+    {
+      case 0:
+      case 1:
+      case 2:
+      {
+        NVTokenDrawElems* draw = stream.alloc<NVTokenDrawElems>();
+        draw->setParams(count);
+        draw->setMode(GL_TRIANGLES);
+      }
+      break;
+      case 3:
+      {
+        NVTokenDrawArrays* draw = stream.alloc<NVTokenDrawArrays>();
+        draw->setParams(count);
+        draw->setMode(GL_TRIANGLES);
+      }
+      break;
+      case 4:
+      {
+        NVTokenDrawElemsStrip* draw = stream.alloc<NVTokenDrawElemsStrip>();
+        draw->setParams(count);
+      }
+      break;
+      case 5:
+      {
+        NVTokenDrawArraysStrip* draw = stream.alloc<NVTokenDrawArraysStrip>();
+        draw->setParams(count);
+      }
+      break;
+      case 6:
+      {
+        NVTokenDrawElemsInstanced* draw = stream.alloc<NVTokenDrawElemsInstanced>();
+        draw->setParams(count);
+        draw->setMode(GL_TRIANGLES);
+        draw->setInstances(2);
+      }
+      break;
+      case 7:
+      {
+        NVTokenDrawArraysInstanced* draw = stream.alloc<NVTokenDrawArraysInstanced>();
+        draw->setParams(count);
+        draw->setMode(GL_TRIANGLES);
+        draw->setInstances(2, 1);
+      }
+      break;
+      case 8:
+      {
+        // DrawElements directly after an unbatched draw
+        NVTokenDrawElems* draw = stream.alloc<NVTokenDrawElems>();
+        draw->setParams(count);
+        draw->setMode(GL_TRIANGLES);
+      }
+      break;
+    }
+  }
+
+  GLintptr offset = 0;
+  GLsizei  size   = GLsizei(stream.size());
+  GLuint   fbo    = BenchScene::FBO;
+
+  glstub::setTracing(true);
+  glstub::reset();
+  nvtokenDrawCommandsStatesSW(stream.data(), stream.size(), &offset, &size, &state, &fbo, 1, stateSystem);
+  std::vector<TracedDraw> reference = traceDraws(glstub::getTrace(), false);
+
+  NVTokenMultiDraw multi;
+  multi.uboIndex   = BenchScene::UBO_OBJECT;
+  multi.uboStride  = BenchScene::UBO_STRIDE;
+  multi.uboBuffer  = BenchScene::OBJECTS_UBO;
+  multi.uboAddress = BenchScene::OBJECTS_ADDRESS;
+
+  // fresh state id, so the emulation applies the full state again
+  StateSystem::StateID stateMulti;
+  stateSystem.generate(1, &stateMulti);
+  stateSystem.set(stateMulti, content, GL_TRIANGLES);
+
+  glstub::reset();
+  nvtokenDrawCommandsStatesMultiSW(stream.data(), stream.size(), &offset, &size, &stateMulti, &fbo, 1, stateSystem, multi);
+  std::vector<TracedDraw> multiDraws = traceDraws(glstub::getTrace(), true);
+  glstub::setTracing(false);
+
+  TEST_CHECK(reference.size() == numDraws);
+  TEST_CHECK(multiDraws.size() == reference.size());
+  for(size_t i = 0; i < reference.size() && i < multiDraws.size(); i++)
+  {
+    TEST_CHECK(reference[i].count == multiDraws[i].count);
+    TEST_CHECK(reference[i].object == multiDraws[i].object);
+  }
+}
+
+void testMultiDraw()
+{
+  testMixedDraws(false);
+  testMixedDraws(true);
+}
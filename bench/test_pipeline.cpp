@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// NVTokenPipeline::runTasks runs every task once, whatever the worker
+// count, and the pipelined emulation still works in between. The pipelined
+// emulation issues the calls of the serial one.
+
+#include "benchutil.hpp"
+
+#include <atomic>
+#include <string.h>
+
+static void testTaskCounts()
+{
+  const GLuint workerCounts[] = {0, 1, 3};
+  const GLuint taskCounts[]   = {0, 1, 5, 200};
+
+  NVTokenPipeline pipeline;
+  for(GLuint numWorkers : workerCounts)
+  {
+    pipeline.init(numWorkers);
+    for(GLuint count : taskCounts)
+    {
+      std::vector<std::atomic<GLuint>> runs(count);
+      pipeline.runTasks(count, [&runs](GLuint index) { runs[index]++; });
+
+      bool once = true;
+      for(GLuint i = 0; i < count; i++)
+      {
+        once = once && runs[i].load() == 1;
+      }
+      if(!once)
+      {
+        printf("pipeline %u workers, %u tasks: not run once each\n", numWorkers, count);
+      }
+      TEST_CHECK(once);
+    }
+  }
+  pipeline.deinit();
+}
+
+// segments recorded as tasks match the ones recorded in turn
+static void testSegmentTasks()
+{
+  nvtokenInitInternals(false, false);
+
+  StateSystem stateSystem;
+  stateSystem.init();
+  GLuint states[2];
+  stateSystem.generate(2, states);
+  for(GLuint i = 0; i < 2; i++)
+  {
+    StateSystem::State content;
+    benchSceneState(content, i);
+    stateSystem.set(states[i], content, GL_TRIANGLES);
+  }
+
+  BenchScene      scene;
+  NVTokenStream   stream;
+  NVTokenSequence seq;
+  scene.init(1024, 8, false);
+  scene.build(stream, seq, states);
+
+  const GLuint numSegments = 6;
+  GLuint       count       = GLuint(seq.offsets.size());
+  auto         record      = [&](NVTokenSegmentedList& list, GLuint s) {
+    GLuint begin = count * s / numSegments;
+    GLuint end   = count * (s + 1) / numSegments;
+    nvtokenListDrawCommandsStatesSW(list, s, stream.data(), stream.size(), seq.offsets.data() + begin,
+                                    seq.sizes.data() + begin, seq.states.data() + begin, seq.fbos.data() + begin,
+                                    end - begin, stateSystem);
+  };
+
+  NVTokenSegmentedList serial;
+  nvtokenListSegmentsSW(serial, numSegments);
+  for(GLuint s = 0; s < numSegments; s++)
+  {
+    record(serial, s);
+  }
+
+  NVTokenPipeline pipeline;
+  pipeline.init(3);
+
+  NVTokenEmulationStats before = {0};
+  nvtokenDrawCommandsStatesPipelinedSW(pipeline, stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(),
+                                       seq.states.data(), seq.fbos.data(), count, stateSystem, &before);
+
+  NVTokenSegmentedList tasks;
+  nvtokenListSegmentsSW(tasks, numSegments);
+  pipeline.runTasks(numSegments, [&](GLuint s) { record(tasks, s); });
+
+  bool same = true;
+  for(GLuint s = 0; s < numSegments; s++)
+  {
+    same = same && tasks.segments[s].words == serial.segments[s].words
+           && tasks.segments[s].stats.draws == serial.segments[s].stats.draws;
+  }
+  TEST_CHECK(same);
+
+  NVTokenEmulationStats after = {0};
+  nvtokenDrawCommandsStatesPipelinedSW(pipeline, stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(),
+                                       seq.states.data(), seq.fbos.data(), count, stateSystem, &after);
+  TEST_CHECK(after.draws == before.draws && after.glCalls == before.glCalls && after.draws == scene.objects.size());
+
+  pipeline.deinit();
+  stateSystem.deinit();
+}
+
+struct TracedCalls
+{
+  std::vector<std::string> calls;
+  std::vector<uint64_t>    contexts;
+  NVTokenEmulationStats    stats;
+};
+
+template <class FN>
+static TracedCalls traceCalls(FN draw)
+{
+  TracedCalls traced;
+  glstub::reset();
+  glstub::setTracing(true);
+  glstub::setTracking(true);
+  traced.stats = draw();
+  glstub::setTracing(false);
+  glstub::setTracking(false);
+  traced.calls    = glstub::getTrace();
+  traced.contexts = glstub::getDrawContexts();
+  return traced;
+}
+
+// Streams larger than the ring, as few large sequences that are cut into
+// batches and as many small ones. Every worker count must issue the calls
+// of nvtokenDrawCommandsStatesSW, in order.
+static void testPipelinedTrace(bool bindless, bool coherent)
+{
+  nvtokenInitInternals(false, bindless);
+
+  StateSystem stateSystem;
+  stateSystem.init();
+  GLuint states[2];
+  stateSystem.generate(2, states);
+  for(GLuint i = 0; i < 2; i++)
+  {
+    StateSystem::State content;
+    benchSceneState(content, i);
+    stateSystem.set(states[i], content, GL_TRIANGLES);
+  }
+
+  BenchScene      scene;
+  NVTokenStream   stream;
+  NVTokenSequence seq;
+  scene.init(3000, 5, coherent);
+  scene.build(stream, seq, states);
+  GLuint count = GLuint(seq.offsets.size());
+  TEST_CHECK(stream.size() > 2 * NVTOKEN_PIPELINE_PACKETS * NVTOKEN_PIPELINE_BATCH);
+
+  TracedCalls serial = traceCalls([&]() {
+    NVTokenEmulationStats stats = {0};
+    nvtokenDrawCommandsStatesSW(stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(), seq.states.data(),
+                                seq.fbos.data(), count, stateSystem, &stats);
+    return stats;
+  });
+  TEST_CHECK(serial.stats.draws == scene.objects.size());
+
+  const GLuint    workerCounts[] = {0, 1, 3};
+  NVTokenPipeline pipeline;
+  for(GLuint numWorkers : workerCounts)
+  {
+    pipeline.init(numWorkers);
+    // twice, the second run reuses the packets
+    for(int run = 0; run < 2; run++)
+    {
+      TracedCalls pipelined = traceCalls([&]() {
+        NVTokenEmulationStats stats = {0};
+        nvtokenDrawCommandsStatesPipelinedSW(pipeline, stream.data(), stream.size(), seq.offsets.data(),
+                                             seq.sizes.data(), seq.states.data(), seq.fbos.data(), count, stateSystem,
+                                             &stats);
+        return stats;
+      });
+
+      size_t same = 0;
+      while(same < serial.calls.size() && same < pipelined.calls.size() && serial.calls[same] == pipelined.calls[same])
+      {
+        same++;
+      }
+      bool sameStats = memcmp(&serial.stats, &pipelined.stats, sizeof(NVTokenEmulationStats)) == 0;
+      bool ok        = same == serial.calls.size() && same == pipelined.calls.size()
+                && serial.contexts == pipelined.contexts && sameStats;
+      if(!ok)
+      {
+        printf("pipelined %s %s, %u workers: call %zu of %zu differs (%s)%s\n", bindless ? "bindless" : "bind",
+               coherent ? "coherent" : "random", numWorkers, same, serial.calls.size(),
+               same < pipelined.calls.size() ? pipelined.calls[same].c_str() : "missing", sameStats ? "" : ", stats differ");
+      }
+      TEST_CHECK(ok);
+    }
+  }
+
+  glstub::reset();
+  pipeline.deinit();
+  stateSystem.deinit();
+  nvtokenInitInternals(false, false);
+}
+
+void testPipeline()
+{
+  testTaskCounts();
+  testSegmentTasks();
+  for(int bindless = 0; bindless < 2; bindless++)
+  {
+    testPipelinedTrace(bindless != 0, true);
+    testPipelinedTrace(bindless != 0, false);
+  }
+}
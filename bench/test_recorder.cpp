@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// StateSystem::Recorder must end up with what State::getGL queries after
+// the recorded calls went to the tracked stub context
+
+#include "benchutil.hpp"
+
+#include <functional>
+#include <string.h>
+
+struct RecorderStep
+{
+  const char*                                  name;
+  std::function<void(StateSystem::Recorder&)> record;
+};
+
+// getGL only overwrites what it queries, so it runs on a copy
+static bool recordedMatchesQueried(const StateSystem::State& recorded)
+{
+  StateSystem::State queried = recorded;
+  queried.getGL();
+  return memcmp(&queried, &recorded, sizeof(StateSystem::State)) == 0;
+}
+
+void testRecorder()
+{
+  glstub::reset();
+  glstub::setTracking(true);
+
+  // the context's values when recording starts
+  StateSystem::State state;
+  state.getGL();
+
+  const GLdouble ranges[] = {0.25, 0.5, 0.125, 1.0};
+  const GLenum   buffers[] = {GL_COLOR_ATTACHMENT0, GL_NONE, GL_COLOR_ATTACHMENT2};
+
+  // steps that go through the separate and back to the shared paths
+  const RecorderStep steps[] = {
+      {"enables",
+       [](StateSystem::Recorder& rec) {
+         rec.enable(GL_DEPTH_TEST);
+         rec.enable(GL_CULL_FACE);
+         rec.enable(GL_CLIP_DISTANCE0 + 3);
+         rec.disable(GL_DITHER);
+       }},
+      {"indexed blend enable", [](StateSystem::Recorder& rec) { rec.enablei(GL_BLEND, 2); }},
+      {"blend enable", [](StateSystem::Recorder& rec) { rec.enable(GL_BLEND); }},
+      {"indexed blend disable", [](StateSystem::Recorder& rec) { rec.disablei(GL_BLEND, 0); }},
+      {"indexed scissor enables",
+       [](StateSystem::Recorder& rec) {
+         for(GLuint i = 0; i < StateSystem::MAX_VIEWPORTS; i++)
+         {
+           rec.enablei(GL_SCISSOR_TEST, i);
+         }
+       }},
+      {"program", [](StateSystem::Recorder& rec) { rec.useProgram(42); }},
+      {"blend func",
+       [](StateSystem::Recorder& rec) {
+         rec.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+         rec.blendEquation(GL_FUNC_ADD);
+       }},
+      {"indexed blend func",
+       [](StateSystem::Recorder& rec) {
+         rec.blendFuncSeparatei(1, GL_ONE, GL_ZERO, GL_ONE, GL_ONE);
+         rec.blendEquationSeparatei(3, GL_MAX, GL_MIN);
+       }},
+      {"blend func separate",
+       [](StateSystem::Recorder& rec) {
+         rec.blendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE);
+         rec.blendEquationSeparate(GL_FUNC_SUBTRACT, GL_FUNC_ADD);
+       }},
+      {"depth and logic",
+       [](StateSystem::Recorder& rec) {
+         rec.depthFunc(GL_LEQUAL);
+         rec.logicOp(GL_XOR);
+       }},
+      {"stencil",
+       [](StateSystem::Recorder& rec) {
+         rec.stencilFunc(GL_EQUAL, 3, 0xFF);
+         rec.stencilOp(GL_KEEP, GL_INCR, GL_REPLACE);
+         rec.stencilFuncSeparate(GL_BACK, GL_NOTEQUAL, 1, 0x0F);
+         rec.stencilOpSeparate(GL_FRONT, GL_ZERO, GL_DECR, GL_INVERT);
+       }},
+      {"raster",
+       [](StateSystem::Recorder& rec) {
+         rec.cullFace(GL_FRONT);
+         rec.pointSize(4.5f);
+         rec.pointParameterf(GL_POINT_FADE_THRESHOLD_SIZE, 2.0f);
+         rec.pointParameteri(GL_POINT_SPRITE_COORD_ORIGIN, GL_LOWER_LEFT);
+       }},
+      {"primitive",
+       [](StateSystem::Recorder& rec) {
+         rec.primitiveRestartIndex(0xFFFF);
+         rec.provokingVertex(GL_FIRST_VERTEX_CONVENTION);
+         rec.patchParameteri(GL_PATCH_VERTICES, 4);
+       }},
+      {"sample",
+       [](StateSystem::Recorder& rec) {
+         rec.sampleCoverage(0.5f, GL_TRUE);
+         rec.sampleMaski(0, 0xF0F0F0F0);
+       }},
+      {"depth range", [](StateSystem::Recorder& rec) { rec.depthRange(0.1, 0.9); }},
+      {"indexed depth ranges",
+       [&ranges](StateSystem::Recorder& rec) {
+         rec.depthRangeIndexed(5, 0.0, 0.5);
+         rec.depthRangeArrayv(1, 2, ranges);
+       }},
+      {"masks",
+       [](StateSystem::Recorder& rec) {
+         rec.colorMask(GL_TRUE, GL_FALSE, GL_TRUE, GL_FALSE);
+         rec.colorMaski(6, GL_FALSE, GL_TRUE, GL_FALSE, GL_TRUE);
+         rec.depthMask(GL_FALSE);
+         rec.stencilMask(0xAA);
+         rec.stencilMaskSeparate(GL_BACK, 0x55);
+       }},
+      {"framebuffer", [](StateSystem::Recorder& rec) { rec.bindFramebuffer(GL_FRAMEBUFFER, 7); }},
+      {"draw buffers",
+       [&buffers](StateSystem::Recorder& rec) {
+         rec.drawBuffers(3, buffers);
+         rec.readBuffer(GL_COLOR_ATTACHMENT2);
+       }},
+      {"read framebuffer", [](StateSystem::Recorder& rec) { rec.bindFramebuffer(GL_READ_FRAMEBUFFER, 0); }},
+      {"vertex format",
+       [](StateSystem::Recorder& rec) {
+         rec.enableVertexAttribArray(0);
+         rec.enableVertexAttribArray(3);
+         rec.vertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
+         rec.vertexAttribFormat(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, 12);
+         rec.vertexAttribIFormat(3, 2, GL_INT, 16);
+         rec.vertexAttribBinding(3, 2);
+         rec.vertexBindingDivisor(2, 1);
+         rec.bindVertexBuffer(2, 5, 64, 24);
+         rec.disableVertexAttribArray(0);
+       }},
+      {"vertex immediates",
+       [](StateSystem::Recorder& rec) {
+         rec.vertexAttrib4f(4, 1.0f, 0.5f, -2.0f, 8.0f);
+         rec.vertexAttribI4i(5, -1, 2, -3, 4);
+       }},
+  };
+
+  StateSystem::Recorder rec(state);
+  for(const RecorderStep& step : steps)
+  {
+    step.record(rec);
+    if(!recordedMatchesQueried(state))
+    {
+      printf("recorder %s: differs from getGL\n", step.name);
+      g_testFailures++;
+    }
+  }
+
+  glstub::setTracking(false);
+  glstub::reset();
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// the emulation through a ShadowState must leave the same context at every
+// draw as without, and only count the calls it issued as glCalls, the ones
+// the shadow skipped as filteredCalls
+
+#include "benchutil.hpp"
+#include "../shadowstate.hpp"
+
+#include <string.h>
+
+enum EmulationMode
+{
+  EMULATION_STANDARD,
+  EMULATION_MULTIDRAW,
+  EMULATION_SEGMENTED,
+  EMULATION_PIPELINED,
+  EMULATION_PIPELINED_WORKERS,
+  EMULATION_MODES,
+};
+
+static const char* s_modeNames[EMULATION_MODES] = {"standard", "multidraw", "segmented", "pipelined", "pipelined workers"};
+
+struct ShadowScene
+{
+  StateSystem      stateSystem;
+  GLuint           states[2];
+  NVTokenStream    stream;
+  NVTokenSequence  seq;
+  NVTokenMultiDraw multi;
+  NVTokenPipeline  pipeline;
+
+  void init(bool bindless)
+  {
+    nvtokenInitInternals(false, bindless);
+
+    stateSystem.init();
+    stateSystem.generate(2, states);
+    for(GLuint i = 0; i < 2; i++)
+    {
+      StateSystem::State content;
+      benchSceneState(content, i);
+      stateSystem.set(states[i], content, GL_TRIANGLES);
+    }
+
+    // few geometries, so neighbouring objects often bind the same buffers
+    BenchScene scene;
+    scene.init(256, 3, false);
+    scene.build(stream, seq, states);
+
+    multi.uboIndex   = BenchScene::UBO_OBJECT;
+    multi.uboStride  = BenchScene::UBO_STRIDE;
+    multi.uboBuffer  = BenchScene::OBJECTS_UBO;
+    multi.uboAddress = BenchScene::OBJECTS_ADDRESS;
+  }
+
+  void deinit()
+  {
+    pipeline.deinit();
+    stateSystem.deinit();
+  }
+
+  NVTokenEmulationStats draw(EmulationMode mode)
+  {
+    NVTokenEmulationStats stats = {0};
+    GLuint                count = GLuint(seq.offsets.size());
+    switch(mode)
+    {
+      case EMULATION_STANDARD:
+        nvtokenDrawCommandsStatesSW(stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(), seq.states.data(),
+                                    seq.fbos.data(), count, stateSystem, &stats);
+        break;
+      case EMULATION_MULTIDRAW:
+        nvtokenDrawCommandsStatesMultiSW(stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(),
+                                         seq.states.data(), seq.fbos.data(), count, stateSystem, multi, &stats);
+        break;
+      case EMULATION_SEGMENTED:
+      {
+        NVTokenSegmentedList list;
+        nvtokenListSegmentsSW(list, 2);
+        GLuint half = count / 2;
+        nvtokenListDrawCommandsStatesSW(list, 0, stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(),
+                                        seq.states.data(), seq.fbos.data(), half, stateSystem);
+        nvtokenListDrawCommandsStatesSW(list, 1, stream.data(), stream.size(), seq.offsets.data() + half,
+                                        seq.sizes.data() + half, seq.states.data() + half, seq.fbos.data() + half,
+                                        count - half, stateSystem);
+        nvtokenDrawSegmentedSW(list, &stats);
+      }
+      break;
+      case EMULATION_PIPELINED:
+      case EMULATION_PIPELINED_WORKERS:
+        pipeline.init(mode == EMULATION_PIPELINED_WORKERS ? 2 : 0);
+        nvtokenDrawCommandsStatesPipelinedSW(pipeline, stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(),
+                                             seq.states.data(), seq.fbos.data(), count, stateSystem, &stats);
+        break;
+      default:
+        break;
+    }
+    return stats;
+  }
+};
+
+static void testFilteredCounts(bool bindless)
+{
+  ShadowScene scene;
+  scene.init(bindless);
+
+  ShadowState shadow;
+  for(int m = 0; m < EMULATION_MODES; m++)
+  {
+    EmulationMode mode = EmulationMode(m);
+
+    glstub::reset();
+    NVTokenEmulationStats unfiltered = scene.draw(mode);
+    size_t                allCalls   = glstub::counters.calls;
+
+    // like the sample, the StateSystem shares the shadow
+    glstub::reset();
+    shadow.invalidate();
+    shadow.resetStats();
+    nvtokenSetShadowState(&shadow);
+    scene.stateSystem.setShadowState(&shadow);
+    NVTokenEmulationStats filtered = scene.draw(mode);
+    nvtokenSetShadowState(NULL);
+    scene.stateSystem.setShadowState(NULL);
+
+    // the shadow also filters state changes, which are not part of glCalls
+    bool ok = unfiltered.filteredCalls == 0 && filtered.filteredCalls > 0
+              && filtered.glCalls + filtered.filteredCalls == unfiltered.glCalls
+              && filtered.filteredCalls <= shadow.getStats().filtered
+              && allCalls - glstub::counters.calls == shadow.getStats().filtered;
+    if(!ok)
+    {
+      printf("shadow %s %s: %zu + %zu filtered calls, %zu unfiltered\n", s_modeNames[m], bindless ? "bindless" : "bind",
+             filtered.glCalls, filtered.filteredCalls, unfiltered.glCalls);
+    }
+    TEST_CHECK(ok);
+  }
+
+  scene.deinit();
+}
+
+struct DrawStream
+{
+  std::vector<std::string> draws;
+  std::vector<uint64_t>    contexts;
+};
+
+static DrawStream traceDraws(ShadowScene& scene, EmulationMode mode, ShadowState* shadow)
+{
+  glstub::reset();
+  if(shadow)
+  {
+    shadow->invalidate();
+  }
+  nvtokenSetShadowState(shadow);
+  scene.stateSystem.setShadowState(shadow);
+  scene.draw(mode);
+  nvtokenSetShadowState(NULL);
+  scene.stateSystem.setShadowState(NULL);
+
+  DrawStream stream;
+  for(const std::string& line : glstub::getTrace())
+  {
+    if(strncmp(line.c_str(), "glDrawArrays", 12) == 0 || strncmp(line.c_str(), "glDrawElements", 14) == 0
+       || strncmp(line.c_str(), "glMultiDraw", 11) == 0)
+    {
+      stream.draws.push_back(line);
+    }
+  }
+  stream.contexts = glstub::getDrawContexts();
+  return stream;
+}
+
+static void testFilteredContexts(bool bindless)
+{
+  ShadowScene scene;
+  scene.init(bindless);
+
+  glstub::setTracing(true);
+  glstub::setTracking(true);
+
+  ShadowState shadow;
+  for(int m = 0; m < EMULATION_MODES; m++)
+  {
+    EmulationMode mode       = EmulationMode(m);
+    DrawStream    unfiltered = traceDraws(scene, mode, NULL);
+    DrawStream    filtered   = traceDraws(scene, mode, &shadow);
+
+    size_t same = 0;
+    while(same < unfiltered.contexts.size() && same < filtered.contexts.size()
+          && unfiltered.contexts[same] == filtered.contexts[same] && unfiltered.draws[same] == filtered.draws[same])
+    {
+      same++;
+    }
+    bool ok = !unfiltered.draws.empty() && unfiltered.draws.size() == unfiltered.contexts.size()
+              && filtered.draws.size() == filtered.contexts.size() && same == unfiltered.contexts.size()
+              && same == filtered.contexts.size();
+    if(!ok)
+    {
+      printf("shadow %s %s: draw %zu of %zu differs\n", s_modeNames[m], bindless ? "bindless" : "bind", same,
+             unfiltered.draws.size());
+    }
+    TEST_CHECK(ok);
+  }
+
+  glstub::setTracking(false);
+  glstub::setTracing(false);
+  glstub::reset();
+  scene.deinit();
+}
+
+void testShadow()
+{
+  testFilteredCounts(false);
+  testFilteredCounts(true);
+  testFilteredContexts(false);
+  testFilteredContexts(true);
+}
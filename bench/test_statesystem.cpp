@@ -0,0 +1,669 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// StateSystem content handling, the transition cache and state creation
+// from several threads, GL calls go to the stub
+
+#include "benchutil.hpp"
+#include "statesystemtest.hpp"
+
+#include <algorithm>
+#include <string.h>
+#include <thread>
+
+// states that only differ in their padding bytes are equal
+static void testPadding()
+{
+  StateSystem stateSystem;
+  stateSystem.init();
+
+  StateSystem::State clean;
+  benchSceneState(clean, 0);
+
+  StateSystem::State dirty = clean;
+  memset(dirty.sample._pad, 0xAB, sizeof(dirty.sample._pad));
+  memset(dirty.mask._pad, 0xCD, sizeof(dirty.mask._pad));
+  dirty.depthrange._pad = 0xDEADBEEF;
+  for(GLuint i = 0; i < StateSystem::MAX_VERTEXATTRIBS; i++)
+  {
+    memset(dirty.vertexformat.formats[i]._pad, 0xEF, sizeof(dirty.vertexformat.formats[i]._pad));
+  }
+  dirty._pad = 0x12345678;
+
+  StateSystem::StateID ids[2];
+  stateSystem.generate(2, ids);
+  stateSystem.set(ids[0], clean, GL_TRIANGLES);
+  stateSystem.set(ids[1], dirty, GL_TRIANGLES);
+  TEST_CHECK(stateSystem.isEqual(ids[0], ids[1]));
+
+  StateSystem::StateID a = stateSystem.intern(clean, GL_TRIANGLES);
+  StateSystem::StateID b = stateSystem.intern(dirty, GL_TRIANGLES);
+  TEST_CHECK(a == b);
+  stateSystem.destroy(1, &a);
+  stateSystem.destroy(1, &b);
+
+  // still distinguishes actual content
+  dirty.vertexformat.formats[2].normalized = GL_TRUE;
+  stateSystem.set(ids[1], dirty, GL_TRIANGLES);
+  TEST_CHECK(!stateSystem.isEqual(ids[0], ids[1]));
+
+  stateSystem.destroy(2, ids);
+}
+
+// makeDiff with the sub-states compared and with the changed ones found
+// per word must agree
+class DiffChecker
+{
+public:
+  DiffChecker()
+  {
+    m_system.init();
+    m_system.generate(2, m_ids);
+  }
+
+  bool check(const StateSystem::State& from, const StateSystem::State& to)
+  {
+    m_system.set(m_ids[0], from, GL_TRIANGLES);
+    m_system.set(m_ids[1], to, GL_TRIANGLES);
+
+    StateSystemTest::Diff subStates, contents;
+    StateSystemTest::makeDiff(m_system, StateSystemTest::DIFF_SUBSTATES, subStates, m_ids[1], m_ids[0]);
+    StateSystemTest::makeDiff(m_system, StateSystemTest::DIFF_CONTENTS, contents, m_ids[1], m_ids[0]);
+    m_checks++;
+    return subStates == contents;
+  }
+
+  size_t getChecks() const { return m_checks; }
+
+private:
+  StateSystem          m_system;
+  StateSystem::StateID m_ids[2];
+  size_t               m_checks = 0;
+};
+
+// flipping a word can make numBuffers exceed the array
+static void sanitize(StateSystem::State& state)
+{
+  if(state.fbo.numBuffers > StateSystem::MAX_DRAWBUFFERS)
+    state.fbo.numBuffers = StateSystem::MAX_DRAWBUFFERS;
+}
+
+static void testDiffEquivalence()
+{
+  const size_t numWords = sizeof(StateSystem::State) / sizeof(GLuint);
+  const GLuint patterns[] = {1, 0x80000000, 0xFFFFFFFF};
+
+  DiffChecker checker;
+  bool        equal = true;
+
+  // every single word, under all combinations of the flags that make
+  // makeDiff look at other elements than the changed ones
+  for(GLuint flags = 0; flags < 32; flags++)
+  {
+    StateSystem::State base;
+    benchSceneState(base, 0);
+    base.blend.useSeparate                = flags & 1 ? GL_TRUE : GL_FALSE;
+    base.blend.separateEnable             = flags & 2 ? 0x5 : 0;
+    base.depthrange.useSeparate           = flags & 4 ? GL_TRUE : GL_FALSE;
+    base.scissorenable.separateEnable     = flags & 8 ? 0x3 : 0;
+    base.mask.colormaskUseSeparate        = flags & 16 ? GL_TRUE : GL_FALSE;
+
+    for(size_t w = 0; w < numWords; w++)
+    {
+      for(GLuint pattern : patterns)
+      {
+        StateSystem::State to = base;
+        ((GLuint*)&to)[w] ^= pattern;
+        sanitize(to);
+        equal = equal && checker.check(base, to) && checker.check(to, base);
+      }
+    }
+  }
+
+  // all combinations of changed sub-states, one word within each
+  StateSystem::State base;
+  benchSceneState(base, 1);
+
+  struct Member
+  {
+    size_t offset;
+    size_t size;
+  };
+  std::vector<Member> members;
+#define MEMBER_ADD(member) members.push_back({size_t((const GLubyte*)&base.member - (const GLubyte*)&base), sizeof(base.member)})
+  MEMBER_ADD(enable);
+#if STATESYSTEM_USE_DEPRECATED
+  MEMBER_ADD(enableDepr);
+  MEMBER_ADD(alpha);
+  MEMBER_ADD(rasterDepr);
+#endif
+  MEMBER_ADD(program);
+  MEMBER_ADD(clip);
+  MEMBER_ADD(blend);
+  MEMBER_ADD(depth);
+  MEMBER_ADD(stencil);
+  MEMBER_ADD(logic);
+  MEMBER_ADD(primitive);
+  MEMBER_ADD(sample);
+  MEMBER_ADD(raster);
+  MEMBER_ADD(depthrange);
+  MEMBER_ADD(scissorenable);
+  MEMBER_ADD(mask);
+  MEMBER_ADD(fbo);
+  MEMBER_ADD(vertexenable);
+  MEMBER_ADD(vertexformat);
+  MEMBER_ADD(verteximm);
+#undef MEMBER_ADD
+
+  GLuint seed = 1;
+  for(GLuint combination = 1; combination < (1u << members.size()); combination++)
+  {
+    StateSystem::State to = base;
+    for(size_t m = 0; m < members.size(); m++)
+    {
+      if(combination & (1u << m))
+      {
+        seed        = seed * 1664525u + 1013904223u;
+        size_t word = (members[m].offset + ((seed >> 8) % members[m].size)) / sizeof(GLuint);
+        ((GLuint*)&to)[word] ^= 1 << (seed >> 27);
+      }
+    }
+    sanitize(to);
+    equal = equal && checker.check(base, to);
+  }
+
+  TEST_CHECK(equal);
+  TEST_CHECK(checker.getChecks() > (1u << members.size()));
+}
+
+// the cache stays within its byte budget and evicted entries are reused
+// without affecting what applyGL issues
+static void testTransitionCache()
+{
+  const GLuint numStates = 48;
+  const size_t budget    = 16 * 1024;
+
+  StateSystem stateSystem;
+  stateSystem.init();
+  stateSystem.setTransitionCacheBudget(budget);
+
+  std::vector<StateSystem::StateID> ids(numStates);
+  stateSystem.generate(numStates, ids.data());
+  for(GLuint i = 0; i < numStates; i++)
+  {
+    StateSystem::State state;
+    benchVariedState(state, i);
+    stateSystem.set(ids[i], state, GL_TRIANGLES);
+  }
+
+  glstub::setTracing(true);
+
+  bool                     withinBudget = true;
+  bool                     sameCalls    = true;
+  StateSystem::OpList      uncached;
+  std::vector<std::string> cached;
+  GLuint                   seed = 7;
+  for(GLuint i = 0; i < 20000; i++)
+  {
+    seed                      = seed * 1664525u + 1013904223u;
+    StateSystem::StateID from = ids[(seed >> 8) % numStates];
+    StateSystem::StateID to   = ids[(seed >> 20) % numStates];
+
+    glstub::reset();
+    stateSystem.applyGL(to, from, false);
+    cached = glstub::getTrace();
+
+    glstub::reset();
+    uncached.clear();
+    stateSystem.compileTransitionUncached(uncached, to, from);
+    uncached.execute();
+    sameCalls    = sameCalls && cached == glstub::getTrace();
+    withinBudget = withinBudget && stateSystem.getTransitionCacheStats().bytes <= budget;
+  }
+
+  glstub::setTracing(false);
+  glstub::reset();
+
+  const StateSystem::TransitionCacheStats& stats = stateSystem.getTransitionCacheStats();
+  TEST_CHECK(sameCalls);
+  TEST_CHECK(withinBudget);
+  TEST_CHECK(stats.evictions > 0 && stats.hits > 0);
+  TEST_CHECK(stats.entries == stats.misses - stats.evictions);
+}
+
+// content that identifies the id and how often it was set
+static void taggedState(StateSystem::State& state, StateSystem::StateID id, GLuint round)
+{
+  benchVariedState(state, id % 32);
+  state.program.program                 = id;
+  state.primitive.restartIndex          = round;
+  state.vertexformat.bindings[1].stride = id ^ round;
+}
+
+static bool isTagged(const StateSystem::State& state, StateSystem::StateID id, GLuint round)
+{
+  return state.program.program == id && state.primitive.restartIndex == round && state.vertexformat.bindings[1].stride == (id ^ round);
+}
+
+// loader threads generate, set, intern and destroy states while the render
+// thread keeps compiling transitions between states created up front
+static void testConcurrentStates()
+{
+  const GLuint numThreads = 8;
+  const GLuint numRounds  = 2000;
+  const GLuint numShared  = 4;
+
+  StateSystem stateSystem;
+  stateSystem.init();
+
+  StateSystem::StateID renderIds[2];
+  stateSystem.generate(2, renderIds);
+  for(GLuint i = 0; i < 2; i++)
+  {
+    StateSystem::State state;
+    benchVariedState(state, 5 + i);
+    stateSystem.set(renderIds[i], state, GL_TRIANGLES);
+  }
+  // only the render thread calls GL
+  StateSystem::OpList expected;
+  stateSystem.compileTransitionUncached(expected, renderIds[1], renderIds[0]);
+  glstub::reset();
+  glstub::setTracing(true);
+  expected.execute(true);
+  std::vector<std::string> expectedCalls = glstub::getTrace();
+
+  std::vector<StateSystem::State> shared(numShared);
+  for(GLuint i = 0; i < numShared; i++)
+  {
+    benchVariedState(shared[i], 20 + i);
+  }
+
+  struct Loader
+  {
+    std::vector<StateSystem::StateID> live;
+    std::vector<GLuint>               rounds;
+    StateSystem::StateID              interned[numShared];
+    bool                              ok = true;
+  };
+  std::vector<Loader> loaders(numThreads);
+
+  std::atomic<GLuint> running(numThreads);
+  bool                renderOk = true;
+  std::thread         render([&]() {
+    do
+    {
+      glstub::reset();
+      stateSystem.applyGL(renderIds[1], renderIds[0], true);
+      renderOk = renderOk && glstub::getTrace() == expectedCalls;
+      stateSystem.applyGL(renderIds[0], renderIds[1], true);
+    } while(running.load() > 0);
+  });
+
+  std::vector<std::thread> threads;
+  for(GLuint t = 0; t < numThreads; t++)
+  {
+    threads.push_back(std::thread([&, t]() {
+      Loader& loader = loaders[t];
+      for(GLuint i = 0; i < numShared; i++)
+      {
+        loader.interned[(i + t) % numShared] = stateSystem.intern(shared[(i + t) % numShared], GL_TRIANGLES);
+      }
+
+      GLuint seed = t + 1;
+      for(GLuint r = 0; r < numRounds; r++)
+      {
+        seed       = seed * 1664525u + 1013904223u;
+        GLuint num = 1 + (seed >> 24) % 8;
+
+        StateSystem::StateID ids[8];
+        stateSystem.generate(num, ids);
+        for(GLuint i = 0; i < num; i++)
+        {
+          StateSystem::State state;
+          taggedState(state, ids[i], r);
+          stateSystem.set(ids[i], state, GL_TRIANGLES);
+          loader.live.push_back(ids[i]);
+          loader.rounds.push_back(r);
+        }
+
+        // set some again, then drop the older half now and then
+        for(size_t i = (seed >> 8) % 4; i < loader.live.size(); i += 4)
+        {
+          StateSystem::State state;
+          taggedState(state, loader.live[i], r);
+          stateSystem.set(loader.live[i], state, GL_TRIANGLES);
+          loader.rounds[i] = r;
+        }
+        for(size_t i = 0; i < loader.live.size(); i++)
+        {
+          loader.ok = loader.ok && isTagged(stateSystem.get(loader.live[i]), loader.live[i], loader.rounds[i]);
+        }
+        if(loader.live.size() > 64)
+        {
+          size_t half = loader.live.size() / 2;
+          stateSystem.destroy(GLuint(half), loader.live.data());
+          loader.live.erase(loader.live.begin(), loader.live.begin() + half);
+          loader.rounds.erase(loader.rounds.begin(), loader.rounds.begin() + half);
+        }
+      }
+      running--;
+    }));
+  }
+  for(std::thread& thread : threads)
+  {
+    thread.join();
+  }
+  render.join();
+  glstub::setTracing(false);
+  glstub::reset();
+
+  // live ids are unique, and identical content was interned once
+  std::vector<StateSystem::StateID> all;
+  bool                              loadersOk = true;
+  bool                              sameIntern = true;
+  for(const Loader& loader : loaders)
+  {
+    loadersOk = loadersOk && loader.ok;
+    all.insert(all.end(), loader.live.begin(), loader.live.end());
+    for(GLuint i = 0; i < numShared; i++)
+    {
+      sameIntern = sameIntern && loader.interned[i] == loaders[0].interned[i] && loader.interned[i] != StateSystem::INVALID_ID;
+    }
+  }
+  std::sort(all.begin(), all.end());
+  TEST_CHECK(loadersOk);
+  TEST_CHECK(renderOk);
+  TEST_CHECK(sameIntern);
+  TEST_CHECK(std::adjacent_find(all.begin(), all.end()) == all.end());
+}
+
+// one thread keeps setting an id to either of two contents while another
+// compiles transitions from and to it, every compiled list must match one
+// of the two contents and never a mix of them
+static void testSetWhileCompiling()
+{
+  const GLuint numSets = 20000;
+
+  StateSystem stateSystem;
+  stateSystem.init();
+
+  StateSystem::StateID ids[2];
+  stateSystem.generate(2, ids);
+  StateSystem::StateID prev = ids[0];
+  StateSystem::StateID id   = ids[1];
+
+  StateSystem::State contents[2];
+  benchVariedState(contents[0], 5);
+  benchVariedState(contents[1], 10);
+  StateSystem::State prevContent;
+  benchVariedState(prevContent, 3);
+  stateSystem.set(prev, prevContent, GL_TRIANGLES);
+
+  std::vector<GLuint> expectedTo[2];
+  std::vector<GLuint> expectedFrom[2];
+  std::vector<GLuint> expectedFull[2];
+  for(GLuint c = 0; c < 2; c++)
+  {
+    stateSystem.set(id, contents[c], GL_TRIANGLES);
+    StateSystem::OpList to, from, full;
+    stateSystem.compileTransitionUncached(to, id, prev);
+    stateSystem.compileTransitionUncached(from, prev, id);
+    stateSystem.compileTransitionUncached(full, id, StateSystem::INVALID_ID);
+    expectedTo[c]   = to.words;
+    expectedFrom[c] = from.words;
+    expectedFull[c] = full.words;
+  }
+  TEST_CHECK(expectedTo[0] != expectedTo[1] && expectedFrom[0] != expectedFrom[1]);
+
+  std::atomic<bool> setting(true);
+  std::thread       setter([&]() {
+    for(GLuint i = 0; i < numSets; i++)
+    {
+      stateSystem.set(id, contents[i & 1], GL_TRIANGLES);
+    }
+    setting = false;
+  });
+
+  size_t compiles = 0;
+  size_t torn     = 0;
+  do
+  {
+    StateSystem::OpList to, from, full;
+    stateSystem.compileTransitionUncached(to, id, prev);
+    stateSystem.compileTransitionUncached(from, prev, id);
+    stateSystem.compileTransitionUncached(full, id, StateSystem::INVALID_ID);
+    torn += to.words != expectedTo[0] && to.words != expectedTo[1];
+    torn += from.words != expectedFrom[0] && from.words != expectedFrom[1];
+    torn += full.words != expectedFull[0] && full.words != expectedFull[1];
+    compiles += 3;
+  } while(setting.load());
+  setter.join();
+
+  if(torn)
+  {
+    printf("set while compiling: %zu of %zu compiled lists torn\n", torn, compiles);
+  }
+  TEST_CHECK(torn == 0);
+}
+
+// generate stops at MAX_STATES, ids freed there are handed out again
+static void testStateLimit()
+{
+  StateSystem stateSystem;
+  stateSystem.init();
+  StateSystemTest::setNumStates(stateSystem, StateSystem::MAX_STATES - 2);
+
+  StateSystem::StateID ids[4];
+  stateSystem.generate(4, ids);
+  TEST_CHECK(ids[0] == StateSystem::MAX_STATES - 2 && ids[1] == StateSystem::MAX_STATES - 1);
+  TEST_CHECK(ids[2] == StateSystem::INVALID_ID && ids[3] == StateSystem::INVALID_ID);
+
+  StateSystem::State state;
+  taggedState(state, ids[1], 1);
+  stateSystem.set(ids[1], state, GL_TRIANGLES);
+  TEST_CHECK(isTagged(stateSystem.get(ids[1]), ids[1], 1));
+
+  benchVariedState(state, 3);
+  TEST_CHECK(stateSystem.intern(state, GL_TRIANGLES) == StateSystem::INVALID_ID);
+
+  stateSystem.destroy(1, &ids[0]);
+  StateSystem::StateID again[2];
+  stateSystem.generate(2, again);
+  TEST_CHECK(again[0] == ids[0] && again[1] == StateSystem::INVALID_ID);
+}
+
+// states round-trip through a CompactStore, and comparisons, costs and
+// compiled transitions on the deltas match the StateSystem's, for the
+// default base and for a base that is itself a typical state
+static void testCompactStore()
+{
+  const GLuint numStates = 200;
+
+  StateSystem stateSystem;
+  stateSystem.init();
+
+  // the second half repeats the first, so some pairs are equal
+  std::vector<StateSystem::StateID> ids(numStates);
+  stateSystem.generate(numStates, ids.data());
+  for(GLuint i = 0; i < numStates; i++)
+  {
+    StateSystem::State state;
+    benchMaterialState(state, i % (numStates / 2));
+    stateSystem.set(ids[i], state, i & 1 ? GL_LINES : GL_TRIANGLES);
+  }
+
+  StateSystem::State sceneBase;
+  benchSceneState(sceneBase, 0);
+  const StateSystem::State bases[] = {StateSystem::State(), sceneBase};
+
+  for(const StateSystem::State& base : bases)
+  {
+    StateSystem::CompactStore store(base);
+    for(GLuint i = 0; i < numStates; i++)
+    {
+      StateSystem::CompactStore::Index idx = store.add(stateSystem.get(ids[i]), i & 1 ? GL_LINES : GL_TRIANGLES);
+      TEST_CHECK(idx == i);
+    }
+    TEST_CHECK(store.getNumStates() == numStates);
+    TEST_CHECK(store.getBytes() < numStates * sizeof(StateSystem::State) / 4);
+
+    bool decoded = true;
+    for(GLuint i = 0; i < numStates; i++)
+    {
+      StateSystem::State state;
+      store.decode(i, state);
+      decoded = decoded && memcmp(&state, &stateSystem.get(ids[i]), sizeof(StateSystem::State)) == 0;
+    }
+    TEST_CHECK(decoded);
+
+    bool                sameEqual = true;
+    bool                sameCost  = true;
+    bool                sameOps   = true;
+    size_t              equal     = 0;
+    StateSystem::OpList compact;
+    StateSystem::OpList full;
+    for(GLuint from = 0; from <= numStates; from += 3)
+    {
+      // the last row starts from nothing
+      GLuint               fromIdx = from < numStates ? from : StateSystem::CompactStore::INVALID_INDEX;
+      StateSystem::StateID fromID  = from < numStates ? ids[from] : StateSystem::INVALID_ID;
+      for(GLuint to = 0; to < numStates; to++)
+      {
+        if(fromIdx != StateSystem::CompactStore::INVALID_INDEX)
+        {
+          bool same = store.isEqual(to, fromIdx);
+          sameEqual = sameEqual && same == stateSystem.isEqual(ids[to], fromID);
+          equal += same;
+        }
+        sameCost = sameCost && store.getTransitionCost(to, fromIdx) == stateSystem.getTransitionCost(ids[to], fromID);
+
+        compact.clear();
+        full.clear();
+        stateSystem.compileTransition(compact, store, to, fromIdx);
+        stateSystem.compileTransitionUncached(full, ids[to], fromID);
+        sameOps = sameOps && compact.words == full.words;
+      }
+    }
+    TEST_CHECK(sameEqual);
+    TEST_CHECK(sameCost);
+    TEST_CHECK(sameOps);
+    TEST_CHECK(equal > numStates / 3);
+  }
+}
+
+// the calls of all transitions among material variants of one base
+// state, each differing in a single setting, with every changed sub-state
+// compiled in full against only the changed fields. Both must leave the
+// same context behind.
+static void testMaterialTransitionCalls()
+{
+  const GLuint numVariants = 5;
+
+  StateSystem stateSystem;
+  stateSystem.init();
+
+  GLuint states[numVariants];
+  stateSystem.generate(numVariants, states);
+  for(GLuint v = 0; v < numVariants; v++)
+  {
+    StateSystem::State content;
+    benchSceneState(content, 0);
+
+    StateSystem::Recorder rec(content, false);
+    switch(v)
+    {
+      case 0:
+        rec.enable(GL_BLEND);
+        rec.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        break;
+      case 1:
+        rec.enable(GL_STENCIL_TEST);
+        rec.stencilFunc(GL_EQUAL, 1, 0xFF);
+        break;
+      case 2:
+        rec.depthMask(GL_FALSE);
+        break;
+      case 3:
+        rec.cullFace(GL_FRONT);
+        break;
+      case 4:
+        rec.depthRange(0.0, 0.5);
+        break;
+    }
+    stateSystem.set(states[v], content, GL_TRIANGLES);
+  }
+
+  size_t callsSubstates = 0;
+  size_t callsFields    = 0;
+  bool   sameContext    = true;
+  glstub::setTracking(true);
+  for(GLuint to = 0; to < numVariants; to++)
+  {
+    for(GLuint from = 0; from < numVariants; from++)
+    {
+      if(to == from)
+        continue;
+
+      uint64_t context[2];
+      for(int fields = 0; fields < 2; fields++)
+      {
+        StateSystem::OpList ops;
+        if(fields)
+          stateSystem.compileTransitionUncached(ops, states[to], states[from]);
+        else
+          StateSystemTest::compileSubstates(stateSystem, ops, states[to], states[from]);
+
+        glstub::reset();
+        stateSystem.applyGL(states[from], false);
+        size_t calls = glstub::counters.calls;
+        ops.execute();
+        (fields ? callsFields : callsSubstates) += glstub::counters.calls - calls;
+
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        context[fields] = glstub::getDrawContexts().back();
+      }
+      sameContext = sameContext && context[0] == context[1];
+    }
+  }
+  glstub::setTracking(false);
+  glstub::reset();
+
+  // each transition sets what the two variants changed and nothing else
+  if(callsSubstates != 120 || callsFields != 56)
+  {
+    printf("material transitions: %d GL calls per sub-state, %d per field\n", int(callsSubstates), int(callsFields));
+  }
+  TEST_CHECK(sameContext);
+  TEST_CHECK(callsSubstates == 120);
+  TEST_CHECK(callsFields == 56);
+
+  stateSystem.deinit();
+}
+
+void testStateSystem()
+{
+  testPadding();
+  testDiffEquivalence();
+  testTransitionCache();
+  testConcurrentStates();
+  testSetWhileCompiling();
+  testStateLimit();
+  testCompactStore();
+  testMaterialTransitionCalls();
+}
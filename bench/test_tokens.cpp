@@ -0,0 +1,705 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// token streams on their own: decoding, building and rewriting them must
+// not change what they draw
+
+#include "benchutil.hpp"
+#include "../shadowstate.hpp"
+
+#include <functional>
+#include <string.h>
+
+// the header lookup table decodes like the linear scan, for either header
+// encoding, and both reject the same damaged header
+static void testDecode()
+{
+  const GLuint states[2] = {1, 2};
+  BenchScene   scene;
+  scene.init(512, 8, false);
+
+  for(int hwsupport = 0; hwsupport < 2; hwsupport++)
+  {
+    int                   stats[2][NVTOKEN_TYPES] = {{0}};
+    NVTokenValidateResult damaged[2];
+    size_t                damagedOffset[2];
+    for(int linear = 0; linear < 2; linear++)
+    {
+      TEST_CHECK(nvtokenInitInternals(hwsupport != 0, hwsupport != 0, linear != 0));
+
+      NVTokenStream   stream;
+      NVTokenSequence seq;
+      scene.build(stream, seq, states);
+      nvtokenGetStats(stream.data(), stream.size(), stats[linear]);
+      TEST_CHECK(nvtokenValidate(stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(),
+                                 GLuint(seq.offsets.size()), NULL)
+                 == NVTOKEN_VALID);
+
+      // damage the header of the first object's vbo token
+      std::vector<GLubyte> bytes((const GLubyte*)stream.data(), (const GLubyte*)stream.data() + stream.size());
+      GLuint*              header = (GLuint*)(bytes.data() + 3 * sizeof(NVTokenUbo));
+      *header ^= 0x5A5A0000;
+      damaged[linear] = nvtokenValidate(bytes.data(), bytes.size(), seq.offsets.data(), seq.sizes.data(),
+                                        GLuint(seq.offsets.size()), &damagedOffset[linear]);
+    }
+    TEST_CHECK(memcmp(stats[0], stats[1], sizeof(stats[0])) == 0);
+    TEST_CHECK(stats[0][GL_DRAW_ELEMENTS_COMMAND_NV] == int(scene.objects.size()));
+    TEST_CHECK(damaged[0] == NVTOKEN_INVALID_HEADER && damaged[1] == NVTOKEN_INVALID_HEADER);
+    TEST_CHECK(damagedOffset[0] == 3 * sizeof(NVTokenUbo) && damagedOffset[1] == damagedOffset[0]);
+  }
+
+  nvtokenInitInternals(false, false);
+}
+
+static bool sameSequences(const NVTokenSequence& a, const NVTokenSequence& b)
+{
+  return a.offsets == b.offsets && a.sizes == b.sizes && a.states == b.states && a.fbos == b.fbos;
+}
+
+// the per-thread streams appended in order build what one thread does,
+// also when a sequence spans several threads or threads get no objects
+static void testParallelBuild()
+{
+  nvtokenInitInternals(false, false);
+
+  const GLuint states[2]      = {1, 2};
+  const size_t objectCounts[] = {1000, 7};
+  for(size_t numObjects : objectCounts)
+  {
+    for(int coherent = 0; coherent < 2; coherent++)
+    {
+      BenchScene scene;
+      scene.init(numObjects, 8, coherent != 0);
+
+      NVTokenStream   serialStream;
+      NVTokenSequence serialSeq;
+      scene.build(serialStream, serialSeq, states);
+
+      for(size_t numThreads = 1; numThreads <= 8; numThreads++)
+      {
+        NVTokenStream   stream;
+        NVTokenSequence seq;
+        scene.buildParallel(stream, seq, states, numThreads);
+
+        bool same = stream.size() == serialStream.size()
+                    && memcmp(stream.data(), serialStream.data(), stream.size()) == 0 && sameSequences(seq, serialSeq);
+        if(!same)
+        {
+          printf("parallel build of %d objects (%s) with %d threads differs\n", int(numObjects),
+                 coherent ? "coherent" : "random", int(numThreads));
+        }
+        TEST_CHECK(same);
+      }
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// the draws of a replay and the context every draw saw
+struct TracedDraws
+{
+  std::vector<std::string> draws;
+  std::vector<uint64_t>    contexts;
+
+  bool operator==(const TracedDraws& other) const { return draws == other.draws && contexts == other.contexts; }
+};
+
+template <class FN>
+static TracedDraws traceDraws(FN draw)
+{
+  glstub::reset();
+  glstub::setTracing(true);
+  glstub::setTracking(true);
+  draw();
+  glstub::setTracing(false);
+  glstub::setTracking(false);
+
+  TracedDraws traced;
+  for(const std::string& line : glstub::getTrace())
+  {
+    if(strncmp(line.c_str(), "glDrawArrays", 12) == 0 || strncmp(line.c_str(), "glDrawElements", 14) == 0
+       || strncmp(line.c_str(), "glMultiDraw", 11) == 0)
+    {
+      traced.draws.push_back(line);
+    }
+  }
+  traced.contexts = glstub::getDrawContexts();
+  return traced;
+}
+
+static TracedDraws traceReplay(const NVTokenStream& stream, const NVTokenSequence& seq, StateSystem& stateSystem)
+{
+  return traceDraws([&]() {
+    nvtokenDrawCommandsStatesSW(stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(), seq.states.data(),
+                                seq.fbos.data(), GLuint(seq.offsets.size()), stateSystem, NULL);
+  });
+}
+
+static void initSceneStates(StateSystem& stateSystem, GLuint states[2])
+{
+  stateSystem.init();
+  stateSystem.generate(2, states);
+  for(GLuint i = 0; i < 2; i++)
+  {
+    StateSystem::State content;
+    benchSceneState(content, i);
+    stateSystem.set(states[i], content, GL_TRIANGLES);
+  }
+}
+
+// Some objects are enqueued twice, the copy's bindings are all redundant,
+// and neighbours of a sequence share buffers. The expected savings are
+// counted along: only vbo, ibo and ubo tokens that repeat the previous one
+// of their binding point within the sequence go.
+static void testOptimizeBindings(bool bindless)
+{
+  nvtokenInitInternals(false, bindless);
+
+  StateSystem stateSystem;
+  GLuint      states[2];
+  initSceneStates(stateSystem, states);
+
+  BenchScene scene;
+  scene.init(600, 3, false, 7);
+
+  NVTokenStream   stream;
+  NVTokenSequence seq;
+  size_t          expectedTokens = 0;
+  size_t          expectedBytes  = 0;
+  {
+    // the scene ubo bindings, no sequence yet
+    scene.buildRange(0, 0, stream, seq, states);
+
+    size_t                    offset  = 0;
+    GLuint                    program = ~0u;
+    const BenchScene::Object* prev    = NULL;
+    for(size_t i = 0; i < scene.objects.size(); i++)
+    {
+      const BenchScene::Object& obj = scene.objects[i];
+      if(program != ~0u && obj.program != program)
+      {
+        seq.offsets.push_back(offset);
+        seq.sizes.push_back(GLsizei(stream.size() - offset));
+        seq.states.push_back(states[program]);
+        seq.fbos.push_back(BenchScene::FBO);
+        offset = stream.size();
+        prev   = NULL;
+      }
+      if(prev && prev->vbo == obj.vbo)
+      {
+        expectedTokens++;
+        expectedBytes += sizeof(NVTokenVbo);
+      }
+      if(prev && prev->ibo == obj.ibo)
+      {
+        expectedTokens++;
+        expectedBytes += sizeof(NVTokenIbo);
+      }
+      scene.enqueueObject(i, stream);
+      if(i % 3 == 0)
+      {
+        scene.enqueueObject(i, stream);
+        GLuint numUbos = obj.program ? 3 : 2;
+        expectedTokens += 2 + numUbos;
+        expectedBytes += sizeof(NVTokenVbo) + sizeof(NVTokenIbo) + sizeof(NVTokenUbo) * numUbos;
+      }
+      program = obj.program;
+      prev    = &obj;
+    }
+    seq.offsets.push_back(offset);
+    seq.sizes.push_back(GLsizei(stream.size() - offset));
+    seq.states.push_back(states[program]);
+    seq.fbos.push_back(BenchScene::FBO);
+  }
+
+  TracedDraws before = traceReplay(stream, seq, stateSystem);
+
+  size_t               size = stream.size();
+  NVTokenOptimizeStats stats;
+  nvtokenOptimizeBindings(stream, seq, &stats);
+  TEST_CHECK(stats.tokensRemoved == expectedTokens);
+  TEST_CHECK(stats.bytesRemoved == expectedBytes);
+  TEST_CHECK(stream.size() == size - expectedBytes);
+  TEST_CHECK(nvtokenValidate(stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(),
+                             GLuint(seq.offsets.size()), NULL)
+             == NVTOKEN_VALID);
+
+  TracedDraws after = traceReplay(stream, seq, stateSystem);
+  TEST_CHECK(before.draws.size() == scene.objects.size() + (scene.objects.size() + 2) / 3);
+  TEST_CHECK(after == before);
+
+  // nothing left to remove
+  nvtokenOptimizeBindings(stream, seq, &stats);
+  TEST_CHECK(stats.tokensRemoved == 0 && stats.bytesRemoved == 0);
+
+  glstub::reset();
+  stateSystem.deinit();
+}
+
+// The compiled list replays the draws of the token emulation in the same
+// contexts, also when both go through a ShadowState. Every segment matches
+// a separate nvtokenDrawCommandsStatesSW call over its sequences. Some
+// sequences use the state's fbo, some another one.
+static void testCompiledList(bool bindless, bool shadowed)
+{
+  nvtokenInitInternals(false, bindless);
+
+  StateSystem stateSystem;
+  GLuint      states[2];
+  initSceneStates(stateSystem, states);
+
+  BenchScene      scene;
+  NVTokenStream   stream;
+  NVTokenSequence seq;
+  scene.init(700, 3, false, 5);
+  scene.build(stream, seq, states);
+  for(size_t i = 0; i < seq.fbos.size(); i++)
+  {
+    seq.fbos[i] = i % 3 == 1 ? 0 : i % 3 == 2 ? BenchScene::FBO + 1 : BenchScene::FBO;
+  }
+  GLuint count = GLuint(seq.offsets.size());
+
+  ShadowState  shadow;
+  ShadowState* active = shadowed ? &shadow : NULL;
+  auto         traceShadowed = [&](std::function<void()> draw) {
+    shadow.invalidate();
+    nvtokenSetShadowState(active);
+    stateSystem.setShadowState(active);
+    TracedDraws traced = traceDraws(draw);
+    nvtokenSetShadowState(NULL);
+    stateSystem.setShadowState(NULL);
+    return traced;
+  };
+
+  const GLuint segmentCounts[] = {1, 4};
+  for(GLuint numSegments : segmentCounts)
+  {
+    auto forSegments = [&](std::function<void(GLuint, GLuint, GLuint)> fn) {
+      for(GLuint s = 0; s < numSegments; s++)
+      {
+        fn(s, count * s / numSegments, count * (s + 1) / numSegments);
+      }
+    };
+
+    TracedDraws reference = traceShadowed([&]() {
+      forSegments([&](GLuint, GLuint begin, GLuint end) {
+        nvtokenDrawCommandsStatesSW(stream.data(), stream.size(), seq.offsets.data() + begin, seq.sizes.data() + begin,
+                                    seq.states.data() + begin, seq.fbos.data() + begin, end - begin, stateSystem, NULL);
+      });
+    });
+    TEST_CHECK(reference.draws.size() == scene.objects.size() && reference.contexts.size() == reference.draws.size());
+
+    NVTokenSegmentedList list;
+    nvtokenListSegmentsSW(list, numSegments);
+    forSegments([&](GLuint s, GLuint begin, GLuint end) {
+      nvtokenListDrawCommandsStatesSW(list, s, stream.data(), stream.size(), seq.offsets.data() + begin,
+                                      seq.sizes.data() + begin, seq.states.data() + begin, seq.fbos.data() + begin,
+                                      end - begin, stateSystem);
+    });
+
+    TracedDraws compiled = traceShadowed([&]() { nvtokenDrawSegmentedSW(list, NULL); });
+    if(!(compiled == reference))
+    {
+      size_t same = 0;
+      while(same < compiled.draws.size() && same < reference.draws.size()
+            && compiled.draws[same] == reference.draws[same] && compiled.contexts[same] == reference.contexts[same])
+      {
+        same++;
+      }
+      printf("compiled list %s%s, %u segments: draw %zu of %zu differs\n", bindless ? "bindless" : "bind",
+             shadowed ? " shadowed" : "", numSegments, same, reference.draws.size());
+    }
+    TEST_CHECK(compiled == reference);
+  }
+
+  glstub::reset();
+  stateSystem.deinit();
+  nvtokenInitInternals(false, false);
+}
+
+// the tokens of an object within the stream, as the sample indexes them
+struct ObjectTokens
+{
+  GLintptr offset;
+  GLsizei  size;
+  GLuint   sequence;
+};
+
+// follows BenchScene::buildRange, the scene ubos come first
+static void indexObjectTokens(const BenchScene& scene, std::vector<ObjectTokens>& entries)
+{
+  entries.resize(scene.objects.size());
+  GLintptr offset   = GLintptr(sizeof(NVTokenUbo) * 3);
+  GLuint   sequence = 0;
+  for(size_t i = 0; i < scene.objects.size(); i++)
+  {
+    if(i && scene.objects[i].program != scene.objects[i - 1].program)
+    {
+      sequence++;
+    }
+    NVTokenStream tokens;
+    scene.enqueueObject(i, tokens);
+    entries[i].offset   = offset;
+    entries[i].size     = GLsizei(tokens.size());
+    entries[i].sequence = sequence;
+    offset += GLintptr(tokens.size());
+  }
+}
+
+// like the sample's moveObjectTokens: the object's new tokens are appended
+// and its sequence is split around the old ones
+static void moveObjectTokens(const BenchScene& scene, size_t i, const GLuint states[2], NVTokenStream& stream,
+                             NVTokenSequence& seq, std::vector<ObjectTokens>& entries, NVTokenDirtyRanges& dirty)
+{
+  ObjectTokens& entry = entries[i];
+  GLuint        s     = entry.sequence;
+
+  GLintptr begin     = seq.offsets[s];
+  GLintptr end       = begin + seq.sizes[s];
+  GLintptr objectEnd = entry.offset + entry.size;
+  GLuint   state     = seq.states[s];
+  GLuint   fbo       = seq.fbos[s];
+
+  GLintptr offset = GLintptr(stream.size());
+  scene.enqueueObject(i, stream);
+  GLsizei size = GLsizei(stream.size() - size_t(offset));
+  dirty.add(size_t(offset), size_t(size));
+
+  GLuint          objectState = states[scene.objects[i].program];
+  NVTokenSequence split;
+  if(entry.offset > begin)
+  {
+    bool sceneOnly = s == 0 && entry.offset - begin == GLintptr(sizeof(NVTokenUbo) * 3);
+    split.offsets.push_back(begin);
+    split.sizes.push_back(GLsizei(entry.offset - begin));
+    split.states.push_back(sceneOnly ? objectState : state);
+    split.fbos.push_back(fbo);
+  }
+  GLuint objectSeq = s + GLuint(split.offsets.size());
+  split.offsets.push_back(offset);
+  split.sizes.push_back(size);
+  split.states.push_back(objectState);
+  split.fbos.push_back(fbo);
+  if(objectEnd < end)
+  {
+    split.offsets.push_back(objectEnd);
+    split.sizes.push_back(GLsizei(end - objectEnd));
+    split.states.push_back(state);
+    split.fbos.push_back(fbo);
+  }
+
+  seq.offsets.erase(seq.offsets.begin() + s);
+  seq.sizes.erase(seq.sizes.begin() + s);
+  seq.states.erase(seq.states.begin() + s);
+  seq.fbos.erase(seq.fbos.begin() + s);
+  seq.offsets.insert(seq.offsets.begin() + s, split.offsets.begin(), split.offsets.end());
+  seq.sizes.insert(seq.sizes.begin() + s, split.sizes.begin(), split.sizes.end());
+  seq.states.insert(seq.states.begin() + s, split.states.begin(), split.states.end());
+  seq.fbos.insert(seq.fbos.begin() + s, split.fbos.begin(), split.fbos.end());
+
+  GLuint added = GLuint(split.offsets.size()) - 1;
+  for(ObjectTokens& other : entries)
+  {
+    if(other.sequence > s)
+    {
+      other.sequence += added;
+    }
+    else if(other.sequence == s && other.offset > entry.offset)
+    {
+      other.sequence = objectSeq + 1;
+    }
+  }
+  entry.offset   = offset;
+  entry.size     = size;
+  entry.sequence = objectSeq;
+}
+
+static bool bufferMatches(GLuint buffer, const NVTokenStream& stream)
+{
+  const std::vector<unsigned char>& data = glstub::getBufferData(buffer);
+  return data.size() == stream.size() && memcmp(data.data(), stream.data(), stream.size()) == 0;
+}
+
+// Objects change meshes and ubo slots in place, then programs, which moves
+// them to sequences of their own. The buffer copy gets exactly the
+// coalesced changed bytes, and the patched stream draws what a stream
+// built from the changed scene draws.
+static void testPatch(bool bindless)
+{
+  nvtokenInitInternals(false, bindless);
+
+  const GLuint buffer   = 7;
+  const size_t mergeGap = 64;
+
+  StateSystem stateSystem;
+  GLuint      states[2];
+  initSceneStates(stateSystem, states);
+
+  BenchScene scene;
+  scene.init(400, 5, false, 11);
+
+  NVTokenStream             stream;
+  NVTokenSequence           seq;
+  std::vector<ObjectTokens> entries;
+  scene.build(stream, seq, states);
+  indexObjectTokens(scene, entries);
+
+  glstub::reset();
+  glNamedBufferSubData(buffer, 0, GLsizeiptr(stream.size()), stream.data());
+
+  // in place: other meshes for neighbours and distant objects, one object
+  // is patched with what it already is
+  const size_t changed[] = {3, 4, 90, 91, 92, 250, 399};
+  const size_t patched[] = {3, 4, 90, 91, 92, 120, 250, 399};
+  NVTokenStream before = stream;
+  for(size_t i : changed)
+  {
+    BenchScene::Object& obj = scene.objects[i];
+    GLuint              geo = (obj.vbo / 2 + 1) % 5;
+    obj.vbo                 = 1 + geo * 2;
+    obj.ibo                 = 2 + geo * 2;
+    obj.vboADDR             = 0x200000000ull + GLuint64(obj.vbo) * 0x10000;
+    obj.iboADDR             = 0x200000000ull + GLuint64(obj.ibo) * 0x10000;
+    obj.numIndices          = 36 * (geo + 1);
+  }
+
+  NVTokenDirtyRanges dirty;
+  bool               patchedAll = true;
+  for(size_t i : patched)
+  {
+    NVTokenStream tokens;
+    scene.enqueueObject(i, tokens);
+    bool same = memcmp(tokens.data(), stream.data() + entries[i].offset, tokens.size()) == 0;
+    bool wrote = nvtokenPatch(stream, size_t(entries[i].offset), tokens.data(), tokens.size(), dirty);
+    patchedAll = patchedAll && tokens.size() == size_t(entries[i].size) && wrote == !same && same == (i == 120);
+  }
+  TEST_CHECK(patchedAll);
+
+  // the changed bytes, coalesced like the upload does
+  std::vector<std::pair<size_t, size_t>> ranges;
+  for(size_t b = 0; b < stream.size(); b++)
+  {
+    if(stream.data()[b] != before.data()[b])
+    {
+      if(!ranges.empty() && b <= ranges.back().second + mergeGap)
+        ranges.back().second = b + 1;
+      else
+        ranges.push_back(std::make_pair(b, b + 1));
+    }
+  }
+
+  glstub::setTracing(true);
+  GLuint uploads = dirty.upload(buffer, stream.data(), mergeGap);
+  glstub::setTracing(false);
+  std::vector<std::string> expectedCalls;
+  for(const std::pair<size_t, size_t>& range : ranges)
+  {
+    char line[128];
+    snprintf(line, sizeof(line), "glNamedBufferSubData %u %lld %lld", buffer, (long long)range.first,
+             (long long)(range.second - range.first));
+    expectedCalls.push_back(line);
+  }
+  TEST_CHECK(dirty.empty());
+  TEST_CHECK(uploads == ranges.size() && glstub::counters.uploads == 1 + ranges.size() && ranges.size() > 1);
+  TEST_CHECK(glstub::getTrace() == expectedCalls);
+  TEST_CHECK(bufferMatches(buffer, stream));
+
+  NVTokenStream   fresh;
+  NVTokenSequence freshSeq;
+  scene.build(fresh, freshSeq, states);
+  TEST_CHECK(fresh.size() == stream.size() && memcmp(fresh.data(), stream.data(), stream.size()) == 0);
+  TEST_CHECK(sameSequences(freshSeq, seq));
+
+  // program changes, including the first and last object and neighbours
+  const size_t moved[] = {0, 57, 58, 200, 399};
+  size_t       oldSize = stream.size();
+  glstub::reset();
+  glNamedBufferSubData(buffer, 0, GLsizeiptr(stream.size()), stream.data());
+  for(size_t i : moved)
+  {
+    scene.objects[i].program ^= 1;
+    moveObjectTokens(scene, i, states, stream, seq, entries, dirty);
+  }
+  uploads = dirty.upload(buffer, stream.data(), mergeGap);
+  TEST_CHECK(uploads == 1 && glstub::counters.uploads == 2);
+  TEST_CHECK(bufferMatches(buffer, stream));
+  TEST_CHECK(nvtokenValidate(stream.data(), stream.size(), seq.offsets.data(), seq.sizes.data(),
+                             GLuint(seq.offsets.size()), NULL)
+             == NVTOKEN_VALID);
+  TEST_CHECK(stream.size() > oldSize);
+
+  scene.build(fresh, freshSeq, states);
+  TracedDraws expected = traceReplay(fresh, freshSeq, stateSystem);
+  TracedDraws split    = traceReplay(stream, seq, stateSystem);
+  if(!(split == expected))
+  {
+    printf("patch %s: split stream draws %zu, fresh stream %zu\n", bindless ? "bindless" : "bind", split.draws.size(),
+           expected.draws.size());
+  }
+  TEST_CHECK(expected.draws.size() == scene.objects.size());
+  TEST_CHECK(split == expected);
+
+  glstub::reset();
+  stateSystem.deinit();
+  nvtokenInitInternals(false, false);
+}
+
+// Random sequences over a few states and fbos, some flagged order dependent.
+// The schedule must be a permutation that leaves flagged sequences in place,
+// moves the others only between them, keeps the order within a state and
+// fbo, and does not cost more than before.
+static void testSchedule()
+{
+  const GLuint numStates        = 12;
+  const GLuint sequenceCounts[] = {1, 2, 7, 64, 300, 1000};
+
+  StateSystem stateSystem;
+  stateSystem.init();
+  std::vector<GLuint> states(numStates);
+  stateSystem.generate(numStates, states.data());
+  for(GLuint i = 0; i < numStates; i++)
+  {
+    StateSystem::State state;
+    benchVariedState(state, i * 5);
+    stateSystem.set(states[i], state, GL_TRIANGLES);
+  }
+
+  GLuint seed     = 3;
+  bool   improved = false;
+  for(GLuint count : sequenceCounts)
+  {
+    for(GLuint dependency = 0; dependency < 4; dependency++)
+    {
+      // no flags, a few, many, and only the first as in the sample
+      NVTokenSequence        seq;
+      std::vector<GLboolean> orderDependent(count);
+      for(GLuint i = 0; i < count; i++)
+      {
+        seed = seed * 1664525u + 1013904223u;
+        seq.offsets.push_back(GLintptr(i) * 64);  // identifies the sequence
+        seq.sizes.push_back(GLsizei(16 + (seed >> 28)));
+        seq.states.push_back(states[(seed >> 8) % numStates]);
+        seq.fbos.push_back((seed >> 16) % 4);  // 0 is the state's fbo
+        bool flagged = (dependency == 1 && (seed >> 20) % 8 == 0) || (dependency == 2 && (seed >> 20) % 2 == 0)
+                       || (dependency == 3 && i == 0);
+        orderDependent[i] = flagged ? GL_TRUE : GL_FALSE;
+      }
+
+      NVTokenSequence      scheduled = seq;
+      NVTokenScheduleStats stats;
+      nvtokenScheduleSequences(scheduled, stateSystem, dependency ? orderDependent.data() : NULL, &stats);
+
+      bool permutation = scheduled.offsets.size() == count && scheduled.sizes.size() == count
+                         && scheduled.states.size() == count && scheduled.fbos.size() == count;
+      bool                kept    = true;
+      bool                inRun   = true;
+      bool                inOrder = true;
+      std::vector<GLuint> source(count);
+      std::vector<bool>   seen(count, false);
+      for(GLuint i = 0; permutation && i < count; i++)
+      {
+        GLuint s    = GLuint(scheduled.offsets[i] / 64);
+        permutation = s < count && !seen[s] && scheduled.sizes[i] == seq.sizes[s]
+                      && scheduled.states[i] == seq.states[s] && scheduled.fbos[i] == seq.fbos[s];
+        if(!permutation)
+          break;
+        seen[s]   = true;
+        source[i] = s;
+        kept      = kept && (!orderDependent[i] || !dependency || s == i);
+      }
+
+      if(permutation)
+      {
+        // no sequence crosses a flagged one
+        for(GLuint i = 0; dependency && i < count; i++)
+        {
+          GLuint lo = std::min(i, source[i]);
+          GLuint hi = std::max(i, source[i]);
+          for(GLuint k = lo; k <= hi && inRun; k++)
+          {
+            inRun = !orderDependent[k] || k == i;
+          }
+        }
+
+        // a later sequence of the same state and bound fbo never goes first
+        for(GLuint i = 0; i < count; i++)
+        {
+          for(GLuint k = i + 1; k < count && inOrder; k++)
+          {
+            GLuint a = source[i];
+            GLuint b = source[k];
+            GLuint fboA = seq.fbos[a] ? seq.fbos[a] : stateSystem.get(seq.states[a]).fbo.fboDraw;
+            GLuint fboB = seq.fbos[b] ? seq.fbos[b] : stateSystem.get(seq.states[b]).fbo.fboDraw;
+            inOrder = !(seq.states[a] == seq.states[b] && fboA == fboB && a > b);
+          }
+        }
+      }
+
+      // the stats report the cost the emulation would see
+      size_t costBefore = 0;
+      size_t costAfter  = 0;
+      for(int pass = 0; pass < 2 && permutation; pass++)
+      {
+        const NVTokenSequence& list = pass ? scheduled : seq;
+        GLuint                 lastState = StateSystem::INVALID_ID;
+        GLuint                 lastFbo   = ~0u;
+        size_t&                cost      = pass ? costAfter : costBefore;
+        for(GLuint i = 0; i < count; i++)
+        {
+          GLuint fbo = list.fbos[i] ? list.fbos[i] : stateSystem.get(list.states[i]).fbo.fboDraw;
+          // NVTOKEN_SCHEDULE_FBO_COST
+          cost += stateSystem.getTransitionCost(list.states[i], lastState) + (fbo != lastFbo ? 8 : 0);
+          lastState = list.states[i];
+          lastFbo   = fbo;
+        }
+      }
+
+      if(!permutation || !kept || !inRun || !inOrder || stats.costAfter > stats.costBefore)
+      {
+        printf("schedule %u sequences, flags %u: permutation %d kept %d in run %d in order %d cost %zu -> %zu\n",
+               count, dependency, permutation, kept, inRun, inOrder, stats.costBefore, stats.costAfter);
+      }
+      TEST_CHECK(permutation);
+      TEST_CHECK(kept);
+      TEST_CHECK(inRun);
+      TEST_CHECK(inOrder);
+      TEST_CHECK(stats.costBefore == costBefore && stats.costAfter == costAfter);
+      TEST_CHECK(stats.costAfter <= stats.costBefore);
+      improved = improved || stats.costAfter < stats.costBefore;
+    }
+  }
+  TEST_CHECK(improved);
+}
+
+void testTokens()
+{
+  testDecode();
+  testParallelBuild();
+  testOptimizeBindings(false);
+  testOptimizeBindings(true);
+  testSchedule();
+  for(int shadowed = 0; shadowed < 2; shadowed++)
+  {
+    testCompiledList(false, shadowed != 0);
+    testCompiledList(true, shadowed != 0);
+  }
+  testPatch(false);
+  testPatch(true);
+}
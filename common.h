@@ -26,6 +26,8 @@
 #define UBO_SCENE     0
 #define UBO_OBJECT    1
 
+#define SSBO_OBJECTS  0
+
 #if defined(GL_core_profile) || defined(GL_compatibility_profile) || defined(GL_es_profile)
 
 #extension GL_ARB_bindless_texture : require
@@ -77,8 +79,21 @@ layout(std140,binding=UBO_SCENE) uniform sceneBuffer {
   SceneData   scene;
 };
 
+#if USE_MULTIDRAW
+// the per-object ubo ranges as one array, the shaders index it with
+// gl_BaseInstanceARB instead of using a ubo binding per object
+struct ObjectEntry {
+  ObjectData  data;
+  vec4        _pad[5]; // 176 -> 256 bytes, the ubo offset alignment of the ranges
+};
+
+layout(std430,binding=SSBO_OBJECTS) readonly buffer objectsBuffer {
+  ObjectEntry objects[];
+};
+#else
 layout(std140,binding=UBO_OBJECT) uniform objectBuffer {
   ObjectData  object;
 };
+#endif
 
 #endif
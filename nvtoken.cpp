@@ -21,6 +21,32 @@
 /* Contact ckubisch@nvidia.com (Christoph Kubisch) for feedback */
 
 #include "nvtoken.hpp"
+#include "shadowstate.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace nvtoken
 {
@@ -29,9 +55,9 @@ namespace nvtoken
   // generic
 
   GLuint   s_nvcmdlist_header[NVTOKEN_TYPES] = {0};
-  GLuint   s_nvcmdlist_headerSizes[NVTOKEN_TYPES] = {0};
   GLushort s_nvcmdlist_stages[NVTOKEN_STAGES] = {0};
   bool     s_nvcmdlist_bindless  = false;
+  static ShadowState* s_nvcmdlist_shadow = NULL;
   
   static inline GLuint nvtokenHeaderSW(GLuint type, GLuint size){
     return type | (size<<16);
@@ -47,56 +73,118 @@ namespace nvtoken
     return header>>16;
   }
 
-  static inline GLenum nvtokenHeaderCommand(GLuint header)
+  // Headers are decoded through a small perfect hash table, so the per-token
+  // cost no longer depends on NVTOKEN_TYPES. The multiplier is picked in
+  // nvtokenInitInternals so that every registered header, hardware or
+  // software encoded, ends up in its own slot. If no multiplier does, the
+  // headers that didn't get a slot are found by a linear scan on a miss.
+  #define NVTOKEN_DECODE_BITS   8
+  #define NVTOKEN_DECODE_SLOTS  (1<<NVTOKEN_DECODE_BITS)
+
+  static GLuint   s_nvcmdlist_decodeHeaders[NVTOKEN_DECODE_SLOTS] = {0};
+  static GLenum   s_nvcmdlist_decodeTypes[NVTOKEN_DECODE_SLOTS]   = {0};
+  static GLuint   s_nvcmdlist_decodeMul = 0;
+  static bool     s_nvcmdlist_decodeLinear = false;
+
+  static inline GLuint nvtokenHeaderSlot(GLuint header, GLuint mul)
+  {
+    return (header * mul) >> (32 - NVTOKEN_DECODE_BITS);
+  }
+
+  static GLenum nvtokenHeaderScan(GLuint header)
   {
     for (int i = 0; i < NVTOKEN_TYPES; i++){
-      if (header == s_nvcmdlist_header[i]) return i;
+      if (s_nvcmdlist_header[i] == header){
+        return i;
+      }
     }
+    return GLenum(-1);
+  }
 
-    assert(0 && "can't find header");
-    return -1;
+  // returns an invalid type (>= NVTOKEN_TYPES) for unknown headers
+  static inline GLenum nvtokenHeaderLookup(GLuint header)
+  {
+    GLuint slot = nvtokenHeaderSlot(header, s_nvcmdlist_decodeMul);
+    if (s_nvcmdlist_decodeHeaders[slot] == header){
+      // unused slots store an invalid type
+      return s_nvcmdlist_decodeTypes[slot];
+    }
+    return s_nvcmdlist_decodeLinear ? nvtokenHeaderScan(header) : GLenum(-1);
   }
 
-  template <class T>
-  static void nvtokenRegisterSize()
+  static inline GLenum nvtokenHeaderCommand(GLuint header)
   {
-    s_nvcmdlist_headerSizes[T::ID] = sizeof(T);
+    GLenum type = nvtokenHeaderLookup(header);
+    assert(type < NVTOKEN_TYPES && "can't find header");
+    return type;
   }
 
-  void nvtokenInitInternals( bool hwsupport, bool bindlessSupport)
+  static void nvtokenFillDecode(GLuint mul, bool linear)
   {
-    assert( !hwsupport || (hwsupport && bindlessSupport) );
+    for (int i = 0; i < NVTOKEN_DECODE_SLOTS; i++){
+      s_nvcmdlist_decodeHeaders[i] = 0;
+      s_nvcmdlist_decodeTypes[i]   = GLenum(-1);
+    }
+    // mul 0 leaves the table empty, otherwise headers sharing a slot keep
+    // the first type
+    for (int i = NVTOKEN_TYPES-1; i >= 0 && mul; i--){
+      GLuint slot = nvtokenHeaderSlot(s_nvcmdlist_header[i], mul);
+      s_nvcmdlist_decodeHeaders[slot] = s_nvcmdlist_header[i];
+      s_nvcmdlist_decodeTypes[slot]   = i;
+    }
+    s_nvcmdlist_decodeLinear = linear;
+    s_nvcmdlist_decodeMul    = mul;
+  }
 
-    nvtokenRegisterSize<NVTokenTerminate>();
-    nvtokenRegisterSize<NVTokenNop>();
-    nvtokenRegisterSize<NVTokenDrawElems>();
-    nvtokenRegisterSize<NVTokenDrawArrays>();
-    nvtokenRegisterSize<NVTokenDrawElemsStrip>();
-    nvtokenRegisterSize<NVTokenDrawArraysStrip>();
-    nvtokenRegisterSize<NVTokenDrawElemsInstanced>();
-    nvtokenRegisterSize<NVTokenDrawArraysInstanced>();
-    nvtokenRegisterSize<NVTokenVbo>();
-    nvtokenRegisterSize<NVTokenIbo>();
-    nvtokenRegisterSize<NVTokenUbo>();
-    nvtokenRegisterSize<NVTokenLineWidth>();
-    nvtokenRegisterSize<NVTokenPolygonOffset>();
-    nvtokenRegisterSize<NVTokenScissor>();
-    nvtokenRegisterSize<NVTokenBlendColor>();
-    nvtokenRegisterSize<NVTokenViewport>();
-    nvtokenRegisterSize<NVTokenAlphaRef>();
-    nvtokenRegisterSize<NVTokenStencilRef>();
-    nvtokenRegisterSize<NVTokenFrontFace>();
-    
+  // fails if two types share a header, a stream couldn't be decoded then
+  static bool nvtokenInitDecode(bool linear)
+  {
     for (int i = 0; i < NVTOKEN_TYPES; i++){
-      GLuint sz = s_nvcmdlist_headerSizes[i];
-      assert(sz);
+      for (int n = i + 1; n < NVTOKEN_TYPES; n++){
+        if (s_nvcmdlist_header[i] == s_nvcmdlist_header[n]){
+          nvtokenFillDecode(0, true);
+          return false;
+        }
+      }
     }
-    
+
+    if (linear){
+      nvtokenFillDecode(0, true);
+      return true;
+    }
+
+    GLuint mul = 0x9E3779B1;
+    for (int attempt = 0; attempt < 4096; attempt++){
+      bool used[NVTOKEN_DECODE_SLOTS] = {false};
+      bool unique = true;
+      for (int i = 0; i < NVTOKEN_TYPES && unique; i++){
+        GLuint slot = nvtokenHeaderSlot(s_nvcmdlist_header[i], mul);
+        unique = !used[slot];
+        used[slot] = true;
+      }
+
+      if (unique){
+        nvtokenFillDecode(mul, false);
+        return true;
+      }
+
+      // next odd multiplier
+      mul = (mul * 1664525 + 1013904223) | 1;
+    }
+
+    nvtokenFillDecode(mul, true);
+    return true;
+  }
+
+  bool nvtokenInitInternals( bool hwsupport, bool bindlessSupport, bool linearDecode)
+  {
+    assert( !hwsupport || (hwsupport && bindlessSupport) );
+
     s_nvcmdlist_bindless  = bindlessSupport;
     
     if (hwsupport){
       for (int i = 0; i < NVTOKEN_TYPES; i++){
-        s_nvcmdlist_header[i] = glGetCommandHeaderNV(i,s_nvcmdlist_headerSizes[i]);
+        s_nvcmdlist_header[i] = glGetCommandHeaderNV(i,s_nvcmdlist_types.sizes[i]);
       }
       s_nvcmdlist_stages[NVTOKEN_STAGE_VERTEX] = glGetStageIndexNV(GL_VERTEX_SHADER);
       s_nvcmdlist_stages[NVTOKEN_STAGE_TESS_CONTROL] = glGetStageIndexNV(GL_TESS_CONTROL_SHADER);
@@ -106,37 +194,23 @@ namespace nvtoken
     }
     else{
       for (int i = 0; i < NVTOKEN_TYPES; i++){
-        s_nvcmdlist_header[i] = nvtokenHeaderSW(i,s_nvcmdlist_headerSizes[i]);
+        s_nvcmdlist_header[i] = nvtokenHeaderSW(i,s_nvcmdlist_types.sizes[i]);
       }
       for (int i = 0; i < NVTOKEN_STAGES; i++){
         s_nvcmdlist_stages[i] = i;
       }
     }
+
+    return nvtokenInitDecode(linearDecode);
+  }
+  void nvtokenSetShadowState( ShadowState* shadow )
+  {
+    s_nvcmdlist_shadow = shadow;
   }
 
-#define TOSTRING(a)  case a: return #a;
+
   const char* nvtokenCommandToString(GLenum type){
-    switch  (type){
-      TOSTRING(GL_NOP_COMMAND_NV                   );
-      TOSTRING(GL_DRAW_ELEMENTS_INSTANCED_COMMAND_NV);
-      TOSTRING(GL_DRAW_ARRAYS_INSTANCED_COMMAND_NV  );
-      TOSTRING(GL_ELEMENT_ADDRESS_COMMAND_NV       );
-      TOSTRING(GL_ATTRIBUTE_ADDRESS_COMMAND_NV     );
-      TOSTRING(GL_UNIFORM_ADDRESS_COMMAND_NV       );
-      TOSTRING(GL_BLEND_COLOR_COMMAND_NV           );
-      TOSTRING(GL_STENCIL_REF_COMMAND_NV           );
-      TOSTRING(GL_TERMINATE_SEQUENCE_COMMAND_NV    );
-      TOSTRING(GL_LINE_WIDTH_COMMAND_NV            );
-      TOSTRING(GL_POLYGON_OFFSET_COMMAND_NV        );
-      TOSTRING(GL_ALPHA_REF_COMMAND_NV             );
-      TOSTRING(GL_VIEWPORT_COMMAND_NV              );
-      TOSTRING(GL_SCISSOR_COMMAND_NV               );
-      TOSTRING(GL_DRAW_ELEMENTS_COMMAND_NV         );
-      TOSTRING(GL_DRAW_ARRAYS_COMMAND_NV           );
-      TOSTRING(GL_DRAW_ELEMENTS_STRIP_COMMAND_NV   );
-      TOSTRING(GL_DRAW_ARRAYS_STRIP_COMMAND_NV     );
-    }
-    return NULL;
+    return type < NVTOKEN_TYPES ? s_nvcmdlist_types.names[type] : NULL;
   }
 
   //////////////////////////////////////////////////////////////////////////
@@ -151,258 +225,2132 @@ namespace nvtoken
       const GLuint*             header  = (const GLuint*)current;
 
       GLenum type = nvtokenHeaderCommand(*header);
+      if (type >= NVTOKEN_TYPES) return;
       stats[type]++;
 
-      current += s_nvcmdlist_headerSizes[type];
+      current += s_nvcmdlist_types.sizes[type];
     }
   }
 
-
-  // Emulation related
-
-  static NV_INLINE GLenum nvtokenDrawCommandSequenceSW( const void* NV_RESTRICT stream, size_t streamSize, GLenum mode, GLenum type, const StateSystem::State& state ) 
+  NVTokenValidateResult nvtokenValidate( const void* NV_RESTRICT stream, size_t streamSize,
+    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, GLuint count, size_t* errorOffset )
   {
-    const GLubyte* NV_RESTRICT current = (GLubyte*)stream;
-    const GLubyte* streamEnd = current + streamSize;
-
-    GLenum modeStrip;
-    if      (mode == GL_LINES)                modeStrip = GL_LINE_STRIP;
-    else if (mode == GL_TRIANGLES)            modeStrip = GL_TRIANGLE_STRIP;
-    /* else if (mode == GL_QUADS)                modeStrip = GL_QUAD_STRIP; */
-    else if (mode == GL_LINES_ADJACENCY)      modeStrip = GL_LINE_STRIP_ADJACENCY;
-    else if (mode == GL_TRIANGLES_ADJACENCY)  modeStrip = GL_TRIANGLE_STRIP_ADJACENCY;
-    else    modeStrip = mode;
+    const GLubyte* NV_RESTRICT tokens = (const GLubyte*)stream;
+    size_t dummy;
+    if (!errorOffset) errorOffset = &dummy;
 
-    GLenum modeSpecial;
-    if      (mode == GL_LINES)      modeSpecial = GL_LINE_LOOP;
-    else if (mode == GL_TRIANGLES)  modeSpecial = GL_TRIANGLE_FAN;
-    else    modeSpecial = mode;
+    for (GLuint i = 0; i < count; i++){
+      size_t offset = size_t(offsets[i]);
+      size_t size   = size_t(sizes[i]);
 
-    while (current < streamEnd){
-      const GLuint*             header  = (const GLuint*)current;
+      *errorOffset = offset;
+      if (offsets[i] < 0 || sizes[i] < 0 || offset > streamSize || size > streamSize - offset || ((offset | size) & 3)){
+        return NVTOKEN_INVALID_SEQUENCE;
+      }
 
-      GLenum cmdtype = nvtokenHeaderCommand(*header);
-      // if you always use emulation on non-native tokens you can use 
-      // cmdtype = nvtokenHeaderCommandSW(header->encoded)
-      switch(cmdtype){
-      case GL_TERMINATE_SEQUENCE_COMMAND_NV:
-        {
-          return type;
-        }
-        break;
-      case GL_NOP_COMMAND_NV:
-        {
-        }
-        break;
-      case GL_DRAW_ELEMENTS_COMMAND_NV:
-        {
-          const DrawElementsCommandNV* cmd = (const DrawElementsCommandNV*)current;
-          glDrawElementsBaseVertex(mode, cmd->count, type, (const GLvoid*)(cmd->firstIndex * sizeof(GLuint)), cmd->baseVertex);
-        }
-        break;
-      case GL_DRAW_ARRAYS_COMMAND_NV:
-        {
-          const DrawArraysCommandNV* cmd = (const DrawArraysCommandNV*)current;
-          glDrawArrays(mode, cmd->first, cmd->count);
-        }
-        break;
-      case GL_DRAW_ELEMENTS_STRIP_COMMAND_NV:
-        {
-          const DrawElementsCommandNV* cmd = (const DrawElementsCommandNV*)current;
-          glDrawElementsBaseVertex(modeStrip, cmd->count, type, (const GLvoid*)(cmd->firstIndex * sizeof(GLuint)), cmd->baseVertex);
-        }
-        break;
-      case GL_DRAW_ARRAYS_STRIP_COMMAND_NV:
-        {
-          const DrawArraysCommandNV* cmd = (const DrawArraysCommandNV*)current;
-          glDrawArrays(modeStrip, cmd->first, cmd->count);
-        }
-        break;
-      case GL_DRAW_ELEMENTS_INSTANCED_COMMAND_NV:
-        {
-          const DrawElementsInstancedCommandNV* cmd = (const DrawElementsInstancedCommandNV*)current;
+      const GLubyte* NV_RESTRICT current = tokens + offset;
+      const GLubyte* seqEnd = current + size;
 
-          assert (cmd->mode == mode || cmd->mode == modeStrip || cmd->mode == modeSpecial);
+      while (current < seqEnd){
+        // sizes and offsets are multiples of 4, so there is always a full header left
+        GLuint header = *(const GLuint*)current;
+        GLenum type   = nvtokenHeaderLookup(header);
+        *errorOffset  = size_t(current - tokens);
 
-          glDrawElementsIndirect(cmd->mode, type, &cmd->count);
+        if (type >= NVTOKEN_TYPES){
+          return NVTOKEN_INVALID_HEADER;
         }
-        break;
-      case GL_DRAW_ARRAYS_INSTANCED_COMMAND_NV:
-        {
-          const DrawArraysInstancedCommandNV* cmd = (const DrawArraysInstancedCommandNV*)current;
-
-          assert (cmd->mode == mode || cmd->mode == modeStrip || cmd->mode == modeSpecial);
 
-          glDrawArraysIndirect(cmd->mode, &cmd->count);
-        }
-        break;
-      case GL_ELEMENT_ADDRESS_COMMAND_NV:
-        {
-          const ElementAddressCommandNV* cmd = (const ElementAddressCommandNV*)current;
-          type = cmd->typeSizeInByte == 4 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
-          if (s_nvcmdlist_bindless){
-            glBufferAddressRangeNV(GL_ELEMENT_ARRAY_ADDRESS_NV, 0, GLuint64(cmd->addressLo) | (GLuint64(cmd->addressHi)<<32), 0x7FFFFFFF);
-          }
-          else{
-            const ElementAddressCommandEMU* cmd = (const ElementAddressCommandEMU*)current;
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cmd->buffer);
-          }
+        GLuint tokenSize = s_nvcmdlist_types.sizes[type];
+        if (tokenSize > size_t(seqEnd - current)){
+          return NVTOKEN_INVALID_SIZE;
         }
-        break;
-      case GL_ATTRIBUTE_ADDRESS_COMMAND_NV:
-        {
+
+        if (type == GL_UNIFORM_ADDRESS_COMMAND_NV){
           if (s_nvcmdlist_bindless){
-            const AttributeAddressCommandNV* cmd = (const AttributeAddressCommandNV*)current;
-            glBufferAddressRangeNV(GL_VERTEX_ATTRIB_ARRAY_ADDRESS_NV, cmd->index, GLuint64(cmd->addressLo) | (GLuint64(cmd->addressHi)<<32), 0x7FFFFFFF);
-          }
-          else{
-            const AttributeAddressCommandEMU* cmd = (const AttributeAddressCommandEMU*)current;
-            glBindVertexBuffer(cmd->index, cmd->buffer, cmd->offset, state.vertexformat.bindings[cmd->index].stride);
-          }
-        }
-        break;
-      case GL_UNIFORM_ADDRESS_COMMAND_NV:
-        {
-           if (s_nvcmdlist_bindless){
             const UniformAddressCommandNV* cmd = (const UniformAddressCommandNV*)current;
-            glBufferAddressRangeNV(GL_UNIFORM_BUFFER_ADDRESS_NV, cmd->index, GLuint64(cmd->addressLo) | (GLuint64(cmd->addressHi)<<32), 0x10000);
+            if (cmd->addressLo & 255){
+              return NVTOKEN_INVALID_UNIFORM;
+            }
           }
           else{
+            // offset256 and size4 are aligned by construction, but a zero sized range is an error in GL
             const UniformAddressCommandEMU* cmd = (const UniformAddressCommandEMU*)current;
-            glBindBufferRange(GL_UNIFORM_BUFFER,cmd->index, cmd->buffer, cmd->offset256 * 256, cmd->size4*4);
+            if (cmd->size4 == 0){
+              return NVTOKEN_INVALID_UNIFORM;
+            }
           }
         }
-        break;
-      case GL_BLEND_COLOR_COMMAND_NV:
-        {
-          const BlendColorCommandNV* cmd = (const BlendColorCommandNV*)current;
-          glBlendColor(cmd->red,cmd->green,cmd->blue,cmd->alpha);
-        }
-        break;
-      case GL_STENCIL_REF_COMMAND_NV:
-        {
-          const StencilRefCommandNV* cmd = (const StencilRefCommandNV*)current;
-          glStencilFuncSeparate(GL_FRONT, state.stencil.funcs[StateSystem::FACE_FRONT].func, cmd->frontStencilRef, state.stencil.funcs[StateSystem::FACE_FRONT].mask);
-          glStencilFuncSeparate(GL_BACK,  state.stencil.funcs[StateSystem::FACE_BACK ].func, cmd->backStencilRef,  state.stencil.funcs[StateSystem::FACE_BACK ].mask);
+        else if (type == GL_TERMINATE_SEQUENCE_COMMAND_NV){
+          // neither hw nor emulation look past it
+          break;
         }
-        break;
 
-      case GL_LINE_WIDTH_COMMAND_NV:
-        {
-          const LineWidthCommandNV* cmd = (const LineWidthCommandNV*)current;
-          glLineWidth(cmd->lineWidth);
-        }
-        break;
-      case GL_POLYGON_OFFSET_COMMAND_NV:
-        {
-          const PolygonOffsetCommandNV* cmd = (const PolygonOffsetCommandNV*)current;
-          glPolygonOffset(cmd->scale,cmd->bias);
-        }
-        break;
-      case GL_ALPHA_REF_COMMAND_NV:
-        { /*
-          const AlphaRefCommandNV* cmd = (const AlphaRefCommandNV*)current;
-          glAlphaFunc(state.alpha.mode, cmd->alphaRef);
-          */
-        }
-        break;
-      case GL_VIEWPORT_COMMAND_NV:
-        {
-          const ViewportCommandNV* cmd = (const ViewportCommandNV*)current;
-          glViewport(cmd->x, cmd->y, cmd->width, cmd->height);
-        }
-        break;
-      case GL_SCISSOR_COMMAND_NV:
-        {
-          const ScissorCommandNV* cmd = (const ScissorCommandNV*)current;
-          glScissor(cmd->x,cmd->y,cmd->width,cmd->height);
-        }
-        break;
-      case GL_FRONT_FACE_COMMAND_NV:
-        {
-          FrontFaceCommandNV* cmd = (FrontFaceCommandNV*)current;
-          glFrontFace(cmd->frontFace?GL_CW:GL_CCW);
-        }
-        break;
+        current += tokenSize;
       }
+    }
+
+    return NVTOKEN_VALID;
+  }
 
 
-      GLuint tokenSize = s_nvcmdlist_headerSizes[cmdtype];
-      assert(tokenSize);
+  void nvtokenAppendSequences( NVTokenStream& dstStream, NVTokenSequence& dstSeq,
+                               const NVTokenStream& srcStream, const NVTokenSequence& srcSeq, bool mergeSequences)
+  {
+    GLintptr base = GLintptr(dstStream.size());
+    dstStream.append(srcStream.data(), srcStream.size());
 
-      current += tokenSize;
+    size_t first = 0;
+    if (mergeSequences && !dstSeq.offsets.empty() && !srcSeq.offsets.empty()){
+      size_t last = dstSeq.offsets.size() - 1;
+      if (dstSeq.states[last] == srcSeq.states[0] &&
+          dstSeq.fbos[last]   == srcSeq.fbos[0] &&
+          dstSeq.offsets[last] + dstSeq.sizes[last] == base &&
+          srcSeq.offsets[0] == 0)
+      {
+        dstSeq.sizes[last] += srcSeq.sizes[0];
+        first = 1;
+      }
+    }
 
+    for (size_t i = first; i < srcSeq.offsets.size(); i++){
+      dstSeq.offsets.push_back(srcSeq.offsets[i] + base);
+      dstSeq.sizes.push_back(srcSeq.sizes[i]);
+      dstSeq.states.push_back(srcSeq.states[i]);
+      dstSeq.fbos.push_back(srcSeq.fbos[i]);
     }
-    return type;
   }
 
-  void nvtokenDrawCommandsSW(GLenum mode, const void* NV_RESTRICT stream, size_t streamSize, 
-    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
-    GLuint count, 
-    StateSystem::State &state)
+
+  void NVTokenDirtyRanges::add(size_t offset, size_t size)
   {
-    const char* NV_RESTRICT tokens = (const char*)stream;
-    GLenum type = GL_UNSIGNED_SHORT;
-    for (GLuint i = 0; i < count; i++)
-    {
-      size_t offset = offsets[i];
-      size_t size   = sizes[i];
+    if (size){
+      m_ranges.push_back(std::make_pair(offset, offset + size));
+    }
+  }
 
-      assert(size + offset <= streamSize);
+  GLuint NVTokenDirtyRanges::upload(GLuint buffer, const void* NV_RESTRICT stream, size_t mergeGap)
+  {
+    std::sort(m_ranges.begin(), m_ranges.end());
 
-      type = nvtokenDrawCommandSequenceSW(&tokens[offset], size, mode, type, state);
+    GLuint uploads = 0;
+    for (size_t i = 0; i < m_ranges.size(); ){
+      size_t begin = m_ranges[i].first;
+      size_t end   = m_ranges[i].second;
+      for (i++; i < m_ranges.size() && m_ranges[i].first <= end + mergeGap; i++){
+        end = std::max(end, m_ranges[i].second);
+      }
+      glNamedBufferSubData(buffer, GLintptr(begin), GLsizeiptr(end - begin), (const GLubyte*)stream + begin);
+      uploads++;
     }
 
+    m_ranges.clear();
+    return uploads;
   }
 
-#if NVTOKEN_STATESYSTEM
-  void nvtokenDrawCommandsStatesSW(const void* NV_RESTRICT stream, size_t streamSize, 
-    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
-    const GLuint* NV_RESTRICT states, const GLuint* NV_RESTRICT fbos, GLuint count, 
-    StateSystem &stateSystem)
+  bool nvtokenPatch( NVTokenStream& stream, size_t offset, const void* NV_RESTRICT tokens, size_t size, NVTokenDirtyRanges& dirty)
   {
-    int lastFbo = ~0;
-    const char* NV_RESTRICT tokens = (const char*)stream;
+    assert(offset + size <= stream.size());
 
-    StateSystem::StateID lastID;
+    GLubyte*       NV_RESTRICT dst = stream.data() + offset;
+    const GLubyte* NV_RESTRICT src = (const GLubyte*)tokens;
 
-    GLenum type = GL_UNSIGNED_SHORT;
-    for (GLuint i = 0; i < count; i++)
-    {
-      GLuint fbo;
+#ifndef NDEBUG
+    for (size_t i = 0; i < size; ){
+      GLuint header = *(const GLuint*)(src + i);
+      assert(header == *(const GLuint*)(dst + i) && "tokens must keep their type");
+      i += s_nvcmdlist_types.sizes[nvtokenHeaderCommand(header)];
+    }
+#endif
 
-      StateSystem::StateID curID = states[i];
-      const StateSystem::State&  state = stateSystem.get(curID);
+    size_t begin = 0;
+    size_t end   = size;
+    while (begin < end && src[begin] == dst[begin]){
+      begin++;
+    }
+    while (end > begin && src[end - 1] == dst[end - 1]){
+      end--;
+    }
+    if (begin == end){
+      return false;
+    }
 
-      if (fbos[i]){
-        fbo = fbos[i];
-      }
-      else{
-        fbo = state.fbo.fboDraw;
-      }
+    memcpy(dst + begin, src + begin, end - begin);
+    dirty.add(offset + begin, end - begin);
+    return true;
+  }
 
-      if (fbo != lastFbo){
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-        lastFbo = fbo;
-      }
 
-      if (i == 0){
-        stateSystem.applyGL( curID, true ); // quite costly
-      }
-      else {
-        stateSystem.applyGL( curID, lastID, true );
-      }
-      lastID = curID;
+  // binding points tracked by nvtokenOptimizeBindings
+  #define NVTOKEN_OPT_VBOS  16
+  #define NVTOKEN_OPT_UBOS  32
 
-      size_t offset = offsets[i];
-      size_t size   = sizes[i];
+  void nvtokenOptimizeBindings( NVTokenStream& stream, NVTokenSequence& seq, NVTokenOptimizeStats* stats )
+  {
+    NVTokenOptimizeStats result = {0, 0};
 
-      GLenum mode = state.basePrimitiveMode;
+    NVTokenStream   optimized;
+    optimized.reserve(stream.size());
 
-      assert(size + offset <= streamSize);
+    for (size_t s = 0; s < seq.offsets.size(); s++){
+      // last token per binding point, zeroed means unbound
+      GLuint  vbos[NVTOKEN_OPT_VBOS][sizeof(NVTokenVbo)/4];
+      GLuint  ibo[sizeof(NVTokenIbo)/4];
+      GLuint  ubos[NVTOKEN_STAGES][NVTOKEN_OPT_UBOS][sizeof(NVTokenUbo)/4];
+      memset(vbos, 0, sizeof(vbos));
+      memset(ibo,  0, sizeof(ibo));
+      memset(ubos, 0, sizeof(ubos));
 
-      type = nvtokenDrawCommandSequenceSW(&tokens[offset], size, mode, type, state);
-    }
+      const GLubyte* current   = stream.data() + seq.offsets[s];
+      const GLubyte* streamEnd = current + seq.sizes[s];
+      size_t         offset    = optimized.size();
+
+      while (current < streamEnd){
+        GLenum type = nvtokenHeaderCommand(*(const GLuint*)current);
+        if (type >= NVTOKEN_TYPES){
+          // unknown tokens, pass on the rest as is
+          optimized.append(current, streamEnd - current);
+          break;
+        }
+
+        GLuint  tokenSize = s_nvcmdlist_types.sizes[type];
+        void*   tracked   = NULL;
+
+        switch (type){
+        case GL_ATTRIBUTE_ADDRESS_COMMAND_NV:
+          {
+            const AttributeAddressCommandNV* cmd = (const AttributeAddressCommandNV*)current;
+            if (cmd->index < NVTOKEN_OPT_VBOS){
+              tracked = vbos[cmd->index];
+            }
+          }
+          break;
+        case GL_ELEMENT_ADDRESS_COMMAND_NV:
+          {
+            tracked = ibo;
+          }
+          break;
+        case GL_UNIFORM_ADDRESS_COMMAND_NV:
+          {
+            const UniformAddressCommandNV* cmd = (const UniformAddressCommandNV*)current;
+            for (int stage = 0; stage < NVTOKEN_STAGES; stage++){
+              if (s_nvcmdlist_stages[stage] == cmd->stage && cmd->index < NVTOKEN_OPT_UBOS){
+                tracked = ubos[stage][cmd->index];
+                break;
+              }
+            }
+          }
+          break;
+        }
+
+        if (tracked && memcmp(tracked, current, tokenSize) == 0){
+          result.tokensRemoved++;
+          result.bytesRemoved += tokenSize;
+        }
+        else{
+          if (tracked){
+            memcpy(tracked, current, tokenSize);
+          }
+          optimized.append(current, tokenSize);
+        }
+
+        current += tokenSize;
+      }
+
+      seq.offsets[s] = GLintptr(offset);
+      seq.sizes[s]   = GLsizei(optimized.size() - offset);
+    }
+
+    stream = std::move(optimized);
+
+    if (stats){
+      *stats = result;
+    }
+  }
+
+
+  //////////////////////////////////////////////////////////////////////////
+  // File storage
+
+  #define NVTOKEN_FILE_MAGIC    0x4B54564E  // "NVTK"
+  #define NVTOKEN_FILE_VERSION  1
+
+  // all offsets are relative to the file begin
+  struct NVTokenFileHeader {
+    GLuint    magic;
+    GLuint    version;
+    GLuint    bindless;
+    GLuint    numTypes;
+    GLuint64  fileSize;
+    GLuint64  tokenOffset;
+    GLuint64  tokenSize;
+    GLuint64  sequenceOffset;     // GLuint64 offsets, then GLuint sizes, states and fbos
+    GLuint64  relocOffset;
+    GLuint64  numRelocs;
+    GLuint    numSequences;
+    GLuint    numBuffers;
+    GLuint    numStates;
+    GLuint    numFbos;
+    GLuint    headers[NVTOKEN_TYPES]; // token headers at save time
+  };
+
+  struct NVTokenFileReloc {
+    GLuint64  fieldOffset;        // of the buffer name or address within the tokens
+    GLuint64  bufferOffset;       // address relative to the buffer (bindless only)
+    GLuint    buffer;             // index into NVTokenObjectTable::buffers
+    GLuint    _pad;
+  };
+
+  static inline GLuint64 nvtokenFileAlign(GLuint64 offset, GLuint64 alignment)
+  {
+    return (offset + alignment - 1) & ~(alignment - 1);
+  }
+
+  static inline size_t nvtokenFileSequenceBytes(size_t numSequences)
+  {
+    return numSequences * (sizeof(GLuint64) + sizeof(GLuint) * 3);
+  }
+
+  // sorted (key, index) pairs to find which table entry a token refers to
+  typedef std::vector< std::pair<GLuint64, GLuint> > NVTokenFileRefMap;
+
+  // returns the index of the entry with the largest key <= key, or ~0
+  static GLuint nvtokenFileRefFind(const NVTokenFileRefMap& map, GLuint64 key)
+  {
+    NVTokenFileRefMap::const_iterator it = std::upper_bound(map.begin(), map.end(), std::make_pair(key, ~GLuint(0)));
+    return it == map.begin() ? ~GLuint(0) : (it - 1)->second;
+  }
+
+  static GLuint nvtokenFileRefFindExact(const NVTokenFileRefMap& map, GLuint64 key)
+  {
+    NVTokenFileRefMap::const_iterator it = std::lower_bound(map.begin(), map.end(), std::make_pair(key, GLuint(0)));
+    return it == map.end() || it->first != key ? ~GLuint(0) : it->second;
+  }
+
+  // offset of the buffer name or address within a token, 0 for tokens without
+  static inline size_t nvtokenFileRelocField(GLenum type)
+  {
+    switch(type){
+    case GL_ELEMENT_ADDRESS_COMMAND_NV:
+      return s_nvcmdlist_bindless ? offsetof(ElementAddressCommandNV, addressLo) : offsetof(ElementAddressCommandEMU, buffer);
+    case GL_ATTRIBUTE_ADDRESS_COMMAND_NV:
+      return s_nvcmdlist_bindless ? offsetof(AttributeAddressCommandNV, addressLo) : offsetof(AttributeAddressCommandEMU, buffer);
+    case GL_UNIFORM_ADDRESS_COMMAND_NV:
+      return s_nvcmdlist_bindless ? offsetof(UniformAddressCommandNV, addressLo) : offsetof(UniformAddressCommandEMU, buffer);
+    default:
+      return 0;
+    }
+  }
+
+  static bool nvtokenFileWrite(FILE* file, GLuint64& pos, GLuint64 at, const void* data, size_t size)
+  {
+    static const GLubyte zeros[16] = {0};
+    while (pos < at){
+      size_t pad = size_t(std::min(at - pos, GLuint64(sizeof(zeros))));
+      if (fwrite(zeros, 1, pad, file) != pad) return false;
+      pos += pad;
+    }
+    if (size && fwrite(data, 1, size, file) != size) return false;
+    pos += size;
+    return true;
+  }
+
+  bool nvtokenSaveFile( const char* filename, const void* NV_RESTRICT stream, size_t streamSize,
+                        const NVTokenSequence& seq, const NVTokenObjectTable& objects )
+  {
+    NVTokenFileRefMap buffers;
+    NVTokenFileRefMap states;
+    NVTokenFileRefMap fbos;
+    for (GLuint i = 0; i < objects.numBuffers; i++){
+      buffers.push_back(std::make_pair(s_nvcmdlist_bindless ? objects.buffers[i].address : GLuint64(objects.buffers[i].buffer), i));
+    }
+    for (GLuint i = 0; i < objects.numStates; i++){
+      states.push_back(std::make_pair(GLuint64(objects.states[i]), i));
+    }
+    for (GLuint i = 0; i < objects.numFbos; i++){
+      fbos.push_back(std::make_pair(GLuint64(objects.fbos[i]), i));
+    }
+    std::sort(buffers.begin(), buffers.end());
+    std::sort(states.begin(), states.end());
+    std::sort(fbos.begin(), fbos.end());
+
+    // derive the relocations from the tokens
+    std::vector<NVTokenFileReloc> relocs;
+    const GLubyte* NV_RESTRICT tokens = (const GLubyte*)stream;
+    size_t current = 0;
+    while (current < streamSize){
+      GLenum type = nvtokenHeaderLookup(*(const GLuint*)&tokens[current]);
+      if (type >= NVTOKEN_TYPES){
+        return false;
+      }
+
+      size_t field = nvtokenFileRelocField(type);
+      if (field){
+        NVTokenFileReloc reloc;
+        reloc.fieldOffset = current + field;
+        reloc._pad = 0;
+
+        if (s_nvcmdlist_bindless){
+          GLuint address[2];
+          memcpy(address, &tokens[current + field], sizeof(address));
+          GLuint64 key = GLuint64(address[0]) | (GLuint64(address[1])<<32);
+
+          reloc.buffer = nvtokenFileRefFind(buffers, key);
+          if (reloc.buffer == ~GLuint(0) || key - objects.buffers[reloc.buffer].address >= objects.buffers[reloc.buffer].size){
+            return false;
+          }
+          reloc.bufferOffset = key - objects.buffers[reloc.buffer].address;
+        }
+        else{
+          reloc.buffer = nvtokenFileRefFindExact(buffers, *(const GLuint*)&tokens[current + field]);
+          if (reloc.buffer == ~GLuint(0)){
+            return false;
+          }
+          reloc.bufferOffset = 0;
+        }
+        relocs.push_back(reloc);
+      }
+
+      current += s_nvcmdlist_types.sizes[type];
+    }
+
+    // sequences store table indices, fbos are biased by one to keep 0
+    size_t numSequences = seq.offsets.size();
+    std::vector<GLuint64> seqOffsets(numSequences);
+    std::vector<GLuint>   seqSizes(numSequences);
+    std::vector<GLuint>   seqStates(numSequences);
+    std::vector<GLuint>   seqFbos(numSequences);
+    for (size_t i = 0; i < numSequences; i++){
+      seqOffsets[i] = GLuint64(seq.offsets[i]);
+      seqSizes[i]   = GLuint(seq.sizes[i]);
+      seqStates[i]  = nvtokenFileRefFindExact(states, seq.states[i]);
+      seqFbos[i]    = seq.fbos[i] ? nvtokenFileRefFindExact(fbos, seq.fbos[i]) + 1 : 0;
+      if (seqStates[i] == ~GLuint(0) || (seqFbos[i] == 0 && seq.fbos[i])){
+        return false;
+      }
+    }
+
+    NVTokenFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic          = NVTOKEN_FILE_MAGIC;
+    header.version        = NVTOKEN_FILE_VERSION;
+    header.bindless       = s_nvcmdlist_bindless;
+    header.numTypes       = NVTOKEN_TYPES;
+    header.tokenOffset    = nvtokenFileAlign(sizeof(NVTokenFileHeader), 16);
+    header.tokenSize      = streamSize;
+    header.sequenceOffset = nvtokenFileAlign(header.tokenOffset + streamSize, 8);
+    header.relocOffset    = nvtokenFileAlign(header.sequenceOffset + nvtokenFileSequenceBytes(numSequences), 8);
+    header.numRelocs      = relocs.size();
+    header.fileSize       = header.relocOffset + relocs.size() * sizeof(NVTokenFileReloc);
+    header.numSequences   = GLuint(numSequences);
+    header.numBuffers     = objects.numBuffers;
+    header.numStates      = objects.numStates;
+    header.numFbos        = objects.numFbos;
+    memcpy(header.headers, s_nvcmdlist_header, sizeof(header.headers));
+
+    FILE* file = fopen(filename, "wb");
+    if (!file){
+      return false;
+    }
+
+    GLuint64 pos = 0;
+    bool okay = nvtokenFileWrite(file, pos, 0, &header, sizeof(header))
+             && nvtokenFileWrite(file, pos, header.tokenOffset, stream, streamSize)
+             && nvtokenFileWrite(file, pos, header.sequenceOffset, seqOffsets.data(), numSequences * sizeof(GLuint64))
+             && nvtokenFileWrite(file, pos, pos, seqSizes.data(), numSequences * sizeof(GLuint))
+             && nvtokenFileWrite(file, pos, pos, seqStates.data(), numSequences * sizeof(GLuint))
+             && nvtokenFileWrite(file, pos, pos, seqFbos.data(), numSequences * sizeof(GLuint))
+             && nvtokenFileWrite(file, pos, header.relocOffset, relocs.data(), relocs.size() * sizeof(NVTokenFileReloc));
+
+    okay = fclose(file) == 0 && okay;
+    if (!okay){
+      remove(filename);
+    }
+    return okay;
+  }
+
+  // maps the file copy-on-write, so patching does not modify it
+  static void* nvtokenFileMap(const char* filename, size_t& size)
+  {
+    void* view = NULL;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE){
+      return NULL;
+    }
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0){
+      HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+      if (mapping){
+        // the view keeps the mapping alive
+        view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+        CloseHandle(mapping);
+      }
+      size = size_t(fileSize.QuadPart);
+    }
+    CloseHandle(file);
+#else
+    int file = open(filename, O_RDONLY);
+    if (file < 0){
+      return NULL;
+    }
+    struct stat info;
+    if (fstat(file, &info) == 0 && info.st_size > 0){
+      view = mmap(NULL, size_t(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+      if (view == MAP_FAILED){
+        view = NULL;
+      }
+      size = size_t(info.st_size);
+    }
+    close(file);
+#endif
+    return view;
+  }
+
+  static void nvtokenFileUnmap(void* view, size_t size)
+  {
+#ifdef _WIN32
+    UnmapViewOfFile(view);
+#else
+    munmap(view, size);
+#endif
+  }
+
+  void NVTokenFile::unload()
+  {
+    if (m_mapping){
+      nvtokenFileUnmap(m_mapping, m_mappingSize);
+    }
+    m_mapping     = NULL;
+    m_mappingSize = 0;
+    m_data        = NULL;
+    m_size        = 0;
+  }
+
+  // patches the buffer field of the token at tokenOffset, fails if the
+  // field or the range the token refers to is outside of the buffer
+  static bool nvtokenFileRelocate(unsigned char* tokens, size_t tokenSize, size_t tokenOffset, GLenum type,
+                                  const NVTokenFileReloc& reloc, const NVTokenObjectTable& objects)
+  {
+    size_t fieldSize = s_nvcmdlist_bindless ? sizeof(GLuint64) : sizeof(GLuint);
+    if (reloc.buffer >= objects.numBuffers || fieldSize > tokenSize || reloc.fieldOffset > tokenSize - fieldSize){
+      return false;
+    }
+
+    const NVTokenBufferRef& ref = objects.buffers[reloc.buffer];
+    const unsigned char* token = tokens + tokenOffset;
+    if (s_nvcmdlist_bindless){
+      if (reloc.bufferOffset >= ref.size){
+        return false;
+      }
+      GLuint64 address = ref.address + reloc.bufferOffset;
+      GLuint   split[2] = { GLuint(address), GLuint(address>>32) };
+      memcpy(tokens + reloc.fieldOffset, split, sizeof(split));
+    }
+    else{
+      if (type == GL_UNIFORM_ADDRESS_COMMAND_NV){
+        const UniformAddressCommandEMU* cmd = (const UniformAddressCommandEMU*)token;
+        if (GLuint64(cmd->offset256) * 256 + GLuint64(cmd->size4) * 4 > ref.size){
+          return false;
+        }
+      }
+      else if (type == GL_ATTRIBUTE_ADDRESS_COMMAND_NV){
+        const AttributeAddressCommandEMU* cmd = (const AttributeAddressCommandEMU*)token;
+        if (cmd->offset >= ref.size){
+          return false;
+        }
+      }
+      memcpy(tokens + reloc.fieldOffset, &ref.buffer, sizeof(GLuint));
+    }
+    return true;
+  }
+
+  bool NVTokenFile::load(const char* filename, const NVTokenObjectTable& objects, NVTokenSequence& seq)
+  {
+    unload();
+
+    m_mapping = nvtokenFileMap(filename, m_mappingSize);
+    if (!m_mapping){
+      return false;
+    }
+
+    unsigned char* base = (unsigned char*)m_mapping;
+    const NVTokenFileHeader& header = *(const NVTokenFileHeader*)base;
+
+    GLuint64 fileSize = m_mappingSize;
+    if (fileSize < sizeof(NVTokenFileHeader) ||
+        header.magic    != NVTOKEN_FILE_MAGIC ||
+        header.version  != NVTOKEN_FILE_VERSION ||
+        header.numTypes != NVTOKEN_TYPES ||
+        header.fileSize != fileSize ||
+        header.bindless != GLuint(s_nvcmdlist_bindless) ||
+        header.numBuffers != objects.numBuffers ||
+        header.numStates  != objects.numStates ||
+        header.numFbos    != objects.numFbos ||
+        header.tokenOffset % 4 || header.sequenceOffset % 8 || header.relocOffset % 8 ||
+        header.tokenOffset > fileSize || header.tokenSize > fileSize - header.tokenOffset ||
+        header.sequenceOffset > fileSize || nvtokenFileSequenceBytes(header.numSequences) > fileSize - header.sequenceOffset ||
+        header.relocOffset > fileSize || header.numRelocs > (fileSize - header.relocOffset) / sizeof(NVTokenFileReloc))
+    {
+      unload();
+      return false;
+    }
+
+    m_data = base + header.tokenOffset;
+    m_size = size_t(header.tokenSize);
+
+    // walk the tokens to re-encode the headers of hw tokens, which are
+    // driver specific, if they changed, and to patch the relocations. These
+    // were written in token order, one per token with a buffer field.
+    bool reencode = memcmp(header.headers, s_nvcmdlist_header, sizeof(header.headers)) != 0;
+    const NVTokenFileReloc* relocs = (const NVTokenFileReloc*)(base + header.relocOffset);
+    GLuint64 numRelocs = 0;
+    size_t current = 0;
+    while (current < m_size){
+      GLuint* tokenHeader = (GLuint*)(m_data + current);
+      GLenum  type = 0;
+      if (m_size - current < sizeof(GLuint)){
+        type = NVTOKEN_TYPES;
+      }
+      else if (reencode){
+        while (type < NVTOKEN_TYPES && header.headers[type] != *tokenHeader){
+          type++;
+        }
+      }
+      else{
+        type = nvtokenHeaderLookup(*tokenHeader);
+      }
+      if (type >= NVTOKEN_TYPES || s_nvcmdlist_types.sizes[type] > m_size - current){
+        unload();
+        return false;
+      }
+      if (reencode){
+        *tokenHeader = s_nvcmdlist_header[type];
+      }
+
+      size_t field = nvtokenFileRelocField(type);
+      if (field){
+        if (numRelocs == header.numRelocs || relocs[numRelocs].fieldOffset != current + field ||
+            !nvtokenFileRelocate(m_data, m_size, current, type, relocs[numRelocs], objects))
+        {
+          unload();
+          return false;
+        }
+        numRelocs++;
+      }
+
+      current += s_nvcmdlist_types.sizes[type];
+    }
+    if (numRelocs != header.numRelocs){
+      unload();
+      return false;
+    }
+
+    size_t numSequences = header.numSequences;
+    const GLuint64* seqOffsets = (const GLuint64*)(base + header.sequenceOffset);
+    const GLuint*   seqSizes   = (const GLuint*)(seqOffsets + numSequences);
+    const GLuint*   seqStates  = seqSizes + numSequences;
+    const GLuint*   seqFbos    = seqStates + numSequences;
+
+    seq.offsets.resize(numSequences);
+    seq.sizes.resize(numSequences);
+    seq.states.resize(numSequences);
+    seq.fbos.resize(numSequences);
+    for (size_t i = 0; i < numSequences; i++){
+      if (seqStates[i] >= objects.numStates || seqFbos[i] > objects.numFbos){
+        seq = NVTokenSequence();
+        unload();
+        return false;
+      }
+      seq.offsets[i] = GLintptr(seqOffsets[i]);
+      seq.sizes[i]   = GLsizei(seqSizes[i]);
+      seq.states[i]  = objects.states[seqStates[i]];
+      seq.fbos[i]    = seqFbos[i] ? objects.fbos[seqFbos[i] - 1] : 0;
+    }
+
+    if (nvtokenValidate(m_data, m_size, seq.offsets.data(), seq.sizes.data(), GLuint(numSequences)) != NVTOKEN_VALID){
+      seq = NVTokenSequence();
+      unload();
+      return false;
+    }
+
+    return true;
+  }
+
+
+  // Emulation related
+
+  #define NVTOKEN_MULTIDRAW_VBOS  16
+
+  // bindings seen by the multi-draw emulation within the current sequence
+  struct NVTokenMultiDrawState {
+    NVTokenMultiDraw* NV_RESTRICT config;
+    GLuint        vbos[NVTOKEN_MULTIDRAW_VBOS][sizeof(NVTokenVbo) / sizeof(GLuint)];
+    GLuint        ibo[sizeof(NVTokenIbo) / sizeof(GLuint)];
+    GLuint        baseInstance;
+
+    void reset()
+    {
+      // zeroed tokens never match a valid header
+      memset(vbos, 0, sizeof(vbos));
+      memset(ibo, 0, sizeof(ibo));
+      baseInstance = 0;
+    }
+  };
+
+  // binds of the emulation, filtered by the shadow state if set,
+  // return whether the call was issued
+
+  static NV_INLINE bool nvtokenBindBuffer(ShadowState* shadow, GLenum target, GLuint buffer)
+  {
+    if (shadow) return shadow->bindBuffer(target, buffer);
+    glBindBuffer(target, buffer);
+    return true;
+  }
+
+  static NV_INLINE bool nvtokenBindBufferRange(ShadowState* shadow, GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+  {
+    if (shadow) return shadow->bindBufferRange(target, index, buffer, offset, size);
+    glBindBufferRange(target, index, buffer, offset, size);
+    return true;
+  }
+
+  static NV_INLINE bool nvtokenBindVertexBuffer(ShadowState* shadow, GLuint index, GLuint buffer, GLintptr offset, GLsizei stride)
+  {
+    if (shadow) return shadow->bindVertexBuffer(index, buffer, offset, stride);
+    glBindVertexBuffer(index, buffer, offset, stride);
+    return true;
+  }
+
+  static NV_INLINE bool nvtokenBufferAddressRange(ShadowState* shadow, GLenum pname, GLuint index, GLuint64 address, GLsizeiptr length)
+  {
+    if (shadow) return shadow->bufferAddressRangeNV(pname, index, address, length);
+    glBufferAddressRangeNV(pname, index, address, length);
+    return true;
+  }
+
+  static NV_INLINE bool nvtokenBindFramebuffer(ShadowState* shadow, GLenum target, GLuint fbo)
+  {
+    if (shadow) return shadow->bindFramebuffer(target, fbo);
+    glBindFramebuffer(target, fbo);
+    return true;
+  }
+
+  static NV_INLINE void nvtokenCountCall(NVTokenEmulationStats& stats, bool issued)
+  {
+    stats.glCalls += issued;
+    stats.filteredCalls += !issued;
+  }
+
+  // returns true if the token was recorded or is redundant, otherwise
+  // pending draws must be flushed before the token is executed
+  static NV_INLINE bool nvtokenMultiDrawRecord(NVTokenMultiDrawState& multi, const GLubyte* NV_RESTRICT current, GLenum cmdtype, NVTokenEmulationStats& stats)
+  {
+    switch(cmdtype){
+    case GL_DRAW_ELEMENTS_COMMAND_NV:
+      {
+        const DrawElementsCommandNV* cmd = (const DrawElementsCommandNV*)current;
+        NVTokenDrawIndirect indirect;
+        indirect.count          = cmd->count;
+        indirect.instanceCount  = 1;
+        indirect.firstIndex     = cmd->firstIndex;
+        indirect.baseVertex     = GLint(cmd->baseVertex);
+        indirect.baseInstance   = multi.baseInstance;
+        multi.config->commands.push_back(indirect);
+        stats.draws++;
+      }
+      return true;
+    case GL_UNIFORM_ADDRESS_COMMAND_NV:
+      {
+        const UniformAddressCommandNV* cmd = (const UniformAddressCommandNV*)current;
+        if (cmd->index != multi.config->uboIndex){
+          return false;
+        }
+
+        GLuint64 offset;
+        if (s_nvcmdlist_bindless){
+          offset = (GLuint64(cmd->addressLo) | (GLuint64(cmd->addressHi)<<32)) - multi.config->uboAddress;
+        }
+        else{
+          const UniformAddressCommandEMU* cmdEMU = (const UniformAddressCommandEMU*)current;
+          assert(cmdEMU->buffer == multi.config->uboBuffer);
+          offset = GLuint64(cmdEMU->offset256) * 256;
+        }
+        multi.baseInstance = GLuint(offset / multi.config->uboStride);
+      }
+      return true;
+    case GL_ATTRIBUTE_ADDRESS_COMMAND_NV:
+      {
+        const AttributeAddressCommandNV* cmd = (const AttributeAddressCommandNV*)current;
+        if (cmd->index >= NVTOKEN_MULTIDRAW_VBOS){
+          return false;
+        }
+        if (memcmp(multi.vbos[cmd->index], current, sizeof(NVTokenVbo)) == 0){
+          return true;
+        }
+        memcpy(multi.vbos[cmd->index], current, sizeof(NVTokenVbo));
+      }
+      return false;
+    case GL_ELEMENT_ADDRESS_COMMAND_NV:
+      {
+        if (memcmp(multi.ibo, current, sizeof(NVTokenIbo)) == 0){
+          return true;
+        }
+        memcpy(multi.ibo, current, sizeof(NVTokenIbo));
+      }
+      return false;
+    default:
+      return false;
+    }
+  }
+
+  static NV_INLINE void nvtokenMultiDrawFlush(NVTokenMultiDrawState& multi, GLenum mode, GLenum type, NVTokenEmulationStats& stats)
+  {
+    std::vector<NVTokenDrawIndirect>& commands = multi.config->commands;
+    if (!commands.empty()){
+      // like the instanced emulation this sources the commands from client memory
+      glMultiDrawElementsIndirect(mode, type, commands.data(), GLsizei(commands.size()), 0);
+      stats.glCalls++;
+      commands.clear();
+    }
+  }
+
+  // Draws other than DrawElements are not batched, but the programs still
+  // fetch the object data via gl_BaseInstanceARB, as the ubo tokens were
+  // swallowed. They are issued as single indirect draws with the current
+  // baseInstance (added to the one of instanced tokens).
+  // returns false if the token is no draw
+  static NV_INLINE bool nvtokenMultiDrawSingle(const NVTokenMultiDrawState& multi, const GLubyte* NV_RESTRICT current, GLenum cmdtype, GLenum mode, GLenum modeStrip, GLenum type, NVTokenEmulationStats& stats)
+  {
+    switch(cmdtype){
+    case GL_DRAW_ARRAYS_COMMAND_NV:
+    case GL_DRAW_ARRAYS_STRIP_COMMAND_NV:
+      {
+        const DrawArraysCommandNV* cmd = (const DrawArraysCommandNV*)current;
+        GLuint indirect[4] = { cmd->count, 1, cmd->first, multi.baseInstance };
+        glDrawArraysIndirect(cmdtype == GL_DRAW_ARRAYS_STRIP_COMMAND_NV ? modeStrip : mode, indirect);
+      }
+      break;
+    case GL_DRAW_ELEMENTS_STRIP_COMMAND_NV:
+      {
+        const DrawElementsCommandNV* cmd = (const DrawElementsCommandNV*)current;
+        NVTokenDrawIndirect indirect;
+        indirect.count          = cmd->count;
+        indirect.instanceCount  = 1;
+        indirect.firstIndex     = cmd->firstIndex;
+        indirect.baseVertex     = GLint(cmd->baseVertex);
+        indirect.baseInstance   = multi.baseInstance;
+        glDrawElementsIndirect(modeStrip, type, &indirect);
+      }
+      break;
+    case GL_DRAW_ELEMENTS_INSTANCED_COMMAND_NV:
+      {
+        const DrawElementsInstancedCommandNV* cmd = (const DrawElementsInstancedCommandNV*)current;
+        NVTokenDrawIndirect indirect;
+        indirect.count          = cmd->count;
+        indirect.instanceCount  = cmd->instanceCount;
+        indirect.firstIndex     = cmd->firstIndex;
+        indirect.baseVertex     = GLint(cmd->baseVertex);
+        indirect.baseInstance   = cmd->baseInstance + multi.baseInstance;
+        glDrawElementsIndirect(cmd->mode, type, &indirect);
+      }
+      break;
+    case GL_DRAW_ARRAYS_INSTANCED_COMMAND_NV:
+      {
+        const DrawArraysInstancedCommandNV* cmd = (const DrawArraysInstancedCommandNV*)current;
+        GLuint indirect[4] = { cmd->count, cmd->instanceCount, cmd->first, cmd->baseInstance + multi.baseInstance };
+        glDrawArraysIndirect(cmd->mode, indirect);
+      }
+      break;
+    default:
+      return false;
+    }
+
+    stats.glCalls++;
+    stats.draws++;
+    return true;
+  }
+
+  template <bool MULTI>
+  static NV_INLINE GLenum nvtokenDrawCommandSequenceSW( const void* NV_RESTRICT stream, size_t streamSize, GLenum mode, GLenum type, const StateSystem::State& state, NVTokenEmulationStats& stats, NVTokenMultiDrawState* multi ) 
+  {
+    const GLubyte* NV_RESTRICT current = (GLubyte*)stream;
+    const GLubyte* streamEnd = current + streamSize;
+    ShadowState* shadow = s_nvcmdlist_shadow;
+
+    GLenum modeStrip;
+    if      (mode == GL_LINES)                modeStrip = GL_LINE_STRIP;
+    else if (mode == GL_TRIANGLES)            modeStrip = GL_TRIANGLE_STRIP;
+    /* else if (mode == GL_QUADS)                modeStrip = GL_QUAD_STRIP; */
+    else if (mode == GL_LINES_ADJACENCY)      modeStrip = GL_LINE_STRIP_ADJACENCY;
+    else if (mode == GL_TRIANGLES_ADJACENCY)  modeStrip = GL_TRIANGLE_STRIP_ADJACENCY;
+    else    modeStrip = mode;
+
+    GLenum modeSpecial;
+    if      (mode == GL_LINES)      modeSpecial = GL_LINE_LOOP;
+    else if (mode == GL_TRIANGLES)  modeSpecial = GL_TRIANGLE_FAN;
+    else    modeSpecial = mode;
+
+    while (current < streamEnd){
+      const GLuint*             header  = (const GLuint*)current;
+
+      GLenum cmdtype = nvtokenHeaderCommand(*header);
+      stats.tokens++;
+      // if you always use emulation on non-native tokens you can use 
+      // cmdtype = nvtokenHeaderCommandSW(header->encoded)
+
+      if (MULTI){
+        if (nvtokenMultiDrawRecord(*multi, current, cmdtype, stats)){
+          current += s_nvcmdlist_types.sizes[cmdtype];
+          continue;
+        }
+        nvtokenMultiDrawFlush(*multi, mode, type, stats);
+        if (nvtokenMultiDrawSingle(*multi, current, cmdtype, mode, modeStrip, type, stats)){
+          current += s_nvcmdlist_types.sizes[cmdtype];
+          continue;
+        }
+      }
+
+      switch(cmdtype){
+      case GL_TERMINATE_SEQUENCE_COMMAND_NV:
+        {
+          return type;
+        }
+        break;
+      case GL_NOP_COMMAND_NV:
+        {
+        }
+        current += sizeof(NVTokenNop);
+        break;
+      case GL_DRAW_ELEMENTS_COMMAND_NV:
+        {
+          stats.glCalls++;
+          stats.draws++;
+          const DrawElementsCommandNV* cmd = (const DrawElementsCommandNV*)current;
+          glDrawElementsBaseVertex(mode, cmd->count, type, (const GLvoid*)(cmd->firstIndex * sizeof(GLuint)), cmd->baseVertex);
+        }
+        current += sizeof(NVTokenDrawElems);
+        break;
+      case GL_DRAW_ARRAYS_COMMAND_NV:
+        {
+          stats.glCalls++;
+          stats.draws++;
+          const DrawArraysCommandNV* cmd = (const DrawArraysCommandNV*)current;
+          glDrawArrays(mode, cmd->first, cmd->count);
+        }
+        current += sizeof(NVTokenDrawArrays);
+        break;
+      case GL_DRAW_ELEMENTS_STRIP_COMMAND_NV:
+        {
+          stats.glCalls++;
+          stats.draws++;
+          const DrawElementsCommandNV* cmd = (const DrawElementsCommandNV*)current;
+          glDrawElementsBaseVertex(modeStrip, cmd->count, type, (const GLvoid*)(cmd->firstIndex * sizeof(GLuint)), cmd->baseVertex);
+        }
+        current += sizeof(NVTokenDrawElemsStrip);
+        break;
+      case GL_DRAW_ARRAYS_STRIP_COMMAND_NV:
+        {
+          stats.glCalls++;
+          stats.draws++;
+          const DrawArraysCommandNV* cmd = (const DrawArraysCommandNV*)current;
+          glDrawArrays(modeStrip, cmd->first, cmd->count);
+        }
+        current += sizeof(NVTokenDrawArraysStrip);
+        break;
+      case GL_DRAW_ELEMENTS_INSTANCED_COMMAND_NV:
+        {
+          stats.glCalls++;
+          stats.draws++;
+          const DrawElementsInstancedCommandNV* cmd = (const DrawElementsInstancedCommandNV*)current;
+
+          assert (cmd->mode == mode || cmd->mode == modeStrip || cmd->mode == modeSpecial);
+
+          glDrawElementsIndirect(cmd->mode, type, &cmd->count);
+        }
+        current += sizeof(NVTokenDrawElemsInstanced);
+        break;
+      case GL_DRAW_ARRAYS_INSTANCED_COMMAND_NV:
+        {
+          stats.glCalls++;
+          stats.draws++;
+          const DrawArraysInstancedCommandNV* cmd = (const DrawArraysInstancedCommandNV*)current;
+
+          assert (cmd->mode == mode || cmd->mode == modeStrip || cmd->mode == modeSpecial);
+
+          glDrawArraysIndirect(cmd->mode, &cmd->count);
+        }
+        current += sizeof(NVTokenDrawArraysInstanced);
+        break;
+      case GL_ELEMENT_ADDRESS_COMMAND_NV:
+        {
+          const ElementAddressCommandNV* cmd = (const ElementAddressCommandNV*)current;
+          type = cmd->typeSizeInByte == 4 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+          if (s_nvcmdlist_bindless){
+            nvtokenCountCall(stats, nvtokenBufferAddressRange(shadow, GL_ELEMENT_ARRAY_ADDRESS_NV, 0, GLuint64(cmd->addressLo) | (GLuint64(cmd->addressHi)<<32), 0x7FFFFFFF));
+          }
+          else{
+            const ElementAddressCommandEMU* cmd = (const ElementAddressCommandEMU*)current;
+            nvtokenCountCall(stats, nvtokenBindBuffer(shadow, GL_ELEMENT_ARRAY_BUFFER, cmd->buffer));
+          }
+        }
+        current += sizeof(NVTokenIbo);
+        break;
+      case GL_ATTRIBUTE_ADDRESS_COMMAND_NV:
+        {
+          if (s_nvcmdlist_bindless){
+            const AttributeAddressCommandNV* cmd = (const AttributeAddressCommandNV*)current;
+            nvtokenCountCall(stats, nvtokenBufferAddressRange(shadow, GL_VERTEX_ATTRIB_ARRAY_ADDRESS_NV, cmd->index, GLuint64(cmd->addressLo) | (GLuint64(cmd->addressHi)<<32), 0x7FFFFFFF));
+          }
+          else{
+            const AttributeAddressCommandEMU* cmd = (const AttributeAddressCommandEMU*)current;
+            nvtokenCountCall(stats, nvtokenBindVertexBuffer(shadow, cmd->index, cmd->buffer, cmd->offset, state.vertexformat.bindings[cmd->index].stride));
+          }
+        }
+        current += sizeof(NVTokenVbo);
+        break;
+      case GL_UNIFORM_ADDRESS_COMMAND_NV:
+        {
+           if (s_nvcmdlist_bindless){
+            const UniformAddressCommandNV* cmd = (const UniformAddressCommandNV*)current;
+            nvtokenCountCall(stats, nvtokenBufferAddressRange(shadow, GL_UNIFORM_BUFFER_ADDRESS_NV, cmd->index, GLuint64(cmd->addressLo) | (GLuint64(cmd->addressHi)<<32), 0x10000));
+          }
+          else{
+            const UniformAddressCommandEMU* cmd = (const UniformAddressCommandEMU*)current;
+            nvtokenCountCall(stats, nvtokenBindBufferRange(shadow, GL_UNIFORM_BUFFER,cmd->index, cmd->buffer, cmd->offset256 * 256, cmd->size4*4));
+          }
+        }
+        current += sizeof(NVTokenUbo);
+        break;
+      case GL_BLEND_COLOR_COMMAND_NV:
+        {
+          stats.glCalls++;
+          const BlendColorCommandNV* cmd = (const BlendColorCommandNV*)current;
+          glBlendColor(cmd->red,cmd->green,cmd->blue,cmd->alpha);
+        }
+        current += sizeof(NVTokenBlendColor);
+        break;
+      case GL_STENCIL_REF_COMMAND_NV:
+        {
+          stats.glCalls += 2;
+          const StencilRefCommandNV* cmd = (const StencilRefCommandNV*)current;
+          glStencilFuncSeparate(GL_FRONT, state.stencil.funcs[StateSystem::FACE_FRONT].func, cmd->frontStencilRef, state.stencil.funcs[StateSystem::FACE_FRONT].mask);
+          glStencilFuncSeparate(GL_BACK,  state.stencil.funcs[StateSystem::FACE_BACK ].func, cmd->backStencilRef,  state.stencil.funcs[StateSystem::FACE_BACK ].mask);
+        }
+        current += sizeof(NVTokenStencilRef);
+        break;
+
+      case GL_LINE_WIDTH_COMMAND_NV:
+        {
+          stats.glCalls++;
+          const LineWidthCommandNV* cmd = (const LineWidthCommandNV*)current;
+          glLineWidth(cmd->lineWidth);
+        }
+        current += sizeof(NVTokenLineWidth);
+        break;
+      case GL_POLYGON_OFFSET_COMMAND_NV:
+        {
+          stats.glCalls++;
+          const PolygonOffsetCommandNV* cmd = (const PolygonOffsetCommandNV*)current;
+          glPolygonOffset(cmd->scale,cmd->bias);
+        }
+        current += sizeof(NVTokenPolygonOffset);
+        break;
+      case GL_ALPHA_REF_COMMAND_NV:
+        { /*
+          const AlphaRefCommandNV* cmd = (const AlphaRefCommandNV*)current;
+          glAlphaFunc(state.alpha.mode, cmd->alphaRef);
+          */
+        }
+        current += sizeof(NVTokenAlphaRef);
+        break;
+      case GL_VIEWPORT_COMMAND_NV:
+        {
+          stats.glCalls++;
+          const ViewportCommandNV* cmd = (const ViewportCommandNV*)current;
+          glViewport(cmd->x, cmd->y, cmd->width, cmd->height);
+        }
+        current += sizeof(NVTokenViewport);
+        break;
+      case GL_SCISSOR_COMMAND_NV:
+        {
+          stats.glCalls++;
+          const ScissorCommandNV* cmd = (const ScissorCommandNV*)current;
+          glScissor(cmd->x,cmd->y,cmd->width,cmd->height);
+        }
+        current += sizeof(NVTokenScissor);
+        break;
+      case GL_FRONT_FACE_COMMAND_NV:
+        {
+          stats.glCalls++;
+          FrontFaceCommandNV* cmd = (FrontFaceCommandNV*)current;
+          glFrontFace(cmd->frontFace?GL_CW:GL_CCW);
+        }
+        current += sizeof(NVTokenFrontFace);
+        break;
+      default:
+        // unknown header, the size is not known either, so skip the rest
+        // (streams from untrusted sources should pass nvtokenValidate first)
+        return type;
+      }
+    }
+
+    if (MULTI){
+      nvtokenMultiDrawFlush(*multi, mode, type, stats);
+    }
+    return type;
+  }
+
+  void nvtokenDrawCommandsSW(GLenum mode, const void* NV_RESTRICT stream, size_t streamSize, 
+    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
+    GLuint count, 
+    StateSystem::State &state, NVTokenEmulationStats* stats)
+  {
+    NVTokenEmulationStats result = {0};
+    const char* NV_RESTRICT tokens = (const char*)stream;
+    GLenum type = GL_UNSIGNED_SHORT;
+    for (GLuint i = 0; i < count; i++)
+    {
+      size_t offset = offsets[i];
+      size_t size   = sizes[i];
+
+      assert(size + offset <= streamSize);
+
+      type = nvtokenDrawCommandSequenceSW<false>(&tokens[offset], size, mode, type, state, result, NULL);
+    }
+    result.sequences = count;
+
+    if (stats){
+      *stats = result;
+    }
+  }
+
+#if NVTOKEN_STATESYSTEM
+  template <bool MULTI>
+  static void nvtokenDrawCommandsStates(const void* NV_RESTRICT stream, size_t streamSize, 
+    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
+    const GLuint* NV_RESTRICT states, const GLuint* NV_RESTRICT fbos, GLuint count, 
+    StateSystem &stateSystem, NVTokenEmulationStats* stats, NVTokenMultiDraw* multiConfig)
+  {
+    NVTokenMultiDrawState multi;
+    multi.config = multiConfig;
+
+    NVTokenEmulationStats result = {0};
+    int lastFbo = ~0;
+    const char* NV_RESTRICT tokens = (const char*)stream;
+
+    StateSystem::StateID lastID;
+
+    GLenum type = GL_UNSIGNED_SHORT;
+    for (GLuint i = 0; i < count; i++)
+    {
+      GLuint fbo;
+
+      StateSystem::StateID curID = states[i];
+      const StateSystem::State&  state = stateSystem.get(curID);
+
+      if (fbos[i]){
+        fbo = fbos[i];
+      }
+      else{
+        fbo = state.fbo.fboDraw;
+      }
+
+      if (fbo != lastFbo){
+        nvtokenCountCall(result, nvtokenBindFramebuffer(s_nvcmdlist_shadow, GL_FRAMEBUFFER, fbo));
+        lastFbo = fbo;
+        result.fboChanges++;
+      }
+
+      if (i == 0){
+        stateSystem.applyGL( curID, true ); // quite costly
+        result.stateChanges++;
+      }
+      else {
+        stateSystem.applyGL( curID, lastID, true );
+        result.stateChanges += curID != lastID;
+      }
+      lastID = curID;
+
+      size_t offset = offsets[i];
+      size_t size   = sizes[i];
+
+      GLenum mode = state.basePrimitiveMode;
+
+      assert(size + offset <= streamSize);
+
+      if (MULTI){
+        // state changes may touch the vertex and element bindings
+        multi.reset();
+      }
+
+      type = nvtokenDrawCommandSequenceSW<MULTI>(&tokens[offset], size, mode, type, state, result, &multi);
+    }
+    result.sequences = count;
+
+    if (stats){
+      *stats = result;
+    }
+  }
+
+  void nvtokenDrawCommandsStatesSW(const void* NV_RESTRICT stream, size_t streamSize, 
+    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
+    const GLuint* NV_RESTRICT states, const GLuint* NV_RESTRICT fbos, GLuint count, 
+    StateSystem &stateSystem, NVTokenEmulationStats* stats)
+  {
+    nvtokenDrawCommandsStates<false>(stream, streamSize, offsets, sizes, states, fbos, count, stateSystem, stats, NULL);
+  }
+
+  void nvtokenDrawCommandsStatesMultiSW(const void* NV_RESTRICT stream, size_t streamSize, 
+    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
+    const GLuint* NV_RESTRICT states, const GLuint* NV_RESTRICT fbos, GLuint count, 
+    StateSystem &stateSystem, NVTokenMultiDraw& multi, NVTokenEmulationStats* stats)
+  {
+    nvtokenDrawCommandsStates<true>(stream, streamSize, offsets, sizes, states, fbos, count, stateSystem, stats, &multi);
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // compiled emulation
+
+  enum NVTokenCompiledOp {
+    NVTOKEN_OP_STATE,                   // numWords, StateSystem::OpList words[numWords]
+    NVTOKEN_OP_BIND_FRAMEBUFFER,        // fbo
+    NVTOKEN_OP_DRAW_ELEMENTS,           // mode, count, type (0 inherited), firstIndex, baseVertex
+    NVTOKEN_OP_DRAW_ARRAYS,             // mode, first, count
+    NVTOKEN_OP_DRAW_ELEMENTS_INDIRECT,  // mode, type (0 inherited), count, instanceCount, firstIndex, baseVertex, baseInstance
+    NVTOKEN_OP_DRAW_ARRAYS_INDIRECT,    // mode, count, instanceCount, first, baseInstance
+    NVTOKEN_OP_ADDRESS_RANGE,           // pname, index, addressLo, addressHi, length
+    NVTOKEN_OP_BIND_BUFFER,             // target, buffer
+    NVTOKEN_OP_BIND_BUFFER_RANGE,       // target, index, buffer, offset, size
+    NVTOKEN_OP_BIND_VERTEX_BUFFER,      // index, buffer, offset, stride
+    NVTOKEN_OP_BLEND_COLOR,             // red, green, blue, alpha
+    NVTOKEN_OP_STENCIL_FUNC_SEPARATE,   // face, func, ref, mask
+    NVTOKEN_OP_LINE_WIDTH,              // width
+    NVTOKEN_OP_POLYGON_OFFSET,          // scale, bias
+    NVTOKEN_OP_VIEWPORT,                // x, y, width, height
+    NVTOKEN_OP_SCISSOR,                 // x, y, width, height
+    NVTOKEN_OP_FRONT_FACE,              // mode
+  };
+
+  static inline GLuint nvtokenWord(GLuint v)   { return v; }
+  static inline GLuint nvtokenWord(GLint v)    { return GLuint(v); }
+  static inline GLuint nvtokenWord(GLfloat v)  { GLuint w; memcpy(&w, &v, sizeof(w)); return w; }
+
+  static inline GLfloat nvtokenFloat(GLuint w) { GLfloat v; memcpy(&v, &w, sizeof(v)); return v; }
+
+  template <class... Args>
+  static void nvtokenCompiledAdd(std::vector<GLuint>& words, NVTokenCompiledOp op, Args... args)
+  {
+    words.push_back(op);
+    (words.push_back(nvtokenWord(args)), ...);
+  }
+
+  // resolves what nvtokenDrawCommandSequenceSW would issue for one sequence
+  static GLenum nvtokenCompileSequence( std::vector<GLuint>& words, const void* NV_RESTRICT stream, size_t streamSize, GLenum mode, GLenum type, const StateSystem::State& state, NVTokenEmulationStats& stats ) 
+  {
+    const GLubyte* NV_RESTRICT current = (GLubyte*)stream;
+    const GLubyte* streamEnd = current + streamSize;
+
+    GLenum modeStrip;
+    if      (mode == GL_LINES)                modeStrip = GL_LINE_STRIP;
+    else if (mode == GL_TRIANGLES)            modeStrip = GL_TRIANGLE_STRIP;
+    else if (mode == GL_LINES_ADJACENCY)      modeStrip = GL_LINE_STRIP_ADJACENCY;
+    else if (mode == GL_TRIANGLES_ADJACENCY)  modeStrip = GL_TRIANGLE_STRIP_ADJACENCY;
+    else    modeStrip = mode;
+
+    while (current < streamEnd){
+      GLenum cmdtype = nvtokenHeaderCommand(*(const GLuint*)current);
+      stats.tokens++;
+
+      switch(cmdtype){
+      case GL_TERMINATE_SEQUENCE_COMMAND_NV:
+        return type;
+      case GL_NOP_COMMAND_NV:
+      case GL_ALPHA_REF_COMMAND_NV:
+        break;
+      case GL_DRAW_ELEMENTS_COMMAND_NV:
+      case GL_DRAW_ELEMENTS_STRIP_COMMAND_NV:
+        {
+          const DrawElementsCommandNV* cmd = (const DrawElementsCommandNV*)current;
+          nvtokenCompiledAdd(words, NVTOKEN_OP_DRAW_ELEMENTS, cmdtype == GL_DRAW_ELEMENTS_COMMAND_NV ? mode : modeStrip,
+                             cmd->count, type, cmd->firstIndex, cmd->baseVertex);
+          stats.glCalls++;
+          stats.draws++;
+        }
+        break;
+      case GL_DRAW_ARRAYS_COMMAND_NV:
+      case GL_DRAW_ARRAYS_STRIP_COMMAND_NV:
+        {
+          const DrawArraysCommandNV* cmd = (const DrawArraysCommandNV*)current;
+          nvtokenCompiledAdd(words, NVTOKEN_OP_DRAW_ARRAYS, cmdtype == GL_DRAW_ARRAYS_COMMAND_NV ? mode : modeStrip,
+                             cmd->first, cmd->count);
+          stats.glCalls++;
+          stats.draws++;
+        }
+        break;
+      case GL_DRAW_ELEMENTS_INSTANCED_COMMAND_NV:
+        {
+          const DrawElementsInstancedCommandNV* cmd = (const DrawElementsInstancedCommandNV*)current;
+          nvtokenCompiledAdd(words, NVTOKEN_OP_DRAW_ELEMENTS_INDIRECT, cmd->mode, type,
+                             cmd->count, cmd->instanceCount, cmd->firstIndex, cmd->baseVertex, cmd->baseInstance);
+          stats.glCalls++;
+          stats.draws++;
+        }
+        break;
+      case GL_DRAW_ARRAYS_INSTANCED_COMMAND_NV:
+        {
+          const DrawArraysInstancedCommandNV* cmd = (const DrawArraysInstancedCommandNV*)current;
+          nvtokenCompiledAdd(words, NVTOKEN_OP_DRAW_ARRAYS_INDIRECT, cmd->mode,
+                             cmd->count, cmd->instanceCount, cmd->first, cmd->baseInstance);
+          stats.glCalls++;
+          stats.draws++;
+        }
+        break;
+      case GL_ELEMENT_ADDRESS_COMMAND_NV:
+        {
+          const ElementAddressCommandNV* cmd = (const ElementAddressCommandNV*)current;
+          type = cmd->typeSizeInByte == 4 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+          if (s_nvcmdlist_bindless){
+            nvtokenCompiledAdd(words, NVTOKEN_OP_ADDRESS_RANGE, GLenum(GL_ELEMENT_ARRAY_ADDRESS_NV), 0u, cmd->addressLo, cmd->addressHi, 0x7FFFFFFFu);
+          }
+          else{
+            const ElementAddressCommandEMU* cmdEMU = (const ElementAddressCommandEMU*)current;
+            nvtokenCompiledAdd(words, NVTOKEN_OP_BIND_BUFFER, GLenum(GL_ELEMENT_ARRAY_BUFFER), cmdEMU->buffer);
+          }
+          stats.glCalls++;
+        }
+        break;
+      case GL_ATTRIBUTE_ADDRESS_COMMAND_NV:
+        {
+          if (s_nvcmdlist_bindless){
+            const AttributeAddressCommandNV* cmd = (const AttributeAddressCommandNV*)current;
+            nvtokenCompiledAdd(words, NVTOKEN_OP_ADDRESS_RANGE, GLenum(GL_VERTEX_ATTRIB_ARRAY_ADDRESS_NV), cmd->index, cmd->addressLo, cmd->addressHi, 0x7FFFFFFFu);
+          }
+          else{
+            const AttributeAddressCommandEMU* cmd = (const AttributeAddressCommandEMU*)current;
+            nvtokenCompiledAdd(words, NVTOKEN_OP_BIND_VERTEX_BUFFER, cmd->index, cmd->buffer, cmd->offset, state.vertexformat.bindings[cmd->index].stride);
+          }
+          stats.glCalls++;
+        }
+        break;
+      case GL_UNIFORM_ADDRESS_COMMAND_NV:
+        {
+          if (s_nvcmdlist_bindless){
+            const UniformAddressCommandNV* cmd = (const UniformAddressCommandNV*)current;
+            nvtokenCompiledAdd(words, NVTOKEN_OP_ADDRESS_RANGE, GLenum(GL_UNIFORM_BUFFER_ADDRESS_NV), GLuint(cmd->index), cmd->addressLo, cmd->addressHi, 0x10000u);
+          }
+          else{
+            const UniformAddressCommandEMU* cmd = (const UniformAddressCommandEMU*)current;
+            nvtokenCompiledAdd(words, NVTOKEN_OP_BIND_BUFFER_RANGE, GLenum(GL_UNIFORM_BUFFER), GLuint(cmd->index), cmd->buffer, GLuint(cmd->offset256) * 256, GLuint(cmd->size4) * 4);
+          }
+          stats.glCalls++;
+        }
+        break;
+      case GL_BLEND_COLOR_COMMAND_NV:
+        {
+          const BlendColorCommandNV* cmd = (const BlendColorCommandNV*)current;
+          nvtokenCompiledAdd(words, NVTOKEN_OP_BLEND_COLOR, cmd->red, cmd->green, cmd->blue, cmd->alpha);
+          stats.glCalls++;
+        }
+        break;
+      case GL_STENCIL_REF_COMMAND_NV:
+        {
+          // the funcs and masks come from the state
+          const StencilRefCommandNV* cmd = (const StencilRefCommandNV*)current;
+          const StateSystem::StencilFunc& front = state.stencil.funcs[StateSystem::FACE_FRONT];
+          const StateSystem::StencilFunc& back  = state.stencil.funcs[StateSystem::FACE_BACK];
+          nvtokenCompiledAdd(words, NVTOKEN_OP_STENCIL_FUNC_SEPARATE, GLenum(GL_FRONT), front.func, cmd->frontStencilRef, front.mask);
+          nvtokenCompiledAdd(words, NVTOKEN_OP_STENCIL_FUNC_SEPARATE, GLenum(GL_BACK),  back.func,  cmd->backStencilRef,  back.mask);
+          stats.glCalls += 2;
+        }
+        break;
+      case GL_LINE_WIDTH_COMMAND_NV:
+        {
+          const LineWidthCommandNV* cmd = (const LineWidthCommandNV*)current;
+          nvtokenCompiledAdd(words, NVTOKEN_OP_LINE_WIDTH, cmd->lineWidth);
+          stats.glCalls++;
+        }
+        break;
+      case GL_POLYGON_OFFSET_COMMAND_NV:
+        {
+          const PolygonOffsetCommandNV* cmd = (const PolygonOffsetCommandNV*)current;
+          nvtokenCompiledAdd(words, NVTOKEN_OP_POLYGON_OFFSET, cmd->scale, cmd->bias);
+          stats.glCalls++;
+        }
+        break;
+      case GL_VIEWPORT_COMMAND_NV:
+        {
+          const ViewportCommandNV* cmd = (const ViewportCommandNV*)current;
+          nvtokenCompiledAdd(words, NVTOKEN_OP_VIEWPORT, cmd->x, cmd->y, cmd->width, cmd->height);
+          stats.glCalls++;
+        }
+        break;
+      case GL_SCISSOR_COMMAND_NV:
+        {
+          const ScissorCommandNV* cmd = (const ScissorCommandNV*)current;
+          nvtokenCompiledAdd(words, NVTOKEN_OP_SCISSOR, cmd->x, cmd->y, cmd->width, cmd->height);
+          stats.glCalls++;
+        }
+        break;
+      case GL_FRONT_FACE_COMMAND_NV:
+        {
+          const FrontFaceCommandNV* cmd = (const FrontFaceCommandNV*)current;
+          nvtokenCompiledAdd(words, NVTOKEN_OP_FRONT_FACE, GLenum(cmd->frontFace ? GL_CW : GL_CCW));
+          stats.glCalls++;
+        }
+        break;
+      default:
+        // unknown header, the size is not known either, so skip the rest
+        return type;
+      }
+
+      current += s_nvcmdlist_types.sizes[cmdtype];
+    }
+
+    return type;
+  }
+
+  // compiles the sequences from byte beginOffset of sequence begin up to
+  // byte endOffset of sequence end, transition(ops, id, prev) appends the
+  // state changes, returns the element type at the end. Starting within a
+  // sequence continues it, its state and fbo are already in place.
+  template <class TRANSITION>
+  static GLenum nvtokenCompileSequences( std::vector<GLuint>& words, NVTokenEmulationStats& stats, const char* NV_RESTRICT tokens, size_t streamSize,
+    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
+    const GLuint* NV_RESTRICT states, const GLuint* NV_RESTRICT fbos, GLuint begin, size_t beginOffset, GLuint end, size_t endOffset, GLenum type,
+    const StateSystem& stateSystem, TRANSITION transition)
+  {
+    StateSystem::OpList     ops;
+    StateSystem::StateID    lastID  = StateSystem::INVALID_ID;
+    GLuint                  lastFbo = ~0u;
+    GLuint                  before  = beginOffset ? begin + 1 : begin;
+    if (before){
+      lastID  = states[before - 1];
+      lastFbo = fbos[before - 1] ? fbos[before - 1] : stateSystem.get(lastID).fbo.fboDraw;
+    }
+
+    GLuint last = endOffset ? end + 1 : end;
+    for (GLuint i = begin; i < last; i++)
+    {
+      StateSystem::StateID curID = states[i];
+      const StateSystem::State&  state = stateSystem.get(curID);
+
+      GLuint fbo = fbos[i] ? fbos[i] : state.fbo.fboDraw;
+      if (fbo != lastFbo){
+        nvtokenCompiledAdd(words, NVTOKEN_OP_BIND_FRAMEBUFFER, fbo);
+        lastFbo = fbo;
+        stats.glCalls++;
+        stats.fboChanges++;
+      }
+
+      if (curID != lastID){
+        ops.clear();
+        transition(ops, curID, lastID);
+        if (!ops.words.empty()){
+          nvtokenCompiledAdd(words, NVTOKEN_OP_STATE, GLuint(ops.words.size()));
+          words.insert(words.end(), ops.words.begin(), ops.words.end());
+        }
+        stats.stateChanges++;
+      }
+      lastID = curID;
+
+      size_t offset = offsets[i];
+      size_t size   = sizes[i];
+
+      assert(size + offset <= streamSize);
+
+      size_t from = i == begin ? beginOffset : 0;
+      size_t to   = i == end ? endOffset : size;
+      type = nvtokenCompileSequence(words, &tokens[offset + from], to - from, state.basePrimitiveMode, type, state, stats);
+    }
+
+    return type;
+  }
+
+  // returns how many of the binds the shadow state filtered, the compiled
+  // stats count them all as glCalls
+  static size_t nvtokenReplayCompiled(const GLuint* NV_RESTRICT w, size_t numWords, GLenum type, ShadowState* shadow)
+  {
+    const GLuint* end = w + numWords;
+    size_t filtered = 0;
+
+    while (w < end){
+      switch(w[0]){
+      case NVTOKEN_OP_STATE:
+        // the fbo bindings of the states are replaced by NVTOKEN_OP_BIND_FRAMEBUFFER
+        StateSystem::OpList::execute(w + 2, w[1], true, shadow);
+        w += 2 + w[1];
+        break;
+      case NVTOKEN_OP_BIND_FRAMEBUFFER:
+        filtered += !nvtokenBindFramebuffer(shadow, GL_FRAMEBUFFER, w[1]);
+        w += 2;
+        break;
+      case NVTOKEN_OP_DRAW_ELEMENTS:
+        glDrawElementsBaseVertex(w[1], GLsizei(w[2]), w[3] ? w[3] : type, (const GLvoid*)(size_t(w[4]) * sizeof(GLuint)), GLint(w[5]));
+        w += 6;
+        break;
+      case NVTOKEN_OP_DRAW_ARRAYS:
+        glDrawArrays(w[1], GLint(w[2]), GLsizei(w[3]));
+        w += 4;
+        break;
+      case NVTOKEN_OP_DRAW_ELEMENTS_INDIRECT:
+        // sourced from client memory, like the token itself
+        glDrawElementsIndirect(w[1], w[2] ? w[2] : type, w + 3);
+        w += 8;
+        break;
+      case NVTOKEN_OP_DRAW_ARRAYS_INDIRECT:
+        glDrawArraysIndirect(w[1], w + 2);
+        w += 6;
+        break;
+      case NVTOKEN_OP_ADDRESS_RANGE:
+        filtered += !nvtokenBufferAddressRange(shadow, w[1], w[2], GLuint64(w[3]) | (GLuint64(w[4]) << 32), GLsizeiptr(w[5]));
+        w += 6;
+        break;
+      case NVTOKEN_OP_BIND_BUFFER:
+        filtered += !nvtokenBindBuffer(shadow, w[1], w[2]);
+        w += 3;
+        break;
+      case NVTOKEN_OP_BIND_BUFFER_RANGE:
+        filtered += !nvtokenBindBufferRange(shadow, w[1], w[2], w[3], GLintptr(w[4]), GLsizeiptr(w[5]));
+        w += 6;
+        break;
+      case NVTOKEN_OP_BIND_VERTEX_BUFFER:
+        filtered += !nvtokenBindVertexBuffer(shadow, w[1], w[2], GLintptr(w[3]), GLsizei(w[4]));
+        w += 5;
+        break;
+      case NVTOKEN_OP_BLEND_COLOR:
+        glBlendColor(nvtokenFloat(w[1]), nvtokenFloat(w[2]), nvtokenFloat(w[3]), nvtokenFloat(w[4]));
+        w += 5;
+        break;
+      case NVTOKEN_OP_STENCIL_FUNC_SEPARATE:
+        glStencilFuncSeparate(w[1], w[2], GLint(w[3]), w[4]);
+        w += 5;
+        break;
+      case NVTOKEN_OP_LINE_WIDTH:
+        glLineWidth(nvtokenFloat(w[1]));
+        w += 2;
+        break;
+      case NVTOKEN_OP_POLYGON_OFFSET:
+        glPolygonOffset(nvtokenFloat(w[1]), nvtokenFloat(w[2]));
+        w += 3;
+        break;
+      case NVTOKEN_OP_VIEWPORT:
+        glViewport(GLint(w[1]), GLint(w[2]), GLsizei(w[3]), GLsizei(w[4]));
+        w += 5;
+        break;
+      case NVTOKEN_OP_SCISSOR:
+        glScissor(GLint(w[1]), GLint(w[2]), GLsizei(w[3]), GLsizei(w[4]));
+        w += 5;
+        break;
+      case NVTOKEN_OP_FRONT_FACE:
+        glFrontFace(w[1]);
+        w += 2;
+        break;
+      default:
+        assert(0 && "unknown compiled op");
+        return filtered;
+      }
+    }
+    return filtered;
+  }
+
+  // transitions one thread compiled without the StateSystem's cache, the
+  // states must not change while it is used, so repeated pairs are only copied
+  struct NVTokenTransitionMemo {
+    std::unordered_map<uint64_t, std::pair<size_t, size_t> >  ranges;
+    std::vector<GLuint>                                       words;
+    StateSystem::OpList                                       ops;
+
+    void reset()
+    {
+      ranges.clear();
+      words.clear();
+    }
+
+    void compile(StateSystem::OpList& out, const StateSystem& stateSystem, StateSystem::StateID id, StateSystem::StateID prev)
+    {
+      uint64_t key = (uint64_t(prev) << 32) | id;
+      auto it = ranges.find(key);
+      if (it == ranges.end()){
+        ops.clear();
+        stateSystem.compileTransitionUncached(ops, id, prev);
+        it = ranges.insert(std::make_pair(key, std::make_pair(words.size(), ops.words.size()))).first;
+        words.insert(words.end(), ops.words.begin(), ops.words.end());
+      }
+      const GLuint* begin = words.data() + it->second.first;
+      out.words.insert(out.words.end(), begin, begin + it->second.second);
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////////
+  // segmented lists
+
+  void nvtokenListSegmentsSW(NVTokenSegmentedList& list, GLuint segments)
+  {
+    list.segments.clear();
+    list.segments.resize(segments);
+  }
+
+  void nvtokenResetSegmentSW(NVTokenSegmentedList& list, GLuint segment)
+  {
+    NVTokenCompiledList& compiled = list.segments[segment];
+    compiled.words.clear();
+    compiled.stats = NVTokenEmulationStats();
+  }
+
+  void nvtokenListDrawCommandsStatesSW(NVTokenSegmentedList& list, GLuint segment, const void* NV_RESTRICT stream, size_t streamSize, 
+    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
+    const GLuint* NV_RESTRICT states, const GLuint* NV_RESTRICT fbos, GLuint count, 
+    const StateSystem &stateSystem)
+  {
+    assert(segment < list.segments.size());
+    NVTokenCompiledList& compiled = list.segments[segment];
+
+    NVTokenTransitionMemo memo;
+    nvtokenCompileSequences(compiled.words, compiled.stats, (const char*)stream, streamSize, offsets, sizes, states, fbos, 0, 0, count, 0, GL_UNSIGNED_SHORT, stateSystem,
+      [&stateSystem, &memo](StateSystem::OpList& ops, StateSystem::StateID id, StateSystem::StateID prev) {
+        memo.compile(ops, stateSystem, id, prev);
+      });
+    compiled.stats.sequences += count;
+  }
+
+  void nvtokenDrawSegmentedSW(const NVTokenSegmentedList& list, NVTokenEmulationStats* stats)
+  {
+    NVTokenEmulationStats result = {0};
+    for (size_t i = 0; i < list.segments.size(); i++){
+      const NVTokenCompiledList& compiled = list.segments[i];
+      size_t filtered = nvtokenReplayCompiled(compiled.words.data(), compiled.words.size(), GL_UNSIGNED_SHORT, s_nvcmdlist_shadow);
+
+      result.sequences     += compiled.stats.sequences;
+      result.tokens        += compiled.stats.tokens;
+      result.draws         += compiled.stats.draws;
+      result.glCalls       += compiled.stats.glCalls - filtered;
+      result.filteredCalls += compiled.stats.filteredCalls + filtered;
+      result.stateChanges  += compiled.stats.stateChanges;
+      result.fboChanges    += compiled.stats.fboChanges;
+    }
+
+    if (stats){
+      *stats = result;
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // pipelined emulation
+
+  struct NVTokenPipelinePacket {
+    // for batch = round * NVTOKEN_PIPELINE_PACKETS + slot, the slot's turn is
+    // 2 * round while it can be written and 2 * round + 1 once it is ready
+    std::atomic<size_t>     turn {0};
+    std::vector<GLuint>     words;
+    NVTokenEmulationStats   stats;
+    GLenum                  type;   // element type at the end, 0 if not set within
+  };
+
+  // where a batch starts, sequence index and byte offset within it
+  struct NVTokenPipelineCut {
+    GLuint    sequence;
+    GLuint    offset;
+  };
+
+  struct NVTokenPipelineJob {
+    const NVTokenPipelineCut* cuts;   // batch b spans cuts[b] to cuts[b + 1]
+    GLuint              numBatches;
+    const char*         tokens;
+    size_t              streamSize;
+    const GLintptr*     offsets;
+    const GLsizei*      sizes;
+    const GLuint*       states;
+    const GLuint*       fbos;
+    GLuint              count;
+    const StateSystem*  stateSystem;
+  };
+
+  struct NVTokenPipelineInternal {
+    std::vector<std::thread>  workers;
+    // one per worker, the last is used by the caller when there are none
+    std::vector<NVTokenTransitionMemo>  memos;
+
+    // workers sleep between jobs, a new generation starts the next one
+    std::mutex                mutex;
+    std::condition_variable   wake;
+    GLuint                    generation = 0;
+    bool                      quit = false;
+
+    NVTokenPipelineJob        job;
+    std::vector<NVTokenPipelineCut> cuts;
+    NVTokenPipelineTimes      times = {0, 0};
+    std::atomic<GLuint>       nextBatch {0};
+    // set while runTasks uses the workers instead of job
+    const std::function<void(GLuint)>*  task = NULL;
+    GLuint                    taskCount = 0;
+    std::atomic<GLuint>       nextTask {0};
+    std::atomic<GLuint>       active {0};   // workers still in the current job
+    NVTokenPipelinePacket     packets[NVTOKEN_PIPELINE_PACKETS];
+
+    // threads that gave up spinning on a packet turn or on active
+    std::mutex                readyMutex;
+    std::condition_variable   ready;
+    std::atomic<GLuint>       waiting {0};
+  };
+
+  // Waiters register before checking again under the mutex, and every
+  // change is sequentially consistent, so either the waiter sees the change
+  // or the thread making it sees the waiter and notifies.
+  template <class T>
+  static void nvtokenPipelineWait(NVTokenPipelineInternal& pipe, const std::atomic<T>& value, T expected)
+  {
+    for (GLuint i = 0; i < NVTOKEN_PIPELINE_SPINS; i++){
+      if (value.load(std::memory_order_acquire) == expected){
+        return;
+      }
+    }
+
+    std::unique_lock<std::mutex> lock(pipe.readyMutex);
+    pipe.waiting.fetch_add(1);
+    pipe.ready.wait(lock, [&]() { return value.load() == expected; });
+    pipe.waiting.fetch_sub(1);
+  }
+
+  // after changing a packet turn or active
+  static void nvtokenPipelineNotify(NVTokenPipelineInternal& pipe)
+  {
+    if (pipe.waiting.load()){
+      std::lock_guard<std::mutex> lock(pipe.readyMutex);
+      pipe.ready.notify_all();
+    }
+  }
+
+  // Cuts the sequences into batches of about NVTOKEN_PIPELINE_BATCH bytes.
+  // Only the tokens of sequences that don't fit whole are walked, to cut
+  // them after a draw, and only up to where the emulation stops decoding.
+  static void nvtokenPipelineSplit(std::vector<NVTokenPipelineCut>& cuts, const char* NV_RESTRICT tokens,
+    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, GLuint count)
+  {
+    NVTokenPipelineCut cut = {0, 0};
+    cuts.clear();
+    cuts.push_back(cut);
+
+    size_t bytes = 0;
+    for (GLuint i = 0; i < count; i++){
+      if (bytes >= NVTOKEN_PIPELINE_BATCH){
+        cut.sequence = i;
+        cut.offset   = 0;
+        cuts.push_back(cut);
+        bytes = 0;
+      }
+
+      GLuint size = GLuint(sizes[i]);
+      if (bytes + size <= NVTOKEN_PIPELINE_BATCH){
+        bytes += size;
+        continue;
+      }
+
+      const char* sequence = tokens + offsets[i];
+      GLuint offset = 0;
+      while (offset < size){
+        GLenum cmdtype = nvtokenHeaderLookup(*(const GLuint*)(sequence + offset));
+        if (cmdtype >= NVTOKEN_TYPES || cmdtype == GL_TERMINATE_SEQUENCE_COMMAND_NV){
+          break;
+        }
+        offset += s_nvcmdlist_types.sizes[cmdtype];
+        bytes  += s_nvcmdlist_types.sizes[cmdtype];
+
+        bool draw = cmdtype == GL_DRAW_ELEMENTS_COMMAND_NV || cmdtype == GL_DRAW_ARRAYS_COMMAND_NV ||
+                    cmdtype == GL_DRAW_ELEMENTS_STRIP_COMMAND_NV || cmdtype == GL_DRAW_ARRAYS_STRIP_COMMAND_NV ||
+                    cmdtype == GL_DRAW_ELEMENTS_INSTANCED_COMMAND_NV || cmdtype == GL_DRAW_ARRAYS_INSTANCED_COMMAND_NV;
+        if (draw && bytes >= NVTOKEN_PIPELINE_BATCH && offset < size){
+          cut.sequence = i;
+          cut.offset   = offset;
+          cuts.push_back(cut);
+          bytes = 0;
+        }
+      }
+    }
+
+    cut.sequence = count;
+    cut.offset   = 0;
+    cuts.push_back(cut);
+  }
+
+  static void nvtokenPipelineCompile(NVTokenPipelinePacket& packet, NVTokenTransitionMemo& memo, const NVTokenPipelineJob& job, GLuint batch)
+  {
+    const NVTokenPipelineCut& begin = job.cuts[batch];
+    const NVTokenPipelineCut& end   = job.cuts[batch + 1];
+    const StateSystem& stateSystem = *job.stateSystem;
+
+    packet.words.clear();
+    packet.stats = NVTokenEmulationStats();
+    // the element type of earlier batches is not known yet, draws
+    // before the first element buffer token inherit it during replay
+    packet.type = nvtokenCompileSequences(packet.words, packet.stats, job.tokens, job.streamSize, job.offsets, job.sizes, job.states, job.fbos,
+      begin.sequence, begin.offset, end.sequence, end.offset, 0, stateSystem,
+      [&stateSystem, &memo](StateSystem::OpList& ops, StateSystem::StateID id, StateSystem::StateID prev) {
+        memo.compile(ops, stateSystem, id, prev);
+      });
+  }
+
+  static void nvtokenPipelineProduce(NVTokenPipelineInternal& pipe, NVTokenTransitionMemo& memo)
+  {
+    for (;;){
+      GLuint batch = pipe.nextBatch.fetch_add(1, std::memory_order_relaxed);
+      if (batch >= pipe.job.numBatches){
+        return;
+      }
+
+      NVTokenPipelinePacket& packet = pipe.packets[batch % NVTOKEN_PIPELINE_PACKETS];
+      size_t round = batch / NVTOKEN_PIPELINE_PACKETS;
+      nvtokenPipelineWait(pipe, packet.turn, 2 * round);
+      nvtokenPipelineCompile(packet, memo, pipe.job, batch);
+      packet.turn.store(2 * round + 1);
+      nvtokenPipelineNotify(pipe);
+    }
+  }
+
+  static void nvtokenPipelineRunTasks(NVTokenPipelineInternal& pipe)
+  {
+    for (;;){
+      GLuint index = pipe.nextTask.fetch_add(1, std::memory_order_relaxed);
+      if (index >= pipe.taskCount){
+        return;
+      }
+      (*pipe.task)(index);
+    }
+  }
+
+  static void nvtokenPipelineWorker(NVTokenPipelineInternal* pipe, GLuint index)
+  {
+    GLuint generation = 0;
+    for (;;){
+      {
+        std::unique_lock<std::mutex> lock(pipe->mutex);
+        pipe->wake.wait(lock, [&]() { return pipe->quit || pipe->generation != generation; });
+        if (pipe->quit){
+          return;
+        }
+        generation = pipe->generation;
+      }
+
+      if (pipe->task){
+        nvtokenPipelineRunTasks(*pipe);
+      }
+      else{
+        NVTokenTransitionMemo& memo = pipe->memos[index];
+        memo.reset();
+        nvtokenPipelineProduce(*pipe, memo);
+      }
+      pipe->active.fetch_sub(1);
+      nvtokenPipelineNotify(*pipe);
+    }
+  }
+
+  void NVTokenPipeline::init(GLuint numWorkers)
+  {
+    deinit();
+    m_internal = new NVTokenPipelineInternal;
+    m_internal->memos.resize(numWorkers + 1);
+    for (GLuint i = 0; i < numWorkers; i++){
+      m_internal->workers.push_back(std::thread(nvtokenPipelineWorker, m_internal, i));
+    }
+  }
+
+  void NVTokenPipeline::deinit()
+  {
+    if (!m_internal){
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_internal->mutex);
+      m_internal->quit = true;
+    }
+    m_internal->wake.notify_all();
+    for (size_t i = 0; i < m_internal->workers.size(); i++){
+      m_internal->workers[i].join();
+    }
+
+    delete m_internal;
+    m_internal = NULL;
+  }
+
+  GLuint NVTokenPipeline::getNumWorkers() const
+  {
+    return m_internal ? GLuint(m_internal->workers.size()) : 0;
+  }
+
+  const NVTokenPipelineTimes& NVTokenPipeline::getTimes() const
+  {
+    assert(m_internal && "NVTokenPipeline::init must be called first");
+    return m_internal->times;
+  }
+
+  void NVTokenPipeline::runTasks(GLuint count, const std::function<void(GLuint)>& task)
+  {
+    assert(m_internal && "NVTokenPipeline::init must be called first");
+
+    NVTokenPipelineInternal& pipe = *m_internal;
+    GLuint numWorkers = GLuint(pipe.workers.size());
+
+    pipe.task      = &task;
+    pipe.taskCount = count;
+    pipe.nextTask.store(0, std::memory_order_relaxed);
+
+    if (numWorkers){
+      // the mutex publishes the tasks to the workers
+      pipe.active.store(numWorkers, std::memory_order_relaxed);
+      {
+        std::lock_guard<std::mutex> lock(pipe.mutex);
+        pipe.generation++;
+      }
+      pipe.wake.notify_all();
+    }
+
+    nvtokenPipelineRunTasks(pipe);
+
+    if (numWorkers){
+      nvtokenPipelineWait(pipe, pipe.active, 0u);
+    }
+    pipe.task = NULL;
+  }
+
+  void nvtokenDrawCommandsStatesPipelinedSW(NVTokenPipeline& pipeline, const void* NV_RESTRICT stream, size_t streamSize, 
+    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
+    const GLuint* NV_RESTRICT states, const GLuint* NV_RESTRICT fbos, GLuint count, 
+    const StateSystem &stateSystem, NVTokenEmulationStats* stats)
+  {
+    assert(pipeline.m_internal && "NVTokenPipeline::init must be called first");
+
+    NVTokenPipelineInternal& pipe = *pipeline.m_internal;
+    GLuint numWorkers = GLuint(pipe.workers.size());
+
+    nvtokenPipelineSplit(pipe.cuts, (const char*)stream, offsets, sizes, count);
+    GLuint numBatches = GLuint(pipe.cuts.size() - 1);
+
+    NVTokenPipelineJob& job = pipe.job;
+    job.cuts        = pipe.cuts.data();
+    job.numBatches  = numBatches;
+    job.tokens      = (const char*)stream;
+    job.streamSize  = streamSize;
+    job.offsets     = offsets;
+    job.sizes       = sizes;
+    job.states      = states;
+    job.fbos        = fbos;
+    job.count       = count;
+    job.stateSystem = &stateSystem;
+
+    for (GLuint i = 0; i < NVTOKEN_PIPELINE_PACKETS; i++){
+      pipe.packets[i].turn.store(0, std::memory_order_relaxed);
+    }
+    pipe.nextBatch.store(0, std::memory_order_relaxed);
+
+    if (numWorkers){
+      // the mutex publishes the job to the workers
+      pipe.active.store(numWorkers, std::memory_order_relaxed);
+      {
+        std::lock_guard<std::mutex> lock(pipe.mutex);
+        pipe.generation++;
+      }
+      pipe.wake.notify_all();
+    }
+
+    NVTokenEmulationStats result = {0};
+    ShadowState* shadow = s_nvcmdlist_shadow;
+    GLenum type = GL_UNSIGNED_SHORT;
+
+    NVTokenTransitionMemo& memo = pipe.memos[numWorkers];
+    if (!numWorkers){
+      memo.reset();
+    }
+
+    typedef std::chrono::steady_clock clock;
+    clock::duration replayTime = clock::duration::zero();
+    clock::duration waitTime   = clock::duration::zero();
+
+    for (GLuint batch = 0; batch < numBatches; batch++){
+      NVTokenPipelinePacket& packet = pipe.packets[batch % NVTOKEN_PIPELINE_PACKETS];
+      size_t round = batch / NVTOKEN_PIPELINE_PACKETS;
+      if (numWorkers){
+        clock::time_point waitBegin = clock::now();
+        nvtokenPipelineWait(pipe, packet.turn, 2 * round + 1);
+        waitTime += clock::now() - waitBegin;
+      }
+      else{
+        nvtokenPipelineCompile(packet, memo, job, batch);
+      }
+
+      clock::time_point replayBegin = clock::now();
+      size_t filtered = nvtokenReplayCompiled(packet.words.data(), packet.words.size(), type, shadow);
+      replayTime += clock::now() - replayBegin;
+      if (packet.type){
+        type = packet.type;
+      }
+
+      result.tokens        += packet.stats.tokens;
+      result.draws         += packet.stats.draws;
+      result.glCalls       += packet.stats.glCalls - filtered;
+      result.filteredCalls += packet.stats.filteredCalls + filtered;
+      result.stateChanges  += packet.stats.stateChanges;
+      result.fboChanges    += packet.stats.fboChanges;
+
+      packet.turn.store(2 * round + 2);
+      if (numWorkers){
+        nvtokenPipelineNotify(pipe);
+      }
+    }
+
+    // the job must not change while workers still look for batches
+    if (numWorkers){
+      nvtokenPipelineWait(pipe, pipe.active, 0u);
+    }
+    result.sequences = count;
+
+    pipe.times.replay = std::chrono::duration<double>(replayTime).count();
+    pipe.times.wait   = std::chrono::duration<double>(waitTime).count();
+
+    if (stats){
+      *stats = result;
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // scheduling
+
+  // The groups of sequences sharing state and fbo are chained greedily, each
+  // followed by the cheapest of the next NVTOKEN_SCHEDULE_WINDOW pending ones.
+  // This keeps the work linear even if every sequence has its own state.
+  #define NVTOKEN_SCHEDULE_WINDOW     64
+  #define NVTOKEN_SCHEDULE_FBO_COST   8
+
+  static const GLuint NVTOKEN_SCHEDULE_NONE = ~0u;
+
+  static inline size_t nvtokenScheduleCost(const StateSystem& stateSystem, GLuint state, GLuint fbo, GLuint lastState, GLuint lastFbo)
+  {
+    return stateSystem.getTransitionCost(state, lastState) + (fbo != lastFbo ? NVTOKEN_SCHEDULE_FBO_COST : 0);
+  }
+
+  static size_t nvtokenScheduleTotalCost(const StateSystem& stateSystem, const std::vector<GLuint>& states, const std::vector<GLuint>& fbos)
+  {
+    size_t cost = 0;
+    GLuint lastState = StateSystem::INVALID_ID;
+    GLuint lastFbo = NVTOKEN_SCHEDULE_NONE;
+    for (size_t i = 0; i < states.size(); i++){
+      cost += nvtokenScheduleCost(stateSystem, states[i], fbos[i], lastState, lastFbo);
+      lastState = states[i];
+      lastFbo = fbos[i];
+    }
+    return cost;
+  }
+
+  void nvtokenScheduleSequences( NVTokenSequence& seq, const StateSystem& stateSystem,
+                                 const GLboolean* orderDependent, NVTokenScheduleStats* stats )
+  {
+    struct Group {
+      GLuint  state;
+      GLuint  fbo;
+      GLuint  first;  // sequences of the group, linked by nextInGroup
+      GLuint  last;
+      GLuint  prev;   // pending groups
+      GLuint  next;
+    };
+
+    GLuint count = GLuint(seq.states.size());
+
+    // the fbo actually bound by the emulation
+    std::vector<GLuint> fbos(count);
+    for (GLuint i = 0; i < count; i++){
+      fbos[i] = seq.fbos[i] ? seq.fbos[i] : stateSystem.get(seq.states[i]).fbo.fboDraw;
+    }
+
+    std::vector<GLuint> order;
+    std::vector<GLuint> nextInGroup(count);
+    std::vector<Group>  groups;
+    std::unordered_map<GLuint64, GLuint> groupOfKey;
+    order.reserve(count);
+
+    GLuint lastState = StateSystem::INVALID_ID;
+    GLuint lastFbo = NVTOKEN_SCHEDULE_NONE;
+    GLuint begin = 0;
+    while (begin < count){
+      if (orderDependent && orderDependent[begin]){
+        order.push_back(begin);
+        lastState = seq.states[begin];
+        lastFbo = fbos[begin];
+        begin++;
+        continue;
+      }
+
+      // group the run of sequences up to the next order dependent one
+      groups.clear();
+      groupOfKey.clear();
+      GLuint end = begin;
+      for (; end < count && !(orderDependent && orderDependent[end]); end++){
+        GLuint64 key = (GLuint64(seq.states[end]) << 32) | fbos[end];
+        auto it = groupOfKey.find(key);
+        nextInGroup[end] = NVTOKEN_SCHEDULE_NONE;
+        if (it == groupOfKey.end()){
+          GLuint index = GLuint(groups.size());
+          Group group = {seq.states[end], fbos[end], end, end, index - 1, index + 1};
+          groupOfKey.insert(std::make_pair(key, index));
+          groups.push_back(group);
+        }
+        else{
+          Group& group = groups[it->second];
+          nextInGroup[group.last] = end;
+          group.last = end;
+        }
+      }
+      groups.back().next = NVTOKEN_SCHEDULE_NONE;
+
+      // chain the groups, starting from what the previous run ended with
+      GLuint head = 0;
+      while (head != NVTOKEN_SCHEDULE_NONE){
+        GLuint best = head;
+        size_t bestCost = ~size_t(0);
+        GLuint g = head;
+        for (GLuint n = 0; n < NVTOKEN_SCHEDULE_WINDOW && g != NVTOKEN_SCHEDULE_NONE; n++, g = groups[g].next){
+          size_t cost = nvtokenScheduleCost(stateSystem, groups[g].state, groups[g].fbo, lastState, lastFbo);
+          if (cost < bestCost){
+            best = g;
+            bestCost = cost;
+            if (!cost) break;
+          }
+        }
+
+        const Group& group = groups[best];
+        if (group.prev != NVTOKEN_SCHEDULE_NONE) groups[group.prev].next = group.next;
+        else                                     head = group.next;
+        if (group.next != NVTOKEN_SCHEDULE_NONE) groups[group.next].prev = group.prev;
+
+        for (GLuint i = group.first; i != NVTOKEN_SCHEDULE_NONE; i = nextInGroup[i]){
+          order.push_back(i);
+        }
+        lastState = group.state;
+        lastFbo = group.fbo;
+      }
+
+      begin = end;
+    }
+
+    NVTokenSequence scheduled;
+    std::vector<GLuint> scheduledFbos(count);
+    scheduled.offsets.resize(count);
+    scheduled.sizes.resize(count);
+    scheduled.states.resize(count);
+    scheduled.fbos.resize(count);
+    for (GLuint i = 0; i < count; i++){
+      scheduled.offsets[i] = seq.offsets[order[i]];
+      scheduled.sizes[i] = seq.sizes[order[i]];
+      scheduled.states[i] = seq.states[order[i]];
+      scheduled.fbos[i] = seq.fbos[order[i]];
+      scheduledFbos[i] = fbos[order[i]];
+    }
+
+    if (stats){
+      stats->costBefore = nvtokenScheduleTotalCost(stateSystem, seq.states, fbos);
+      stats->costAfter = nvtokenScheduleTotalCost(stateSystem, scheduled.states, scheduledFbos);
+    }
+
+    seq = scheduled;
   }
 #endif
 }
@@ -22,12 +22,19 @@
 
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <new>
 #include <string>
 #include <vector>
 
 #define NVTOKEN_STATESYSTEM 1
 
 #include "platform.h"
+
+class ShadowState;
+
 #if NVTOKEN_STATESYSTEM
 // not needed if emulation is not used, or implemented differently
 #include "statesystem.hpp"
@@ -81,7 +88,6 @@ namespace nvtoken
 
   extern bool     s_nvcmdlist_bindless;
   extern GLuint   s_nvcmdlist_header[NVTOKEN_TYPES];
-  extern GLuint   s_nvcmdlist_headerSizes[NVTOKEN_TYPES];
   extern GLushort s_nvcmdlist_stages[NVTOKEN_STAGES];
   
   class NVPointerStream {
@@ -110,6 +116,145 @@ namespace nvtoken
     }
   };
 
+  // Growable token stream, tokens are constructed in place at the end.
+  // Storage grows in multiples of CHUNK_SIZE (at least doubling), so building
+  // a stream costs a handful of allocations rather than one per token.
+  // The tokens always stay contiguous and can be uploaded via data()/size().
+  // Offsets remain valid as the stream grows, pointers do not.
+  class NVTokenStream {
+  public:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    NVTokenStream()
+      : m_begin(NULL)
+      , m_size(0)
+      , m_capacity(0)
+    {
+    }
+
+    NVTokenStream(const NVTokenStream& other)
+      : m_begin(NULL)
+      , m_size(0)
+      , m_capacity(0)
+    {
+      append(other.data(), other.size());
+    }
+
+    NVTokenStream(NVTokenStream&& other)
+      : m_begin(other.m_begin)
+      , m_size(other.m_size)
+      , m_capacity(other.m_capacity)
+    {
+      other.m_begin    = NULL;
+      other.m_size     = 0;
+      other.m_capacity = 0;
+    }
+
+    ~NVTokenStream()
+    {
+      free(m_begin);
+    }
+
+    NVTokenStream& operator=(const NVTokenStream& other)
+    {
+      if (this != &other){
+        m_size = 0;
+        append(other.data(), other.size());
+      }
+      return *this;
+    }
+
+    NVTokenStream& operator=(NVTokenStream&& other)
+    {
+      if (this != &other){
+        free(m_begin);
+        m_begin          = other.m_begin;
+        m_size           = other.m_size;
+        m_capacity       = other.m_capacity;
+        other.m_begin    = NULL;
+        other.m_size     = 0;
+        other.m_capacity = 0;
+      }
+      return *this;
+    }
+
+    void reserve(size_t capacity)
+    {
+      if (capacity <= m_capacity) return;
+
+      capacity = ((capacity + CHUNK_SIZE - 1) / CHUNK_SIZE) * CHUNK_SIZE;
+      unsigned char* begin = (unsigned char*)realloc(m_begin, capacity);
+      if (!begin){
+        // m_begin is still valid, the stream is left unchanged
+        throw std::bad_alloc();
+      }
+      m_begin    = begin;
+      m_capacity = capacity;
+    }
+
+    void clear()
+    {
+      m_size = 0;
+    }
+
+    // returns pointer to uninitialized space of the given size
+    void* allocate(size_t size)
+    {
+      size_t required = m_size + size;
+      if (required > m_capacity){
+        reserve(required > m_capacity * 2 ? required : m_capacity * 2);
+      }
+
+      void* ptr = m_begin + m_size;
+      m_size = required;
+      return ptr;
+    }
+
+    // default constructs the token within the stream
+    template <class T>
+    T* alloc()
+    {
+      return new (allocate(sizeof(T))) T();
+    }
+
+    void append(const void* data, size_t size)
+    {
+      if (size){
+        memcpy(allocate(size), data, size);
+      }
+    }
+
+    unsigned char* data()
+    {
+      return m_begin;
+    }
+
+    const unsigned char* data() const
+    {
+      return m_begin;
+    }
+
+    size_t size() const
+    {
+      return m_size;
+    }
+
+    size_t capacity() const
+    {
+      return m_capacity;
+    }
+
+    bool empty() const
+    {
+      return m_size == 0;
+    }
+
+  private:
+    unsigned char*  m_begin;
+    size_t          m_size;
+    size_t          m_capacity;
+  };
+
   struct NVTokenSequence {
     std::vector<GLintptr>  offsets;
     std::vector<GLsizei>   sizes;
@@ -145,6 +290,7 @@ namespace nvtoken
 
   struct NVTokenNop {
     static const GLenum   ID = GL_NOP_COMMAND_NV;
+    static constexpr const char* NAME = "GL_NOP_COMMAND_NV";
 
     NOPCommandNV      cmd;
 
@@ -155,6 +301,7 @@ namespace nvtoken
 
   struct NVTokenTerminate {
     static const GLenum   ID = GL_TERMINATE_SEQUENCE_COMMAND_NV;
+    static constexpr const char* NAME = "GL_TERMINATE_SEQUENCE_COMMAND_NV";
 
     TerminateSequenceCommandNV      cmd;
 
@@ -165,6 +312,7 @@ namespace nvtoken
 
   struct NVTokenDrawElemsInstanced {
     static const GLenum   ID = GL_DRAW_ELEMENTS_INSTANCED_COMMAND_NV;
+    static constexpr const char* NAME = "GL_DRAW_ELEMENTS_INSTANCED_COMMAND_NV";
 
     DrawElementsInstancedCommandNV   cmd;
 
@@ -198,6 +346,7 @@ namespace nvtoken
 
   struct NVTokenDrawArraysInstanced {
     static const GLenum   ID = GL_DRAW_ARRAYS_INSTANCED_COMMAND_NV;
+    static constexpr const char* NAME = "GL_DRAW_ARRAYS_INSTANCED_COMMAND_NV";
 
     DrawArraysInstancedCommandNV          cmd;
 
@@ -229,6 +378,7 @@ namespace nvtoken
 
   struct NVTokenDrawElems {
     static const GLenum   ID = GL_DRAW_ELEMENTS_COMMAND_NV;
+    static constexpr const char* NAME = "GL_DRAW_ELEMENTS_COMMAND_NV";
 
     DrawElementsCommandNV   cmd;
 
@@ -264,6 +414,7 @@ namespace nvtoken
 
   struct NVTokenDrawArrays {
     static const GLenum   ID = GL_DRAW_ARRAYS_COMMAND_NV;
+    static constexpr const char* NAME = "GL_DRAW_ARRAYS_COMMAND_NV";
 
     DrawArraysCommandNV   cmd;
 
@@ -297,6 +448,7 @@ namespace nvtoken
 
   struct NVTokenDrawElemsStrip {
     static const GLenum   ID = GL_DRAW_ELEMENTS_STRIP_COMMAND_NV;
+    static constexpr const char* NAME = "GL_DRAW_ELEMENTS_STRIP_COMMAND_NV";
 
     DrawElementsCommandNV   cmd;
 
@@ -318,6 +470,7 @@ namespace nvtoken
 
   struct NVTokenDrawArraysStrip {
     static const GLenum   ID = GL_DRAW_ARRAYS_STRIP_COMMAND_NV;
+    static constexpr const char* NAME = "GL_DRAW_ARRAYS_STRIP_COMMAND_NV";
 
     DrawArraysCommandNV   cmd;
 
@@ -337,6 +490,7 @@ namespace nvtoken
 
   struct NVTokenVbo {
     static const GLenum   ID = GL_ATTRIBUTE_ADDRESS_COMMAND_NV;
+    static constexpr const char* NAME = "GL_ATTRIBUTE_ADDRESS_COMMAND_NV";
 
     union {
       AttributeAddressCommandNV   cmd;
@@ -367,6 +521,7 @@ namespace nvtoken
 
   struct NVTokenIbo {
     static const GLenum   ID = GL_ELEMENT_ADDRESS_COMMAND_NV;
+    static constexpr const char* NAME = "GL_ELEMENT_ADDRESS_COMMAND_NV";
 
     union{
       ElementAddressCommandNV     cmd;
@@ -407,6 +562,7 @@ namespace nvtoken
 
   struct NVTokenUbo {
     static const GLenum   ID = GL_UNIFORM_ADDRESS_COMMAND_NV;
+    static constexpr const char* NAME = "GL_UNIFORM_ADDRESS_COMMAND_NV";
 
     union{
       UniformAddressCommandNV   cmd;
@@ -440,6 +596,7 @@ namespace nvtoken
 
   struct NVTokenBlendColor{
     static const GLenum   ID = GL_BLEND_COLOR_COMMAND_NV;
+    static constexpr const char* NAME = "GL_BLEND_COLOR_COMMAND_NV";
 
     BlendColorCommandNV     cmd;
 
@@ -450,6 +607,7 @@ namespace nvtoken
 
   struct NVTokenStencilRef{
     static const GLenum   ID = GL_STENCIL_REF_COMMAND_NV;
+    static constexpr const char* NAME = "GL_STENCIL_REF_COMMAND_NV";
 
     StencilRefCommandNV cmd;
 
@@ -460,6 +618,7 @@ namespace nvtoken
 
   struct NVTokenLineWidth{
     static const GLenum   ID = GL_LINE_WIDTH_COMMAND_NV;
+    static constexpr const char* NAME = "GL_LINE_WIDTH_COMMAND_NV";
 
     LineWidthCommandNV  cmd;
 
@@ -470,6 +629,7 @@ namespace nvtoken
 
   struct NVTokenPolygonOffset{
     static const GLenum   ID = GL_POLYGON_OFFSET_COMMAND_NV;
+    static constexpr const char* NAME = "GL_POLYGON_OFFSET_COMMAND_NV";
 
     PolygonOffsetCommandNV  cmd;
 
@@ -480,6 +640,7 @@ namespace nvtoken
 
   struct NVTokenAlphaRef{
     static const GLenum   ID = GL_ALPHA_REF_COMMAND_NV;
+    static constexpr const char* NAME = "GL_ALPHA_REF_COMMAND_NV";
 
     AlphaRefCommandNV cmd;
 
@@ -490,6 +651,7 @@ namespace nvtoken
 
   struct NVTokenViewport{
     static const GLenum   ID = GL_VIEWPORT_COMMAND_NV;
+    static constexpr const char* NAME = "GL_VIEWPORT_COMMAND_NV";
 
     ViewportCommandNV cmd;
 
@@ -500,6 +662,7 @@ namespace nvtoken
 
   struct NVTokenScissor {
     static const GLenum   ID = GL_SCISSOR_COMMAND_NV;
+    static constexpr const char* NAME = "GL_SCISSOR_COMMAND_NV";
 
     ScissorCommandNV  cmd;
 
@@ -510,6 +673,7 @@ namespace nvtoken
 
   struct NVTokenFrontFace {
     static const GLenum   ID = GL_FRONT_FACE_COMMAND_NV;
+    static constexpr const char* NAME = "GL_FRONT_FACE_COMMAND_NV";
 
     FrontFaceCommandNV  cmd;
 
@@ -524,6 +688,57 @@ namespace nvtoken
 
 #pragma pack(pop)
 
+  // Compile-time registry of all token structs, the size and name tables are
+  // derived from it. A type that is missing or listed twice fails to compile.
+  struct NVTokenTypeTable {
+    GLuint      sizes[NVTOKEN_TYPES];
+    const char* names[NVTOKEN_TYPES];
+  };
+
+  template <class... T>
+  struct NVTokenTypeList {
+    static constexpr NVTokenTypeTable table()
+    {
+      NVTokenTypeTable result = {};
+      ((result.sizes[T::ID] = GLuint(sizeof(T)), result.names[T::ID] = T::NAME), ...);
+      return result;
+    }
+
+    static constexpr bool complete()
+    {
+      NVTokenTypeTable result = table();
+      for (int i = 0; i < NVTOKEN_TYPES; i++){
+        if (!result.sizes[i]) return false;
+      }
+      return sizeof...(T) == NVTOKEN_TYPES;
+    }
+  };
+
+  typedef NVTokenTypeList<
+    NVTokenTerminate,
+    NVTokenNop,
+    NVTokenDrawElems,
+    NVTokenDrawArrays,
+    NVTokenDrawElemsStrip,
+    NVTokenDrawArraysStrip,
+    NVTokenDrawElemsInstanced,
+    NVTokenDrawArraysInstanced,
+    NVTokenVbo,
+    NVTokenIbo,
+    NVTokenUbo,
+    NVTokenLineWidth,
+    NVTokenPolygonOffset,
+    NVTokenScissor,
+    NVTokenBlendColor,
+    NVTokenViewport,
+    NVTokenAlphaRef,
+    NVTokenStencilRef,
+    NVTokenFrontFace> NVTokenTypes;
+
+  static_assert(NVTokenTypes::complete(), "every token type must be listed exactly once");
+
+  inline constexpr NVTokenTypeTable s_nvcmdlist_types = NVTokenTypes::table();
+
   template <class T>
   void nvtokenMakeNop(T & token){
     NVTokenNop *nop = (NVTokenNop*)&token;
@@ -536,9 +751,18 @@ namespace nvtoken
   size_t nvtokenEnqueue(std::string& queue, T& data)
   {
     size_t offset = queue.size();
-    std::string cmd = std::string((const char*)&data,sizeof(T));
 
-    queue += cmd;
+    queue.append((const char*)&data,sizeof(T));
+
+    return offset;
+  }
+
+  template <class T>
+  size_t nvtokenEnqueue(NVTokenStream& queue, T& data)
+  {
+    size_t offset = queue.size();
+
+    queue.append(&data,sizeof(T));
 
     return offset;
   }
@@ -557,19 +781,304 @@ namespace nvtoken
   
   //////////////////////////////////////////////////////////
   
-  void        nvtokenInitInternals( bool hwsupport, bool bindlessSupport);
+  // Returns false if the token headers can't be told apart. linearDecode
+  // forces the header scan the lookup table otherwise replaces, only there
+  // to compare against it.
+  bool        nvtokenInitInternals( bool hwsupport, bool bindlessSupport, bool linearDecode = false);
+  // The emulation issues its binds through the shadow state if one is set,
+  // so binds matching the current context are filtered. NULL by default.
+  void        nvtokenSetShadowState( ShadowState* shadow );
   const char* nvtokenCommandToString( GLenum type );
   void        nvtokenGetStats( const void* NV_RESTRICT stream, size_t streamSize, int stats[NVTOKEN_TYPES]);
 
+  enum NVTokenValidateResult {
+    NVTOKEN_VALID,
+    NVTOKEN_INVALID_SEQUENCE,   // sequence outside of stream or not 4 byte aligned
+    NVTOKEN_INVALID_HEADER,     // unknown token header
+    NVTOKEN_INVALID_SIZE,       // token crosses the end of its sequence
+    NVTOKEN_INVALID_UNIFORM,    // ubo address not 256 byte aligned, or empty range
+  };
+
+  // Checks the sequences of a stream in a single pass, meant to be used in
+  // release builds for streams that were loaded or created elsewhere.
+  // On failure errorOffset (optional) holds the stream offset of the bad
+  // sequence or token.
+  NVTokenValidateResult nvtokenValidate( const void* NV_RESTRICT stream, size_t streamSize,
+    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, GLuint count, size_t* errorOffset = NULL);
+
+  // Appends src's tokens to dst and rebases its sequences. If mergeSequences is set,
+  // src's first sequence is folded into dst's last one when both use the same
+  // state and fbo and are adjacent. This allows to build sub-streams independently
+  // (e.g. per thread) and get the same result as building them in one go.
+  void        nvtokenAppendSequences( NVTokenStream& dstStream, NVTokenSequence& dstSeq,
+                                      const NVTokenStream& srcStream, const NVTokenSequence& srcSeq, bool mergeSequences);
+
+  // Byte ranges of a stream that were changed in place, so that its copy in a
+  // buffer (created with GL_DYNAMIC_STORAGE_BIT) can be updated partially.
+  // The ranges are coalesced on upload, gaps of up to mergeGap bytes are
+  // uploaded along rather than costing another call.
+  class NVTokenDirtyRanges {
+  public:
+    void    add(size_t offset, size_t size);
+    bool    empty() const { return m_ranges.empty(); }
+    void    clear()       { m_ranges.clear(); }
+
+    // glNamedBufferSubData for the coalesced ranges, clears them,
+    // returns the number of uploads
+    GLuint  upload(GLuint buffer, const void* NV_RESTRICT stream, size_t mergeGap = 256);
+
+  private:
+    std::vector< std::pair<size_t, size_t> >  m_ranges;  // begin, end
+  };
+
+  // Overwrites tokens in place with ones of the same types. Only the bytes
+  // that differ are written and added to dirty, returns false if none did.
+  bool        nvtokenPatch( NVTokenStream& stream, size_t offset, const void* NV_RESTRICT tokens, size_t size, NVTokenDirtyRanges& dirty);
+
+  template <class T>
+  bool nvtokenPatch(NVTokenStream& stream, size_t offset, const T& token, NVTokenDirtyRanges& dirty)
+  {
+    return nvtokenPatch(stream, offset, &token, sizeof(T), dirty);
+  }
+
+  struct NVTokenOptimizeStats {
+    size_t    tokensRemoved;
+    size_t    bytesRemoved;
+  };
+
+  // Removes vbo, ibo and ubo tokens that bind the same address (or buffer range
+  // for emulation) as the previous token of the same binding point and stage.
+  // Bindings are tracked per sequence only. The stream is rewritten to contain
+  // just the sequences' tokens and the sequence offsets and sizes are updated.
+  void        nvtokenOptimizeBindings( NVTokenStream& stream, NVTokenSequence& seq, NVTokenOptimizeStats* stats);
+
+  // GL objects a stream refers to. Files store indices into these tables
+  // instead of names or addresses, so a stream can be loaded again with
+  // objects that were created later (or in another process).
+  struct NVTokenBufferRef {
+    GLuint      buffer;
+    GLuint64    address;    // only used with bindless
+    GLuint64    size;
+  };
+
+  struct NVTokenObjectTable {
+    const NVTokenBufferRef* buffers;
+    GLuint                  numBuffers;
+    const GLuint*           states;
+    GLuint                  numStates;
+    const GLuint*           fbos;       // 0 sequence fbos are kept as is
+    GLuint                  numFbos;
+  };
+
+  // Writes the stream and its sequences to a file. The vbo, ibo and ubo
+  // tokens as well as the sequence states and fbos must reference objects
+  // of the table, otherwise nothing is written and false is returned.
+  bool        nvtokenSaveFile( const char* filename, const void* NV_RESTRICT stream, size_t streamSize,
+                               const NVTokenSequence& seq, const NVTokenObjectTable& objects);
+
+  // Maps a file written by nvtokenSaveFile copy-on-write. The tokens are
+  // patched in place to the current headers and the table's buffers, so
+  // data() can be used directly without copying the stream.
+  // load fails if the file is damaged, was written with a different
+  // bindless mode, the table sizes differ from the ones at save time, or
+  // a token refers to a range outside of its buffer's size.
+  class NVTokenFile {
+  public:
+    NVTokenFile()
+      : m_mapping(NULL)
+      , m_mappingSize(0)
+      , m_data(NULL)
+      , m_size(0)
+    {
+    }
+
+    ~NVTokenFile()
+    {
+      unload();
+    }
+
+    bool load(const char* filename, const NVTokenObjectTable& objects, NVTokenSequence& seq);
+    void unload();
+
+    const unsigned char* data() const
+    {
+      return m_data;
+    }
+
+    size_t size() const
+    {
+      return m_size;
+    }
+
+  private:
+    NVTokenFile(const NVTokenFile&);
+    NVTokenFile& operator=(const NVTokenFile&);
+
+    void*           m_mapping;
+    size_t          m_mappingSize;
+    unsigned char*  m_data;
+    size_t          m_size;
+  };
+
+  // counters of the work done by one emulated submission,
+  // glCalls covers what the token decoding issues, binds the shadow state
+  // skipped are counted as filteredCalls instead, StateSystem transitions
+  // are only counted as stateChanges
+  struct NVTokenEmulationStats {
+    size_t  sequences;
+    size_t  tokens;
+    size_t  draws;
+    size_t  glCalls;        // issued by the tokens and fbo changes
+    size_t  filteredCalls;  // skipped by the shadow state, not in glCalls
+    size_t  stateChanges;
+    size_t  fboChanges;
+  };
+
   void nvtokenDrawCommandsSW(GLenum mode, const void* NV_RESTRICT stream, size_t streamSize, 
     const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
     GLuint count, 
-    StateSystem::State &state);
+    StateSystem::State &state, NVTokenEmulationStats* stats = NULL);
 
 #if NVTOKEN_STATESYSTEM
   void nvtokenDrawCommandsStatesSW(const void* NV_RESTRICT stream, size_t streamSize, 
     const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
     const GLuint* NV_RESTRICT states, const GLuint* NV_RESTRICT fbos, GLuint count, 
-    StateSystem &stateSystem);
+    StateSystem &stateSystem, NVTokenEmulationStats* stats = NULL);
+
+  // layout of the commands used by glMultiDrawElementsIndirect
+  struct NVTokenDrawIndirect {
+    GLuint  count;
+    GLuint  instanceCount;
+    GLuint  firstIndex;
+    GLint   baseVertex;
+    GLuint  baseInstance;
+  };
+
+  // Runs of DrawElements tokens that only differ in the per-object ubo range
+  // are issued as a single glMultiDrawElementsIndirect. The ubo at uboIndex is
+  // not bound, instead its range's offset / uboStride is passed as baseInstance
+  // and the programs must fetch the object data via gl_BaseInstanceARB from
+  // an array in that buffer. All ranges at uboIndex must be within uboBuffer
+  // (uboAddress with bindless). Redundant vbo and ibo tokens are skipped, so
+  // that draws of the same geometry form a run. Other draw tokens are issued
+  // as indirect draws that get the same baseInstance (added to their own).
+  struct NVTokenMultiDraw {
+    GLuint      uboIndex;
+    GLuint      uboStride;
+    GLuint      uboBuffer;
+    GLuint64    uboAddress;
+
+    // scratch space of the pending commands, kept across calls
+    std::vector<NVTokenDrawIndirect>  commands;
+  };
+
+  void nvtokenDrawCommandsStatesMultiSW(const void* NV_RESTRICT stream, size_t streamSize, 
+    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
+    const GLuint* NV_RESTRICT states, const GLuint* NV_RESTRICT fbos, GLuint count, 
+    StateSystem &stateSystem, NVTokenMultiDraw& multi, NVTokenEmulationStats* stats = NULL);
+
+  // Emulated counterpart of glCompileCommandListNV. The sequences are decoded
+  // once into a flat list of GL calls with resolved arguments (buffers or
+  // addresses, draw parameters, strides, index types), and the state and fbo
+  // transitions between them are compiled in. Replay neither parses tokens
+  // nor looks up states, so the list must be compiled again whenever the
+  // tokens, the StateSystem states or the fbos change. Replay filters the
+  // state transitions through the shadow of nvtokenSetShadowState as well,
+  // which should thus be the StateSystem's.
+  struct NVTokenCompiledList {
+    std::vector<GLuint>     words;  // opcode followed by its arguments
+    NVTokenEmulationStats   stats;  // the work of one replay
+  };
+
+  // The lists are recorded in segments, following glCommandListSegmentsNV.
+  // Every nvtokenListDrawCommandsStatesSW call appends to one segment and,
+  // like a separate nvtokenDrawCommandsStatesSW call, inherits neither state
+  // nor element type from what was recorded before. Segments are thus
+  // independent: distinct ones can be recorded from different threads, and
+  // a segment can be reset and recorded again without touching the others.
+  // The transitions are resolved without the StateSystem's cache for that.
+  // Replay executes the segments in order.
+  struct NVTokenSegmentedList {
+    std::vector<NVTokenCompiledList>  segments;
+  };
+
+  void nvtokenListSegmentsSW(NVTokenSegmentedList& list, GLuint segments);  // resets all segments
+  void nvtokenResetSegmentSW(NVTokenSegmentedList& list, GLuint segment);
+
+  void nvtokenListDrawCommandsStatesSW(NVTokenSegmentedList& list, GLuint segment, const void* NV_RESTRICT stream, size_t streamSize, 
+    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
+    const GLuint* NV_RESTRICT states, const GLuint* NV_RESTRICT fbos, GLuint count, 
+    const StateSystem &stateSystem);
+
+  void nvtokenDrawSegmentedSW(const NVTokenSegmentedList& list, NVTokenEmulationStats* stats = NULL);
+
+  // Pipelined emulation. Worker threads decode batches of about
+  // NVTOKEN_PIPELINE_BATCH token bytes into packets of ready-to-issue calls,
+  // like the segments of an NVTokenSegmentedList. Larger sequences are cut
+  // after draws, the batch continuing one inherits its state, element type
+  // and bindings. The packets are handed over in order through a ring of
+  // NVTOKEN_PIPELINE_PACKETS slots, so the calling thread only replays them
+  // while later ones are being decoded. Without workers the calling thread
+  // does both. Threads waiting for a packet check NVTOKEN_PIPELINE_SPINS
+  // times before they block.
+  #define NVTOKEN_PIPELINE_BATCH    4096
+  #define NVTOKEN_PIPELINE_PACKETS  16
+  #define NVTOKEN_PIPELINE_SPINS    256
+
+  struct NVTokenPipelineInternal;
+
+  // where the calling thread spent the last pipelined emulation, in seconds
+  struct NVTokenPipelineTimes {
+    double  replay;   // issuing the GL calls of the packets
+    double  wait;     // waiting for workers to finish packets
+  };
+
+  class NVTokenPipeline {
+  public:
+    NVTokenPipeline() : m_internal(NULL) {}
+    ~NVTokenPipeline() { deinit(); }
+
+    void    init(GLuint numWorkers);  // restarts the workers if initialized before
+    void    deinit();
+    GLuint  getNumWorkers() const;
+
+    // Runs task(0) to task(count - 1) on the workers and the calling
+    // thread, returns once all are done. Other work, such as recording the
+    // segments of an NVTokenSegmentedList, can so use the same threads.
+    void    runTasks(GLuint count, const std::function<void(GLuint)>& task);
+
+    const NVTokenPipelineTimes& getTimes() const;
+
+  private:
+    NVTokenPipeline(const NVTokenPipeline&) = delete;
+    NVTokenPipeline& operator=(const NVTokenPipeline&) = delete;
+
+    friend void nvtokenDrawCommandsStatesPipelinedSW(NVTokenPipeline& pipeline, const void* NV_RESTRICT stream, size_t streamSize, 
+      const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
+      const GLuint* NV_RESTRICT states, const GLuint* NV_RESTRICT fbos, GLuint count, 
+      const StateSystem &stateSystem, NVTokenEmulationStats* stats);
+
+    NVTokenPipelineInternal*  m_internal;
+  };
+
+  void nvtokenDrawCommandsStatesPipelinedSW(NVTokenPipeline& pipeline, const void* NV_RESTRICT stream, size_t streamSize, 
+    const GLintptr* NV_RESTRICT offsets, const GLsizei* NV_RESTRICT sizes, 
+    const GLuint* NV_RESTRICT states, const GLuint* NV_RESTRICT fbos, GLuint count, 
+    const StateSystem &stateSystem, NVTokenEmulationStats* stats = NULL);
+
+  struct NVTokenScheduleStats {
+    size_t    costBefore;
+    size_t    costAfter;
+  };
+
+  // Reorders sequences that use StateSystem ids, so that sequences with the
+  // same state and fbo follow each other and the remaining transitions are
+  // cheap according to StateSystem::getTransitionCost (an fbo change adds
+  // NVTOKEN_SCHEDULE_FBO_COST). Sequences flagged in orderDependent (optional,
+  // e.g. blended ones, or ones setting bindings later sequences rely on) keep
+  // their position, the others are only moved between them. Sequences of the
+  // same state and fbo keep their relative order.
+  void nvtokenScheduleSequences( NVTokenSequence& seq, const StateSystem& stateSystem,
+                                 const GLboolean* orderDependent, NVTokenScheduleStats* stats);
 #endif
 }
@@ -29,12 +29,18 @@ in Interpolants {
   vec3 wPos;
   vec3 wNormal;
   vec2 uv;
+#if USE_MULTIDRAW
+  flat uint objectIndex;
+#endif
 } IN;
 
 layout(location=0,index=0) out vec4 out_Color;
 
 void main()
 {
+#if USE_MULTIDRAW
+  ObjectData object = objects[IN.objectIndex].data;
+#endif
   vec4 color = texture(object.texColor, IN.uv * object.texScale.xy);
   
   vec3 lightDir = normalize(scene.wLightPos.xyz - IN.wPos);
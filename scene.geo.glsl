@@ -32,12 +32,18 @@ in Interpolants {
   vec3 wPos;
   vec3 wNormal;
   vec2 uv;
+#if USE_MULTIDRAW
+  flat uint objectIndex;
+#endif
 } IN[];
 
 out Interpolants {
   vec3 wPos;
   vec3 wNormal;
   vec2 uv;
+#if USE_MULTIDRAW
+  flat uint objectIndex;
+#endif
 } OUT;
 
 void main()
@@ -65,6 +71,9 @@ void main()
     OUT.wPos = wPos;
     OUT.wNormal = useFaceNormal ? normal : IN[i].wNormal;
     OUT.uv = IN[i].uv;
+#if USE_MULTIDRAW
+    OUT.objectIndex = IN[i].objectIndex;
+#endif
     gl_Position = scene.viewProjMatrix * vec4(wPos,1);
     EmitVertex();
   }
@@ -23,6 +23,9 @@
 /**/
 
 #extension GL_ARB_shading_language_include : enable
+#if USE_MULTIDRAW
+#extension GL_ARB_shader_draw_parameters : require
+#endif
 #include "common.h"
 
 in layout(location=VERTEX_POS)    vec3 pos;
@@ -33,10 +36,17 @@ out Interpolants {
   vec3 wPos;
   vec3 wNormal;
   vec2 uv;
+#if USE_MULTIDRAW
+  flat uint objectIndex;
+#endif
 } OUT;
 
 void main()
 {
+#if USE_MULTIDRAW
+  ObjectData object = objects[gl_BaseInstanceARB].data;
+  OUT.objectIndex = uint(gl_BaseInstanceARB);
+#endif
   vec3 wPos     = (object.worldMatrix   * vec4(pos,1)).xyz;
   vec3 wNormal  = mat3(object.worldMatrixIT) * normal;
   gl_Position   = scene.viewProjMatrix * vec4(wPos,1);
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+/* Contact ckubisch@nvidia.com (Christoph Kubisch) for feedback */
+
+
+#include "shadowstate.hpp"
+
+
+void ShadowState::invalidate()
+{
+  // keys stay, only the values are forgotten
+  for (GLuint i = 0; i < CAP_SLOTS; i++) {
+    m_capValues[i] = -1;
+  }
+  m_attribKnown = 0;
+  m_attribEnabled = 0;
+
+  m_program = INVALID_NAME;
+  m_fboDraw = INVALID_NAME;
+  m_fboRead = INVALID_NAME;
+  m_elementBuffer = INVALID_NAME;
+
+  for (GLuint i = 0; i < MAX_BUFFER_BINDINGS; i++) {
+    m_uniformBuffers[i].buffer = INVALID_NAME;
+    m_storageBuffers[i].buffer = INVALID_NAME;
+    m_uniformAddresses[i].address = ~GLuint64(0);
+  }
+  for (GLuint i = 0; i < MAX_VERTEX_BINDINGS; i++) {
+    m_vertexBuffers[i].buffer = INVALID_NAME;
+  }
+  for (GLuint i = 0; i < MAX_VERTEX_ATTRIBS; i++) {
+    m_vertexAddresses[i].address = ~GLuint64(0);
+  }
+  m_elementAddress.address = ~GLuint64(0);
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2014-2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2014-2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+/* Contact ckubisch@nvidia.com (Christoph Kubisch) for feedback */
+
+
+#ifndef SHADOWSTATE_H__
+#define SHADOWSTATE_H__
+
+
+#include <nvgl/extensions_gl.hpp>
+
+// Value-level shadow of the parts of the context that are changed most
+// often while drawing: capabilities, program, framebuffers, buffer and
+// vertex buffer bindings, as well as bindless addresses.
+// Calls that would set what the context already holds are filtered, the
+// binding calls return whether they were issued.
+//
+// Everything starts out unknown. invalidate() must be called whenever the
+// context was changed without going through the shadow (other libraries,
+// native command lists, vertex array object switches...).
+
+class ShadowState {
+public:
+  static const GLuint MAX_BUFFER_BINDINGS = 16;   // per indexed buffer target
+  static const GLuint MAX_VERTEX_BINDINGS = 16;
+  static const GLuint MAX_VERTEX_ATTRIBS  = 16;
+
+  struct Stats {
+    GLuint  issued;
+    GLuint  filtered;
+  };
+
+  ShadowState()
+  {
+    for (GLuint i = 0; i < CAP_SLOTS; i++) {
+      m_capKeys[i] = 0;
+    }
+    invalidate();
+    resetStats();
+  }
+
+  void invalidate();
+
+  void          resetStats()      { m_stats.issued = 0; m_stats.filtered = 0; }
+  const Stats&  getStats() const  { return m_stats; }
+
+  //////////////////////////////////////////////////////////////////////////
+
+  void enable(GLenum cap)   { setCap(cap, true); }
+  void disable(GLenum cap)  { setCap(cap, false); }
+
+  // indexed enables change what the non-indexed cap reports
+  void enablei(GLenum cap, GLuint index)
+  {
+    forgetCap(cap);
+    issued();
+    glEnablei(cap, index);
+  }
+  void disablei(GLenum cap, GLuint index)
+  {
+    forgetCap(cap);
+    issued();
+    glDisablei(cap, index);
+  }
+
+  void enableVertexAttribArray(GLuint index)   { setAttribArray(index, true); }
+  void disableVertexAttribArray(GLuint index)  { setAttribArray(index, false); }
+
+  bool useProgram(GLuint program)
+  {
+    if (m_program == program) {
+      filtered();
+      return false;
+    }
+    m_program = program;
+    issued();
+    glUseProgram(program);
+    return true;
+  }
+
+  bool bindFramebuffer(GLenum target, GLuint fbo)
+  {
+    bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+    bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+    if ((!draw || m_fboDraw == fbo) && (!read || m_fboRead == fbo)) {
+      filtered();
+      return false;
+    }
+    if (draw) m_fboDraw = fbo;
+    if (read) m_fboRead = fbo;
+    issued();
+    glBindFramebuffer(target, fbo);
+    return true;
+  }
+
+  // only the element array binding is tracked
+  bool bindBuffer(GLenum target, GLuint buffer)
+  {
+    if (target == GL_ELEMENT_ARRAY_BUFFER) {
+      if (m_elementBuffer == buffer) {
+        filtered();
+        return false;
+      }
+      m_elementBuffer = buffer;
+    }
+    issued();
+    glBindBuffer(target, buffer);
+    return true;
+  }
+
+  bool bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+  {
+    if (!setBufferRange(target, index, buffer, 0, WHOLE_BUFFER)) return false;
+    issued();
+    glBindBufferBase(target, index, buffer);
+    return true;
+  }
+
+  bool bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+  {
+    if (!setBufferRange(target, index, buffer, offset, size)) return false;
+    issued();
+    glBindBufferRange(target, index, buffer, offset, size);
+    return true;
+  }
+
+  bool bindVertexBuffer(GLuint index, GLuint buffer, GLintptr offset, GLsizei stride)
+  {
+    if (index < MAX_VERTEX_BINDINGS) {
+      VertexBuffer& vbo = m_vertexBuffers[index];
+      if (vbo.buffer == buffer && vbo.offset == offset && vbo.stride == stride) {
+        filtered();
+        return false;
+      }
+      vbo.buffer = buffer;
+      vbo.offset = offset;
+      vbo.stride = stride;
+    }
+    issued();
+    glBindVertexBuffer(index, buffer, offset, stride);
+    return true;
+  }
+
+  bool bufferAddressRangeNV(GLenum pname, GLuint index, GLuint64 address, GLsizeiptr length)
+  {
+    AddressRange* range = NULL;
+    switch (pname) {
+    case GL_VERTEX_ATTRIB_ARRAY_ADDRESS_NV:
+      range = index < MAX_VERTEX_ATTRIBS ? &m_vertexAddresses[index] : NULL;
+      break;
+    case GL_ELEMENT_ARRAY_ADDRESS_NV:
+      range = &m_elementAddress;
+      break;
+    case GL_UNIFORM_BUFFER_ADDRESS_NV:
+      range = index < MAX_BUFFER_BINDINGS ? &m_uniformAddresses[index] : NULL;
+      break;
+    }
+    if (range) {
+      if (range->address == address && range->length == length) {
+        filtered();
+        return false;
+      }
+      range->address = address;
+      range->length = length;
+    }
+    issued();
+    glBufferAddressRangeNV(pname, index, address, length);
+    return true;
+  }
+
+private:
+  static const GLuint     CAP_BITS  = 6;
+  static const GLuint     CAP_SLOTS = 1 << CAP_BITS;
+  static const GLuint     INVALID_NAME = ~0u;
+  static const GLsizeiptr WHOLE_BUFFER = -1;   // glBindBufferBase
+
+  struct BufferRange {
+    GLuint      buffer;
+    GLintptr    offset;
+    GLsizeiptr  size;
+  };
+
+  struct VertexBuffer {
+    GLuint      buffer;
+    GLintptr    offset;
+    GLsizei     stride;
+  };
+
+  struct AddressRange {
+    GLuint64    address;
+    GLsizeiptr  length;
+  };
+
+  // caps are hashed into a small open addressed table, as the enums are
+  // sparse; values are -1 (unknown), 0 or 1
+  GLenum        m_capKeys[CAP_SLOTS];
+  GLbyte        m_capValues[CAP_SLOTS];
+  GLbitfield    m_attribKnown;
+  GLbitfield    m_attribEnabled;
+
+  GLuint        m_program;
+  GLuint        m_fboDraw;
+  GLuint        m_fboRead;
+  GLuint        m_elementBuffer;
+  BufferRange   m_uniformBuffers[MAX_BUFFER_BINDINGS];
+  BufferRange   m_storageBuffers[MAX_BUFFER_BINDINGS];
+  VertexBuffer  m_vertexBuffers[MAX_VERTEX_BINDINGS];
+
+  AddressRange  m_elementAddress;
+  AddressRange  m_vertexAddresses[MAX_VERTEX_ATTRIBS];
+  AddressRange  m_uniformAddresses[MAX_BUFFER_BINDINGS];
+
+  Stats         m_stats;
+
+  void issued()   { m_stats.issued++; }
+  void filtered() { m_stats.filtered++; }
+
+  // returns NULL if the table is full, the cap is then not tracked
+  GLbyte* capValue(GLenum cap)
+  {
+    GLuint slot = (cap * 0x9E3779B1u) >> (32 - CAP_BITS);
+    for (GLuint i = 0; i < CAP_SLOTS; i++, slot = (slot + 1) & (CAP_SLOTS - 1)) {
+      if (m_capKeys[slot] == cap) {
+        return &m_capValues[slot];
+      }
+      if (m_capKeys[slot] == 0) {
+        m_capKeys[slot] = cap;
+        m_capValues[slot] = -1;
+        return &m_capValues[slot];
+      }
+    }
+    return NULL;
+  }
+
+  void forgetCap(GLenum cap)
+  {
+    GLbyte* value = capValue(cap);
+    if (value) *value = -1;
+  }
+
+  void setCap(GLenum cap, bool state)
+  {
+    GLbyte* value = capValue(cap);
+    if (value) {
+      if (*value == GLbyte(state)) {
+        filtered();
+        return;
+      }
+      *value = GLbyte(state);
+    }
+    issued();
+    if (state)  glEnable(cap);
+    else        glDisable(cap);
+  }
+
+  void setAttribArray(GLuint index, bool state)
+  {
+    if (index < MAX_VERTEX_ATTRIBS) {
+      GLbitfield bit = 1 << index;
+      if ((m_attribKnown & bit) && ((m_attribEnabled & bit) != 0) == state) {
+        filtered();
+        return;
+      }
+      m_attribKnown |= bit;
+      if (state)  m_attribEnabled |= bit;
+      else        m_attribEnabled &= ~bit;
+    }
+    issued();
+    if (state)  glEnableVertexAttribArray(index);
+    else        glDisableVertexAttribArray(index);
+  }
+
+  // returns true if the call must be issued
+  bool setBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+  {
+    BufferRange* range = NULL;
+    if (index < MAX_BUFFER_BINDINGS) {
+      if      (target == GL_UNIFORM_BUFFER)         range = &m_uniformBuffers[index];
+      else if (target == GL_SHADER_STORAGE_BUFFER)  range = &m_storageBuffers[index];
+    }
+    if (range) {
+      if (range->buffer == buffer && range->offset == offset && range->size == size) {
+        filtered();
+        return false;
+      }
+      range->buffer = buffer;
+      range->offset = offset;
+      range->size = size;
+    }
+    return true;
+  }
+};
+
+#endif
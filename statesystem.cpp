@@ -21,15 +21,153 @@
 /* Contact ckubisch@nvidia.com (Christoph Kubisch) for feedback */
 
 #include "statesystem.hpp"
-#include <cstring> // memcmp
+#include "shadowstate.hpp"
+#include <algorithm>
+#include <cstring> // memcmp, memcpy
+#include <assert.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+
+static inline GLfloat opFloat(const GLuint* w)
+{
+  GLfloat v;
+  memcpy(&v, w, sizeof(v));
+  return v;
+}
+
+static inline GLdouble opDouble(const GLuint* w)
+{
+  GLdouble v;
+  memcpy(&v, w, sizeof(v));
+  return v;
+}
+
+void StateSystem::OpList::execute(const GLuint* words, size_t numWords, bool skipFboBinding, ShadowState* shadow)
+{
+  const GLuint* w   = words;
+  const GLuint* end = words + numWords;
+
+  while (w < end) {
+    switch (OpCode(*w++)) {
+    case OP_ENABLE:
+      if (shadow) shadow->enable(w[0]);
+      else        glEnable(w[0]);
+      w += 1;
+      break;
+    case OP_DISABLE:
+      if (shadow) shadow->disable(w[0]);
+      else        glDisable(w[0]);
+      w += 1;
+      break;
+    case OP_ENABLEI:
+      if (shadow) shadow->enablei(w[0], w[1]);
+      else        glEnablei(w[0], w[1]);
+      w += 2;
+      break;
+    case OP_DISABLEI:
+      if (shadow) shadow->disablei(w[0], w[1]);
+      else        glDisablei(w[0], w[1]);
+      w += 2;
+      break;
+    case OP_USE_PROGRAM:
+      if (shadow) shadow->useProgram(w[0]);
+      else        glUseProgram(w[0]);
+      w += 1;
+      break;
+#if STATESYSTEM_USE_DEPRECATED
+    case OP_ALPHA_FUNC:               glAlphaFunc(w[0], opFloat(w + 1)); w += 2; break;
+    case OP_LINE_STIPPLE:             glLineStipple(GLint(w[0]), GLushort(w[1])); w += 2; break;
+    case OP_SHADE_MODEL:              glShadeModel(w[0]); w += 1; break;
+#endif
+    case OP_STENCIL_FUNC_SEPARATE:    glStencilFuncSeparate(w[0], w[1], GLint(w[2]), w[3]); w += 4; break;
+    case OP_STENCIL_OP_SEPARATE:      glStencilOpSeparate(w[0], w[1], w[2], w[3]); w += 4; break;
+    case OP_BLEND_FUNC_SEPARATE:      glBlendFuncSeparate(w[0], w[1], w[2], w[3]); w += 4; break;
+    case OP_BLEND_FUNC_SEPARATEI:     glBlendFuncSeparatei(w[0], w[1], w[2], w[3], w[4]); w += 5; break;
+    case OP_BLEND_EQUATION_SEPARATE:  glBlendEquationSeparate(w[0], w[1]); w += 2; break;
+    case OP_BLEND_EQUATION_SEPARATEI: glBlendEquationSeparatei(w[0], w[1], w[2]); w += 3; break;
+    case OP_DEPTH_FUNC:               glDepthFunc(w[0]); w += 1; break;
+    case OP_LOGIC_OP:                 glLogicOp(w[0]); w += 1; break;
+    case OP_CULL_FACE:                glCullFace(w[0]); w += 1; break;
+    case OP_POLYGON_MODE:             glPolygonMode(w[0], w[1]); w += 2; break;
+    case OP_POINT_SIZE:               glPointSize(opFloat(w)); w += 1; break;
+    case OP_POINT_PARAMETERF:         glPointParameterf(w[0], opFloat(w + 1)); w += 2; break;
+    case OP_POINT_PARAMETERI:         glPointParameteri(w[0], GLint(w[1])); w += 2; break;
+    case OP_PRIMITIVE_RESTART_INDEX:  glPrimitiveRestartIndex(w[0]); w += 1; break;
+    case OP_PROVOKING_VERTEX:         glProvokingVertex(w[0]); w += 1; break;
+    case OP_PATCH_PARAMETERI:         glPatchParameteri(w[0], GLint(w[1])); w += 2; break;
+    case OP_SAMPLE_COVERAGE:          glSampleCoverage(opFloat(w), GLboolean(w[1])); w += 2; break;
+    case OP_SAMPLE_MASKI:             glSampleMaski(w[0], w[1]); w += 2; break;
+    case OP_DEPTH_RANGE:              glDepthRange(opDouble(w), opDouble(w + 2)); w += 4; break;
+    case OP_DEPTH_RANGE_INDEXED:      glDepthRangeIndexed(w[0], opDouble(w + 1), opDouble(w + 3)); w += 5; break;
+    case OP_DEPTH_RANGE_ARRAY:
+      {
+        GLdouble depths[MAX_VIEWPORTS * 2];
+        memcpy(depths, w + 1, sizeof(GLdouble) * 2 * w[0]);
+        glDepthRangeArrayv(0, w[0], depths);
+        w += 1 + w[0] * 4;
+      }
+      break;
+    case OP_COLOR_MASK:               glColorMask(GLboolean(w[0]), GLboolean(w[1]), GLboolean(w[2]), GLboolean(w[3])); w += 4; break;
+    case OP_COLOR_MASKI:              glColorMaski(w[0], GLboolean(w[1]), GLboolean(w[2]), GLboolean(w[3]), GLboolean(w[4])); w += 5; break;
+    case OP_DEPTH_MASK:               glDepthMask(GLboolean(w[0])); w += 1; break;
+    case OP_STENCIL_MASK_SEPARATE:    glStencilMaskSeparate(w[0], w[1]); w += 2; break;
+    case OP_BIND_FRAMEBUFFER:
+      if (!skipFboBinding) {
+        if (shadow) shadow->bindFramebuffer(w[0], w[1]);
+        else        glBindFramebuffer(w[0], w[1]);
+      }
+      w += 2;
+      break;
+    case OP_DRAW_BUFFERS:             glDrawBuffers(GLsizei(w[0]), w + 1); w += 1 + w[0]; break;
+    case OP_READ_BUFFER:              glReadBuffer(w[0]); w += 1; break;
+    case OP_ENABLE_VERTEX_ATTRIB_ARRAY:
+      if (shadow) shadow->enableVertexAttribArray(w[0]);
+      else        glEnableVertexAttribArray(w[0]);
+      w += 1;
+      break;
+    case OP_DISABLE_VERTEX_ATTRIB_ARRAY:
+      if (shadow) shadow->disableVertexAttribArray(w[0]);
+      else        glDisableVertexAttribArray(w[0]);
+      w += 1;
+      break;
+    case OP_VERTEX_ATTRIB_FORMAT:     glVertexAttribFormat(w[0], GLint(w[1]), w[2], GLboolean(w[3]), w[4]); w += 5; break;
+    case OP_VERTEX_ATTRIB_IFORMAT:    glVertexAttribIFormat(w[0], GLint(w[1]), w[2], w[3]); w += 4; break;
+    case OP_VERTEX_ATTRIB_BINDING:    glVertexAttribBinding(w[0], w[1]); w += 2; break;
+    case OP_VERTEX_BINDING_DIVISOR:   glVertexBindingDivisor(w[0], w[1]); w += 2; break;
+    case OP_BIND_VERTEX_BUFFER:
+      if (shadow) shadow->bindVertexBuffer(w[0], 0, 0, GLsizei(w[1]));
+      else        glBindVertexBuffer(w[0], 0, 0, GLsizei(w[1]));
+      w += 2;
+      break;
+    case OP_VERTEX_ATTRIB_4FV:
+      {
+        GLfloat v[4];
+        memcpy(v, w + 1, sizeof(v));
+        glVertexAttrib4fv(w[0], v);
+        w += 5;
+      }
+      break;
+    case OP_VERTEX_ATTRIB_I4IV:       glVertexAttribI4iv(w[0], (const GLint*)(w + 1)); w += 5; break;
+    case OP_VERTEX_ATTRIB_I4UIV:      glVertexAttribI4uiv(w[0], w + 1); w += 5; break;
+    default:
+      assert(0 && "unknown StateSystem opcode");
+      return;
+    }
+  }
+}
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::ClipDistanceState::applyGL() const
+void StateSystem::ClipDistanceState::compileGL(OpList& ops, GLbitfield changed) const
 {
   for (GLuint i = 0; i < MAX_CLIPPLANES; i++) {
-    if (isBitSet(enabled, i))  glEnable(GL_CLIP_DISTANCE0 + i);
-    else                      glDisable(GL_CLIP_DISTANCE0 + i);
+    if (!isBitSet(changed, i)) continue;
+    if (isBitSet(enabled, i))  ops.add(OP_ENABLE, GLenum(GL_CLIP_DISTANCE0 + i));
+    else                      ops.add(OP_DISABLE, GLenum(GL_CLIP_DISTANCE0 + i));
   }
 }
 
@@ -44,9 +182,9 @@ void StateSystem::ClipDistanceState::getGL()
 //////////////////////////////////////////////////////////////////////////
 
 #if STATESYSTEM_USE_DEPRECATED
-void StateSystem::AlphaStateDepr::applyGL() const
+void StateSystem::AlphaStateDepr::compileGL(OpList& ops) const
 {
-  glAlphaFunc(mode, refvalue);
+  ops.add(OP_ALPHA_FUNC, mode, refvalue);
 }
 
 void StateSystem::AlphaStateDepr::getGL()
@@ -58,12 +196,27 @@ void StateSystem::AlphaStateDepr::getGL()
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::StencilState::applyGL() const
+void StateSystem::StencilState::compileGL(OpList& opList, GLbitfield changed) const
 {
-  glStencilFuncSeparate(GL_FRONT, funcs[FACE_FRONT].func, funcs[FACE_FRONT].refvalue, funcs[FACE_FRONT].mask);
-  glStencilFuncSeparate(GL_BACK, funcs[FACE_BACK].func, funcs[FACE_BACK].refvalue, funcs[FACE_BACK].mask);
-  glStencilOpSeparate(GL_FRONT, ops[FACE_FRONT].fail, ops[FACE_FRONT].zfail, ops[FACE_FRONT].zpass);
-  glStencilOpSeparate(GL_BACK, ops[FACE_BACK].fail, ops[FACE_BACK].zfail, ops[FACE_BACK].zpass);
+  // both faces in one call when they agree
+  bool funcBoth = isBitSet(changed, FUNC_FRONT) && isBitSet(changed, FUNC_BACK) && memcmp(&funcs[FACE_FRONT], &funcs[FACE_BACK], sizeof(StencilFunc)) == 0;
+  bool opBoth   = isBitSet(changed, OP_FRONT) && isBitSet(changed, OP_BACK) && memcmp(&ops[FACE_FRONT], &ops[FACE_BACK], sizeof(StencilOp)) == 0;
+
+  if (funcBoth) {
+    opList.add(OP_STENCIL_FUNC_SEPARATE, GLenum(GL_FRONT_AND_BACK), funcs[FACE_FRONT].func, funcs[FACE_FRONT].refvalue, funcs[FACE_FRONT].mask);
+  }
+  else {
+    if (isBitSet(changed, FUNC_FRONT)) opList.add(OP_STENCIL_FUNC_SEPARATE, GLenum(GL_FRONT), funcs[FACE_FRONT].func, funcs[FACE_FRONT].refvalue, funcs[FACE_FRONT].mask);
+    if (isBitSet(changed, FUNC_BACK))  opList.add(OP_STENCIL_FUNC_SEPARATE, GLenum(GL_BACK), funcs[FACE_BACK].func, funcs[FACE_BACK].refvalue, funcs[FACE_BACK].mask);
+  }
+
+  if (opBoth) {
+    opList.add(OP_STENCIL_OP_SEPARATE, GLenum(GL_FRONT_AND_BACK), ops[FACE_FRONT].fail, ops[FACE_FRONT].zfail, ops[FACE_FRONT].zpass);
+  }
+  else {
+    if (isBitSet(changed, OP_FRONT)) opList.add(OP_STENCIL_OP_SEPARATE, GLenum(GL_FRONT), ops[FACE_FRONT].fail, ops[FACE_FRONT].zfail, ops[FACE_FRONT].zpass);
+    if (isBitSet(changed, OP_BACK))  opList.add(OP_STENCIL_OP_SEPARATE, GLenum(GL_BACK), ops[FACE_BACK].fail, ops[FACE_BACK].zfail, ops[FACE_BACK].zpass);
+  }
 }
 
 void StateSystem::StencilState::getGL()
@@ -87,24 +240,25 @@ void StateSystem::StencilState::getGL()
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::BlendState::applyGL() const
+void StateSystem::BlendState::compileGL(OpList& ops, GLbitfield changedEnable, GLbitfield changedFunc, GLbitfield changedEquation) const
 {
   if (separateEnable) {
     for (GLuint i = 0; i < MAX_DRAWBUFFERS; i++) {
-      if (isBitSet(separateEnable, i)) glEnablei(GL_BLEND, i);
-      else                            glDisablei(GL_BLEND, i);
+      if (!isBitSet(changedEnable, i)) continue;
+      if (isBitSet(separateEnable, i)) ops.add(OP_ENABLEI, GLenum(GL_BLEND), i);
+      else                            ops.add(OP_DISABLEI, GLenum(GL_BLEND), i);
     }
   }
 
   if (useSeparate) {
     for (GLuint i = 0; i < MAX_DRAWBUFFERS; i++) {
-      glBlendFuncSeparatei(i, blends[i].rgb.srcw, blends[i].rgb.dstw, blends[i].alpha.srcw, blends[i].alpha.dstw);
-      glBlendEquationSeparatei(i, blends[i].rgb.equ, blends[i].alpha.equ);
+      if (isBitSet(changedFunc, i))     ops.add(OP_BLEND_FUNC_SEPARATEI, i, blends[i].rgb.srcw, blends[i].rgb.dstw, blends[i].alpha.srcw, blends[i].alpha.dstw);
+      if (isBitSet(changedEquation, i)) ops.add(OP_BLEND_EQUATION_SEPARATEI, i, blends[i].rgb.equ, blends[i].alpha.equ);
     }
   }
   else {
-    glBlendFuncSeparate(blends[0].rgb.srcw, blends[0].rgb.dstw, blends[0].alpha.srcw, blends[0].alpha.dstw);
-    glBlendEquationSeparate(blends[0].rgb.equ, blends[0].alpha.equ);
+    if (changedFunc)      ops.add(OP_BLEND_FUNC_SEPARATE, blends[0].rgb.srcw, blends[0].rgb.dstw, blends[0].alpha.srcw, blends[0].alpha.dstw);
+    if (changedEquation)  ops.add(OP_BLEND_EQUATION_SEPARATE, blends[0].rgb.equ, blends[0].alpha.equ);
   }
 
   //glBlendColor(color[0],color[1],color[2],color[3]);
@@ -131,7 +285,7 @@ void StateSystem::BlendState::getGL()
     glGetIntegeri_v(GL_BLEND_DST_ALPHA, i, (GLint*)&blends[i].alpha.dstw);
     glGetIntegeri_v(GL_BLEND_EQUATION_ALPHA, i, (GLint*)&blends[i].alpha.equ);
 
-    if (i > 1 && memcmp(&blends[i].rgb, &blends[i - 1].rgb, sizeof(blends[i].rgb)) == 0 && memcmp(&blends[i].alpha, &blends[i - 1].alpha, sizeof(blends[i].alpha)) == 0) {
+    if (i > 0 && memcmp(&blends[i].rgb, &blends[i - 1].rgb, sizeof(blends[i].rgb)) == 0 && memcmp(&blends[i].alpha, &blends[i - 1].alpha, sizeof(blends[i].alpha)) == 0) {
       numEqual++;
     }
   }
@@ -143,9 +297,9 @@ void StateSystem::BlendState::getGL()
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::DepthState::applyGL() const
+void StateSystem::DepthState::compileGL(OpList& ops) const
 {
-  glDepthFunc(func);
+  ops.add(OP_DEPTH_FUNC, func);
 }
 
 void StateSystem::DepthState::getGL()
@@ -155,9 +309,9 @@ void StateSystem::DepthState::getGL()
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::LogicState::applyGL() const
+void StateSystem::LogicState::compileGL(OpList& ops) const
 {
-  glLogicOp(op);
+  ops.add(OP_LOGIC_OP, op);
 }
 
 void StateSystem::LogicState::getGL()
@@ -167,16 +321,16 @@ void StateSystem::LogicState::getGL()
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::RasterState::applyGL() const
+void StateSystem::RasterState::compileGL(OpList& ops, GLbitfield changed) const
 {
   //glFrontFace(frontFace);
-  glCullFace(cullFace);
+  if (isBitSet(changed, CULLFACE))           ops.add(OP_CULL_FACE, cullFace);
   //glPolygonOffset(polyOffsetFactor,polyOffsetUnits);
-  glPolygonMode(GL_FRONT_AND_BACK, polyMode);
+  if (isBitSet(changed, POLYMODE))           ops.add(OP_POLYGON_MODE, GLenum(GL_FRONT_AND_BACK), polyMode);
   //glLineWidth(lineWidth);
-  glPointSize(pointSize);
-  glPointParameterf(GL_POINT_FADE_THRESHOLD_SIZE, pointFade);
-  glPointParameteri(GL_POINT_SPRITE_COORD_ORIGIN, pointSpriteOrigin);
+  if (isBitSet(changed, POINTSIZE))          ops.add(OP_POINT_SIZE, pointSize);
+  if (isBitSet(changed, POINTFADE))          ops.add(OP_POINT_PARAMETERF, GLenum(GL_POINT_FADE_THRESHOLD_SIZE), pointFade);
+  if (isBitSet(changed, POINTSPRITEORIGIN))  ops.add(OP_POINT_PARAMETERI, GLenum(GL_POINT_SPRITE_COORD_ORIGIN), pointSpriteOrigin);
 }
 
 void StateSystem::RasterState::getGL()
@@ -194,10 +348,10 @@ void StateSystem::RasterState::getGL()
 //////////////////////////////////////////////////////////////////////////
 
 #if STATESYSTEM_USE_DEPRECATED
-void StateSystem::RasterStateDepr::applyGL() const
+void StateSystem::RasterStateDepr::compileGL(OpList& ops) const
 {
-  glLineStipple(lineStippleFactor, lineStipplePattern);
-  glShadeModel(shadeModel);
+  ops.add(OP_LINE_STIPPLE, lineStippleFactor, lineStipplePattern);
+  ops.add(OP_SHADE_MODEL, shadeModel);
 }
 
 void StateSystem::RasterStateDepr::getGL()
@@ -212,11 +366,11 @@ void StateSystem::RasterStateDepr::getGL()
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::PrimitiveState::applyGL() const
+void StateSystem::PrimitiveState::compileGL(OpList& ops, GLbitfield changed) const
 {
-  glPrimitiveRestartIndex(restartIndex);
-  glProvokingVertex(provokingVertex);
-  glPatchParameteri(GL_PATCH_VERTICES, patchVertices);
+  if (isBitSet(changed, RESTARTINDEX))     ops.add(OP_PRIMITIVE_RESTART_INDEX, restartIndex);
+  if (isBitSet(changed, PROVOKINGVERTEX))  ops.add(OP_PROVOKING_VERTEX, provokingVertex);
+  if (isBitSet(changed, PATCHVERTICES))    ops.add(OP_PATCH_PARAMETERI, GLenum(GL_PATCH_VERTICES), patchVertices);
 }
 
 void StateSystem::PrimitiveState::getGL()
@@ -228,15 +382,15 @@ void StateSystem::PrimitiveState::getGL()
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::SampleState::applyGL() const
+void StateSystem::SampleState::compileGL(OpList& ops) const
 {
-  glSampleCoverage(coverage, invert);
-  glSampleMaski(0, mask);
+  ops.add(OP_SAMPLE_COVERAGE, coverage, invert);
+  ops.add(OP_SAMPLE_MASKI, GLuint(0), mask);
 }
 
 void StateSystem::SampleState::getGL()
 {
-  glGetIntegerv(GL_SAMPLE_COVERAGE_VALUE, (GLint*)&coverage);
+  glGetFloatv(GL_SAMPLE_COVERAGE_VALUE, &coverage);
   glGetIntegerv(GL_SAMPLE_COVERAGE_INVERT, (GLint*)&invert);
   glGetIntegeri_v(GL_SAMPLE_MASK_VALUE, 0, (GLint*)&mask);
 }
@@ -268,13 +422,26 @@ useSeparate = (numEqual != MAX_VIEWPORTS);
 */
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::DepthRangeState::applyGL() const
+void StateSystem::DepthRangeState::compileGL(OpList& ops, GLbitfield changed) const
 {
+  const GLbitfield all = (1 << MAX_VIEWPORTS) - 1;
+
   if (useSeparate) {
-    glDepthRangeArrayv(0, MAX_VIEWPORTS, &depths[0].nearPlane);
+    if ((changed & all) == all) {
+      ops.add(OP_DEPTH_RANGE_ARRAY, GLuint(MAX_VIEWPORTS));
+      for (GLuint i = 0; i < MAX_VIEWPORTS; i++) {
+        ops.push(depths[i].nearPlane);
+        ops.push(depths[i].farPlane);
+      }
+    }
+    else {
+      for (GLuint i = 0; i < MAX_VIEWPORTS; i++) {
+        if (isBitSet(changed, i)) ops.add(OP_DEPTH_RANGE_INDEXED, i, depths[i].nearPlane, depths[i].farPlane);
+      }
+    }
   }
-  else {
-    glDepthRange(depths[0].nearPlane, depths[0].farPlane);
+  else if (changed) {
+    ops.add(OP_DEPTH_RANGE, depths[0].nearPlane, depths[0].farPlane);
   }
 }
 
@@ -318,44 +485,49 @@ useSeparate = (numEqual != MAX_VIEWPORTS);
 */
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::ScissorEnableState::applyGL() const
+void StateSystem::ScissorEnableState::compileGL(OpList& ops, GLbitfield changed) const
 {
   if (separateEnable) {
     for (GLuint i = 0; i < MAX_VIEWPORTS; i++) {
-      if (isBitSet(separateEnable, i))  glEnablei(GL_SCISSOR_TEST, i);
-      else                                    glDisablei(GL_SCISSOR_TEST, i);
+      if (!isBitSet(changed, i)) continue;
+      if (isBitSet(separateEnable, i))  ops.add(OP_ENABLEI, GLenum(GL_SCISSOR_TEST), i);
+      else                              ops.add(OP_DISABLEI, GLenum(GL_SCISSOR_TEST), i);
     }
   }
-
 }
 
 void StateSystem::ScissorEnableState::getGL()
 {
   GLuint stateSet = 0;
   separateEnable = 0;
-  for (GLuint i = 0; i < MAX_DRAWBUFFERS; i++) {
-    if (setBitState(separateEnable, i, glIsEnabledi(GL_BLEND, i))) stateSet++;
+  for (GLuint i = 0; i < MAX_VIEWPORTS; i++) {
+    if (setBitState(separateEnable, i, glIsEnabledi(GL_SCISSOR_TEST, i))) stateSet++;
   }
-  if (stateSet == MAX_DRAWBUFFERS) {
+  if (stateSet == MAX_VIEWPORTS) {
     separateEnable = 0;
   }
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::MaskState::applyGL() const
+void StateSystem::MaskState::compileGL(OpList& ops, GLbitfield changedColor, GLbitfield changed) const
 {
   if (colormaskUseSeparate) {
     for (GLuint i = 0; i < MAX_DRAWBUFFERS; i++) {
-      glColorMaski(i, colormask[i][0], colormask[i][1], colormask[i][2], colormask[i][3]);
+      if (isBitSet(changedColor, i)) ops.add(OP_COLOR_MASKI, i, colormask[i][0], colormask[i][1], colormask[i][2], colormask[i][3]);
     }
   }
+  else if (changedColor) {
+    ops.add(OP_COLOR_MASK, colormask[0][0], colormask[0][1], colormask[0][2], colormask[0][3]);
+  }
+  if (isBitSet(changed, DEPTH)) ops.add(OP_DEPTH_MASK, depth);
+  if (isBitSet(changed, STENCIL_FRONT) && isBitSet(changed, STENCIL_BACK) && stencil[FACE_FRONT] == stencil[FACE_BACK]) {
+    ops.add(OP_STENCIL_MASK_SEPARATE, GLenum(GL_FRONT_AND_BACK), stencil[FACE_FRONT]);
+  }
   else {
-    glColorMask(colormask[0][0], colormask[0][1], colormask[0][2], colormask[0][3]);
+    if (isBitSet(changed, STENCIL_FRONT)) ops.add(OP_STENCIL_MASK_SEPARATE, GLenum(GL_FRONT), stencil[FACE_FRONT]);
+    if (isBitSet(changed, STENCIL_BACK))  ops.add(OP_STENCIL_MASK_SEPARATE, GLenum(GL_BACK), stencil[FACE_BACK]);
   }
-  glDepthMask(depth);
-  glStencilMaskSeparate(GL_FRONT, stencil[FACE_FRONT]);
-  glStencilMaskSeparate(GL_BACK, stencil[FACE_BACK]);
 }
 
 void StateSystem::MaskState::getGL()
@@ -378,14 +550,17 @@ void StateSystem::MaskState::getGL()
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::FBOState::applyGL(bool skipFboBinding) const
+void StateSystem::FBOState::compileGL(OpList& ops, GLbitfield changed) const
 {
-  if (!skipFboBinding) {
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboDraw);
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, fboRead);
+  if (isBitSet(changed, BINDING)) {
+    ops.add(OP_BIND_FRAMEBUFFER, GLenum(GL_DRAW_FRAMEBUFFER), fboDraw);
+    ops.add(OP_BIND_FRAMEBUFFER, GLenum(GL_READ_FRAMEBUFFER), fboRead);
+  }
+  if (isBitSet(changed, DRAWBUFFERS)) {
+    ops.add(OP_DRAW_BUFFERS, numBuffers);
+    ops.words.insert(ops.words.end(), drawBuffers, drawBuffers + numBuffers);
   }
-  glDrawBuffers(numBuffers, drawBuffers);
-  glReadBuffer(readBuffer);
+  if (isBitSet(changed, READBUFFER))  ops.add(OP_READ_BUFFER, readBuffer);
 }
 
 void StateSystem::FBOState::getGL()
@@ -405,12 +580,12 @@ void StateSystem::FBOState::getGL()
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::VertexEnableState::applyGL(GLbitfield changed) const
+void StateSystem::VertexEnableState::compileGL(OpList& ops, GLbitfield changed) const
 {
   for (GLuint i = 0; i < MAX_VERTEXATTRIBS; i++) {
     if (isBitSet(changed, i)) {
-      if (isBitSet(enabled, i))  glEnableVertexAttribArray(i);
-      else                      glDisableVertexAttribArray(i);
+      if (isBitSet(enabled, i))  ops.add(OP_ENABLE_VERTEX_ATTRIB_ARRAY, i);
+      else                      ops.add(OP_DISABLE_VERTEX_ATTRIB_ARRAY, i);
     }
   }
 }
@@ -427,28 +602,28 @@ void StateSystem::VertexEnableState::getGL()
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::VertexFormatState::applyGL(GLbitfield changedFormat, GLbitfield changedBinding) const
+void StateSystem::VertexFormatState::compileGL(OpList& ops, GLbitfield changedFormat, GLbitfield changedBinding) const
 {
   for (GLuint i = 0; i < MAX_VERTEXATTRIBS; i++) {
     if (!isBitSet(changedFormat, i)) continue;
 
     switch (formats[i].mode) {
     case VERTEXMODE_FLOAT:
-      glVertexAttribFormat(i, formats[i].size, formats[i].type, formats[i].normalized, formats[i].relativeoffset);
+      ops.add(OP_VERTEX_ATTRIB_FORMAT, i, formats[i].size, formats[i].type, formats[i].normalized, formats[i].relativeoffset);
       break;
     case VERTEXMODE_INT:
     case VERTEXMODE_UINT:
-      glVertexAttribIFormat(i, formats[i].size, formats[i].type, formats[i].relativeoffset);
+      ops.add(OP_VERTEX_ATTRIB_IFORMAT, i, formats[i].size, formats[i].type, formats[i].relativeoffset);
       break;
     }
-    glVertexAttribBinding(i, formats[i].binding);
+    ops.add(OP_VERTEX_ATTRIB_BINDING, i, formats[i].binding);
   }
 
   for (GLuint i = 0; i < MAX_VERTEXBINDINGS; i++) {
     if (!isBitSet(changedBinding, i)) continue;
 
-    glVertexBindingDivisor(i, bindings[i].divisor);
-    glBindVertexBuffer(i, 0, 0, bindings[i].stride);
+    ops.add(OP_VERTEX_BINDING_DIVISOR, i, bindings[i].divisor);
+    ops.add(OP_BIND_VERTEX_BUFFER, i, bindings[i].stride);
   }
 }
 
@@ -479,20 +654,20 @@ void StateSystem::VertexFormatState::getGL()
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::VertexImmediateState::applyGL(GLbitfield changed) const
+void StateSystem::VertexImmediateState::compileGL(OpList& ops, GLbitfield changed) const
 {
   for (GLuint i = 0; i < MAX_VERTEXATTRIBS; i++) {
     if (!isBitSet(changed, i)) continue;
 
     switch (data[i].mode) {
     case VERTEXMODE_FLOAT:
-      glVertexAttrib4fv(i, data[i].floats);
+      ops.add(OP_VERTEX_ATTRIB_4FV, i, data[i].floats[0], data[i].floats[1], data[i].floats[2], data[i].floats[3]);
       break;
     case VERTEXMODE_INT:
-      glVertexAttribI4iv(i, data[i].ints);
+      ops.add(OP_VERTEX_ATTRIB_I4IV, i, data[i].ints[0], data[i].ints[1], data[i].ints[2], data[i].ints[3]);
       break;
     case VERTEXMODE_UINT:
-      glVertexAttribI4uiv(i, data[i].uints);
+      ops.add(OP_VERTEX_ATTRIB_I4UIV, i, data[i].uints[0], data[i].uints[1], data[i].uints[2], data[i].uints[3]);
       break;
     }
   }
@@ -517,9 +692,9 @@ void StateSystem::VertexImmediateState::getGL()
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::ProgramState::applyGL() const
+void StateSystem::ProgramState::compileGL(OpList& ops) const
 {
-  glUseProgram(program);
+  ops.add(OP_USE_PROGRAM, program);
 }
 
 void StateSystem::ProgramState::getGL()
@@ -558,12 +733,12 @@ static GLenum s_stateEnums[StateSystem::NUM_STATEBITS] = {
   GL_PROGRAM_POINT_SIZE,
 };
 
-void StateSystem::EnableState::applyGL(GLbitfield changedBits) const
+void StateSystem::EnableState::compileGL(OpList& ops, GLbitfield changedBits) const
 {
   for (GLuint i = 0; i < NUM_STATEBITS; i++) {
     if (isBitSet(changedBits, i)) {
-      if (isBitSet(stateBits, i))  glEnable(s_stateEnums[i]);
-      else                        glDisable(s_stateEnums[i]);
+      if (isBitSet(stateBits, i))  ops.add(OP_ENABLE, s_stateEnums[i]);
+      else                        ops.add(OP_DISABLE, s_stateEnums[i]);
     }
   }
 }
@@ -585,12 +760,12 @@ static GLenum s_stateEnumsDepr[StateSystem::NUM_STATEBITSDEPR] = {
   GL_POLYGON_STIPPLE,
 };
 
-void StateSystem::EnableStateDepr::applyGL(GLbitfield changedBits) const
+void StateSystem::EnableStateDepr::compileGL(OpList& ops, GLbitfield changedBits) const
 {
   for (GLuint i = 0; i < NUM_STATEBITSDEPR; i++) {
     if (isBitSet(changedBits, i)) {
-      if (isBitSet(stateBitsDepr, i))  glEnable(s_stateEnumsDepr[i]);
-      else                            glDisable(s_stateEnumsDepr[i]);
+      if (isBitSet(stateBitsDepr, i))  ops.add(OP_ENABLE, s_stateEnumsDepr[i]);
+      else                            ops.add(OP_DISABLE, s_stateEnumsDepr[i]);
     }
   }
 }
@@ -605,52 +780,59 @@ void StateSystem::EnableStateDepr::getGL()
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::State::applyGL(bool coreonly, bool skipFboBinding) const
+void StateSystem::State::compileGL(OpList& ops, bool coreonly) const
 {
-  enable.applyGL();
+  enable.compileGL(ops);
 #if STATESYSTEM_USE_DEPRECATED
-  if (!coreonly) enableDepr.applyGL();
+  if (!coreonly) enableDepr.compileGL(ops);
 #endif
-  program.applyGL();
-  clip.applyGL();
+  program.compileGL(ops);
+  clip.compileGL(ops);
 #if STATESYSTEM_USE_DEPRECATED
-  if (!coreonly) alpha.applyGL();
+  if (!coreonly) alpha.compileGL(ops);
 #endif
-  blend.applyGL();
-  depth.applyGL();
-  stencil.applyGL();
-  logic.applyGL();
-  primitive.applyGL();
-  sample.applyGL();
-  raster.applyGL();
+  blend.compileGL(ops);
+  depth.compileGL(ops);
+  stencil.compileGL(ops);
+  logic.compileGL(ops);
+  primitive.compileGL(ops);
+  sample.compileGL(ops);
+  raster.compileGL(ops);
 #if STATESYSTEM_USE_DEPRECATED
-  if (!coreonly) rasterDepr.applyGL();
+  if (!coreonly) rasterDepr.compileGL(ops);
 #endif
   /*if (!isBitSet(dynamicState,DYNAMIC_VIEWPORT)){
   viewport.applyGL();
   }*/
-  depthrange.applyGL();
+  depthrange.compileGL(ops);
   /*if (!isBitSet(dynamicState,DYNAMIC_SCISSOR)){
   scissor.applyGL();
   }*/
-  scissorenable.applyGL();
-  mask.applyGL();
-  fbo.applyGL(skipFboBinding);
-  vertexenable.applyGL();
-  vertexformat.applyGL();
-  verteximm.applyGL();
+  scissorenable.compileGL(ops);
+  mask.compileGL(ops);
+  fbo.compileGL(ops);
+  vertexenable.compileGL(ops);
+  vertexformat.compileGL(ops);
+  verteximm.compileGL(ops);
+}
+
+void StateSystem::State::applyGL(bool coreonly, bool skipFboBinding) const
+{
+  OpList ops;
+  compileGL(ops, coreonly);
+  ops.execute(skipFboBinding);
 }
 
 void StateSystem::State::getGL(bool coreonly)
 {
   enable.getGL();
 #if STATESYSTEM_USE_DEPRECATED
-  if (!coreonly) enableDepr.applyGL();
+  if (!coreonly) enableDepr.getGL();
 #endif
   program.getGL();
   clip.getGL();
 #if STATESYSTEM_USE_DEPRECATED
-  if (!coreonly) alpha.applyGL();
+  if (!coreonly) alpha.getGL();
 #endif
   blend.getGL();
   depth.getGL();
@@ -660,7 +842,7 @@ void StateSystem::State::getGL(bool coreonly)
   sample.getGL();
   raster.getGL();
 #if STATESYSTEM_USE_DEPRECATED
-  if (!coreonly) rasterDepr.applyGL();
+  if (!coreonly) rasterDepr.getGL();
 #endif
   //viewport.getGL();
   depthrange.getGL();
@@ -676,223 +858,1550 @@ void StateSystem::State::getGL(bool coreonly)
 
 //////////////////////////////////////////////////////////////////////////
 
-void StateSystem::init(bool coreonly)
+template <class T>
+static inline bool allEqual(const T* items, GLuint count)
 {
-  m_coreonly = coreonly;
+  for (GLuint i = 1; i < count; i++) {
+    if (memcmp(&items[i], &items[0], sizeof(T)) != 0) return false;
+  }
+  return true;
 }
 
-void StateSystem::deinit()
+void StateSystem::Recorder::setEnable(GLenum cap, bool state)
+{
+  for (GLuint i = 0; i < NUM_STATEBITS; i++) {
+    if (s_stateEnums[i] == cap) {
+      setBitState(m_state.enable.stateBits, i, state);
+    }
+  }
+#if STATESYSTEM_USE_DEPRECATED
+  for (GLuint i = 0; i < NUM_STATEBITSDEPR; i++) {
+    if (s_stateEnumsDepr[i] == cap) {
+      setBitState(m_state.enableDepr.stateBitsDepr, i, state);
+    }
+  }
+#endif
+  // the non-indexed enable sets all indices
+  if (cap == GL_BLEND)        m_state.blend.separateEnable = 0;
+  if (cap == GL_SCISSOR_TEST) m_state.scissorenable.separateEnable = 0;
+
+  if (cap >= GL_CLIP_DISTANCE0 && cap < GL_CLIP_DISTANCE0 + MAX_CLIPPLANES) {
+    setBitState(m_state.clip.enabled, cap - GL_CLIP_DISTANCE0, state);
+  }
+}
+
+void StateSystem::Recorder::setEnablei(GLenum cap, GLuint index, bool state)
 {
-  m_states.resize(0);
-  m_freeIDs.resize(0);
+  GLbitfield* separate = NULL;
+  GLuint      count = 0;
+  GLuint      bit = 0;
+  if (cap == GL_BLEND) {
+    separate = &m_state.blend.separateEnable;
+    count = MAX_DRAWBUFFERS;
+    bit = BLEND;
+  }
+  else if (cap == GL_SCISSOR_TEST) {
+    separate = &m_state.scissorenable.separateEnable;
+    count = MAX_VIEWPORTS;
+    bit = SCISSOR_TEST;
+  }
+  if (!separate || index >= count) return;
+
+  // like getGL, separateEnable is only used for mixed enables,
+  // otherwise the non-indexed bit stands for all indices
+  const GLbitfield all = (1 << count) - 1;
+  GLbitfield enabled = *separate ? *separate : (isBitSet(m_state.enable.stateBits, bit) ? all : 0);
+  setBitState(enabled, index, state);
+
+  *separate = enabled == all ? 0 : enabled;
+  setBitState(m_state.enable.stateBits, bit, isBitSet(enabled, 0));
 }
 
-void StateSystem::generate(GLuint num, StateID* objects)
+void StateSystem::Recorder::enable(GLenum cap)
 {
+  setEnable(cap, true);
+  if (m_issueGL) glEnable(cap);
+}
 
-  GLuint i;
-  for (i = 0; i < num && !m_freeIDs.empty(); i++) {
-    objects[i] = m_freeIDs.back();
-    m_freeIDs.pop_back();
-  }
+void StateSystem::Recorder::disable(GLenum cap)
+{
+  setEnable(cap, false);
+  if (m_issueGL) glDisable(cap);
+}
 
-  GLuint begin = GLuint(m_states.size());
+void StateSystem::Recorder::enablei(GLenum cap, GLuint index)
+{
+  setEnablei(cap, index, true);
+  if (m_issueGL) glEnablei(cap, index);
+}
 
-  if (i < num) {
-    m_states.resize(begin + num - i);
-  }
+void StateSystem::Recorder::disablei(GLenum cap, GLuint index)
+{
+  setEnablei(cap, index, false);
+  if (m_issueGL) glDisablei(cap, index);
+}
+
+void StateSystem::Recorder::useProgram(GLuint program)
+{
+  m_state.program.program = program;
+  if (m_issueGL) glUseProgram(program);
+}
+
+#if STATESYSTEM_USE_DEPRECATED
+void StateSystem::Recorder::alphaFunc(GLenum func, GLfloat ref)
+{
+  m_state.alpha.mode = func;
+  m_state.alpha.refvalue = ref;
+  if (m_issueGL) glAlphaFunc(func, ref);
+}
+
+void StateSystem::Recorder::lineStipple(GLint factor, GLushort pattern)
+{
+  m_state.rasterDepr.lineStippleFactor = factor;
+  m_state.rasterDepr.lineStipplePattern = pattern;
+  if (m_issueGL) glLineStipple(factor, pattern);
+}
+
+void StateSystem::Recorder::shadeModel(GLenum mode)
+{
+  m_state.rasterDepr.shadeModel = mode;
+  if (m_issueGL) glShadeModel(mode);
+}
+#endif
 
-  for (i = i; i < num; i++) {
-    objects[i] = begin + i;
+void StateSystem::Recorder::setBlend(GLuint first, GLuint count, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+{
+  BlendState& blend = m_state.blend;
+  for (GLuint i = first; i < first + count && i < MAX_DRAWBUFFERS; i++) {
+    blend.blends[i].rgb.srcw = srcRGB;
+    blend.blends[i].rgb.dstw = dstRGB;
+    blend.blends[i].alpha.srcw = srcAlpha;
+    blend.blends[i].alpha.dstw = dstAlpha;
   }
+  blend.useSeparate = !allEqual(blend.blends, MAX_DRAWBUFFERS);
 }
 
-void StateSystem::destroy(GLuint num, const StateID* objects)
+void StateSystem::Recorder::setBlendEquation(GLuint first, GLuint count, GLenum modeRGB, GLenum modeAlpha)
 {
-  for (GLuint i = 0; i < num; i++) {
-    m_freeIDs.push_back(objects[i]);
+  BlendState& blend = m_state.blend;
+  for (GLuint i = first; i < first + count && i < MAX_DRAWBUFFERS; i++) {
+    blend.blends[i].rgb.equ = modeRGB;
+    blend.blends[i].alpha.equ = modeAlpha;
   }
+  blend.useSeparate = !allEqual(blend.blends, MAX_DRAWBUFFERS);
 }
 
-void StateSystem::set(StateID id, const State& state, GLenum basePrimitiveMode)
+void StateSystem::Recorder::blendFunc(GLenum src, GLenum dst)
 {
-  StateInternal& intstate = m_states[id];
-  intstate.changeID++;
-  intstate.state = state;
-  intstate.state.basePrimitiveMode = basePrimitiveMode;
+  setBlend(0, MAX_DRAWBUFFERS, src, dst, src, dst);
+  if (m_issueGL) glBlendFunc(src, dst);
+}
 
-  intstate.usedDiff = 0;
-  for (int i = 0; i < MAX_DIFFS; i++) {
-    intstate.others[i].state = INVALID_ID;
-  }
+void StateSystem::Recorder::blendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+{
+  setBlend(0, MAX_DRAWBUFFERS, srcRGB, dstRGB, srcAlpha, dstAlpha);
+  if (m_issueGL) glBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
 }
 
-const StateSystem::State& StateSystem::get(StateID id) const
+void StateSystem::Recorder::blendFunci(GLuint buf, GLenum src, GLenum dst)
+{
+  setBlend(buf, 1, src, dst, src, dst);
+  if (m_issueGL) glBlendFunci(buf, src, dst);
+}
+
+void StateSystem::Recorder::blendFuncSeparatei(GLuint buf, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+{
+  setBlend(buf, 1, srcRGB, dstRGB, srcAlpha, dstAlpha);
+  if (m_issueGL) glBlendFuncSeparatei(buf, srcRGB, dstRGB, srcAlpha, dstAlpha);
+}
+
+void StateSystem::Recorder::blendEquation(GLenum mode)
 {
-  return m_states[id].state;
+  setBlendEquation(0, MAX_DRAWBUFFERS, mode, mode);
+  if (m_issueGL) glBlendEquation(mode);
 }
 
-inline int StateSystem::prepareTransitionCache(StateID prev, StateInternal& to)
+void StateSystem::Recorder::blendEquationSeparate(GLenum modeRGB, GLenum modeAlpha)
 {
-  StateInternal& from = m_states[prev];
+  setBlendEquation(0, MAX_DRAWBUFFERS, modeRGB, modeAlpha);
+  if (m_issueGL) glBlendEquationSeparate(modeRGB, modeAlpha);
+}
 
-  int index = -1;
+void StateSystem::Recorder::blendEquationi(GLuint buf, GLenum mode)
+{
+  setBlendEquation(buf, 1, mode, mode);
+  if (m_issueGL) glBlendEquationi(buf, mode);
+}
 
-  for (int i = 0; i < MAX_DIFFS; i++) {
-    if (to.others[i].state == prev && to.others[i].changeID == from.changeID) {
-      index = i;
-      break;
+void StateSystem::Recorder::blendEquationSeparatei(GLuint buf, GLenum modeRGB, GLenum modeAlpha)
+{
+  setBlendEquation(buf, 1, modeRGB, modeAlpha);
+  if (m_issueGL) glBlendEquationSeparatei(buf, modeRGB, modeAlpha);
+}
+
+void StateSystem::Recorder::depthFunc(GLenum func)
+{
+  m_state.depth.func = func;
+  if (m_issueGL) glDepthFunc(func);
+}
+
+void StateSystem::Recorder::logicOp(GLenum op)
+{
+  m_state.logic.op = op;
+  if (m_issueGL) glLogicOp(op);
+}
+
+void StateSystem::Recorder::setStencilFunc(GLenum face, GLenum func, GLint ref, GLuint mask)
+{
+  for (GLuint i = 0; i < MAX_FACES; i++) {
+    if (face == GL_FRONT_AND_BACK || face == (i == FACE_FRONT ? GL_FRONT : GL_BACK)) {
+      m_state.stencil.funcs[i].func = func;
+      m_state.stencil.funcs[i].refvalue = ref;
+      m_state.stencil.funcs[i].mask = mask;
     }
   }
+}
 
-  if (index < 0) {
-    index = to.usedDiff;
-    to.usedDiff = (to.usedDiff + 1) % MAX_DIFFS;
-
-    to.others[index].state = prev;
-    to.others[index].changeID = from.changeID;
+void StateSystem::Recorder::setStencilOp(GLenum face, GLenum fail, GLenum zfail, GLenum zpass)
+{
+  for (GLuint i = 0; i < MAX_FACES; i++) {
+    if (face == GL_FRONT_AND_BACK || face == (i == FACE_FRONT ? GL_FRONT : GL_BACK)) {
+      m_state.stencil.ops[i].fail = fail;
+      m_state.stencil.ops[i].zfail = zfail;
+      m_state.stencil.ops[i].zpass = zpass;
+    }
+  }
+}
 
-    makeDiff(to.diffs[index], from, to);
+void StateSystem::Recorder::setStencilMask(GLenum face, GLuint mask)
+{
+  for (GLuint i = 0; i < MAX_FACES; i++) {
+    if (face == GL_FRONT_AND_BACK || face == (i == FACE_FRONT ? GL_FRONT : GL_BACK)) {
+      m_state.mask.stencil[i] = mask;
+    }
   }
+}
 
-  return index;
+void StateSystem::Recorder::stencilFunc(GLenum func, GLint ref, GLuint mask)
+{
+  setStencilFunc(GL_FRONT_AND_BACK, func, ref, mask);
+  if (m_issueGL) glStencilFunc(func, ref, mask);
 }
 
-void StateSystem::applyGL(StateID id, bool skipFboBinding) const
+void StateSystem::Recorder::stencilFuncSeparate(GLenum face, GLenum func, GLint ref, GLuint mask)
 {
-  m_states[id].state.applyGL(m_coreonly, skipFboBinding);
+  setStencilFunc(face, func, ref, mask);
+  if (m_issueGL) glStencilFuncSeparate(face, func, ref, mask);
 }
 
-void StateSystem::applyGL(StateID id, StateID prev, bool skipFboBinding)
+void StateSystem::Recorder::stencilOp(GLenum fail, GLenum zfail, GLenum zpass)
 {
-  StateInternal& to = m_states[id];
+  setStencilOp(GL_FRONT_AND_BACK, fail, zfail, zpass);
+  if (m_issueGL) glStencilOp(fail, zfail, zpass);
+}
 
-  if (prev == INVALID_ID) {
-    applyGL(id, skipFboBinding);
-    return;
-  }
+void StateSystem::Recorder::stencilOpSeparate(GLenum face, GLenum fail, GLenum zfail, GLenum zpass)
+{
+  setStencilOp(face, fail, zfail, zpass);
+  if (m_issueGL) glStencilOpSeparate(face, fail, zfail, zpass);
+}
 
-  int index = prepareTransitionCache(prev, to);
-  applyDiffGL(to.diffs[index], to.state, skipFboBinding);
+void StateSystem::Recorder::cullFace(GLenum mode)
+{
+  m_state.raster.cullFace = mode;
+  if (m_issueGL) glCullFace(mode);
+}
 
+void StateSystem::Recorder::polygonMode(GLenum face, GLenum mode)
+{
+  m_state.raster.polyMode = mode;
+  if (m_issueGL) glPolygonMode(face, mode);
 }
 
-void StateSystem::applyDiffGL(const StateDiff& diff, const State &state, bool skipFboBinding)
+void StateSystem::Recorder::pointSize(GLfloat size)
 {
-  if (isBitSet(diff.changedContentBits, StateDiff::ENABLE))
-    state.enable.applyGL(diff.changedStateBits);
-#if STATESYSTEM_USE_DEPRECATED
-  if (!m_coreonly && isBitSet(diff.changedContentBits, StateDiff::ENABLE_DEPR))
-    state.enableDepr.applyGL(diff.changedStateDeprBits);
-#endif
-  if (isBitSet(diff.changedContentBits, StateDiff::PROGRAM))
-    state.program.applyGL();
-  if (isBitSet(diff.changedContentBits, StateDiff::CLIP))
-    state.clip.applyGL();
-#if STATESYSTEM_USE_DEPRECATED
-  if (!m_coreonly && isBitSet(diff.changedContentBits, StateDiff::ALPHA_DEPR))
-    state.alpha.applyGL();
-#endif
-  if (isBitSet(diff.changedContentBits, StateDiff::BLEND))
-    state.blend.applyGL();
-  if (isBitSet(diff.changedContentBits, StateDiff::DEPTH))
-    state.depth.applyGL();
-  if (isBitSet(diff.changedContentBits, StateDiff::STENCIL))
-    state.stencil.applyGL();
-  if (isBitSet(diff.changedContentBits, StateDiff::LOGIC))
-    state.logic.applyGL();
-  if (isBitSet(diff.changedContentBits, StateDiff::PRIMITIVE))
-    state.primitive.applyGL();
-  if (isBitSet(diff.changedContentBits, StateDiff::RASTER))
-    state.raster.applyGL();
-#if STATESYSTEM_USE_DEPRECATED
-  if (!m_coreonly && isBitSet(diff.changedContentBits, StateDiff::RASTER_DEPR))
-    state.rasterDepr.applyGL();
-#endif
-  /*if (isBitSet(diff.changedContentBits,StateDiff::VIEWPORT))
-  state.viewport.applyGL();*/
-  if (isBitSet(diff.changedContentBits, StateDiff::DEPTHRANGE))
-    state.depthrange.applyGL();
-  /*if (isBitSet(diff.changedContentBits,StateDiff::SCISSOR))
-  state.scissor.applyGL();*/
-  if (isBitSet(diff.changedContentBits, StateDiff::SCISSORENABLE))
-    state.scissorenable.applyGL();
-  if (isBitSet(diff.changedContentBits, StateDiff::MASK))
-    state.mask.applyGL();
-  if (isBitSet(diff.changedContentBits, StateDiff::FBO))
-    state.fbo.applyGL(skipFboBinding);
-  if (isBitSet(diff.changedContentBits, StateDiff::VERTEXENABLE))
-    state.vertexenable.applyGL(diff.changedVertexEnable);
-  if (isBitSet(diff.changedContentBits, StateDiff::VERTEXFORMAT))
-    state.vertexformat.applyGL(diff.changedVertexFormat, diff.changedVertexBinding);
-  if (isBitSet(diff.changedContentBits, StateDiff::VERTEXIMMEDIATE))
-    state.verteximm.applyGL(diff.changedVertexImm);
+  m_state.raster.pointSize = size;
+  if (m_issueGL) glPointSize(size);
 }
 
+void StateSystem::Recorder::pointParameterf(GLenum pname, GLfloat param)
+{
+  if (pname == GL_POINT_FADE_THRESHOLD_SIZE)  m_state.raster.pointFade = param;
+  if (pname == GL_POINT_SPRITE_COORD_ORIGIN)  m_state.raster.pointSpriteOrigin = GLenum(param);
+  if (m_issueGL) glPointParameterf(pname, param);
+}
 
-void StateSystem::makeDiff(StateDiff& diff, const StateInternal &fromInternal, const StateInternal &toInternal)
+void StateSystem::Recorder::pointParameteri(GLenum pname, GLint param)
 {
-  const State &from = fromInternal.state;
-  const State &to = toInternal.state;
+  if (pname == GL_POINT_FADE_THRESHOLD_SIZE)  m_state.raster.pointFade = GLfloat(param);
+  if (pname == GL_POINT_SPRITE_COORD_ORIGIN)  m_state.raster.pointSpriteOrigin = param;
+  if (m_issueGL) glPointParameteri(pname, param);
+}
 
-  diff.changedStateBits = from.enable.stateBits ^ to.enable.stateBits;
-#if STATESYSTEM_USE_DEPRECATED
-  diff.changedStateDeprBits = from.enableDepr.stateBitsDepr ^ to.enableDepr.stateBitsDepr;
-#endif
-  diff.changedContentBits = 0;
+void StateSystem::Recorder::primitiveRestartIndex(GLuint index)
+{
+  m_state.primitive.restartIndex = index;
+  if (m_issueGL) glPrimitiveRestartIndex(index);
+}
 
-  if (memcmp(&from.enable, &to.enable, sizeof(from.enable)) != 0) setBit(diff.changedContentBits, StateDiff::ENABLE);
-#if STATESYSTEM_USE_DEPRECATED
-  if (memcmp(&from.enableDepr, &to.enableDepr, sizeof(from.enableDepr)) != 0) setBit(diff.changedContentBits, StateDiff::ENABLE_DEPR);
-#endif
-  if (memcmp(&from.program, &to.program, sizeof(from.program)) != 0) setBit(diff.changedContentBits, StateDiff::PROGRAM);
-  if (memcmp(&from.clip, &to.clip, sizeof(from.clip)) != 0) setBit(diff.changedContentBits, StateDiff::CLIP);
-#if STATESYSTEM_USE_DEPRECATED
-  if (memcmp(&from.alpha, &to.alpha, sizeof(from.alpha)) != 0) setBit(diff.changedContentBits, StateDiff::ALPHA_DEPR);
-#endif
-  if (memcmp(&from.blend, &to.blend, sizeof(from.blend)) != 0) setBit(diff.changedContentBits, StateDiff::BLEND);
-  if (memcmp(&from.depth, &to.depth, sizeof(from.depth)) != 0) setBit(diff.changedContentBits, StateDiff::DEPTH);
-  if (memcmp(&from.stencil, &to.stencil, sizeof(from.stencil)) != 0) setBit(diff.changedContentBits, StateDiff::STENCIL);
-  if (memcmp(&from.logic, &to.logic, sizeof(from.logic)) != 0) setBit(diff.changedContentBits, StateDiff::LOGIC);
-  if (memcmp(&from.primitive, &to.primitive, sizeof(from.primitive)) != 0) setBit(diff.changedContentBits, StateDiff::PRIMITIVE);
-  if (memcmp(&from.raster, &to.raster, sizeof(from.raster)) != 0) setBit(diff.changedContentBits, StateDiff::RASTER);
-#if STATESYSTEM_USE_DEPRECATED
-  if (memcmp(&from.rasterDepr, &to.rasterDepr, sizeof(from.rasterDepr)) != 0) setBit(diff.changedContentBits, StateDiff::RASTER_DEPR);
-#endif
-  //if (memcmp(&from.viewport       ,&to.viewport       ,sizeof(from.viewport       )) != 0) setBit(diff.changedContentBits,StateDiff::VIEWPORT);
-  if (memcmp(&from.depth, &to.depth, sizeof(from.depth)) != 0) setBit(diff.changedContentBits, StateDiff::DEPTHRANGE);
-  //if (memcmp(&from.scissor        ,&to.scissor        ,sizeof(from.scissor        )) != 0) setBit(diff.changedContentBits,StateDiff::SCISSOR);
-  if (memcmp(&from.scissorenable, &to.scissorenable, sizeof(from.scissorenable)) != 0) setBit(diff.changedContentBits, StateDiff::SCISSORENABLE);
-  if (memcmp(&from.mask, &to.mask, sizeof(from.mask)) != 0) setBit(diff.changedContentBits, StateDiff::MASK);
-  if (memcmp(&from.fbo, &to.fbo, sizeof(from.fbo)) != 0) setBit(diff.changedContentBits, StateDiff::FBO);
+void StateSystem::Recorder::provokingVertex(GLenum mode)
+{
+  m_state.primitive.provokingVertex = mode;
+  if (m_issueGL) glProvokingVertex(mode);
+}
 
-  // special case vertex stuff, more likely to change then rest
+void StateSystem::Recorder::patchParameteri(GLenum pname, GLint value)
+{
+  if (pname == GL_PATCH_VERTICES) m_state.primitive.patchVertices = value;
+  if (m_issueGL) glPatchParameteri(pname, value);
+}
 
-  diff.changedVertexEnable = from.vertexenable.enabled ^ to.vertexenable.enabled;
+void StateSystem::Recorder::sampleCoverage(GLfloat value, GLboolean invert)
+{
+  m_state.sample.coverage = value;
+  m_state.sample.invert = invert;
+  if (m_issueGL) glSampleCoverage(value, invert);
+}
 
-  diff.changedVertexImm = 0;
-  diff.changedVertexFormat = 0;
+void StateSystem::Recorder::sampleMaski(GLuint index, GLbitfield mask)
+{
+  if (index == 0) m_state.sample.mask = mask;
+  if (m_issueGL) glSampleMaski(index, mask);
+}
 
-  for (GLint i = 0; i < MAX_VERTEXATTRIBS; i++) {
-    if (memcmp(&from.vertexformat.formats[i], &to.vertexformat.formats[i], sizeof(to.vertexformat.formats[i])) != 0)  setBit(diff.changedVertexFormat, i);
-    if (memcmp(&from.verteximm.data[i], &to.verteximm.data[i], sizeof(to.verteximm.data[i])) != 0)                    setBit(diff.changedVertexImm, i);
+void StateSystem::Recorder::setDepthRange(GLuint first, GLuint count, const GLdouble* v, bool sameForAll)
+{
+  DepthRangeState& depthrange = m_state.depthrange;
+  for (GLuint i = 0; i < count && first + i < MAX_VIEWPORTS; i++) {
+    const GLdouble* range = sameForAll ? v : v + i * 2;
+    depthrange.depths[first + i].nearPlane = range[0];
+    depthrange.depths[first + i].farPlane = range[1];
   }
+  depthrange.useSeparate = !allEqual(depthrange.depths, MAX_VIEWPORTS);
+}
 
-  diff.changedVertexBinding = 0;
-  for (GLint i = 0; i < MAX_VERTEXBINDINGS; i++) {
-    if (memcmp(&from.vertexformat.bindings[i], &to.vertexformat.bindings[i], sizeof(to.vertexformat.bindings[i])) != 0)  setBit(diff.changedVertexBinding, i);
+void StateSystem::Recorder::depthRange(GLdouble nearPlane, GLdouble farPlane)
+{
+  GLdouble range[2] = {nearPlane, farPlane};
+  setDepthRange(0, MAX_VIEWPORTS, range, true);
+  if (m_issueGL) glDepthRange(nearPlane, farPlane);
+}
+
+void StateSystem::Recorder::depthRangeIndexed(GLuint index, GLdouble nearPlane, GLdouble farPlane)
+{
+  GLdouble range[2] = {nearPlane, farPlane};
+  setDepthRange(index, 1, range, false);
+  if (m_issueGL) glDepthRangeIndexed(index, nearPlane, farPlane);
+}
+
+void StateSystem::Recorder::depthRangeArrayv(GLuint first, GLsizei count, const GLdouble* v)
+{
+  setDepthRange(first, count, v, false);
+  if (m_issueGL) glDepthRangeArrayv(first, count, v);
+}
+
+void StateSystem::Recorder::setColorMask(GLuint first, GLuint count, GLboolean r, GLboolean g, GLboolean b, GLboolean a)
+{
+  MaskState& mask = m_state.mask;
+  for (GLuint i = first; i < first + count && i < MAX_DRAWBUFFERS; i++) {
+    mask.colormask[i][0] = r;
+    mask.colormask[i][1] = g;
+    mask.colormask[i][2] = b;
+    mask.colormask[i][3] = a;
   }
+  mask.colormaskUseSeparate = !allEqual(mask.colormask, MAX_DRAWBUFFERS);
+}
 
-  if (diff.changedVertexEnable)                               setBit(diff.changedContentBits, StateDiff::VERTEXENABLE);
-  if (diff.changedVertexBinding || diff.changedVertexFormat)  setBit(diff.changedContentBits, StateDiff::VERTEXFORMAT);
-  if (diff.changedVertexImm)                                  setBit(diff.changedContentBits, StateDiff::VERTEXIMMEDIATE);
+void StateSystem::Recorder::colorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a)
+{
+  setColorMask(0, MAX_DRAWBUFFERS, r, g, b, a);
+  if (m_issueGL) glColorMask(r, g, b, a);
 }
 
-void StateSystem::prepareTransition(StateID id, StateID prev)
+void StateSystem::Recorder::colorMaski(GLuint buf, GLboolean r, GLboolean g, GLboolean b, GLboolean a)
+{
+  setColorMask(buf, 1, r, g, b, a);
+  if (m_issueGL) glColorMaski(buf, r, g, b, a);
+}
+
+void StateSystem::Recorder::depthMask(GLboolean flag)
+{
+  m_state.mask.depth = flag;
+  if (m_issueGL) glDepthMask(flag);
+}
+
+void StateSystem::Recorder::stencilMask(GLuint mask)
+{
+  setStencilMask(GL_FRONT_AND_BACK, mask);
+  if (m_issueGL) glStencilMask(mask);
+}
+
+void StateSystem::Recorder::stencilMaskSeparate(GLenum face, GLuint mask)
+{
+  setStencilMask(face, mask);
+  if (m_issueGL) glStencilMaskSeparate(face, mask);
+}
+
+void StateSystem::Recorder::bindFramebuffer(GLenum target, GLuint fbo)
 {
-  StateInternal& to = m_states[id];
+  FBOState& state = m_state.fbo;
+  GLenum    defaultBuffer = fbo ? GL_COLOR_ATTACHMENT0 : GL_BACK;
+  if (target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER) {
+    state.fboDraw = fbo;
+    for (GLuint i = 0; i < MAX_DRAWBUFFERS; i++) {
+      state.drawBuffers[i] = GL_NONE;
+    }
+    state.drawBuffers[0] = defaultBuffer;
+    state.numBuffers = 1;
+  }
+  if (target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER) {
+    state.fboRead = fbo;
+    state.readBuffer = defaultBuffer;
+  }
+  if (m_issueGL) glBindFramebuffer(target, fbo);
+}
+
+void StateSystem::Recorder::setDrawBuffers(GLsizei n, const GLenum* bufs)
+{
+  // numBuffers as getGL derives it
+  FBOState& state = m_state.fbo;
+  for (GLuint i = 0; i < MAX_DRAWBUFFERS; i++) {
+    state.drawBuffers[i] = GLsizei(i) < n ? bufs[i] : GL_NONE;
+    if (state.drawBuffers[i] != GL_NONE) {
+      state.numBuffers = i + 1;
+    }
+  }
+}
 
-  prepareTransitionCache(prev, to);
+void StateSystem::Recorder::drawBuffer(GLenum buf)
+{
+  setDrawBuffers(1, &buf);
+  if (m_issueGL) glDrawBuffer(buf);
 }
 
+void StateSystem::Recorder::drawBuffers(GLsizei n, const GLenum* bufs)
+{
+  setDrawBuffers(n, bufs);
+  if (m_issueGL) glDrawBuffers(n, bufs);
+}
 
+void StateSystem::Recorder::readBuffer(GLenum mode)
+{
+  m_state.fbo.readBuffer = mode;
+  if (m_issueGL) glReadBuffer(mode);
+}
+
+void StateSystem::Recorder::enableVertexAttribArray(GLuint index)
+{
+  setBitState(m_state.vertexenable.enabled, index, GL_TRUE);
+  if (m_issueGL) glEnableVertexAttribArray(index);
+}
+
+void StateSystem::Recorder::disableVertexAttribArray(GLuint index)
+{
+  setBitState(m_state.vertexenable.enabled, index, GL_FALSE);
+  if (m_issueGL) glDisableVertexAttribArray(index);
+}
+
+void StateSystem::Recorder::vertexAttribFormat(GLuint index, GLint size, GLenum type, GLboolean normalized, GLuint relativeoffset)
+{
+  VertexFormat& format = m_state.vertexformat.formats[index];
+  format.mode = VERTEXMODE_FLOAT;
+  format.size = size;
+  format.type = type;
+  format.normalized = normalized;
+  format.relativeoffset = relativeoffset;
+  if (m_issueGL) glVertexAttribFormat(index, size, type, normalized, relativeoffset);
+}
+
+void StateSystem::Recorder::vertexAttribIFormat(GLuint index, GLint size, GLenum type, GLuint relativeoffset)
+{
+  // getGL cannot tell signed from unsigned either
+  VertexFormat& format = m_state.vertexformat.formats[index];
+  format.mode = VERTEXMODE_INT;
+  format.size = size;
+  format.type = type;
+  format.normalized = GL_FALSE;
+  format.relativeoffset = relativeoffset;
+  if (m_issueGL) glVertexAttribIFormat(index, size, type, relativeoffset);
+}
+
+void StateSystem::Recorder::vertexAttribBinding(GLuint index, GLuint binding)
+{
+  m_state.vertexformat.formats[index].binding = binding;
+  if (m_issueGL) glVertexAttribBinding(index, binding);
+}
+
+void StateSystem::Recorder::vertexBindingDivisor(GLuint binding, GLuint divisor)
+{
+  m_state.vertexformat.bindings[binding].divisor = divisor;
+  if (m_issueGL) glVertexBindingDivisor(binding, divisor);
+}
+
+void StateSystem::Recorder::bindVertexBuffer(GLuint binding, GLuint buffer, GLintptr offset, GLsizei stride)
+{
+  m_state.vertexformat.bindings[binding].stride = stride;
+  if (m_issueGL) glBindVertexBuffer(binding, buffer, offset, stride);
+}
+
+void StateSystem::Recorder::vertexAttrib4f(GLuint index, GLfloat x, GLfloat y, GLfloat z, GLfloat w)
+{
+  VertexData& data = m_state.verteximm.data[index];
+  data.mode = VERTEXMODE_FLOAT;
+  data.floats[0] = x;
+  data.floats[1] = y;
+  data.floats[2] = z;
+  data.floats[3] = w;
+  if (m_issueGL) glVertexAttrib4f(index, x, y, z, w);
+}
+
+void StateSystem::Recorder::vertexAttribI4i(GLuint index, GLint x, GLint y, GLint z, GLint w)
+{
+  VertexData& data = m_state.verteximm.data[index];
+  data.mode = VERTEXMODE_INT;
+  data.ints[0] = x;
+  data.ints[1] = y;
+  data.ints[2] = z;
+  data.ints[3] = w;
+  if (m_issueGL) glVertexAttribI4i(index, x, y, z, w);
+}
+
+void StateSystem::Recorder::vertexAttribI4ui(GLuint index, GLuint x, GLuint y, GLuint z, GLuint w)
+{
+  VertexData& data = m_state.verteximm.data[index];
+  data.mode = VERTEXMODE_UINT;
+  data.uints[0] = x;
+  data.uints[1] = y;
+  data.uints[2] = z;
+  data.uints[3] = w;
+  if (m_issueGL) glVertexAttribI4ui(index, x, y, z, w);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+
+static inline GLuint hashBytes(const void* data, size_t size)
+{
+  // FNV-1a over 32-bit words, the sub-states are mostly made of GLenum/GLuint
+  const GLubyte* bytes = (const GLubyte*)data;
+  GLuint hash = 2166136261u;
+  size_t i = 0;
+  for (; i + sizeof(GLuint) <= size; i += sizeof(GLuint)) {
+    GLuint word;
+    memcpy(&word, bytes + i, sizeof(GLuint));
+    hash = (hash ^ word) * 16777619u;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash ^ (hash >> 15);
+}
+
+// States are hashed and compared bytewise, so they must not contain implicit
+// padding, and the explicit padding is cleared whenever a state is stored,
+// as applications may fill sub-states themselves (e.g. a VertexFormat).
+static_assert(sizeof(StateSystem::SampleState) == sizeof(GLfloat) + sizeof(GLboolean) + 3 + sizeof(GLuint), "SampleState has implicit padding");
+static_assert(sizeof(StateSystem::MaskState) == sizeof(GLuint) * (1 + StateSystem::MAX_FACES) + sizeof(GLboolean) * (StateSystem::MAX_DRAWBUFFERS * StateSystem::MAX_COLORS + 1) + 3,
+              "MaskState has implicit padding");
+static_assert(sizeof(StateSystem::VertexFormat) == sizeof(GLuint) * 5 + sizeof(GLboolean) + 3, "VertexFormat has implicit padding");
+static_assert(sizeof(StateSystem::DepthRangeState) == sizeof(GLuint) * 2 + sizeof(StateSystem::DepthRange) * StateSystem::MAX_VIEWPORTS,
+              "DepthRangeState has implicit padding");
+#if STATESYSTEM_USE_DEPRECATED
+static_assert(sizeof(StateSystem::RasterStateDepr) == sizeof(GLuint) * 3, "RasterStateDepr has implicit padding");
+#endif
+static_assert(sizeof(StateSystem::State) == sizeof(StateSystem::EnableState)
+#if STATESYSTEM_USE_DEPRECATED
+                                                + sizeof(StateSystem::EnableStateDepr) + sizeof(StateSystem::AlphaStateDepr) + sizeof(StateSystem::RasterStateDepr)
+#endif
+                                                + sizeof(StateSystem::ProgramState) + sizeof(StateSystem::ClipDistanceState) + sizeof(StateSystem::BlendState)
+                                                + sizeof(StateSystem::DepthState) + sizeof(StateSystem::StencilState) + sizeof(StateSystem::LogicState)
+                                                + sizeof(StateSystem::PrimitiveState) + sizeof(StateSystem::SampleState) + sizeof(StateSystem::RasterState)
+                                                + sizeof(StateSystem::DepthRangeState) + sizeof(StateSystem::ScissorEnableState) + sizeof(StateSystem::MaskState)
+                                                + sizeof(StateSystem::FBOState) + sizeof(StateSystem::VertexEnableState) + sizeof(StateSystem::VertexFormatState)
+                                                + sizeof(StateSystem::VertexImmediateState) + sizeof(GLenum) + sizeof(GLuint),
+              "State has implicit padding between its sub-states");
+
+static void clearPadding(StateSystem::State& state)
+{
+  memset(state.sample._pad, 0, sizeof(state.sample._pad));
+  memset(state.mask._pad, 0, sizeof(state.mask._pad));
+  state.depthrange._pad = 0;
+#if STATESYSTEM_USE_DEPRECATED
+  state.rasterDepr._pad = 0;
+#endif
+  for (GLuint i = 0; i < StateSystem::MAX_VERTEXATTRIBS; i++) {
+    memset(state.vertexformat.formats[i]._pad, 0, sizeof(state.vertexformat.formats[i]._pad));
+  }
+  state._pad = 0;
+}
+
+// Which StateDiff::ContentBits each 32-bit word of State belongs to, so
+// changes found per word or block map to the sub-states to compare.
+// All sub-states are at least 4 byte aligned, hence words never straddle two.
+struct StateSystem::ContentWords {
+  static const size_t NUM_WORDS = sizeof(State) / sizeof(GLuint);
+  static const GLubyte NO_CONTENT = 0xFF;
+
+  GLubyte words[NUM_WORDS];
+
+  ContentWords();
+  void add(const State& state, const void* member, size_t size, StateDiff::ContentBits bit);
+
+  // the contents of the words in [first, first + count) that differ
+  static GLbitfield differing(const GLuint* a, const GLuint* b, size_t first, size_t count);
+};
+
+static_assert(sizeof(StateSystem::State) % sizeof(GLuint) == 0, "State must be made of 32-bit words");
+
+static inline GLuint bitScanForward(GLuint64 bits)
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, bits);
+  return GLuint(index);
+#else
+  return GLuint(__builtin_ctzll(bits));
+#endif
+}
+
+void StateSystem::ContentWords::add(const State& state, const void* member, size_t size, StateDiff::ContentBits bit)
+{
+  size_t begin = ((const GLubyte*)member - (const GLubyte*)&state) / sizeof(GLuint);
+  for (size_t w = begin; w < begin + size / sizeof(GLuint); w++) {
+    words[w] = GLubyte(bit);
+  }
+}
+
+StateSystem::ContentWords::ContentWords()
+{
+  memset(words, NO_CONTENT, sizeof(words));
+
+  // the remaining words (sample, basePrimitiveMode) are not diffed
+  State state;
+#define CONTENT_ADD(member, bit)  add(state, &state.member, sizeof(state.member), StateDiff::bit)
+  CONTENT_ADD(enable, ENABLE);
+#if STATESYSTEM_USE_DEPRECATED
+  CONTENT_ADD(enableDepr, ENABLE_DEPR);
+#endif
+  CONTENT_ADD(program, PROGRAM);
+  CONTENT_ADD(clip, CLIP);
+#if STATESYSTEM_USE_DEPRECATED
+  CONTENT_ADD(alpha, ALPHA_DEPR);
+#endif
+  CONTENT_ADD(blend, BLEND);
+  CONTENT_ADD(depth, DEPTH);
+  CONTENT_ADD(stencil, STENCIL);
+  CONTENT_ADD(logic, LOGIC);
+  CONTENT_ADD(primitive, PRIMITIVE);
+  CONTENT_ADD(raster, RASTER);
+#if STATESYSTEM_USE_DEPRECATED
+  CONTENT_ADD(rasterDepr, RASTER_DEPR);
+#endif
+  CONTENT_ADD(depthrange, DEPTHRANGE);
+  CONTENT_ADD(scissorenable, SCISSORENABLE);
+  CONTENT_ADD(mask, MASK);
+  CONTENT_ADD(fbo, FBO);
+  CONTENT_ADD(vertexenable, VERTEXENABLE);
+  CONTENT_ADD(vertexformat, VERTEXFORMAT);
+  CONTENT_ADD(verteximm, VERTEXIMMEDIATE);
+#undef CONTENT_ADD
+}
+
+GLbitfield StateSystem::ContentWords::differing(const GLuint* a, const GLuint* b, size_t first, size_t count)
+{
+  static const ContentWords table;
+
+  GLbitfield result = 0;
+  for (size_t w = 0; w < count && first + w < NUM_WORDS; w++) {
+    if (a[w] == b[w]) continue;
+    GLubyte content = table.words[first + w];
+    if (content != NO_CONTENT) result |= 1 << content;
+  }
+  return result;
+}
+
+StateSystem::StateSystem()
+{
+  for (GLuint i = 0; i < MAX_PAGES; i++) {
+    m_pages[i] = NULL;
+  }
+  m_numStates = 0;
+  m_freeHead = INVALID_ID;
+}
+
+void StateSystem::init(bool coreonly)
+{
+  m_coreonly = coreonly;
+  setTransitionCacheBudget(DEFAULT_TRANSITION_BUDGET);
+}
+
+void StateSystem::deinit()
+{
+  for (GLuint i = 0; i < MAX_PAGES; i++) {
+    StateChunkPage* page = m_pages[i].load();
+    if (!page) continue;
+    for (GLuint c = 0; c < PAGE_SIZE; c++) {
+      delete page->chunks[c].load();
+    }
+    delete page;
+    m_pages[i] = NULL;
+  }
+  m_numStates = 0;
+  m_freeHead = INVALID_ID;
+  m_interned.clear();
+  m_transitionLinks.clear();
+  m_transitions.clear();
+  m_transitionBuckets.clear();
+}
+
+void StateSystem::allocChunk(GLuint chunk)
+{
+  assert(chunk < MAX_PAGES * PAGE_SIZE);
+  std::atomic<StateChunkPage*>& pageSlot = m_pages[chunk >> PAGE_BITS];
+  StateChunkPage* page = pageSlot.load(std::memory_order_acquire);
+  if (!page) {
+    // another thread may have been faster
+    StateChunkPage* created = new StateChunkPage;
+    if (pageSlot.compare_exchange_strong(page, created, std::memory_order_acq_rel)) {
+      page = created;
+    }
+    else {
+      delete created;
+    }
+  }
+
+  std::atomic<StateChunk*>& chunkSlot = page->chunks[chunk & (PAGE_SIZE - 1)];
+  if (chunkSlot.load(std::memory_order_acquire)) return;
+
+  StateChunk* states = new StateChunk;
+  updateHashes(states->versions[0][0]);
+  for (GLuint i = 0; i < CHUNK_SIZE; i++) {
+    states->versions[i][0] = states->versions[0][0];
+    states->versions[i][1] = states->versions[0][0];
+  }
+
+  StateChunk* expected = NULL;
+  if (!chunkSlot.compare_exchange_strong(expected, states, std::memory_order_acq_rel)) {
+    delete states;
+  }
+}
+
+// Treiber stack linked through StateInternal::nextFree, every update of
+// the head bumps the tag so a concurrent pop cannot fall for ABA
+
+void StateSystem::freePush(StateID id)
+{
+  GLuint64 head = m_freeHead.load(std::memory_order_relaxed);
+  GLuint64 next;
+  do {
+    getInternal(id).nextFree.store(StateID(head), std::memory_order_relaxed);
+    next = (((head >> 32) + 1) << 32) | id;
+  } while (!m_freeHead.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+StateSystem::StateID StateSystem::freePop()
+{
+  GLuint64 head = m_freeHead.load(std::memory_order_acquire);
+  GLuint64 next;
+  do {
+    StateID id = StateID(head);
+    if (id == INVALID_ID) return INVALID_ID;
+    next = (((head >> 32) + 1) << 32) | getInternal(id).nextFree.load(std::memory_order_relaxed);
+  } while (!m_freeHead.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire));
+
+  return StateID(head);
+}
+
+void StateSystem::generate(GLuint num, StateID* objects)
+{
+  GLuint i;
+  for (i = 0; i < num; i++) {
+    objects[i] = freePop();
+    if (objects[i] == INVALID_ID) break;
+  }
+
+  if (i < num) {
+    // never count past MAX_STATES, so failed calls cannot wrap the ids
+    GLuint begin = m_numStates.load(std::memory_order_relaxed);
+    GLuint count;
+    do {
+      count = std::min(num - i, MAX_STATES - begin);
+    } while (!m_numStates.compare_exchange_weak(begin, begin + count, std::memory_order_relaxed));
+
+    for (StateID id = begin; id < begin + count; i++, id++) {
+      allocChunk(id >> CHUNK_BITS);
+      objects[i] = id;
+    }
+    for (; i < num; i++) {
+      objects[i] = INVALID_ID;
+    }
+  }
+}
+
+void StateSystem::destroy(GLuint num, const StateID* objects)
+{
+  for (GLuint i = 0; i < num; i++) {
+    StateID id = objects[i];
+    StateInternal& intstate = getInternal(id);
+    if (intstate.internRefs.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(m_internMutex);
+      if (--intstate.internRefs) continue;
+      internRemove(id);
+    }
+    freePush(id);
+  }
+}
+
+void StateSystem::set(StateID id, const State& state, GLenum basePrimitiveMode)
+{
+  StateInternal& intstate = getInternal(id);
+  if (intstate.internRefs.load(std::memory_order_relaxed)) {
+    // content no longer matches what others interned
+    std::lock_guard<std::mutex> lock(m_internMutex);
+    internRemove(id);
+  }
+
+  // mark the id busy before the writes, readers overlapping them retry
+  GLuint changeID = intstate.changeID.load(std::memory_order_relaxed);
+  intstate.changeID.store(changeID + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  StateVersion& version = getVersion(id, changeID + 2);
+  version.state = state;
+  version.state.basePrimitiveMode = basePrimitiveMode;
+  clearPadding(version.state);
+  updateHashes(version);
+  intstate.changeID.store(changeID + 2, std::memory_order_release);
+}
+
+StateSystem::StateID StateSystem::intern(const State& state, GLenum basePrimitiveMode)
+{
+  StateID id;
+  generate(1, &id);
+  if (id == INVALID_ID) return INVALID_ID;
+  set(id, state, basePrimitiveMode);
+
+  StateInternal& intstate = getInternal(id);
+  const StateVersion& version = getVersion(id, intstate.changeID.load(std::memory_order_relaxed));
+
+  std::lock_guard<std::mutex> lock(m_internMutex);
+  auto range = m_interned.equal_range(version.hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    StateInternal& other = getInternal(it->second);
+    if (memcmp(&getVersion(it->second, other.changeID.load(std::memory_order_relaxed)).state, &version.state, sizeof(State)) == 0) {
+      other.internRefs++;
+      freePush(id);
+      return it->second;
+    }
+  }
+
+  intstate.internRefs = 1;
+  m_interned.insert(std::make_pair(version.hash, id));
+  return id;
+}
+
+void StateSystem::internRemove(StateID id)
+{
+  // m_internMutex must be held
+  StateInternal& intstate = getInternal(id);
+  auto range = m_interned.equal_range(getVersion(id, intstate.changeID.load(std::memory_order_relaxed)).hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second == id) {
+      m_interned.erase(it);
+      break;
+    }
+  }
+  intstate.internRefs = 0;
+}
+
+bool StateSystem::isEqual(StateID a, StateID b) const
+{
+  if (a == b) return true;
+
+  const StateVersion& verA = getVersion(a, getInternal(a).changeID.load(std::memory_order_acquire));
+  const StateVersion& verB = getVersion(b, getInternal(b).changeID.load(std::memory_order_acquire));
+  return verA.hash == verB.hash && memcmp(&verA.state, &verB.state, sizeof(State)) == 0;
+}
+
+void StateSystem::updateHashes(StateVersion& version)
+{
+  const State& state = version.state;
+  GLuint* hashes = version.hashes;
+
+  // the slots of compiled out contents must compare equal
+  memset(hashes, 0, sizeof(version.hashes));
+
+  hashes[StateDiff::ENABLE] = hashBytes(&state.enable, sizeof(state.enable));
+#if STATESYSTEM_USE_DEPRECATED
+  hashes[StateDiff::ENABLE_DEPR] = hashBytes(&state.enableDepr, sizeof(state.enableDepr));
+#endif
+  hashes[StateDiff::PROGRAM] = hashBytes(&state.program, sizeof(state.program));
+  hashes[StateDiff::CLIP] = hashBytes(&state.clip, sizeof(state.clip));
+#if STATESYSTEM_USE_DEPRECATED
+  hashes[StateDiff::ALPHA_DEPR] = hashBytes(&state.alpha, sizeof(state.alpha));
+#endif
+  hashes[StateDiff::BLEND] = hashBytes(&state.blend, sizeof(state.blend));
+  hashes[StateDiff::DEPTH] = hashBytes(&state.depth, sizeof(state.depth));
+  hashes[StateDiff::STENCIL] = hashBytes(&state.stencil, sizeof(state.stencil));
+  hashes[StateDiff::LOGIC] = hashBytes(&state.logic, sizeof(state.logic));
+  hashes[StateDiff::PRIMITIVE] = hashBytes(&state.primitive, sizeof(state.primitive));
+  hashes[StateDiff::RASTER] = hashBytes(&state.raster, sizeof(state.raster));
+#if STATESYSTEM_USE_DEPRECATED
+  hashes[StateDiff::RASTER_DEPR] = hashBytes(&state.rasterDepr, sizeof(state.rasterDepr));
+#endif
+  hashes[StateDiff::DEPTHRANGE] = hashBytes(&state.depthrange, sizeof(state.depthrange));
+  hashes[StateDiff::SCISSORENABLE] = hashBytes(&state.scissorenable, sizeof(state.scissorenable));
+  hashes[StateDiff::MASK] = hashBytes(&state.mask, sizeof(state.mask));
+  hashes[StateDiff::FBO] = hashBytes(&state.fbo, sizeof(state.fbo));
+  hashes[StateDiff::VERTEXENABLE] = hashBytes(&state.vertexenable, sizeof(state.vertexenable));
+  hashes[StateDiff::VERTEXFORMAT] = hashBytes(&state.vertexformat, sizeof(state.vertexformat));
+  hashes[StateDiff::VERTEXIMMEDIATE] = hashBytes(&state.verteximm, sizeof(state.verteximm));
+
+  version.hash = hashBytes(&state, sizeof(State));
+}
+
+const StateSystem::State& StateSystem::get(StateID id) const
+{
+  return getVersion(id, getInternal(id).changeID.load(std::memory_order_acquire)).state;
+}
+
+void StateSystem::setTransitionCacheBudget(size_t bytes)
+{
+  m_transitionLinks.clear();
+  m_transitions.clear();
+  m_transitionBuckets.clear();
+  m_transitionLruHead = INVALID_ENTRY;
+  m_transitionLruTail = INVALID_ENTRY;
+  m_transitionFree = INVALID_ENTRY;
+
+  m_transitionStats.entries = 0;
+  m_transitionStats.bytes = 0;
+  m_transitionStats.budget = bytes;
+  resetTransitionCacheStats();
+
+  transitionRehash(64);
+}
+
+void StateSystem::resetTransitionCacheStats()
+{
+  m_transitionStats.hits = 0;
+  m_transitionStats.misses = 0;
+  m_transitionStats.evictions = 0;
+}
+
+inline GLuint StateSystem::transitionBucket(const TransitionKey& key) const
+{
+  GLuint hash = key.from * 0x9E3779B1u ^ key.to * 0x85EBCA77u ^ key.fromChangeID * 0xC2B2AE3Du ^ key.toChangeID * 0x27D4EB2Fu;
+  hash ^= hash >> 15;
+  return hash & GLuint(m_transitionBuckets.size() - 1);
+}
+
+inline void StateSystem::transitionLruUnlink(GLuint entry)
+{
+  TransitionLink& link = m_transitionLinks[entry];
+  if (link.lruPrev != INVALID_ENTRY) m_transitionLinks[link.lruPrev].lruNext = link.lruNext;
+  else                               m_transitionLruHead = link.lruNext;
+  if (link.lruNext != INVALID_ENTRY) m_transitionLinks[link.lruNext].lruPrev = link.lruPrev;
+  else                               m_transitionLruTail = link.lruPrev;
+}
+
+inline void StateSystem::transitionLruPushFront(GLuint entry)
+{
+  TransitionLink& link = m_transitionLinks[entry];
+  link.lruPrev = INVALID_ENTRY;
+  link.lruNext = m_transitionLruHead;
+  if (m_transitionLruHead != INVALID_ENTRY) m_transitionLinks[m_transitionLruHead].lruPrev = entry;
+  else                                      m_transitionLruTail = entry;
+  m_transitionLruHead = entry;
+}
+
+inline void StateSystem::transitionEvict(GLuint entry)
+{
+  transitionLruUnlink(entry);
+
+  TransitionLink& link = m_transitionLinks[entry];
+  GLuint* next = &m_transitionBuckets[transitionBucket(link.key)];
+  while (*next != entry) {
+    next = &m_transitionLinks[*next].hashNext;
+  }
+  *next = link.hashNext;
+
+  // free the ops, the entry is reused by a later miss
+  std::vector<GLuint>& words = m_transitions[entry].ops.words;
+  m_transitionStats.bytes -= words.capacity() * sizeof(GLuint);
+  std::vector<GLuint>().swap(words);
+
+  link.key.from = INVALID_ID;
+  link.lruNext = m_transitionFree;
+  m_transitionFree = entry;
+
+  m_transitionStats.entries--;
+  m_transitionStats.evictions++;
+}
+
+void StateSystem::transitionRehash(size_t numBuckets)
+{
+  // numBuckets must be a power of two
+  m_transitionStats.bytes += (numBuckets - m_transitionBuckets.size()) * sizeof(GLuint);
+  m_transitionBuckets.assign(numBuckets, GLuint(INVALID_ENTRY));
+  for (GLuint i = 0; i < GLuint(m_transitionLinks.size()); i++) {
+    // skip free entries
+    if (m_transitionLinks[i].key.from == INVALID_ID) continue;
+    GLuint bucket = transitionBucket(m_transitionLinks[i].key);
+    m_transitionLinks[i].hashNext = m_transitionBuckets[bucket];
+    m_transitionBuckets[bucket] = i;
+  }
+}
+
+inline const StateSystem::TransitionEntry& StateSystem::prepareTransitionCache(StateID prev, StateID id)
+{
+  const StateInternal& from = getInternal(prev);
+  const StateInternal& to   = getInternal(id);
+
+  TransitionKey key;
+  key.from = prev;
+  key.to = id;
+  key.fromChangeID = beginRead(from);
+  key.toChangeID = beginRead(to);
+
+  GLuint bucket = transitionBucket(key);
+  for (GLuint entry = m_transitionBuckets[bucket]; entry != INVALID_ENTRY; entry = m_transitionLinks[entry].hashNext) {
+    if (memcmp(&m_transitionLinks[entry].key, &key, sizeof(key)) == 0) {
+      if (entry != m_transitionLruHead) {
+        transitionLruUnlink(entry);
+        transitionLruPushFront(entry);
+      }
+      m_transitionStats.hits++;
+      return m_transitions[entry];
+    }
+  }
+
+  m_transitionStats.misses++;
+
+  GLuint entry;
+  if (m_transitionFree != INVALID_ENTRY) {
+    entry = m_transitionFree;
+    m_transitionFree = m_transitionLinks[entry].lruNext;
+  }
+  else {
+    entry = GLuint(m_transitions.size());
+    TransitionLink unused;
+    unused.key.from = INVALID_ID;
+    m_transitionLinks.push_back(unused);
+    m_transitions.push_back(TransitionEntry());
+    m_transitionStats.bytes += sizeof(TransitionLink) + sizeof(TransitionEntry);
+
+    if (m_transitions.size() > m_transitionBuckets.size()) {
+      transitionRehash(m_transitionBuckets.size() * 2);
+      bucket = transitionBucket(key);
+    }
+  }
+  m_transitionStats.entries++;
+
+  TransitionEntry& trans = m_transitions[entry];
+  const StateVersion& toVersion = getVersion(id, key.toChangeID);
+  makeDiff(trans.diff, getVersion(prev, key.fromChangeID), toVersion);
+  compileDiff(trans.ops, trans.diff, toVersion.state);
+  m_transitionStats.bytes += trans.ops.words.capacity() * sizeof(GLuint);
+
+  TransitionLink& link = m_transitionLinks[entry];
+  link.key = key;
+  link.hashNext = m_transitionBuckets[bucket];
+  m_transitionBuckets[bucket] = entry;
+  transitionLruPushFront(entry);
+
+  // the new entry itself is kept even if it exceeds the budget alone
+  while (m_transitionStats.bytes > m_transitionStats.budget && m_transitionLruTail != entry) {
+    transitionEvict(m_transitionLruTail);
+  }
+
+  // If another thread set a state meanwhile, the entry may have been
+  // made from a torn version. Its key is never asked for again, so it
+  // simply ages out.
+  if (readChanged(from, key.fromChangeID) || readChanged(to, key.toChangeID)) {
+    return prepareTransitionCache(prev, id);
+  }
+
+  return trans;
+}
+
+void StateSystem::compileState(OpList& ops, StateID id) const
+{
+  const StateInternal& intstate = getInternal(id);
+  size_t begin = ops.words.size();
+  GLuint changeID;
+  do {
+    // retry if the version was overwritten while compiling
+    ops.words.resize(begin);
+    changeID = beginRead(intstate);
+    getVersion(id, changeID).state.compileGL(ops, m_coreonly);
+  } while (readChanged(intstate, changeID));
+}
+
+void StateSystem::applyGL(StateID id, bool skipFboBinding) const
+{
+  OpList ops;
+  compileState(ops, id);
+  ops.execute(skipFboBinding, m_shadow);
+}
+
+void StateSystem::applyGL(StateID id, StateID prev, bool skipFboBinding)
+{
+  if (prev == INVALID_ID) {
+    applyGL(id, skipFboBinding);
+    return;
+  }
+  if (prev == id) {
+    return;
+  }
+
+  prepareTransitionCache(prev, id).ops.execute(skipFboBinding, m_shadow);
+}
+
+void StateSystem::compileDiff(OpList& ops, const StateDiff& diff, const State &state) const
+{
+  if (isBitSet(diff.changedContentBits, StateDiff::ENABLE))
+    state.enable.compileGL(ops, diff.changedStateBits);
+#if STATESYSTEM_USE_DEPRECATED
+  if (!m_coreonly && isBitSet(diff.changedContentBits, StateDiff::ENABLE_DEPR))
+    state.enableDepr.compileGL(ops, diff.changedStateDeprBits);
+#endif
+  if (isBitSet(diff.changedContentBits, StateDiff::PROGRAM))
+    state.program.compileGL(ops);
+  if (isBitSet(diff.changedContentBits, StateDiff::CLIP))
+    state.clip.compileGL(ops, diff.changedClip);
+#if STATESYSTEM_USE_DEPRECATED
+  if (!m_coreonly && isBitSet(diff.changedContentBits, StateDiff::ALPHA_DEPR))
+    state.alpha.compileGL(ops);
+#endif
+  if (isBitSet(diff.changedContentBits, StateDiff::BLEND))
+    state.blend.compileGL(ops, diff.changedBlendEnable, diff.changedBlendFunc, diff.changedBlendEquation);
+  if (isBitSet(diff.changedContentBits, StateDiff::DEPTH))
+    state.depth.compileGL(ops);
+  if (isBitSet(diff.changedContentBits, StateDiff::STENCIL))
+    state.stencil.compileGL(ops, diff.getFields(StateDiff::FIELDS_STENCIL));
+  if (isBitSet(diff.changedContentBits, StateDiff::LOGIC))
+    state.logic.compileGL(ops);
+  if (isBitSet(diff.changedContentBits, StateDiff::PRIMITIVE))
+    state.primitive.compileGL(ops, diff.getFields(StateDiff::FIELDS_PRIMITIVE));
+  if (isBitSet(diff.changedContentBits, StateDiff::RASTER))
+    state.raster.compileGL(ops, diff.getFields(StateDiff::FIELDS_RASTER));
+#if STATESYSTEM_USE_DEPRECATED
+  if (!m_coreonly && isBitSet(diff.changedContentBits, StateDiff::RASTER_DEPR))
+    state.rasterDepr.compileGL(ops);
+#endif
+  /*if (isBitSet(diff.changedContentBits,StateDiff::VIEWPORT))
+  state.viewport.applyGL();*/
+  if (isBitSet(diff.changedContentBits, StateDiff::DEPTHRANGE))
+    state.depthrange.compileGL(ops, diff.changedDepthRange);
+  /*if (isBitSet(diff.changedContentBits,StateDiff::SCISSOR))
+  state.scissor.applyGL();*/
+  if (isBitSet(diff.changedContentBits, StateDiff::SCISSORENABLE))
+    state.scissorenable.compileGL(ops, diff.changedScissorEnable);
+  if (isBitSet(diff.changedContentBits, StateDiff::MASK))
+    state.mask.compileGL(ops, diff.changedColorMask, diff.getFields(StateDiff::FIELDS_MASK));
+  if (isBitSet(diff.changedContentBits, StateDiff::FBO))
+    state.fbo.compileGL(ops, diff.getFields(StateDiff::FIELDS_FBO));
+  if (isBitSet(diff.changedContentBits, StateDiff::VERTEXENABLE))
+    state.vertexenable.compileGL(ops, diff.changedVertexEnable);
+  if (isBitSet(diff.changedContentBits, StateDiff::VERTEXFORMAT))
+    state.vertexformat.compileGL(ops, diff.changedVertexFormat, diff.changedVertexBinding);
+  if (isBitSet(diff.changedContentBits, StateDiff::VERTEXIMMEDIATE))
+    state.verteximm.compileGL(ops, diff.changedVertexImm);
+}
+
+
+void StateSystem::makeDiff(StateDiff& diff, const StateVersion &fromVersion, const StateVersion &toVersion) const
+{
+  // different hashes are conclusive, equal ones still need to be confirmed
+  GLbitfield changed = 0;
+  for (GLuint i = 0; i < StateDiff::NUM_CONTENTS; i++) {
+    if (fromVersion.hashes[i] != toVersion.hashes[i]) setBit(changed, i);
+  }
+  makeDiff(diff, fromVersion.state, toVersion.state, changed, ~changed);
+}
+
+void StateSystem::makeDiff(StateDiff& diff, const State &from, const State &to, GLbitfield changed, GLbitfield unknown) const
+{
+#define SUBSTATE_CHANGED(member, bit) \
+  (isBitSet(changed, bit) || (isBitSet(unknown, bit) && memcmp(&from.member, &to.member, sizeof(from.member)) != 0))
+
+  diff.changedStateBits = from.enable.stateBits ^ to.enable.stateBits;
+#if STATESYSTEM_USE_DEPRECATED
+  diff.changedStateDeprBits = from.enableDepr.stateBitsDepr ^ to.enableDepr.stateBitsDepr;
+#endif
+  diff.changedContentBits = 0;
+  diff.changedClip = 0;
+  diff.changedBlendEnable = 0;
+  diff.changedBlendFunc = 0;
+  diff.changedBlendEquation = 0;
+  diff.changedColorMask = 0;
+  diff.changedDepthRange = 0;
+  diff.changedScissorEnable = 0;
+  diff.changedFields = 0;
+
+  if (SUBSTATE_CHANGED(enable, StateDiff::ENABLE)) setBit(diff.changedContentBits, StateDiff::ENABLE);
+#if STATESYSTEM_USE_DEPRECATED
+  if (SUBSTATE_CHANGED(enableDepr, StateDiff::ENABLE_DEPR)) setBit(diff.changedContentBits, StateDiff::ENABLE_DEPR);
+#endif
+  if (SUBSTATE_CHANGED(program, StateDiff::PROGRAM)) setBit(diff.changedContentBits, StateDiff::PROGRAM);
+  diff.changedClip = from.clip.enabled ^ to.clip.enabled;
+  if (diff.changedClip) setBit(diff.changedContentBits, StateDiff::CLIP);
+#if STATESYSTEM_USE_DEPRECATED
+  if (SUBSTATE_CHANGED(alpha, StateDiff::ALPHA_DEPR)) setBit(diff.changedContentBits, StateDiff::ALPHA_DEPR);
+#endif
+  if (SUBSTATE_CHANGED(blend, StateDiff::BLEND) || (to.blend.separateEnable && isBitSet(diff.changedStateBits, BLEND))) {
+    // per draw buffer enables are overridden by a global toggle
+    if (to.blend.separateEnable) {
+      diff.changedBlendEnable = from.blend.separateEnable && !isBitSet(diff.changedStateBits, BLEND) ?
+        from.blend.separateEnable ^ to.blend.separateEnable : (1 << MAX_DRAWBUFFERS) - 1;
+    }
+    // compare what each draw buffer effectively uses
+    for (GLuint i = 0; i < MAX_DRAWBUFFERS; i++) {
+      const BlendStage& fromBlend = from.blend.blends[from.blend.useSeparate ? i : 0];
+      const BlendStage& toBlend   = to.blend.blends[to.blend.useSeparate ? i : 0];
+      if (fromBlend.rgb.srcw != toBlend.rgb.srcw || fromBlend.rgb.dstw != toBlend.rgb.dstw ||
+          fromBlend.alpha.srcw != toBlend.alpha.srcw || fromBlend.alpha.dstw != toBlend.alpha.dstw) {
+        setBit(diff.changedBlendFunc, i);
+      }
+      if (fromBlend.rgb.equ != toBlend.rgb.equ || fromBlend.alpha.equ != toBlend.alpha.equ) {
+        setBit(diff.changedBlendEquation, i);
+      }
+    }
+    if (diff.changedBlendEnable || diff.changedBlendFunc || diff.changedBlendEquation) setBit(diff.changedContentBits, StateDiff::BLEND);
+  }
+  if (SUBSTATE_CHANGED(depth, StateDiff::DEPTH)) setBit(diff.changedContentBits, StateDiff::DEPTH);
+  if (SUBSTATE_CHANGED(stencil, StateDiff::STENCIL)) {
+    GLbitfield fields = 0;
+    for (GLuint f = 0; f < MAX_FACES; f++) {
+      if (memcmp(&from.stencil.funcs[f], &to.stencil.funcs[f], sizeof(StencilFunc)) != 0) setBit(fields, StencilState::FUNC_FRONT + f);
+      if (memcmp(&from.stencil.ops[f], &to.stencil.ops[f], sizeof(StencilOp)) != 0)       setBit(fields, StencilState::OP_FRONT + f);
+    }
+    diff.setFields(StateDiff::FIELDS_STENCIL, fields);
+    if (fields) setBit(diff.changedContentBits, StateDiff::STENCIL);
+  }
+  if (SUBSTATE_CHANGED(logic, StateDiff::LOGIC)) setBit(diff.changedContentBits, StateDiff::LOGIC);
+  if (SUBSTATE_CHANGED(primitive, StateDiff::PRIMITIVE)) {
+    GLbitfield fields = 0;
+    if (from.primitive.restartIndex != to.primitive.restartIndex)       setBit(fields, PrimitiveState::RESTARTINDEX);
+    if (from.primitive.patchVertices != to.primitive.patchVertices)     setBit(fields, PrimitiveState::PATCHVERTICES);
+    if (from.primitive.provokingVertex != to.primitive.provokingVertex) setBit(fields, PrimitiveState::PROVOKINGVERTEX);
+    diff.setFields(StateDiff::FIELDS_PRIMITIVE, fields);
+    if (fields) setBit(diff.changedContentBits, StateDiff::PRIMITIVE);
+  }
+  if (SUBSTATE_CHANGED(raster, StateDiff::RASTER)) {
+    GLbitfield fields = 0;
+    if (from.raster.cullFace != to.raster.cullFace)                   setBit(fields, RasterState::CULLFACE);
+    if (from.raster.polyMode != to.raster.polyMode)                   setBit(fields, RasterState::POLYMODE);
+    if (from.raster.pointSize != to.raster.pointSize)                 setBit(fields, RasterState::POINTSIZE);
+    if (from.raster.pointFade != to.raster.pointFade)                 setBit(fields, RasterState::POINTFADE);
+    if (from.raster.pointSpriteOrigin != to.raster.pointSpriteOrigin) setBit(fields, RasterState::POINTSPRITEORIGIN);
+    diff.setFields(StateDiff::FIELDS_RASTER, fields);
+    if (fields) setBit(diff.changedContentBits, StateDiff::RASTER);
+  }
+#if STATESYSTEM_USE_DEPRECATED
+  if (SUBSTATE_CHANGED(rasterDepr, StateDiff::RASTER_DEPR)) setBit(diff.changedContentBits, StateDiff::RASTER_DEPR);
+#endif
+  //if (SUBSTATE_CHANGED(viewport, StateDiff::VIEWPORT)) setBit(diff.changedContentBits,StateDiff::VIEWPORT);
+  if (SUBSTATE_CHANGED(depthrange, StateDiff::DEPTHRANGE)) {
+    for (GLuint i = 0; i < MAX_VIEWPORTS; i++) {
+      const DepthRange& fromRange = from.depthrange.depths[from.depthrange.useSeparate ? i : 0];
+      const DepthRange& toRange   = to.depthrange.depths[to.depthrange.useSeparate ? i : 0];
+      if (fromRange.nearPlane != toRange.nearPlane || fromRange.farPlane != toRange.farPlane) setBit(diff.changedDepthRange, i);
+    }
+    if (diff.changedDepthRange) setBit(diff.changedContentBits, StateDiff::DEPTHRANGE);
+  }
+  //if (SUBSTATE_CHANGED(scissor, StateDiff::SCISSOR)) setBit(diff.changedContentBits,StateDiff::SCISSOR);
+  if (to.scissorenable.separateEnable && (SUBSTATE_CHANGED(scissorenable, StateDiff::SCISSORENABLE) || isBitSet(diff.changedStateBits, SCISSOR_TEST))) {
+    // per viewport enables are overridden by a global toggle
+    diff.changedScissorEnable = from.scissorenable.separateEnable && !isBitSet(diff.changedStateBits, SCISSOR_TEST) ?
+      from.scissorenable.separateEnable ^ to.scissorenable.separateEnable : (1 << MAX_VIEWPORTS) - 1;
+    if (diff.changedScissorEnable) setBit(diff.changedContentBits, StateDiff::SCISSORENABLE);
+  }
+  if (SUBSTATE_CHANGED(mask, StateDiff::MASK)) {
+    GLbitfield fields = 0;
+    for (GLuint i = 0; i < MAX_DRAWBUFFERS; i++) {
+      const GLboolean* fromColor = from.mask.colormask[from.mask.colormaskUseSeparate ? i : 0];
+      const GLboolean* toColor   = to.mask.colormask[to.mask.colormaskUseSeparate ? i : 0];
+      if (memcmp(fromColor, toColor, sizeof(GLboolean) * MAX_COLORS) != 0) setBit(diff.changedColorMask, i);
+    }
+    if (from.mask.depth != to.mask.depth)                                         setBit(fields, MaskState::DEPTH);
+    if (from.mask.stencil[FACE_FRONT] != to.mask.stencil[FACE_FRONT])             setBit(fields, MaskState::STENCIL_FRONT);
+    if (from.mask.stencil[FACE_BACK] != to.mask.stencil[FACE_BACK])               setBit(fields, MaskState::STENCIL_BACK);
+    diff.setFields(StateDiff::FIELDS_MASK, fields);
+    if (fields || diff.changedColorMask) setBit(diff.changedContentBits, StateDiff::MASK);
+  }
+  if (SUBSTATE_CHANGED(fbo, StateDiff::FBO)) {
+    GLbitfield fields = 0;
+    if (from.fbo.fboDraw != to.fbo.fboDraw || from.fbo.fboRead != to.fbo.fboRead) {
+      // draw and read buffers are per framebuffer state
+      fields = getBit(FBOState::BINDING) | getBit(FBOState::DRAWBUFFERS) | getBit(FBOState::READBUFFER);
+    }
+    if (from.fbo.numBuffers != to.fbo.numBuffers || memcmp(from.fbo.drawBuffers, to.fbo.drawBuffers, sizeof(GLenum) * to.fbo.numBuffers) != 0) {
+      setBit(fields, FBOState::DRAWBUFFERS);
+    }
+    if (from.fbo.readBuffer != to.fbo.readBuffer) setBit(fields, FBOState::READBUFFER);
+    diff.setFields(StateDiff::FIELDS_FBO, fields);
+    if (fields) setBit(diff.changedContentBits, StateDiff::FBO);
+  }
+
+  // special case vertex stuff, more likely to change then rest
+
+  diff.changedVertexEnable = from.vertexenable.enabled ^ to.vertexenable.enabled;
+
+  diff.changedVertexImm = 0;
+  diff.changedVertexFormat = 0;
+  diff.changedVertexBinding = 0;
+
+  if (SUBSTATE_CHANGED(vertexformat, StateDiff::VERTEXFORMAT)) {
+    for (GLint i = 0; i < MAX_VERTEXATTRIBS; i++) {
+      if (memcmp(&from.vertexformat.formats[i], &to.vertexformat.formats[i], sizeof(to.vertexformat.formats[i])) != 0)  setBit(diff.changedVertexFormat, i);
+    }
+    for (GLint i = 0; i < MAX_VERTEXBINDINGS; i++) {
+      if (memcmp(&from.vertexformat.bindings[i], &to.vertexformat.bindings[i], sizeof(to.vertexformat.bindings[i])) != 0)  setBit(diff.changedVertexBinding, i);
+    }
+  }
+
+  if (SUBSTATE_CHANGED(verteximm, StateDiff::VERTEXIMMEDIATE)) {
+    for (GLint i = 0; i < MAX_VERTEXATTRIBS; i++) {
+      if (memcmp(&from.verteximm.data[i], &to.verteximm.data[i], sizeof(to.verteximm.data[i])) != 0)                    setBit(diff.changedVertexImm, i);
+    }
+  }
+
+#undef SUBSTATE_CHANGED
+
+  if (diff.changedVertexEnable)                               setBit(diff.changedContentBits, StateDiff::VERTEXENABLE);
+  if (diff.changedVertexBinding || diff.changedVertexFormat)  setBit(diff.changedContentBits, StateDiff::VERTEXFORMAT);
+  if (diff.changedVertexImm)                                  setBit(diff.changedContentBits, StateDiff::VERTEXIMMEDIATE);
+}
+
+void StateSystem::prepareTransition(StateID id, StateID prev)
+{
+  prepareTransitionCache(prev, id);
+}
+
+void StateSystem::compileTransitionUncached(OpList& ops, StateID id, StateID prev) const
+{
+  if (prev == INVALID_ID) {
+    compileState(ops, id);
+    return;
+  }
+  if (prev == id) return;
+
+  const StateInternal& from = getInternal(prev);
+  const StateInternal& to   = getInternal(id);
+  size_t begin = ops.words.size();
+  GLuint fromChangeID;
+  GLuint toChangeID;
+  do {
+    // retry if a version was overwritten while compiling
+    ops.words.resize(begin);
+    fromChangeID = beginRead(from);
+    toChangeID = beginRead(to);
+
+    const StateVersion& toVersion = getVersion(id, toChangeID);
+    StateDiff diff;
+    makeDiff(diff, getVersion(prev, fromChangeID), toVersion);
+    compileDiff(ops, diff, toVersion.state);
+  } while (readChanged(from, fromChangeID) || readChanged(to, toChangeID));
+}
+
+GLuint StateSystem::getContentCost(GLbitfield changedContents)
+{
+  // rough relative cost of the GL calls per sub-state, indexed by ContentBits
+  static const GLubyte contentCosts[StateDiff::NUM_CONTENTS] = {
+    2,  // ENABLE
+    2,  // ENABLE_DEPR
+    8,  // PROGRAM
+    1,  // CLIP
+    1,  // ALPHA_DEPR
+    2,  // BLEND
+    1,  // DEPTH
+    1,  // STENCIL
+    1,  // LOGIC
+    1,  // PRIMITIVE
+    1,  // RASTER
+    1,  // RASTER_DEPR
+    1,  // DEPTHRANGE
+    1,  // SCISSORENABLE
+    1,  // MASK
+    8,  // FBO
+    1,  // VERTEXENABLE
+    4,  // VERTEXFORMAT
+    1,  // VERTEXIMMEDIATE
+  };
+  // the transition lookup itself
+  static const GLuint baseCost = 1;
+
+  GLuint cost = 0;
+  for (GLuint i = 0; i < StateDiff::NUM_CONTENTS; i++) {
+    if (isBitSet(changedContents, i)) cost += contentCosts[i];
+  }
+
+  return cost ? baseCost + cost : 0;
+}
+
+GLuint StateSystem::getTransitionCost(StateID id, StateID prev) const
+{
+  if (id == prev) return 0;
+  if (prev == INVALID_ID) return getContentCost((1 << StateDiff::NUM_CONTENTS) - 1);
+
+  const StateVersion& to   = getVersion(id, getInternal(id).changeID.load(std::memory_order_acquire));
+  const StateVersion& from = getVersion(prev, getInternal(prev).changeID.load(std::memory_order_acquire));
+
+  GLbitfield changed = 0;
+  for (GLuint i = 0; i < StateDiff::NUM_CONTENTS; i++) {
+    if (from.hashes[i] != to.hashes[i]) setBit(changed, i);
+  }
+
+  return getContentCost(changed);
+}
+
+void StateSystem::compileTransition(OpList& ops, const CompactStore& store, GLuint to, GLuint from) const
+{
+  if (to == from) return;
+
+  State toState;
+  store.decode(to, toState);
+  if (from == CompactStore::INVALID_INDEX) {
+    toState.compileGL(ops, m_coreonly);
+    return;
+  }
+
+  // the changed contents come from the blocks, the per-field checks of
+  // makeDiff only look at the sub-states flagged there
+  GLbitfield changed = store.diffContents(from, to);
+
+  State fromState;
+  store.decode(from, fromState);
+
+  StateDiff diff;
+  makeDiff(diff, fromState, toState, changed, 0);
+  compileDiff(ops, diff, toState);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void StateSystem::CompactStore::reset(const State& base)
+{
+  State copy = base;
+  clearPadding(copy);
+
+  memset(m_base, 0, sizeof(m_base));
+  memcpy(m_base, &copy, sizeof(State));
+  m_entries.clear();
+  m_payload.clear();
+}
+
+StateSystem::CompactStore::Index StateSystem::CompactStore::add(const State& state, GLenum basePrimitiveMode)
+{
+  State copy = state;
+  copy.basePrimitiveMode = basePrimitiveMode;
+  clearPadding(copy);
+
+  GLuint words[NUM_BLOCKS * BLOCK_WORDS] = {};
+  memcpy(words, &copy, sizeof(State));
+
+  Entry entry;
+  memset(entry.present, 0, sizeof(entry.present));
+  entry.offset = GLuint(m_payload.size());
+
+  for (GLuint b = 0; b < NUM_BLOCKS; b++) {
+    const GLuint* block = words + b * BLOCK_WORDS;
+    if (memcmp(block, m_base + b * BLOCK_WORDS, BLOCK_WORDS * sizeof(GLuint)) != 0) {
+      entry.present[b / 64] |= GLuint64(1) << (b % 64);
+      m_payload.insert(m_payload.end(), block, block + BLOCK_WORDS);
+    }
+  }
+
+  m_entries.push_back(entry);
+  return Index(m_entries.size() - 1);
+}
+
+void StateSystem::CompactStore::decode(Index idx, State& state) const
+{
+  const Entry&  entry   = m_entries[idx];
+  const GLuint* payload = m_payload.data() + entry.offset;
+  GLuint*       words   = (GLuint*)&state;
+
+  memcpy(words, m_base, sizeof(State));
+  for (GLuint m = 0; m < MASK_WORDS; m++) {
+    for (GLuint64 bits = entry.present[m]; bits; bits &= bits - 1) {
+      size_t first = (m * 64 + bitScanForward(bits)) * BLOCK_WORDS;
+      size_t count = first + BLOCK_WORDS <= ContentWords::NUM_WORDS ? BLOCK_WORDS : ContentWords::NUM_WORDS - first;
+      memcpy(words + first, payload, count * sizeof(GLuint));
+      payload += BLOCK_WORDS;
+    }
+  }
+}
+
+bool StateSystem::CompactStore::isEqual(Index a, Index b) const
+{
+  // a block is stored only if it differs from the base, so equal states
+  // have equal masks and payloads
+  if (a == b) return true;
+
+  const Entry& entryA = m_entries[a];
+  const Entry& entryB = m_entries[b];
+  return memcmp(entryA.present, entryB.present, sizeof(entryA.present)) == 0 &&
+         memcmp(m_payload.data() + entryA.offset, m_payload.data() + entryB.offset, getPayloadWords(a) * sizeof(GLuint)) == 0;
+}
+
+GLbitfield StateSystem::CompactStore::diffContents(Index from, Index to) const
+{
+  const Entry&  entryA = m_entries[from];
+  const Entry&  entryB = m_entries[to];
+  const GLuint* payloadA = m_payload.data() + entryA.offset;
+  const GLuint* payloadB = m_payload.data() + entryB.offset;
+
+  // blocks neither state stores are the base's in both
+  GLbitfield changed = 0;
+  for (GLuint m = 0; m < MASK_WORDS; m++) {
+    for (GLuint64 either = entryA.present[m] | entryB.present[m]; either; either &= either - 1) {
+      GLuint64      bit   = either & (~either + 1);
+      size_t        first = (m * 64 + bitScanForward(either)) * BLOCK_WORDS;
+      const GLuint* a     = m_base + first;
+      const GLuint* b     = m_base + first;
+      if (entryA.present[m] & bit) {
+        a = payloadA;
+        payloadA += BLOCK_WORDS;
+      }
+      if (entryB.present[m] & bit) {
+        b = payloadB;
+        payloadB += BLOCK_WORDS;
+      }
+      changed |= ContentWords::differing(a, b, first, BLOCK_WORDS);
+    }
+  }
+  return changed;
+}
+
+GLbitfield StateSystem::getChangedContents(const State& from, const State& to)
+{
+  const GLuint* a = (const GLuint*)&from;
+  const GLuint* b = (const GLuint*)&to;
+
+  // most of State is equal, skip it a block at a time
+  const size_t BLOCK = 16;
+  GLbitfield   changed = 0;
+  for (size_t w = 0; w < ContentWords::NUM_WORDS; w += BLOCK) {
+    size_t count = std::min(BLOCK, ContentWords::NUM_WORDS - w);
+    if (memcmp(a + w, b + w, count * sizeof(GLuint)) != 0) {
+      changed |= ContentWords::differing(a + w, b + w, w, count);
+    }
+  }
+  return changed;
+}
+
+GLuint StateSystem::CompactStore::getTransitionCost(Index to, Index from) const
+{
+  if (to == from) return 0;
+  if (from == INVALID_INDEX) return getContentCost((1 << StateDiff::NUM_CONTENTS) - 1);
+
+  return getContentCost(diffContents(from, to));
+}
+
+size_t StateSystem::CompactStore::getBytes() const
+{
+  return sizeof(m_base) + m_entries.size() * sizeof(Entry) + m_payload.size() * sizeof(GLuint);
+}
@@ -27,6 +27,13 @@
 
 #include <nvgl/extensions_gl.hpp>
 #include <vector>
+#include <cstring> // memcpy
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+class ShadowState;
 
 class StateSystem {
 public:
@@ -107,6 +114,85 @@ public:
 
   //////////////////////////////////////////////////////////////////////////
 
+  // GL calls are not issued directly but compiled into a linear list,
+  // each opcode is followed by its arguments as 32-bit words
+  // (floats as bits, doubles as two words).
+  enum OpCode {
+    OP_ENABLE,                      // cap
+    OP_DISABLE,                     // cap
+    OP_ENABLEI,                     // cap, index
+    OP_DISABLEI,                    // cap, index
+    OP_USE_PROGRAM,                 // program
+    OP_ALPHA_FUNC,                  // func, ref
+    OP_STENCIL_FUNC_SEPARATE,       // face, func, ref, mask
+    OP_STENCIL_OP_SEPARATE,         // face, fail, zfail, zpass
+    OP_BLEND_FUNC_SEPARATE,         // srcRGB, dstRGB, srcAlpha, dstAlpha
+    OP_BLEND_FUNC_SEPARATEI,        // buf, srcRGB, dstRGB, srcAlpha, dstAlpha
+    OP_BLEND_EQUATION_SEPARATE,     // modeRGB, modeAlpha
+    OP_BLEND_EQUATION_SEPARATEI,    // buf, modeRGB, modeAlpha
+    OP_DEPTH_FUNC,                  // func
+    OP_LOGIC_OP,                    // op
+    OP_CULL_FACE,                   // mode
+    OP_POLYGON_MODE,                // face, mode
+    OP_POINT_SIZE,                  // size
+    OP_POINT_PARAMETERF,            // pname, param
+    OP_POINT_PARAMETERI,            // pname, param
+    OP_LINE_STIPPLE,                // factor, pattern
+    OP_SHADE_MODEL,                 // mode
+    OP_PRIMITIVE_RESTART_INDEX,     // index
+    OP_PROVOKING_VERTEX,            // mode
+    OP_PATCH_PARAMETERI,            // pname, value
+    OP_SAMPLE_COVERAGE,             // value, invert
+    OP_SAMPLE_MASKI,                // index, mask
+    OP_DEPTH_RANGE,                 // near (2), far (2)
+    OP_DEPTH_RANGE_INDEXED,         // index, near (2), far (2)
+    OP_DEPTH_RANGE_ARRAY,           // count, { near (2), far (2) }[count]
+    OP_COLOR_MASK,                  // r, g, b, a
+    OP_COLOR_MASKI,                 // buf, r, g, b, a
+    OP_DEPTH_MASK,                  // flag
+    OP_STENCIL_MASK_SEPARATE,       // face, mask
+    OP_BIND_FRAMEBUFFER,            // target, framebuffer (skipped on request)
+    OP_DRAW_BUFFERS,                // n, bufs[n]
+    OP_READ_BUFFER,                 // mode
+    OP_ENABLE_VERTEX_ATTRIB_ARRAY,  // index
+    OP_DISABLE_VERTEX_ATTRIB_ARRAY, // index
+    OP_VERTEX_ATTRIB_FORMAT,        // index, size, type, normalized, relativeoffset
+    OP_VERTEX_ATTRIB_IFORMAT,       // index, size, type, relativeoffset
+    OP_VERTEX_ATTRIB_BINDING,       // index, binding
+    OP_VERTEX_BINDING_DIVISOR,      // index, divisor
+    OP_BIND_VERTEX_BUFFER,          // index, stride (buffer and offset are 0)
+    OP_VERTEX_ATTRIB_4FV,           // index, v[4]
+    OP_VERTEX_ATTRIB_I4IV,          // index, v[4]
+    OP_VERTEX_ATTRIB_I4UIV,         // index, v[4]
+  };
+
+  struct OpList {
+    std::vector<GLuint> words;
+
+    template <class... Args>
+    void add(OpCode op, Args... args)
+    {
+      words.push_back(op);
+      (push(args), ...);
+    }
+
+    void push(GLuint v)     { words.push_back(v); }
+    void push(GLint v)      { words.push_back(GLuint(v)); }
+    void push(GLushort v)   { words.push_back(v); }
+    void push(GLboolean v)  { words.push_back(v); }
+    void push(GLfloat v)    { GLuint w; memcpy(&w, &v, sizeof(w)); words.push_back(w); }
+    void push(GLdouble v)   { GLuint w[2]; memcpy(w, &v, sizeof(w)); words.push_back(w[0]); words.push_back(w[1]); }
+
+    void clear() { words.clear(); }
+    void execute(bool skipFboBinding = false, ShadowState* shadow = NULL) const { execute(words.data(), words.size(), skipFboBinding, shadow); }
+
+    // with a shadow, enables, program, framebuffer and vertex buffer
+    // bindings are filtered against the current context
+    static void execute(const GLuint* words, size_t numWords, bool skipFboBinding, ShadowState* shadow);
+  };
+
+  //////////////////////////////////////////////////////////////////////////
+
   struct ClipDistanceState {
     GLbitfield  enabled;
 
@@ -115,7 +201,7 @@ public:
       enabled = 0;
     }
 
-    void applyGL() const;
+    void compileGL(OpList& ops, GLbitfield changed = ~0) const;
     void getGL();
   };
 
@@ -131,7 +217,7 @@ public:
       refvalue = 1.0;
     }
 
-    void applyGL() const;
+    void compileGL(OpList& ops) const;
     void getGL();
   };
 #endif
@@ -150,6 +236,13 @@ public:
     GLuint  mask;
   };
   struct StencilState {
+    enum Fields {
+      FUNC_FRONT,
+      FUNC_BACK,
+      OP_FRONT,
+      OP_BACK,
+    };
+
     StencilFunc funcs[MAX_FACES];
     StencilOp   ops[MAX_FACES];
 
@@ -159,10 +252,13 @@ public:
         funcs[i].func = GL_ALWAYS;
         funcs[i].refvalue = 0;
         funcs[i].mask = ~0;
+        ops[i].fail = GL_KEEP;
+        ops[i].zfail = GL_KEEP;
+        ops[i].zpass = GL_KEEP;
       }
     }
 
-    void applyGL() const;
+    void compileGL(OpList& ops, GLbitfield changed = ~0) const;
     void getGL();
   };
 
@@ -193,7 +289,8 @@ public:
       }
     }
 
-    void applyGL() const;
+    // changed bits are per draw buffer
+    void compileGL(OpList& ops, GLbitfield changedEnable = ~0, GLbitfield changedFunc = ~0, GLbitfield changedEquation = ~0) const;
     void getGL();
   };
   //////////////////////////////////////////////////////////////////////////
@@ -206,7 +303,7 @@ public:
       func = GL_LESS;
     }
 
-    void applyGL() const;
+    void compileGL(OpList& ops) const;
     void getGL();
   };
   //////////////////////////////////////////////////////////////////////////
@@ -218,12 +315,20 @@ public:
       op = GL_COPY;
     }
 
-    void applyGL() const;
+    void compileGL(OpList& ops) const;
     void getGL();
   };
   //////////////////////////////////////////////////////////////////////////
 
   struct RasterState {
+    enum Fields {
+      CULLFACE,
+      POLYMODE,
+      POINTSIZE,
+      POINTFADE,
+      POINTSPRITEORIGIN,
+    };
+
     //GLenum    frontFace;
     GLenum    cullFace;
     //GLfloat   polyOffsetFactor;
@@ -246,7 +351,7 @@ public:
       pointSpriteOrigin = GL_UPPER_LEFT;
     }
 
-    void applyGL() const;
+    void compileGL(OpList& ops, GLbitfield changed = ~0) const;
     void getGL();
   };
 
@@ -254,16 +359,18 @@ public:
   struct RasterStateDepr {
     GLint     lineStippleFactor;
     GLushort  lineStipplePattern;
+    GLushort  _pad;
     GLenum    shadeModel;
     // ignore polygonStipple
 
     RasterStateDepr() {
       lineStippleFactor = 1;
       lineStipplePattern = ~0;
+      _pad = 0;
       shadeModel = GL_SMOOTH;
     }
 
-    void applyGL() const;
+    void compileGL(OpList& ops) const;
     void getGL();
   };
 #endif
@@ -271,6 +378,12 @@ public:
   //////////////////////////////////////////////////////////////////////////
 
   struct PrimitiveState {
+    enum Fields {
+      RESTARTINDEX,
+      PATCHVERTICES,
+      PROVOKINGVERTEX,
+    };
+
     GLuint    restartIndex;
     GLint     patchVertices;
     GLenum    provokingVertex;
@@ -281,7 +394,7 @@ public:
       provokingVertex = GL_LAST_VERTEX_CONVENTION;
     }
 
-    void applyGL() const;
+    void compileGL(OpList& ops, GLbitfield changed = ~0) const;
     void getGL();
   };
 
@@ -290,15 +403,17 @@ public:
   struct SampleState {
     GLfloat   coverage;
     GLboolean invert;
+    GLubyte   _pad[3];  // explicit, states are hashed and compared bytewise
     GLuint    mask;
 
     SampleState() {
       coverage = 1.0;
       invert = GL_FALSE;
+      _pad[0] = _pad[1] = _pad[2] = 0;
       mask = ~0;
     }
 
-    void applyGL() const;
+    void compileGL(OpList& ops) const;
     void getGL();
   };
   //////////////////////////////////////////////////////////////////////////
@@ -342,17 +457,19 @@ public:
 
   struct DepthRangeState {
     GLuint        useSeparate;  // if set uses per view, otherwise first
+    GLuint        _pad;
     DepthRange    depths[MAX_VIEWPORTS];
 
     DepthRangeState() {
       useSeparate = GL_FALSE;
+      _pad = 0;
       for (GLuint i = 0; i < MAX_VIEWPORTS; i++) {
         depths[i].nearPlane = 0;
         depths[i].farPlane = 1;
       }
     }
 
-    void applyGL() const;
+    void compileGL(OpList& ops, GLbitfield changed = ~0) const; // changed bits are per viewport
     void getGL();
   };
 
@@ -383,21 +500,29 @@ public:
       separateEnable = 0;
     }
 
-    void applyGL() const;
+    void compileGL(OpList& ops, GLbitfield changed = ~0) const; // changed bits are per viewport
     void getGL();
   };
 
   //////////////////////////////////////////////////////////////////////////
 
   struct MaskState {
+    enum Fields {
+      STENCIL_FRONT,
+      STENCIL_BACK,
+      DEPTH,
+    };
+
     GLuint    colormaskUseSeparate;
     GLboolean colormask[MAX_DRAWBUFFERS][MAX_COLORS];
     GLboolean depth;
+    GLubyte   _pad[3];
     GLuint    stencil[MAX_FACES];
 
     MaskState() {
       colormaskUseSeparate = GL_FALSE;
       depth = GL_TRUE;
+      _pad[0] = _pad[1] = _pad[2] = 0;
       stencil[FACE_FRONT] = ~0;
       stencil[FACE_BACK] = ~0;
       for (GLuint i = 0; i < MAX_DRAWBUFFERS; i++) {
@@ -407,13 +532,20 @@ public:
       }
     }
 
-    void applyGL() const;
+    // changedColor bits are per draw buffer
+    void compileGL(OpList& ops, GLbitfield changedColor = ~0, GLbitfield changed = ~0) const;
     void getGL();
   };
 
   //////////////////////////////////////////////////////////////////////////
 
   struct FBOState {
+    enum Fields {
+      BINDING,
+      DRAWBUFFERS,
+      READBUFFER,
+    };
+
     GLuint  fboDraw;
     GLuint  fboRead;
     GLenum  readBuffer;
@@ -439,7 +571,7 @@ public:
       numBuffers = 1;
     }
 
-    void applyGL(bool noBind = false) const;
+    void compileGL(OpList& ops, GLbitfield changed = ~0) const;
     void getGL();
   };
 
@@ -452,7 +584,7 @@ public:
       enabled = 0;
     }
 
-    void applyGL(GLbitfield changed = ~0) const;
+    void compileGL(OpList& ops, GLbitfield changed = ~0) const;
     void getGL();
   };
 
@@ -467,6 +599,7 @@ public:
     VertexModeType  mode;
 
     GLboolean normalized;
+    GLubyte   _pad[3];
 
     GLuint    size;
     GLenum    type;
@@ -490,6 +623,7 @@ public:
         formats[i].size = 4;
         formats[i].type = GL_FLOAT;
         formats[i].normalized = GL_FALSE;
+        formats[i]._pad[0] = formats[i]._pad[1] = formats[i]._pad[2] = 0;
         formats[i].relativeoffset = 0;
         formats[i].binding = i;
       }
@@ -500,7 +634,7 @@ public:
       }
     }
 
-    void applyGL(GLbitfield changedFormat = ~0, GLbitfield changedBinding = ~0) const;
+    void compileGL(OpList& ops, GLbitfield changedFormat = ~0, GLbitfield changedBinding = ~0) const;
     void getGL();
   };
 
@@ -526,7 +660,7 @@ public:
       }
     }
 
-    void applyGL(GLbitfield changed = ~0) const;
+    void compileGL(OpList& ops, GLbitfield changed = ~0) const;
     void getGL(); // ensure proper mode, otherwise will get garbage
   };
 
@@ -541,7 +675,7 @@ public:
       program = 0;
     }
 
-    void applyGL() const;
+    void compileGL(OpList& ops) const;
     void getGL();
   };
 
@@ -554,7 +688,7 @@ public:
       stateBits = 0;
     }
 
-    void applyGL(GLbitfield changed = ~0) const;
+    void compileGL(OpList& ops, GLbitfield changed = ~0) const;
     void getGL();
   };
 
@@ -566,7 +700,7 @@ public:
       stateBitsDepr = 0;
     }
 
-    void applyGL(GLbitfield changed = ~0) const;
+    void compileGL(OpList& ops, GLbitfield changed = ~0) const;
     void getGL();
   };
 #endif
@@ -607,41 +741,197 @@ public:
     // and is unaffected by apply or get operations, its value
     // is set during StateSystem::set
     GLenum                basePrimitiveMode;
+    GLuint                _pad;
 
     State()
       : basePrimitiveMode(GL_TRIANGLES)
+      , _pad(0)
     {
 
     }
 
+    void    compileGL(OpList& ops, bool coreonly = false) const;
     void    applyGL(bool coreonly = false, bool skipFboBinding = false) const;
     void    getGL(bool coreonly = false);
   };
 
+  //////////////////////////////////////////////////////////////////////////
+
+  // Builds a State from the setup calls an application makes, as an
+  // alternative to State::getGL that needs no queries. Every call updates
+  // the state the way GL would, and is also issued if issueGL is set.
+  // The state must hold the context's values when recording starts.
+  // Binding a framebuffer assumes it uses its default draw and read buffers.
+  class Recorder {
+  public:
+    Recorder(State& state, bool issueGL = true) : m_state(state), m_issueGL(issueGL) {}
+
+    void enable(GLenum cap);
+    void disable(GLenum cap);
+    void enablei(GLenum cap, GLuint index);
+    void disablei(GLenum cap, GLuint index);
+
+    void useProgram(GLuint program);
+
+#if STATESYSTEM_USE_DEPRECATED
+    void alphaFunc(GLenum func, GLfloat ref);
+    void lineStipple(GLint factor, GLushort pattern);
+    void shadeModel(GLenum mode);
+#endif
+
+    void blendFunc(GLenum src, GLenum dst);
+    void blendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha);
+    void blendFunci(GLuint buf, GLenum src, GLenum dst);
+    void blendFuncSeparatei(GLuint buf, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha);
+    void blendEquation(GLenum mode);
+    void blendEquationSeparate(GLenum modeRGB, GLenum modeAlpha);
+    void blendEquationi(GLuint buf, GLenum mode);
+    void blendEquationSeparatei(GLuint buf, GLenum modeRGB, GLenum modeAlpha);
+
+    void depthFunc(GLenum func);
+    void logicOp(GLenum op);
+
+    void stencilFunc(GLenum func, GLint ref, GLuint mask);
+    void stencilFuncSeparate(GLenum face, GLenum func, GLint ref, GLuint mask);
+    void stencilOp(GLenum fail, GLenum zfail, GLenum zpass);
+    void stencilOpSeparate(GLenum face, GLenum fail, GLenum zfail, GLenum zpass);
+
+    void cullFace(GLenum mode);
+    void polygonMode(GLenum face, GLenum mode);
+    void pointSize(GLfloat size);
+    void pointParameterf(GLenum pname, GLfloat param);
+    void pointParameteri(GLenum pname, GLint param);
+
+    void primitiveRestartIndex(GLuint index);
+    void provokingVertex(GLenum mode);
+    void patchParameteri(GLenum pname, GLint value);
+
+    void sampleCoverage(GLfloat value, GLboolean invert);
+    void sampleMaski(GLuint index, GLbitfield mask);
+
+    void depthRange(GLdouble nearPlane, GLdouble farPlane);
+    void depthRangeIndexed(GLuint index, GLdouble nearPlane, GLdouble farPlane);
+    void depthRangeArrayv(GLuint first, GLsizei count, const GLdouble* v);
+
+    void colorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a);
+    void colorMaski(GLuint buf, GLboolean r, GLboolean g, GLboolean b, GLboolean a);
+    void depthMask(GLboolean flag);
+    void stencilMask(GLuint mask);
+    void stencilMaskSeparate(GLenum face, GLuint mask);
+
+    void bindFramebuffer(GLenum target, GLuint fbo);
+    void drawBuffer(GLenum buf);
+    void drawBuffers(GLsizei n, const GLenum* bufs);
+    void readBuffer(GLenum mode);
+
+    void enableVertexAttribArray(GLuint index);
+    void disableVertexAttribArray(GLuint index);
+    void vertexAttribFormat(GLuint index, GLint size, GLenum type, GLboolean normalized, GLuint relativeoffset);
+    void vertexAttribIFormat(GLuint index, GLint size, GLenum type, GLuint relativeoffset);
+    void vertexAttribBinding(GLuint index, GLuint binding);
+    void vertexBindingDivisor(GLuint binding, GLuint divisor);
+    void bindVertexBuffer(GLuint binding, GLuint buffer, GLintptr offset, GLsizei stride); // only stride is state
+
+    void vertexAttrib4f(GLuint index, GLfloat x, GLfloat y, GLfloat z, GLfloat w);
+    void vertexAttribI4i(GLuint index, GLint x, GLint y, GLint z, GLint w);
+    void vertexAttribI4ui(GLuint index, GLuint x, GLuint y, GLuint z, GLuint w);
+
+  private:
+    State&  m_state;
+    bool    m_issueGL;
+
+    void setEnable(GLenum cap, bool state);
+    void setEnablei(GLenum cap, GLuint index, bool state);
+    void setBlend(GLuint first, GLuint count, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha);
+    void setBlendEquation(GLuint first, GLuint count, GLenum modeRGB, GLenum modeAlpha);
+    void setStencilFunc(GLenum face, GLenum func, GLint ref, GLuint mask);
+    void setStencilOp(GLenum face, GLenum fail, GLenum zfail, GLenum zpass);
+    void setStencilMask(GLenum face, GLuint mask);
+    void setDepthRange(GLuint first, GLuint count, const GLdouble* v, bool sameForAll);
+    void setColorMask(GLuint first, GLuint count, GLboolean r, GLboolean g, GLboolean b, GLboolean a);
+    void setDrawBuffers(GLsizei n, const GLenum* bufs);
+  };
+
+  // delta encoded storage for large numbers of states, defined below
+  class CompactStore;
+
+  //////////////////////////////////////////////////////////////////////////
+
   typedef unsigned int StateID;
   static const StateID  INVALID_ID = ~0;
+  // ids that can exist at once, generate hands out INVALID_ID beyond
+  static const GLuint   MAX_STATES = 1 << 30;
+
+  StateSystem();
+  ~StateSystem() { deinit(); }
 
   void    init(bool coreonly = false);
   void    deinit();
 
+  // generate, destroy, set, get, intern and isEqual can be used from any
+  // thread. An id must not be set by two threads at once. set publishes a
+  // new version next to the current one, so a reference from get stays
+  // valid until the id was set twice more. applyGL, prepareTransition and
+  // the transition cache must be used from a single thread.
+
+  // objects are INVALID_ID once MAX_STATES ids exist
   void    generate(GLuint num, StateID* objects);
   void    destroy(GLuint num, const StateID* objects);
   void          set(StateID id, const State& state, GLenum basePrimitiveMode);
   const State&  get(StateID id) const;
 
+  // Returns a shared id for the content, identical states get the same id and
+  // transitions between them are free. Interned ids are reference counted,
+  // every intern must be matched by a destroy, and must not be passed to set.
+  // Returns INVALID_ID if no id was left to build it in.
+  StateID intern(const State& state, GLenum basePrimitiveMode);
+  bool    isEqual(StateID a, StateID b) const;
+
   void    applyGL(StateID id, bool skipFboBinding) const;         // brute force sets everything
   void    applyGL(StateID id, StateID prev, bool skipFboBinding);  // tries to avoid redundant, can pass INVALID_ID as previous
 
   void    prepareTransition(StateID id, StateID prev); // can speed up state apply
 
+  // Appends what applyGL(id, prev, ...) would issue, so the calls can be
+  // replayed later without going through the StateSystem. prev can be
+  // INVALID_ID. The ops are only valid as long as neither state is set.
+  // Bypasses the transition cache, so it can be used from any thread.
+  void    compileTransitionUncached(OpList& ops, StateID id, StateID prev) const;
+
+  // Estimated cost of applyGL(id, prev), a weighted count of the sub-states
+  // that differ, 0 if none does. Only compares the sub-state hashes, so it
+  // is cheap enough for scheduling. prev can be INVALID_ID.
+  GLuint  getTransitionCost(StateID id, StateID prev) const;
+
+  // Compiles what applyGL would issue to go from one state of the store to
+  // another, the diff is made from the stored deltas. from can be
+  // CompactStore::INVALID_INDEX. Nothing is cached.
+  void    compileTransition(OpList& ops, const CompactStore& store, GLuint to, GLuint from) const;
+
+  // applyGL goes through the shadow if set, NULL issues every call
+  void          setShadowState(ShadowState* shadow) { m_shadow = shadow; }
+  ShadowState*  getShadowState() const { return m_shadow; }
+
+  // Transitions are cached in a hash table shared by all states, the least
+  // recently used ones are evicted once the memory budget is exceeded.
+  // bytes counts the table, the entries and the capacity of their ops.
+  struct TransitionCacheStats {
+    size_t  hits;
+    size_t  misses;
+    size_t  evictions;
+    size_t  entries;
+    size_t  bytes;
+    size_t  budget;
+  };
 
-private:
-  static const int MAX_DIFFS = 16;
+  static const size_t DEFAULT_TRANSITION_BUDGET = 1024 * 1024;
 
-  struct StateDiffKey {
-    StateID   state;
-    GLuint    changeID;
-  };
+  void    setTransitionCacheBudget(size_t bytes); // drops all cached transitions
+  void    resetTransitionCacheStats();
+  const TransitionCacheStats& getTransitionCacheStats() const { return m_transitionStats; }
+
+
+private:
 
   struct StateDiff {
 
@@ -667,8 +957,20 @@ private:
       VERTEXENABLE,
       VERTEXFORMAT,
       VERTEXIMMEDIATE,
+      NUM_CONTENTS,
     };
 
+    // the Fields of the smaller sub-states share changedFields
+    enum FieldGroups {
+      FIELDS_STENCIL,
+      FIELDS_MASK,
+      FIELDS_RASTER,
+      FIELDS_PRIMITIVE,
+      FIELDS_FBO,
+    };
+
+    static const GLuint FIELDS_BITS = 6;
+
     GLbitfield    changedContentBits;
     GLbitfield    changedStateBits;
     GLbitfield    changedStateDeprBits;
@@ -676,29 +978,230 @@ private:
     GLbitfield    changedVertexImm;
     GLbitfield    changedVertexFormat;
     GLbitfield    changedVertexBinding;
+    GLbitfield    changedClip;          // per clip distance
+    GLbitfield    changedBlendEnable;   // per draw buffer
+    GLbitfield    changedBlendFunc;     // per draw buffer
+    GLbitfield    changedBlendEquation; // per draw buffer
+    GLbitfield    changedColorMask;     // per draw buffer
+    GLbitfield    changedDepthRange;    // per viewport
+    GLbitfield    changedScissorEnable; // per viewport
+    GLbitfield    changedFields;
     GLuint        pad;
+
+    GLbitfield getFields(FieldGroups group) const
+    {
+      return (changedFields >> (group * FIELDS_BITS)) & ((1 << FIELDS_BITS) - 1);
+    }
+
+    void setFields(FieldGroups group, GLbitfield fields)
+    {
+      changedFields |= fields << (group * FIELDS_BITS);
+    }
   };
 
-  struct StateInternal {
+  struct StateVersion {
     State       state;
-    GLuint      changeID;
+    GLuint      hash;       // entire state
+    GLuint      hashes[StateDiff::NUM_CONTENTS];  // per sub-state, indexed by ContentBits
+  };
 
-    int           usedDiff;
-    StateDiffKey  others[MAX_DIFFS];
-    StateDiff     diffs[MAX_DIFFS];
+  // the part of a state every transition lookup touches, the versions
+  // are kept apart so these stay densely packed
+  struct StateInternal {
+    // A seqlock: set makes changeID odd while it fills the version
+    // readers don't see, and even again to publish it. Readers retry
+    // while it is odd or when it changed under them. The current version
+    // is (changeID >> 1) & 1, odd values still select the published one.
+    std::atomic<GLuint>   changeID;
+    std::atomic<GLuint>   internRefs; // 0 if not interned
+    std::atomic<StateID>  nextFree;   // free-list link
 
     StateInternal() {
       changeID = 0;
+      internRefs = 0;
+      nextFree = INVALID_ID;
+    }
+  };
+
+  // states live in chunks that never move, so ids can be resolved while
+  // other threads generate new ones. The chunk pointers are kept in pages
+  // that are allocated on demand as well, so the directory stays small
+  // while covering MAX_STATES.
+  static const GLuint CHUNK_BITS = 6;
+  static const GLuint CHUNK_SIZE = 1 << CHUNK_BITS;
+  static const GLuint PAGE_BITS  = 12;
+  static const GLuint PAGE_SIZE  = 1 << PAGE_BITS; // chunks per page
+  static const GLuint MAX_PAGES  = MAX_STATES >> (PAGE_BITS + CHUNK_BITS);
+  static_assert(MAX_PAGES * PAGE_SIZE * CHUNK_SIZE == MAX_STATES, "MAX_STATES must fill whole pages");
+
+  struct StateChunk {
+    StateInternal   internals[CHUNK_SIZE];
+    StateVersion    versions[CHUNK_SIZE][2];
+  };
+
+  struct StateChunkPage {
+    std::atomic<StateChunk*>  chunks[PAGE_SIZE];
+
+    StateChunkPage() {
+      for (GLuint i = 0; i < PAGE_SIZE; i++) {
+        chunks[i] = NULL;
+      }
     }
   };
 
+  // changeIDs are part of the key, so transitions of modified states
+  // are never found again and simply age out
+  struct TransitionKey {
+    StateID   from;
+    StateID   to;
+    GLuint    fromChangeID;
+    GLuint    toChangeID;
+  };
+
+  static const GLuint INVALID_ENTRY = ~0u;
+
+  // what lookups and LRU updates walk, kept apart from the entries
+  struct TransitionLink {
+    TransitionKey key;
+    GLuint        hashNext;   // next entry within the bucket
+    GLuint        lruPrev;    // towards more recently used
+    GLuint        lruNext;    // towards less recently used
+  };
+
+  struct TransitionEntry {
+    StateDiff     diff;
+    OpList        ops;        // compiled from diff, replayed by applyGL
+  };
+
   bool                          m_coreonly;
-  std::vector<StateInternal>    m_states;
-  std::vector<StateID>          m_freeIDs;
+  ShadowState*                  m_shadow = NULL;
+  std::atomic<StateChunkPage*>  m_pages[MAX_PAGES];
+  std::atomic<GLuint>           m_numStates;
+  std::atomic<GLuint64>         m_freeHead; // StateID in the low half, ABA tag in the high half
+
+  std::mutex                                m_internMutex;
+  std::unordered_multimap<GLuint, StateID>  m_interned; // by StateVersion::hash
+
+  std::vector<TransitionLink>   m_transitionLinks;
+  std::vector<TransitionEntry>  m_transitions;
+  std::vector<GLuint>           m_transitionBuckets;
+  GLuint                        m_transitionLruHead;
+  GLuint                        m_transitionLruTail;
+  GLuint                        m_transitionFree;     // evicted entries, linked by lruNext
+  TransitionCacheStats          m_transitionStats;
+
+  struct ContentWords; // the sub-state of every word of State
+
+  friend struct StateSystemTest; // bench/ compares the makeDiff variants
+
+  StateChunk* getChunk(StateID id) const
+  {
+    const StateChunkPage* page = m_pages[id >> (PAGE_BITS + CHUNK_BITS)].load(std::memory_order_acquire);
+    return page->chunks[(id >> CHUNK_BITS) & (PAGE_SIZE - 1)].load(std::memory_order_acquire);
+  }
+
+  StateInternal& getInternal(StateID id) const
+  {
+    return getChunk(id)->internals[id & (CHUNK_SIZE - 1)];
+  }
+
+  StateVersion& getVersion(StateID id, GLuint changeID) const
+  {
+    return getChunk(id)->versions[id & (CHUNK_SIZE - 1)][(changeID >> 1) & 1];
+  }
+
+  // the changeID to read a version with, waits while a set is in progress
+  static GLuint beginRead(const StateInternal& intstate)
+  {
+    GLuint changeID;
+    while ((changeID = intstate.changeID.load(std::memory_order_acquire)) & 1) {
+      std::this_thread::yield();
+    }
+    return changeID;
+  }
+
+  // true if a set overlapped what was read since beginRead
+  static bool readChanged(const StateInternal& intstate, GLuint changeID)
+  {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return intstate.changeID.load(std::memory_order_relaxed) != changeID;
+  }
+
+  void    allocChunk(GLuint chunk);
+  void    freePush(StateID id);
+  StateID freePop();
+
+  void  updateHashes(StateVersion& version);
+  void  internRemove(StateID id);
+  // per sub-state, the ones with different hashes are known to differ
+  void  makeDiff(StateDiff& diff, const StateVersion &from, const StateVersion &to) const;
+  // sub-states in changed are known to differ, the ones in unknown are
+  // compared, all others are taken as equal
+  void  makeDiff(StateDiff& diff, const State &from, const State &to, GLbitfield changed, GLbitfield unknown) const;
+  void  compileDiff(OpList& ops, const StateDiff& diff, const State &to) const;
+  void  compileState(OpList& ops, StateID id) const;
+  const TransitionEntry& prepareTransitionCache(StateID prev, StateID id);
+
+  static GLuint getContentCost(GLbitfield changedContents);
+  static GLbitfield getChangedContents(const State& from, const State& to); // word by word, one bit per StateDiff::ContentBits
+
+  GLuint  transitionBucket(const TransitionKey& key) const;
+  void    transitionLruUnlink(GLuint entry);
+  void    transitionLruPushFront(GLuint entry);
+  void    transitionEvict(GLuint entry);
+  void    transitionRehash(size_t numBuckets);
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+// Most states keep the defaults for the bulk of their content (vertex
+// formats, immediate attributes, depth ranges, color masks...). A store
+// keeps each state as a delta against a shared base: one bit per 16 byte
+// block of State that differs from the base, followed by only those blocks.
+// States are decoded on demand, comparisons and costs work on the blocks.
+// Meant to be filled up front, not thread-safe.
+
+class StateSystem::CompactStore {
+public:
+  typedef GLuint Index;
+  static const Index INVALID_INDEX = ~0u;
+
+  CompactStore() { reset(State()); }
+  explicit CompactStore(const State& base) { reset(base); }
+
+  void    reset(const State& base); // drops all states
+  Index   add(const State& state, GLenum basePrimitiveMode);
+  void    decode(Index idx, State& state) const;
+  bool    isEqual(Index a, Index b) const;
+
+  // same weights as StateSystem::getTransitionCost, from can be INVALID_INDEX
+  GLuint  getTransitionCost(Index to, Index from) const;
+
+  size_t  getNumStates() const { return m_entries.size(); }
+  size_t  getBytes() const; // base, block masks and payload
+
+private:
+  friend class StateSystem;
+
+  static const GLuint BLOCK_WORDS = 4;
+  static const GLuint NUM_BLOCKS  = GLuint(sizeof(State) / sizeof(GLuint) + BLOCK_WORDS - 1) / BLOCK_WORDS;
+  static const GLuint MASK_WORDS  = (NUM_BLOCKS + 63) / 64;
+
+  struct Entry {
+    GLuint64  present[MASK_WORDS];  // blocks that differ from the base
+    GLuint    offset;               // of the first present block in m_payload
+  };
+
+  GLuint                m_base[NUM_BLOCKS * BLOCK_WORDS]; // zero padded to whole blocks
+  std::vector<Entry>    m_entries;
+  std::vector<GLuint>   m_payload;
+
+  size_t  getPayloadWords(Index idx) const
+  {
+    return (idx + 1 < m_entries.size() ? m_entries[idx + 1].offset : m_payload.size()) - m_entries[idx].offset;
+  }
 
-  void  makeDiff(StateDiff& diff, const StateInternal &fromInternal, const StateInternal &toInternal);
-  void  applyDiffGL(const StateDiff& diff, const State &to, bool skipFboBinding);
-  int   prepareTransitionCache(StateID prev, StateInternal& to);
+  GLbitfield  diffContents(Index from, Index to) const; // one bit per StateDiff::ContentBits
 };
 
 